@@ -0,0 +1,142 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 19/10/2026 GMT +7 16.30
+ * - Initial barrier implementation
+ * 20/10/2026 GMT +7 21.30
+ * - The events use the userspace backend
+ * 24/10/2026 GMT +7 11.40
+ * - The events only use the userspace backend when ntsync_backend says so
+ */
+
+#include "ntp.h"
+#include <errno.h>
+#include <stddef.h>
+
+#define RTLP_BARRIER_DEFAULT_SPIN_COUNT 2000
+
+static void RtlpBarrierPause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+}
+
+static HANDLE RtlpGetBarrierEvent(PRTL_BARRIER Barrier, ULONG Phase)
+{
+        HANDLE Event = {.DesiredAccess = EVENT_ALL_ACCESS, .Object = Barrier->Events[Phase & 1]};
+        return Event;
+}
+
+NTSTATUS RtlInitBarrier(PRTL_BARRIER Barrier, LONG TotalThreads, LONG SpinCount)
+{
+        if (Barrier == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (TotalThreads < 1) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if (SpinCount < -1) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        /* One manual-reset event per sense. The event of the next phase is
+         * reset by the last thread of the current one, before anybody can
+         * wait on it again. Both are NTSYNC events unless the process
+         * picked the userspace backend. */
+        HANDLE Events[2];
+        OBJECT_ATTRIBUTES Attributes;
+        InitializeObjectAttributes(&Attributes, NULL, ntsync_backend == NTSYNC_BACKEND_USERSPACE ? OBJ_PROCESS_LOCAL : 0, NULL, NULL);
+        NTSTATUS Status = NtCreateEvent(&Events[0], EVENT_ALL_ACCESS, &Attributes, NotificationEvent, FALSE);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        Status = NtCreateEvent(&Events[1], EVENT_ALL_ACCESS, &Attributes, NotificationEvent, FALSE);
+        if (Status != STATUS_SUCCESS) {
+                NtClose(Events[0]);
+                return Status;
+        }
+
+        Barrier->Remaining = TotalThreads;
+        Barrier->Phase = 0;
+        Barrier->TotalThreads = TotalThreads;
+        Barrier->SpinCount = SpinCount == -1 ? RTLP_BARRIER_DEFAULT_SPIN_COUNT : SpinCount;
+        Barrier->Sleepers[0] = 0;
+        Barrier->Sleepers[1] = 0;
+        Barrier->Events[0] = Events[0].Object;
+        Barrier->Events[1] = Events[1].Object;
+        Barrier->EventSet[0] = FALSE;
+        Barrier->EventSet[1] = FALSE;
+
+        return STATUS_SUCCESS;
+}
+
+BOOLEAN RtlBarrier(PRTL_BARRIER Barrier, ULONG Flags)
+{
+        if ((Flags & RTL_BARRIER_FLAGS_SPIN_ONLY) && (Flags & RTL_BARRIER_FLAGS_BLOCK_ONLY)) {
+                errno = EINVAL;
+                return FALSE;
+        }
+
+        ULONG Phase = __atomic_load_n(&Barrier->Phase, __ATOMIC_ACQUIRE);
+        if (__atomic_sub_fetch(&Barrier->Remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+                /* Only the last thread of each phase touches EventSet, the
+                 * phases are ordered through Remaining and Phase. */
+                if (Barrier->EventSet[(Phase + 1) & 1]) {
+                        NtResetEvent(RtlpGetBarrierEvent(Barrier, Phase + 1), NULL);
+                        Barrier->EventSet[(Phase + 1) & 1] = FALSE;
+                }
+
+                __atomic_store_n(&Barrier->Remaining, Barrier->TotalThreads, __ATOMIC_RELAXED);
+                __atomic_store_n(&Barrier->Phase, Phase + 1, __ATOMIC_SEQ_CST);
+
+                if (__atomic_load_n(&Barrier->Sleepers[Phase & 1], __ATOMIC_SEQ_CST) != 0) {
+                        NtSetEvent(RtlpGetBarrierEvent(Barrier, Phase), NULL);
+                        Barrier->EventSet[Phase & 1] = TRUE;
+                }
+                return TRUE;
+        }
+
+        if (!(Flags & RTL_BARRIER_FLAGS_BLOCK_ONLY)) {
+                LONG Spin = Barrier->SpinCount;
+                while ((Flags & RTL_BARRIER_FLAGS_SPIN_ONLY) || Spin-- > 0) {
+                        if (__atomic_load_n(&Barrier->Phase, __ATOMIC_ACQUIRE) != Phase) {
+                                return FALSE;
+                        }
+                        RtlpBarrierPause();
+                }
+        }
+
+        /* Announce the sleep before the last check of Phase, so the last
+         * thread either sees us or we see the new phase. */
+        __atomic_add_fetch(&Barrier->Sleepers[Phase & 1], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&Barrier->Phase, __ATOMIC_SEQ_CST) == Phase) {
+                NtWaitForSingleObject(RtlpGetBarrierEvent(Barrier, Phase), FALSE, NULL);
+        }
+        __atomic_sub_fetch(&Barrier->Sleepers[Phase & 1], 1, __ATOMIC_RELEASE);
+
+        return FALSE;
+}
+
+NTSTATUS RtlDeleteBarrier(PRTL_BARRIER Barrier)
+{
+        NtClose(RtlpGetBarrierEvent(Barrier, 0));
+        NtClose(RtlpGetBarrierEvent(Barrier, 1));
+        Barrier->Events[0] = -1;
+        Barrier->Events[1] = -1;
+
+        return STATUS_SUCCESS;
+}
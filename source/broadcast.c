@@ -0,0 +1,281 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 22/10/2026 GMT +7 09.20
+ * - Initial broadcast event implementation
+ * 24/10/2026 GMT +7 13.00
+ * - Creates and broadcasts are recorded by the sync trace
+ */
+
+/* A broadcast event releases every thread that was waiting on it when it
+ * was broadcast, once, and nobody who comes later. It replaces
+ * NtPulseEvent, which loses a waiter that isn't blocked in the kernel at
+ * the exact time of the pulse.
+ *
+ * Each generation is a notification event. A waiter references the
+ * current generation and waits on its event, a broadcast puts a fresh
+ * generation in its place and then sets the old event. The old event stays
+ * set for as long as anyone references it, so a waiter that got its
+ * reference before the broadcast is released however late it blocks, and
+ * one that came after only finds the new generation. Setting the event is
+ * the only wake, one for every waiter at once. Generations nobody
+ * references anymore are reset and reused instead of creating a new event
+ * every time.
+ */
+
+#include "ntp.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* Retired holds the generations already broadcast and Pending one that
+ * was replaced but couldn't be set, both only touched under Lock.
+ * Generation counts the broadcasts. */
+typedef struct _RTLP_BROADCAST
+{
+        RTLP_OBJECT Header;
+        _Atomic(PRTLP_BROADCAST_GENERATION) Current;
+        pthread_mutex_t Lock;
+        PRTLP_BROADCAST_GENERATION Retired;
+        PRTLP_BROADCAST_GENERATION Pending;
+        ULONG Generation;
+        bool ProcessLocal;
+} RTLP_BROADCAST, *PRTLP_BROADCAST;
+
+/* The event of a generation is created like any other event and taken out
+ * of the object table, the generation owns its fd. */
+static PRTLP_BROADCAST_GENERATION RtlpAllocateGeneration(PRTLP_BROADCAST Broadcast, NTSTATUS *Status)
+{
+        PRTLP_BROADCAST_GENERATION Generation = calloc(1, sizeof(*Generation));
+        if (Generation == NULL) {
+                *Status = RtlpGetNtStatusFromUnixErrno();
+                return NULL;
+        }
+
+        HANDLE Event;
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_PROCESS_LOCAL, NULL, NULL);
+        *Status = RtlpCreateEvent(&Event, EVENT_ALL_ACCESS, Broadcast->ProcessLocal ? &ObjectAttributes : NULL, NotificationEvent, FALSE);
+        if (*Status != STATUS_SUCCESS) {
+                free(Generation);
+                return NULL;
+        }
+
+        Generation->Event = (PRTLP_DISPATCHER)RtlpRemoveObject(Event.Object);
+        atomic_init(&Generation->References, 0);
+        return Generation;
+}
+
+static void RtlpFreeGeneration(PRTLP_BROADCAST_GENERATION Generation)
+{
+        close(Generation->Event->Object);
+        RtlpFreeDispatcher(Generation->Event);
+        free(Generation);
+}
+
+PRTLP_BROADCAST_GENERATION RtlpReferenceBroadcast(PRTLP_OBJECT Record)
+{
+        PRTLP_BROADCAST Broadcast = (PRTLP_BROADCAST)Record;
+        for (;;) {
+                PRTLP_BROADCAST_GENERATION Generation = atomic_load(&Broadcast->Current);
+                atomic_fetch_add(&Generation->References, 1);
+
+                /* Pairs with a broadcast checking the references before it
+                 * reuses a generation. Either it sees this reference and
+                 * leaves the event set, or this sees the generation was
+                 * replaced and doesn't use it. */
+                if (atomic_load(&Broadcast->Current) == Generation) {
+                        return Generation;
+                }
+                RtlpDereferenceBroadcast(Generation);
+        }
+}
+
+void RtlpDereferenceBroadcast(PRTLP_BROADCAST_GENERATION Generation)
+{
+        atomic_fetch_sub_explicit(&Generation->References, 1, memory_order_release);
+}
+
+/* A retired generation nobody references anymore, reset and unlinked, or
+ * a new one. */
+static PRTLP_BROADCAST_GENERATION RtlpGetFreeGeneration(PRTLP_BROADCAST Broadcast, NTSTATUS *Status)
+{
+        for (PRTLP_BROADCAST_GENERATION *Link = &Broadcast->Retired; *Link != NULL; Link = &(*Link)->Next) {
+                PRTLP_BROADCAST_GENERATION Generation = *Link;
+                if (atomic_load(&Generation->References) != 0 || RtlpResetEventDispatcher(Generation->Event) != STATUS_SUCCESS) {
+                        continue;
+                }
+
+                *Link = Generation->Next;
+                Generation->Next = NULL;
+                return Generation;
+        }
+
+        return RtlpAllocateGeneration(Broadcast, Status);
+}
+
+static NTSTATUS RtlpCreateBroadcastEvent(PHANDLE EventHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes)
+{
+        if (EventHandle == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (ObjectAttributes != NULL && ObjectAttributes->ObjectName != NULL) {
+                errno = ENOSYS;
+                return STATUS_NOT_IMPLEMENTED;
+        }
+
+        PRTLP_BROADCAST Broadcast = calloc(1, sizeof(*Broadcast));
+        if (Broadcast == NULL) {
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+        Broadcast->Header.Type = RtlpBroadcastObject;
+        Broadcast->ProcessLocal = ObjectAttributes != NULL && (ObjectAttributes->Attributes & OBJ_PROCESS_LOCAL);
+        pthread_mutex_init(&Broadcast->Lock, NULL);
+
+        NTSTATUS Status;
+        PRTLP_BROADCAST_GENERATION Generation = RtlpAllocateGeneration(Broadcast, &Status);
+        if (Generation == NULL) {
+                pthread_mutex_destroy(&Broadcast->Lock);
+                free(Broadcast);
+                return Status;
+        }
+        atomic_init(&Broadcast->Current, Generation);
+
+        /* Only gives the broadcast event a handle value, it is never
+         * signaled */
+        int ret = eventfd(0, EFD_CLOEXEC);
+        if (ret == -1) {
+                Status = RtlpGetNtStatusFromUnixErrno();
+                RtlpCloseBroadcast(&Broadcast->Header);
+                return Status;
+        }
+
+        if (!RtlpInsertObject(ret, &Broadcast->Header)) {
+                Status = RtlpGetNtStatusFromUnixErrno();
+                close(ret);
+                RtlpCloseBroadcast(&Broadcast->Header);
+                return Status;
+        }
+
+        EventHandle->DesiredAccess = DesiredAccess;
+        EventHandle->Object = ret;
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS NtCreateBroadcastEvent(PHANDLE EventHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpCreateBroadcastEvent(EventHandle, DesiredAccess, ObjectAttributes);
+        RtlpTraceCall(Start, RtlpTraceCreateBroadcastEvent, Status == STATUS_SUCCESS ? EventHandle->Object : -1, 0, 0, Status);
+        return Status;
+}
+
+static NTSTATUS RtlpBroadcastEvent(HANDLE EventHandle, PULONG Generation)
+{
+        if (!(EventHandle.DesiredAccess & EVENT_MODIFY_STATE)) {
+                errno = EPERM;
+                return STATUS_ACCESS_DENIED;
+        }
+
+        PRTLP_OBJECT Record = RtlpLookupObject(EventHandle.Object);
+        if (Record == NULL || Record->Type != RtlpBroadcastObject) {
+                errno = EINVAL;
+                return STATUS_OBJECT_TYPE_MISMATCH;
+        }
+
+        PRTLP_BROADCAST Broadcast = (PRTLP_BROADCAST)Record;
+        pthread_mutex_lock(&Broadcast->Lock);
+        NTSTATUS Status = STATUS_SUCCESS;
+        if (Broadcast->Pending != NULL) {
+                Status = RtlpSetEventDispatcher(Broadcast->Pending->Event);
+                if (Status != STATUS_SUCCESS) {
+                        pthread_mutex_unlock(&Broadcast->Lock);
+                        return Status;
+                }
+                Broadcast->Pending->Next = Broadcast->Retired;
+                Broadcast->Retired = Broadcast->Pending;
+                Broadcast->Pending = NULL;
+        }
+
+        PRTLP_BROADCAST_GENERATION Next = RtlpGetFreeGeneration(Broadcast, &Status);
+        if (Next == NULL) {
+                pthread_mutex_unlock(&Broadcast->Lock);
+                return Status;
+        }
+
+        /* The old generation is replaced before it is set, a waiter it
+         * released must not find it again. If it can't be set its waiters
+         * go with the next broadcast. */
+        PRTLP_BROADCAST_GENERATION Previous = atomic_exchange(&Broadcast->Current, Next);
+        Status = RtlpSetEventDispatcher(Previous->Event);
+        if (Status != STATUS_SUCCESS) {
+                Broadcast->Pending = Previous;
+                pthread_mutex_unlock(&Broadcast->Lock);
+                return Status;
+        }
+
+        Previous->Next = Broadcast->Retired;
+        Broadcast->Retired = Previous;
+        if (Generation != NULL) {
+                *Generation = Broadcast->Generation;
+        }
+        Broadcast->Generation++;
+        pthread_mutex_unlock(&Broadcast->Lock);
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS NtBroadcastEvent(HANDLE EventHandle, PULONG Generation)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpBroadcastEvent(EventHandle, Generation);
+        RtlpTraceCall(Start, RtlpTraceBroadcastEvent, EventHandle.Object, 0, 0, Status);
+        return Status;
+}
+
+void RtlpCloseBroadcast(PRTLP_OBJECT Record)
+{
+        PRTLP_BROADCAST Broadcast = (PRTLP_BROADCAST)Record;
+        PRTLP_BROADCAST_GENERATION Generation = Broadcast->Retired;
+        while (Generation != NULL) {
+                PRTLP_BROADCAST_GENERATION Next = Generation->Next;
+                RtlpFreeGeneration(Generation);
+                Generation = Next;
+        }
+
+        if (Broadcast->Pending != NULL) {
+                RtlpFreeGeneration(Broadcast->Pending);
+        }
+        RtlpFreeGeneration(atomic_load_explicit(&Broadcast->Current, memory_order_relaxed));
+        pthread_mutex_destroy(&Broadcast->Lock);
+        free(Broadcast);
+}
+
+/* The references of the parent's waiters went away with them */
+void RtlpForkBroadcast(PRTLP_OBJECT Record)
+{
+        PRTLP_BROADCAST Broadcast = (PRTLP_BROADCAST)Record;
+        pthread_mutex_init(&Broadcast->Lock, NULL);
+
+        PRTLP_BROADCAST_GENERATION Current = atomic_load_explicit(&Broadcast->Current, memory_order_relaxed);
+        atomic_store_explicit(&Current->References, 0, memory_order_relaxed);
+        RtlpForkDispatcher(Current->Event);
+        if (Broadcast->Pending != NULL) {
+                atomic_store_explicit(&Broadcast->Pending->References, 0, memory_order_relaxed);
+                RtlpForkDispatcher(Broadcast->Pending->Event);
+        }
+        for (PRTLP_BROADCAST_GENERATION Generation = Broadcast->Retired; Generation != NULL; Generation = Generation->Next) {
+                atomic_store_explicit(&Generation->References, 0, memory_order_relaxed);
+                RtlpForkDispatcher(Generation->Event);
+        }
+}
@@ -0,0 +1,385 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 22/10/2026 GMT +7 13.40
+ * - Initial channel implementation
+ */
+
+/* FreeSlots and Messages count what senders and receivers may take. A
+ * thread takes from a count before it touches the ring, so once it has
+ * taken n it is sure to find n cells, and only has to wait for a cell
+ * while another thread is in the middle of it. A thread that finds nothing
+ * to take leaves the count negative and sleeps on the semaphore of that
+ * side, whoever adds to a negative count releases one unit per sleeper it
+ * covers. Nobody else makes a system call.
+ *
+ * A sleeper that gives up has to undo its claim. If the count is still
+ * negative it simply adds one back, otherwise somebody already released a
+ * unit for it and the claim is granted, so it takes that unit and then has
+ * what it was waiting for.
+ *
+ * The ring is a sequence per cell: a cell at position p can be written
+ * when its sequence is p and read when it is p + 1, reading it moves it
+ * to p plus the size of the ring.
+ */
+
+#include "ntp.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#define RTLP_CHANNEL_MAXIMUM_CAPACITY 0x40000000
+#define RTLP_CHANNEL_SPIN_COUNT 1000
+
+typedef struct _RTLP_CHANNEL_CELL
+{
+        ULONGLONG Sequence;
+        PVOID Message;
+} RTLP_CHANNEL_CELL, *PRTLP_CHANNEL_CELL;
+
+static void RtlpChannelPause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+}
+
+static HANDLE RtlpGetChannelSemaphore(int Object)
+{
+        HANDLE Semaphore = {.DesiredAccess = SEMAPHORE_ALL_ACCESS, .Object = Object};
+        return Semaphore;
+}
+
+/* The other thread is running, it has already taken the cell */
+static void RtlpWaitForCell(PRTLP_CHANNEL_CELL Cell, ULONGLONG Sequence)
+{
+        for (ULONG Spin = 0; __atomic_load_n(&Cell->Sequence, __ATOMIC_ACQUIRE) != Sequence; Spin++) {
+                if (Spin < RTLP_CHANNEL_SPIN_COUNT) {
+                        RtlpChannelPause();
+                } else {
+                        sched_yield();
+                }
+        }
+}
+
+/* Takes up to Count from a positive count without blocking */
+static ULONG RtlpTakeChannelCount(LONG *Available, ULONG Count)
+{
+        LONG Value = __atomic_load_n(Available, __ATOMIC_RELAXED);
+        LONG Taken;
+        do {
+                if (Value <= 0) {
+                        return 0;
+                }
+                Taken = (ULONG)Value < Count ? Value : (LONG)Count;
+        } while (!__atomic_compare_exchange_n(Available, &Value, Value - Taken, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+        return Taken;
+}
+
+static void RtlpAddChannelCount(LONG *Available, int Semaphore, ULONG Count)
+{
+        LONG Value = __atomic_fetch_add(Available, Count, __ATOMIC_SEQ_CST);
+        if (Value < 0) {
+                NtReleaseSemaphore(RtlpGetChannelSemaphore(Semaphore), -Value < (LONG)Count ? -Value : (LONG)Count, NULL);
+        }
+}
+
+/* Undoes the claim of a sleeper that stopped waiting, TRUE if the claim was
+ * granted in the meantime */
+static bool RtlpCancelChannelWait(LONG *Available, int Semaphore)
+{
+        LONG Value = __atomic_load_n(Available, __ATOMIC_RELAXED);
+        while (Value < 0) {
+                if (__atomic_compare_exchange_n(Available, &Value, Value + 1, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                        return false;
+                }
+        }
+
+        /* The unit is released right after the count went up */
+        NtWaitForSingleObject(RtlpGetChannelSemaphore(Semaphore), FALSE, NULL);
+        return true;
+}
+
+/* Blocks until one of Available can be taken. Any Status but STATUS_SUCCESS
+ * means it wasn't. */
+static NTSTATUS RtlpWaitChannelCount(LONG *Available, int Semaphore, __u64 Deadline)
+{
+        if (__atomic_fetch_sub(Available, 1, __ATOMIC_SEQ_CST) > 0) {
+                return STATUS_SUCCESS;
+        }
+
+        LARGE_INTEGER Remaining;
+        PLARGE_INTEGER TimeOut = NULL;
+        NTSTATUS Status = STATUS_TIMEOUT;
+        if (Deadline != UINT64_MAX) {
+                TimeOut = RtlpGetRemainingTimeOut(Deadline, &Remaining) ? &Remaining : NULL;
+        }
+        if (Deadline == UINT64_MAX || TimeOut != NULL) {
+                Status = NtWaitForSingleObject(RtlpGetChannelSemaphore(Semaphore), FALSE, TimeOut);
+        }
+
+        if (Status == STATUS_WAIT_0 || RtlpCancelChannelWait(Available, Semaphore)) {
+                return STATUS_SUCCESS;
+        }
+
+        return Status;
+}
+
+static void RtlpWriteChannel(PRTL_CHANNEL Channel, PVOID const *Messages, ULONG Count)
+{
+        PRTLP_CHANNEL_CELL Cells = Channel->Cells;
+        ULONGLONG Position = __atomic_fetch_add(&Channel->Head, Count, __ATOMIC_RELAXED);
+        for (ULONG i = 0; i < Count; i++) {
+                PRTLP_CHANNEL_CELL Cell = &Cells[(Position + i) & Channel->Mask];
+                RtlpWaitForCell(Cell, Position + i);
+                Cell->Message = Messages[i];
+                __atomic_store_n(&Cell->Sequence, Position + i + 1, __ATOMIC_RELEASE);
+        }
+
+        RtlpAddChannelCount(&Channel->Messages, Channel->ReceiveSemaphore, Count);
+}
+
+static void RtlpReadChannel(PRTL_CHANNEL Channel, PVOID *Messages, ULONG Count)
+{
+        PRTLP_CHANNEL_CELL Cells = Channel->Cells;
+        ULONGLONG Position = __atomic_fetch_add(&Channel->Tail, Count, __ATOMIC_RELAXED);
+        for (ULONG i = 0; i < Count; i++) {
+                PRTLP_CHANNEL_CELL Cell = &Cells[(Position + i) & Channel->Mask];
+                RtlpWaitForCell(Cell, Position + i + 1);
+                Messages[i] = Cell->Message;
+                __atomic_store_n(&Cell->Sequence, Position + i + Channel->Mask + 1, __ATOMIC_RELEASE);
+        }
+
+        RtlpAddChannelCount(&Channel->FreeSlots, Channel->SendSemaphore, Count);
+}
+
+NTSTATUS RtlInitChannel(PRTL_CHANNEL Channel, ULONG Capacity)
+{
+        if (Channel == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (Capacity == 0 || Capacity > RTLP_CHANNEL_MAXIMUM_CAPACITY) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        /* The ring is a power of two at least as large as the capacity,
+         * FreeSlots keeps the channel to the capacity itself */
+        ULONG Size = 1;
+        while (Size < Capacity) {
+                Size <<= 1;
+        }
+
+        PRTLP_CHANNEL_CELL Cells = malloc(Size * sizeof(*Cells));
+        if (Cells == NULL) {
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+        for (ULONG i = 0; i < Size; i++) {
+                Cells[i].Sequence = i;
+        }
+
+        HANDLE Semaphores[2];
+        NTSTATUS Status = NtCreateSemaphore(&Semaphores[0], SEMAPHORE_ALL_ACCESS, NULL, 0, INT32_MAX);
+        if (Status != STATUS_SUCCESS) {
+                free(Cells);
+                return Status;
+        }
+
+        Status = NtCreateSemaphore(&Semaphores[1], SEMAPHORE_ALL_ACCESS, NULL, 0, INT32_MAX);
+        if (Status != STATUS_SUCCESS) {
+                NtClose(Semaphores[0]);
+                free(Cells);
+                return Status;
+        }
+
+        Channel->Head = 0;
+        Channel->FreeSlots = Capacity;
+        Channel->Tail = 0;
+        Channel->Messages = 0;
+        Channel->Cells = Cells;
+        Channel->Capacity = Capacity;
+        Channel->Mask = Size - 1;
+        Channel->SendSemaphore = Semaphores[0].Object;
+        Channel->ReceiveSemaphore = Semaphores[1].Object;
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlSendChannel(PRTL_CHANNEL Channel, PVOID const *Messages, ULONG Count, PULONG Sent, PLARGE_INTEGER TimeOut)
+{
+        if (Channel == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (Messages == NULL && Count != 0) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        __u64 Deadline;
+        NTSTATUS Status = RtlpFormatTimeOut(TimeOut, &Deadline);
+        ULONG Done = 0;
+        while (Status == STATUS_SUCCESS && Done < Count) {
+                ULONG Taken = RtlpTakeChannelCount(&Channel->FreeSlots, Count - Done);
+                if (Taken == 0 && TimeOut != NULL && TimeOut->QuadPart == 0) {
+                        Status = STATUS_TIMEOUT;
+                        break;
+                }
+
+                if (Taken == 0) {
+                        Status = RtlpWaitChannelCount(&Channel->FreeSlots, Channel->SendSemaphore, Deadline);
+                        if (Status != STATUS_SUCCESS) {
+                                break;
+                        }
+                        Taken = 1;
+                }
+
+                RtlpWriteChannel(Channel, Messages + Done, Taken);
+                Done += Taken;
+        }
+
+        if (Sent != NULL) {
+                *Sent = Done;
+        }
+
+        return Status;
+}
+
+NTSTATUS RtlReceiveChannel(PRTL_CHANNEL Channel, PVOID *Messages, ULONG Count, PULONG Received, PLARGE_INTEGER TimeOut)
+{
+        if (Channel == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (Messages == NULL || Count == 0) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if (Received != NULL) {
+                *Received = 0;
+        }
+
+        ULONG Taken = RtlpTakeChannelCount(&Channel->Messages, Count);
+        if (Taken == 0) {
+                if (TimeOut != NULL && TimeOut->QuadPart == 0) {
+                        return STATUS_TIMEOUT;
+                }
+
+                __u64 Deadline;
+                NTSTATUS Status = RtlpFormatTimeOut(TimeOut, &Deadline);
+                if (Status == STATUS_SUCCESS) {
+                        Status = RtlpWaitChannelCount(&Channel->Messages, Channel->ReceiveSemaphore, Deadline);
+                }
+                if (Status != STATUS_SUCCESS) {
+                        return Status;
+                }
+
+                /* Whatever else came in the meantime goes along */
+                Taken = 1 + RtlpTakeChannelCount(&Channel->Messages, Count - 1);
+        }
+
+        RtlpReadChannel(Channel, Messages, Taken);
+        if (Received != NULL) {
+                *Received = Taken;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/* Gives up the claims of a select on every channel but Selected, a granted
+ * claim goes back to the channel. */
+static void RtlpCancelChannelSelect(ULONG Count, PRTL_CHANNEL const *Channels, ULONG Selected)
+{
+        for (ULONG i = 0; i < Count; i++) {
+                if (i != Selected && RtlpCancelChannelWait(&Channels[i]->Messages, Channels[i]->ReceiveSemaphore)) {
+                        RtlpAddChannelCount(&Channels[i]->Messages, Channels[i]->ReceiveSemaphore, 1);
+                }
+        }
+}
+
+/* Claims a message on every channel and waits for the first claim to be
+ * granted. A claim that is granted while the rest are given up is passed
+ * on to the next receiver of its channel. */
+NTSTATUS RtlSelectChannels(ULONG Count, PRTL_CHANNEL const *Channels, PVOID *Message, PLARGE_INTEGER TimeOut)
+{
+        if (Count == 0 || Count > MAXIMUM_WAIT_OBJECTS) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (Channels == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if (Message == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        for (ULONG i = 0; i < Count; i++) {
+                if (RtlpTakeChannelCount(&Channels[i]->Messages, 1) != 0) {
+                        RtlpReadChannel(Channels[i], Message, 1);
+                        return STATUS_WAIT_0 + i;
+                }
+        }
+
+        if (TimeOut != NULL && TimeOut->QuadPart == 0) {
+                return STATUS_TIMEOUT;
+        }
+
+        HANDLE Semaphores[MAXIMUM_WAIT_OBJECTS];
+        for (ULONG i = 0; i < Count; i++) {
+                if (__atomic_fetch_sub(&Channels[i]->Messages, 1, __ATOMIC_SEQ_CST) > 0) {
+                        RtlpCancelChannelSelect(i, Channels, i);
+                        RtlpReadChannel(Channels[i], Message, 1);
+                        return STATUS_WAIT_0 + i;
+                }
+                Semaphores[i] = RtlpGetChannelSemaphore(Channels[i]->ReceiveSemaphore);
+        }
+
+        NTSTATUS Status = NtWaitForMultipleObjects(Count, Semaphores, WaitAny, FALSE, TimeOut);
+        ULONG Selected = Status <= STATUS_WAIT_63 ? Status : Count;
+        if (Selected == Count) {
+                /* The first claim granted in the meantime still counts */
+                for (ULONG i = 0; i < Count && Selected == Count; i++) {
+                        if (RtlpCancelChannelWait(&Channels[i]->Messages, Channels[i]->ReceiveSemaphore)) {
+                                Selected = i;
+                                RtlpCancelChannelSelect(Count - i - 1, Channels + i + 1, Count);
+                        }
+                }
+                if (Selected == Count) {
+                        return Status;
+                }
+        } else {
+                RtlpCancelChannelSelect(Count, Channels, Selected);
+        }
+
+        RtlpReadChannel(Channels[Selected], Message, 1);
+        return STATUS_WAIT_0 + Selected;
+}
+
+NTSTATUS RtlDeleteChannel(PRTL_CHANNEL Channel)
+{
+        NtClose(RtlpGetChannelSemaphore(Channel->SendSemaphore));
+        NtClose(RtlpGetChannelSemaphore(Channel->ReceiveSemaphore));
+        free(Channel->Cells);
+        Channel->SendSemaphore = -1;
+        Channel->ReceiveSemaphore = -1;
+        Channel->Cells = NULL;
+
+        return STATUS_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 19/10/2026 GMT +7 14.05
+ * - Initial critical section implementation
+ * 20/10/2026 GMT +7 21.30
+ * - The lock semaphore uses the userspace backend
+ * 24/10/2026 GMT +7 11.40
+ * - The lock semaphore only uses the userspace backend when ntsync_backend says so
+ */
+
+#include "ntp.h"
+#include <errno.h>
+#include <sched.h>
+
+/* LockCount
+ * 0 : free
+ * 1 : owned, nobody is blocked
+ * 2 : owned, somebody may be blocked on LockSemaphore
+ */
+#define RTLP_CRITSEC_FREE 0
+#define RTLP_CRITSEC_OWNED 1
+#define RTLP_CRITSEC_CONTENDED 2
+
+static void RtlpCriticalSectionPause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+}
+
+static void RtlpCriticalSectionOwned(PRTL_CRITICAL_SECTION CriticalSection, ULONG OwnerId)
+{
+        __atomic_store_n(&CriticalSection->OwningThread, OwnerId, __ATOMIC_RELAXED);
+        CriticalSection->RecursionCount = 1;
+}
+
+/* The semaphore is only created by the first thread that has to block,
+ * a critical section that is never contended costs no fd at all. */
+static int RtlpGetCriticalSectionSemaphore(PRTL_CRITICAL_SECTION CriticalSection)
+{
+        int Object = __atomic_load_n(&CriticalSection->LockSemaphore, __ATOMIC_ACQUIRE);
+        if (Object != -1) {
+                return Object;
+        }
+
+        /* NTSYNC unless the process picked the userspace backend */
+        HANDLE Semaphore;
+        OBJECT_ATTRIBUTES Attributes;
+        InitializeObjectAttributes(&Attributes, NULL, ntsync_backend == NTSYNC_BACKEND_USERSPACE ? OBJ_PROCESS_LOCAL : 0, NULL, NULL);
+        if (NtCreateSemaphore(&Semaphore, SEMAPHORE_ALL_ACCESS, &Attributes, 0, INT32_MAX) != STATUS_SUCCESS) {
+                return -1;
+        }
+
+        if (!__atomic_compare_exchange_n(&CriticalSection->LockSemaphore, &Object, Semaphore.Object, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                NtClose(Semaphore);
+        } else {
+                Object = Semaphore.Object;
+        }
+
+        return Object;
+}
+
+NTSTATUS RtlInitializeCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
+{
+        return RtlInitializeCriticalSectionAndSpinCount(CriticalSection, 0);
+}
+
+NTSTATUS RtlInitializeCriticalSectionAndSpinCount(PRTL_CRITICAL_SECTION CriticalSection, ULONG SpinCount)
+{
+        if (CriticalSection == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        CriticalSection->DebugInfo = NULL;
+        CriticalSection->LockCount = RTLP_CRITSEC_FREE;
+        CriticalSection->RecursionCount = 0;
+        CriticalSection->OwningThread = 0;
+        CriticalSection->LockSemaphore = -1;
+        CriticalSection->SpinCount = SpinCount;
+
+        return STATUS_SUCCESS;
+}
+
+ULONG RtlSetCriticalSectionSpinCount(PRTL_CRITICAL_SECTION CriticalSection, ULONG SpinCount)
+{
+        return __atomic_exchange_n(&CriticalSection->SpinCount, SpinCount, __ATOMIC_RELAXED);
+}
+
+BOOLEAN RtlTryEnterCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
+{
+        ULONG OwnerId = RtlpGetOwnerId();
+        if (__atomic_load_n(&CriticalSection->OwningThread, __ATOMIC_RELAXED) == OwnerId) {
+                CriticalSection->RecursionCount++;
+                return TRUE;
+        }
+
+        LONG LockCount = RTLP_CRITSEC_FREE;
+        if (__atomic_compare_exchange_n(&CriticalSection->LockCount, &LockCount, RTLP_CRITSEC_OWNED, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                RtlpCriticalSectionOwned(CriticalSection, OwnerId);
+                return TRUE;
+        }
+
+        return FALSE;
+}
+
+NTSTATUS RtlEnterCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
+{
+        ULONG OwnerId = RtlpGetOwnerId();
+        if (__atomic_load_n(&CriticalSection->OwningThread, __ATOMIC_RELAXED) == OwnerId) {
+                CriticalSection->RecursionCount++;
+                return STATUS_SUCCESS;
+        }
+
+        LONG LockCount = RTLP_CRITSEC_FREE;
+        if (__atomic_compare_exchange_n(&CriticalSection->LockCount, &LockCount, RTLP_CRITSEC_OWNED, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                RtlpCriticalSectionOwned(CriticalSection, OwnerId);
+                return STATUS_SUCCESS;
+        }
+
+        for (ULONG Spin = __atomic_load_n(&CriticalSection->SpinCount, __ATOMIC_RELAXED); Spin != 0; Spin--) {
+                LockCount = __atomic_load_n(&CriticalSection->LockCount, __ATOMIC_RELAXED);
+                if (LockCount == RTLP_CRITSEC_CONTENDED) {
+                        /* Somebody is already asleep, spinning won't get us ahead of it */
+                        break;
+                }
+
+                if (LockCount == RTLP_CRITSEC_FREE &&
+                    __atomic_compare_exchange_n(&CriticalSection->LockCount, &LockCount, RTLP_CRITSEC_OWNED, false,
+                                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                        RtlpCriticalSectionOwned(CriticalSection, OwnerId);
+                        return STATUS_SUCCESS;
+                }
+                RtlpCriticalSectionPause();
+        }
+
+        /* Real contention. The semaphore has to exist before LockCount says
+         * somebody may be blocked, LeaveCriticalSection relies on it. */
+        HANDLE Semaphore = {.DesiredAccess = SEMAPHORE_ALL_ACCESS, .Object = RtlpGetCriticalSectionSemaphore(CriticalSection)};
+        while (__atomic_exchange_n(&CriticalSection->LockCount, RTLP_CRITSEC_CONTENDED, __ATOMIC_ACQUIRE) != RTLP_CRITSEC_FREE) {
+                if (Semaphore.Object == -1) {
+                        /* No semaphore could be created, degrade to yielding */
+                        sched_yield();
+                        continue;
+                }
+
+                NTSTATUS Status = NtWaitForSingleObject(Semaphore, FALSE, NULL);
+                if (Status != STATUS_WAIT_0) {
+                        return Status;
+                }
+        }
+
+        RtlpCriticalSectionOwned(CriticalSection, OwnerId);
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlLeaveCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
+{
+        if (__atomic_load_n(&CriticalSection->OwningThread, __ATOMIC_RELAXED) != RtlpGetOwnerId()) {
+                errno = EPERM;
+                return STATUS_RESOURCE_NOT_OWNED;
+        }
+
+        if (--CriticalSection->RecursionCount != 0) {
+                return STATUS_SUCCESS;
+        }
+
+        __atomic_store_n(&CriticalSection->OwningThread, 0, __ATOMIC_RELAXED);
+        if (__atomic_exchange_n(&CriticalSection->LockCount, RTLP_CRITSEC_FREE, __ATOMIC_RELEASE) == RTLP_CRITSEC_CONTENDED) {
+                HANDLE Semaphore = {.DesiredAccess = SEMAPHORE_ALL_ACCESS,
+                                    .Object = __atomic_load_n(&CriticalSection->LockSemaphore, __ATOMIC_ACQUIRE)};
+                if (Semaphore.Object != -1) {
+                        return NtReleaseSemaphore(Semaphore, 1, NULL);
+                }
+        }
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlDeleteCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
+{
+        if (CriticalSection->LockSemaphore != -1) {
+                HANDLE Semaphore = {.DesiredAccess = SEMAPHORE_ALL_ACCESS, .Object = CriticalSection->LockSemaphore};
+                CriticalSection->LockSemaphore = -1;
+                return NtClose(Semaphore);
+        }
+
+        return STATUS_SUCCESS;
+}
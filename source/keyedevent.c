@@ -0,0 +1,220 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 19/10/2026 GMT +7 11.40
+ * - Initial keyed event implementation
+ * 19/10/2026 GMT +7 16.30
+ * - Process-wide keyed event for the RTL primitives
+ */
+
+#include "ntp.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define RTLP_KEYED_EVENT_SHARD_SHIFT 6
+#define RTLP_KEYED_EVENT_BUCKET_SHIFT 6
+#define RTLP_KEYED_EVENT_SHARDS (1 << RTLP_KEYED_EVENT_SHARD_SHIFT)
+#define RTLP_KEYED_EVENT_BUCKETS (1 << RTLP_KEYED_EVENT_BUCKET_SHIFT)
+
+typedef struct _LIST_ENTRY
+{
+        struct _LIST_ENTRY *Flink;
+        struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+/* Lives on the stack of the blocked thread for as long as it is linked */
+typedef struct _RTLP_KEYED_WAIT_BLOCK
+{
+        LIST_ENTRY WaitListEntry;
+        PRTLP_OBJECT KeyedEvent;
+        PVOID Key;
+        bool Release;
+        _Atomic ULONG Signaled;
+} RTLP_KEYED_WAIT_BLOCK, *PRTLP_KEYED_WAIT_BLOCK;
+
+/* Each shard lock covers its own buckets only, so unrelated keys rarely
+ * contend. Buckets are lists kept in arrival order, the oldest matching
+ * block is paired first. */
+typedef struct __attribute__((aligned(64))) _RTLP_KEYED_EVENT_SHARD
+{
+        pthread_mutex_t Lock;
+        LIST_ENTRY Buckets[RTLP_KEYED_EVENT_BUCKETS];
+} RTLP_KEYED_EVENT_SHARD, *PRTLP_KEYED_EVENT_SHARD;
+
+static RTLP_KEYED_EVENT_SHARD RtlpKeyedEventShards[RTLP_KEYED_EVENT_SHARDS];
+static pthread_once_t RtlpGlobalKeyedEventOnce = PTHREAD_ONCE_INIT;
+static HANDLE RtlpGlobalKeyedEvent = {.DesiredAccess = 0, .Object = -1};
+
+static void __attribute__((constructor)) RtlpInitializeKeyedEventShards(void)
+{
+        for (size_t i = 0; i < RTLP_KEYED_EVENT_SHARDS; i++) {
+                pthread_mutex_init(&RtlpKeyedEventShards[i].Lock, NULL);
+                for (size_t j = 0; j < RTLP_KEYED_EVENT_BUCKETS; j++) {
+                        RtlpKeyedEventShards[i].Buckets[j].Flink = &RtlpKeyedEventShards[i].Buckets[j];
+                        RtlpKeyedEventShards[i].Buckets[j].Blink = &RtlpKeyedEventShards[i].Buckets[j];
+                }
+        }
+}
+
+static void RtlpInsertTailList(PLIST_ENTRY ListHead, PLIST_ENTRY Entry)
+{
+        Entry->Flink = ListHead;
+        Entry->Blink = ListHead->Blink;
+        ListHead->Blink->Flink = Entry;
+        ListHead->Blink = Entry;
+}
+
+static void RtlpRemoveEntryList(PLIST_ENTRY Entry)
+{
+        Entry->Blink->Flink = Entry->Flink;
+        Entry->Flink->Blink = Entry->Blink;
+}
+
+static PLIST_ENTRY RtlpGetKeyedEventBucket(PRTLP_OBJECT KeyedEvent, PVOID Key, PRTLP_KEYED_EVENT_SHARD *Shard)
+{
+        uint64_t Hash = ((uintptr_t)Key ^ ((uintptr_t)KeyedEvent >> 4)) * 0x9e3779b97f4a7c15ULL;
+        *Shard = &RtlpKeyedEventShards[Hash >> (64 - RTLP_KEYED_EVENT_SHARD_SHIFT)];
+        return &(*Shard)->Buckets[(Hash >> (64 - RTLP_KEYED_EVENT_SHARD_SHIFT - RTLP_KEYED_EVENT_BUCKET_SHIFT)) & (RTLP_KEYED_EVENT_BUCKETS - 1)];
+}
+
+static NTSTATUS RtlpKeyedEventRendezvous(HANDLE KeyedEventHandle, PVOID Key, BOOLEAN Alertable, PLARGE_INTEGER TimeOut, bool Release)
+{
+        if ((uintptr_t)Key & 1) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if (Alertable) {
+                errno = ENOSYS;
+                return STATUS_NOT_IMPLEMENTED;
+        }
+
+        if (!(KeyedEventHandle.DesiredAccess & (Release ? KEYEDEVENT_WAKE : KEYEDEVENT_WAIT))) {
+                errno = EPERM;
+                return STATUS_ACCESS_DENIED;
+        }
+
+        PRTLP_OBJECT KeyedEvent = RtlpLookupObject(KeyedEventHandle.Object);
+        if (KeyedEvent == NULL || KeyedEvent->Type != RtlpKeyedEventObject) {
+                errno = EINVAL;
+                return STATUS_OBJECT_TYPE_MISMATCH;
+        }
+
+        __u64 Deadline;
+        NTSTATUS Status = RtlpFormatTimeOut(TimeOut, &Deadline);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        PRTLP_KEYED_EVENT_SHARD Shard;
+        PLIST_ENTRY Bucket = RtlpGetKeyedEventBucket(KeyedEvent, Key, &Shard);
+
+        pthread_mutex_lock(&Shard->Lock);
+        for (PLIST_ENTRY Entry = Bucket->Flink; Entry != Bucket; Entry = Entry->Flink) {
+                PRTLP_KEYED_WAIT_BLOCK Partner = (PRTLP_KEYED_WAIT_BLOCK)Entry;
+                if (Partner->KeyedEvent == KeyedEvent && Partner->Key == Key && Partner->Release != Release) {
+                        RtlpRemoveEntryList(Entry);
+                        atomic_store_explicit(&Partner->Signaled, 1, memory_order_release);
+                        pthread_mutex_unlock(&Shard->Lock);
+                        RtlpFutexWake(&Partner->Signaled, 1);
+                        return STATUS_SUCCESS;
+                }
+        }
+
+        RTLP_KEYED_WAIT_BLOCK WaitBlock = {.KeyedEvent = KeyedEvent, .Key = Key, .Release = Release, .Signaled = 0};
+        RtlpInsertTailList(Bucket, &WaitBlock.WaitListEntry);
+        pthread_mutex_unlock(&Shard->Lock);
+
+        while (!atomic_load_explicit(&WaitBlock.Signaled, memory_order_acquire)) {
+                if (RtlpFutexWait(&WaitBlock.Signaled, 0, Deadline) == STATUS_TIMEOUT) {
+                        pthread_mutex_lock(&Shard->Lock);
+                        bool Signaled = atomic_load_explicit(&WaitBlock.Signaled, memory_order_acquire);
+                        if (!Signaled) {
+                                RtlpRemoveEntryList(&WaitBlock.WaitListEntry);
+                        }
+                        pthread_mutex_unlock(&Shard->Lock);
+
+                        if (!Signaled) {
+                                errno = ETIMEDOUT;
+                                return STATUS_TIMEOUT;
+                        }
+                }
+        }
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS NtCreateKeyedEvent(PHANDLE KeyedEventHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, ULONG Flags)
+{
+        if (KeyedEventHandle == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (ObjectAttributes != NULL) {
+                errno = ENOSYS;
+                return STATUS_NOT_IMPLEMENTED;
+        }
+
+        if (Flags != 0) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_4;
+        }
+
+        PRTLP_OBJECT KeyedEvent = calloc(1, sizeof(*KeyedEvent));
+        if (KeyedEvent == NULL) {
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+        KeyedEvent->Type = RtlpKeyedEventObject;
+
+        /* Only gives the keyed event a handle value, it is never signaled */
+        int ret = eventfd(0, EFD_CLOEXEC);
+        if (ret == -1) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                free(KeyedEvent);
+                return Status;
+        }
+
+        if (!RtlpInsertObject(ret, KeyedEvent)) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                close(ret);
+                free(KeyedEvent);
+                return Status;
+        }
+
+        KeyedEventHandle->DesiredAccess = DesiredAccess;
+        KeyedEventHandle->Object = ret;
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS NtWaitForKeyedEvent(HANDLE KeyedEventHandle, PVOID Key, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
+{
+        return RtlpKeyedEventRendezvous(KeyedEventHandle, Key, Alertable, TimeOut, false);
+}
+
+NTSTATUS NtReleaseKeyedEvent(HANDLE KeyedEventHandle, PVOID Key, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
+{
+        return RtlpKeyedEventRendezvous(KeyedEventHandle, Key, Alertable, TimeOut, true);
+}
+
+static void RtlpCreateGlobalKeyedEvent(void)
+{
+        NtCreateKeyedEvent(&RtlpGlobalKeyedEvent, KEYEDEVENT_ALL_ACCESS, NULL, 0);
+}
+
+/* Shared by the RTL primitives, keyed by their own address. Like the one in
+ * Windows it is never closed. */
+HANDLE RtlpGetGlobalKeyedEvent(void)
+{
+        pthread_once(&RtlpGlobalKeyedEventOnce, RtlpCreateGlobalKeyedEvent);
+        return RtlpGlobalKeyedEvent;
+}
@@ -0,0 +1,951 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 20/10/2026 GMT +7 18.10
+ * - Initial named objects through a per-user broker process
+ * 23/10/2026 GMT +7 13.10
+ * - The broker waits for the object of a create in its poll loop instead of blocking on the client
+ * 24/10/2026 GMT +7 11.20
+ * - The broker is started by executing the program again instead of a bare fork of it
+ */
+
+#define _GNU_SOURCE
+#include "ntp.h"
+#include <errno.h>
+#include <link.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RTLP_OBJECT_NAME_MAX 255
+#define RTLP_NAME_TABLE_MIN 64
+#define RTLP_BROKER_CONNECT_RETRIES 200
+
+/* The broker listens on an abstract socket named after the user, so every
+ * process of that user shares one namespace. Nothing is left on disk. */
+#define RTLP_BROKER_ADDRESS "libntsync-%u"
+
+/* A program executed with this variable set runs the broker on the given
+ * listening socket instead of its own main */
+#define RTLP_BROKER_ENVIRONMENT "LIBNTSYNC_BROKER"
+#define RTLP_BROKER_LISTENER 3
+
+typedef enum _RTLP_NAME_OPERATION
+{
+        RtlpNameCreate = 1,
+        RtlpNameOpen,
+        RtlpNameClose,
+} RTLP_NAME_OPERATION;
+
+/* Create is followed by the object itself, sent with RtlpSendObject. The
+ * reply to create and open is followed by an object when the status is
+ * STATUS_OBJECT_NAME_EXISTS or STATUS_SUCCESS for open. Close has no reply.
+ */
+typedef struct _RTLP_NAME_REQUEST
+{
+        RTLP_NAME_OPERATION Operation;
+        RTLP_OBJECT_TYPE Type;
+        ULONG DesiredAccess;
+        USHORT Length;
+        char Name[RTLP_OBJECT_NAME_MAX];
+} RTLP_NAME_REQUEST, *PRTLP_NAME_REQUEST;
+
+typedef struct _RTLP_NAME_REPLY
+{
+        NTSTATUS Status;
+} RTLP_NAME_REPLY;
+
+typedef struct _RTLP_NAME_ENTRY
+{
+        struct _RTLP_NAME_ENTRY *Next;
+        ULONG Hash;
+        USHORT Length;
+        char Name[RTLP_OBJECT_NAME_MAX];
+} RTLP_NAME_ENTRY, *PRTLP_NAME_ENTRY;
+
+/* Chained hash table, grown to keep at most one entry per bucket on average */
+typedef struct _RTLP_NAME_TABLE
+{
+        PRTLP_NAME_ENTRY *Buckets;
+        ULONG Size;
+        ULONG Count;
+} RTLP_NAME_TABLE, *PRTLP_NAME_TABLE;
+
+/* Cache entry of a name opened by this process. Record is the object while
+ * Linked, the last NtClose of it unlinks and frees the entry. */
+typedef struct _RTLP_OBJECT_NAME
+{
+        RTLP_NAME_ENTRY Entry;
+        PRTLP_OBJECT Record;
+        int Object;
+        bool Linked;
+} RTLP_OBJECT_NAME, *PRTLP_OBJECT_NAME;
+
+/* Broker side, a name lives as long as some client references it */
+typedef struct _RTLP_BROKER_NAME
+{
+        RTLP_NAME_ENTRY Entry;
+        HANDLE Handle;
+        RTLP_OBJECT_TYPE Type;
+        ULONG References;
+} RTLP_BROKER_NAME, *PRTLP_BROKER_NAME;
+
+typedef struct _RTLP_BROKER_REFERENCE
+{
+        PRTLP_BROKER_NAME Name;
+        ULONG Count;
+} RTLP_BROKER_REFERENCE, *PRTLP_BROKER_REFERENCE;
+
+/* Pending is a create still waiting for its object. The broker serves
+ * everybody from one thread, so the object is only read once it is there. */
+typedef struct _RTLP_BROKER_CLIENT
+{
+        PRTLP_BROKER_REFERENCE References;
+        ULONG Count;
+        ULONG Capacity;
+        RTLP_NAME_REQUEST Pending;
+        bool HasPending;
+} RTLP_BROKER_CLIENT, *PRTLP_BROKER_CLIENT;
+
+static pthread_mutex_t RtlpNameLock = PTHREAD_MUTEX_INITIALIZER;
+static RTLP_NAME_TABLE RtlpNameCache;
+static int RtlpBrokerSocket = -1;
+static bool RtlpNameForked;
+
+static ULONG RtlpHashName(const char *Name, USHORT Length)
+{
+        ULONG Hash = 2166136261u;
+        for (USHORT i = 0; i < Length; i++) {
+                Hash = (Hash ^ (unsigned char)Name[i]) * 16777619u;
+        }
+
+        return Hash;
+}
+
+static PRTLP_NAME_ENTRY *RtlpFindName(PRTLP_NAME_TABLE Table, const char *Name, USHORT Length, ULONG Hash)
+{
+        if (Table->Size == 0) {
+                return NULL;
+        }
+
+        PRTLP_NAME_ENTRY *Link = &Table->Buckets[Hash & (Table->Size - 1)];
+        for (; *Link != NULL; Link = &(*Link)->Next) {
+                if ((*Link)->Hash == Hash && (*Link)->Length == Length && memcmp((*Link)->Name, Name, Length) == 0) {
+                        return Link;
+                }
+        }
+
+        return NULL;
+}
+
+static bool RtlpInsertName(PRTLP_NAME_TABLE Table, PRTLP_NAME_ENTRY Entry)
+{
+        if (Table->Count >= Table->Size) {
+                ULONG Size = Table->Size != 0 ? Table->Size * 2 : RTLP_NAME_TABLE_MIN;
+                PRTLP_NAME_ENTRY *Buckets = calloc(Size, sizeof(*Buckets));
+                if (Buckets == NULL) {
+                        return false;
+                }
+
+                for (ULONG i = 0; i < Table->Size; i++) {
+                        while (Table->Buckets[i] != NULL) {
+                                PRTLP_NAME_ENTRY Moved = Table->Buckets[i];
+                                Table->Buckets[i] = Moved->Next;
+                                Moved->Next = Buckets[Moved->Hash & (Size - 1)];
+                                Buckets[Moved->Hash & (Size - 1)] = Moved;
+                        }
+                }
+
+                free(Table->Buckets);
+                Table->Buckets = Buckets;
+                Table->Size = Size;
+        }
+
+        Entry->Next = Table->Buckets[Entry->Hash & (Table->Size - 1)];
+        Table->Buckets[Entry->Hash & (Table->Size - 1)] = Entry;
+        Table->Count++;
+        return true;
+}
+
+static void RtlpUnlinkName(PRTLP_NAME_TABLE Table, PRTLP_NAME_ENTRY *Link)
+{
+        *Link = (*Link)->Next;
+        Table->Count--;
+}
+
+/* Fills Request with the name, without the namespace prefixes Windows
+ * programs use. Every name already lives in the session namespace. */
+static NTSTATUS RtlpFormatObjectName(POBJECT_ATTRIBUTES ObjectAttributes, PRTLP_NAME_REQUEST Request)
+{
+        if (ObjectAttributes->RootDirectory != NULL || ObjectAttributes->SecurityDescriptor != NULL) {
+                errno = ENOSYS;
+                return STATUS_NOT_IMPLEMENTED;
+        }
+
+        const char *Name = ObjectAttributes->ObjectName->Buffer;
+        size_t Length = ObjectAttributes->ObjectName->Length;
+        if (Name == NULL) {
+                Length = 0;
+        } else if (Length >= 7 && memcmp(Name, "Global\\", 7) == 0) {
+                Name += 7;
+                Length -= 7;
+        } else if (Length >= 6 && memcmp(Name, "Local\\", 6) == 0) {
+                Name += 6;
+                Length -= 6;
+        }
+
+        if (Length == 0 || Length > RTLP_OBJECT_NAME_MAX) {
+                errno = EINVAL;
+                return STATUS_OBJECT_NAME_INVALID;
+        }
+
+        memset(Request, 0, sizeof(*Request));
+        memcpy(Request->Name, Name, Length);
+        Request->Length = Length;
+        return STATUS_SUCCESS;
+}
+
+static void RtlpGetBrokerAddress(struct sockaddr_un *Address, socklen_t *AddressLength)
+{
+        memset(Address, 0, sizeof(*Address));
+        Address->sun_family = AF_UNIX;
+        int Length = snprintf(Address->sun_path + 1, sizeof(Address->sun_path) - 1, RTLP_BROKER_ADDRESS, (unsigned)getuid());
+        *AddressLength = offsetof(struct sockaddr_un, sun_path) + 1 + Length;
+}
+
+/* An abstract socket has no permissions, so both ends check who the other
+ * one is. */
+static bool RtlpIsSameUser(int Socket)
+{
+        struct ucred Credentials;
+        socklen_t Length = sizeof(Credentials);
+        if (getsockopt(Socket, SOL_SOCKET, SO_PEERCRED, &Credentials, &Length) == -1) {
+                return false;
+        }
+
+        return Credentials.uid == getuid();
+}
+
+static bool RtlpAddBrokerReference(PRTLP_BROKER_CLIENT Client, PRTLP_BROKER_NAME Name)
+{
+        for (ULONG i = 0; i < Client->Count; i++) {
+                if (Client->References[i].Name == Name) {
+                        Client->References[i].Count++;
+                        Name->References++;
+                        return true;
+                }
+        }
+
+        if (Client->Count == Client->Capacity) {
+                ULONG Capacity = Client->Capacity != 0 ? Client->Capacity * 2 : 16;
+                PRTLP_BROKER_REFERENCE References = realloc(Client->References, Capacity * sizeof(*References));
+                if (References == NULL) {
+                        return false;
+                }
+                Client->References = References;
+                Client->Capacity = Capacity;
+        }
+
+        Client->References[Client->Count].Name = Name;
+        Client->References[Client->Count].Count = 1;
+        Client->Count++;
+        Name->References++;
+        return true;
+}
+
+static void RtlpReleaseBrokerName(PRTLP_NAME_TABLE Table, PRTLP_BROKER_NAME Name, ULONG Count)
+{
+        Name->References -= Count;
+        if (Name->References != 0) {
+                return;
+        }
+
+        PRTLP_NAME_ENTRY *Link = RtlpFindName(Table, Name->Entry.Name, Name->Entry.Length, Name->Entry.Hash);
+        RtlpUnlinkName(Table, Link);
+        NtClose(Name->Handle);
+        free(Name);
+}
+
+static void RtlpDropBrokerReference(PRTLP_NAME_TABLE Table, PRTLP_BROKER_CLIENT Client, PRTLP_BROKER_NAME Name)
+{
+        for (ULONG i = 0; i < Client->Count; i++) {
+                if (Client->References[i].Name != Name) {
+                        continue;
+                }
+
+                if (--Client->References[i].Count == 0) {
+                        Client->References[i] = Client->References[--Client->Count];
+                }
+                RtlpReleaseBrokerName(Table, Name, 1);
+                return;
+        }
+}
+
+static bool RtlpSendBrokerReply(int Socket, NTSTATUS Status, PRTLP_BROKER_NAME Name, ULONG DesiredAccess)
+{
+        RTLP_NAME_REPLY Reply = {.Status = Status};
+        if (send(Socket, &Reply, sizeof(Reply), MSG_NOSIGNAL) != sizeof(Reply)) {
+                return false;
+        }
+
+        if (Name != NULL) {
+                return RtlpSendObject(Socket, RtlpLookupObject(Name->Handle.Object), DesiredAccess) == STATUS_SUCCESS;
+        }
+
+        return true;
+}
+
+/* Completes the create pending on Client with the object that followed it */
+static bool RtlpServeBrokerCreate(PRTLP_NAME_TABLE Table, PRTLP_BROKER_CLIENT Client, int Socket)
+{
+        PRTLP_NAME_REQUEST Request = &Client->Pending;
+        Client->HasPending = false;
+
+        HANDLE Handle;
+        if (RtlpReceiveObject(Socket, &Handle) != STATUS_SUCCESS) {
+                return false;
+        }
+
+        ULONG Hash = RtlpHashName(Request->Name, Request->Length);
+        PRTLP_NAME_ENTRY *Link = RtlpFindName(Table, Request->Name, Request->Length, Hash);
+        PRTLP_BROKER_NAME Name = Link != NULL ? (PRTLP_BROKER_NAME)*Link : NULL;
+        if (Name != NULL) {
+                NtClose(Handle);
+                if (Name->Type != Request->Type) {
+                        return RtlpSendBrokerReply(Socket, STATUS_OBJECT_TYPE_MISMATCH, NULL, 0);
+                }
+                if (!RtlpAddBrokerReference(Client, Name)) {
+                        return RtlpSendBrokerReply(Socket, STATUS_NO_MEMORY, NULL, 0);
+                }
+                return RtlpSendBrokerReply(Socket, STATUS_OBJECT_NAME_EXISTS, Name, Request->DesiredAccess);
+        }
+
+        Name = calloc(1, sizeof(*Name));
+        if (Name != NULL) {
+                Name->Entry.Hash = Hash;
+                Name->Entry.Length = Request->Length;
+                memcpy(Name->Entry.Name, Request->Name, Request->Length);
+                Name->Handle = Handle;
+                Name->Type = Request->Type;
+        }
+
+        if (Name == NULL || !RtlpInsertName(Table, &Name->Entry)) {
+                free(Name);
+                NtClose(Handle);
+                return RtlpSendBrokerReply(Socket, STATUS_NO_MEMORY, NULL, 0);
+        }
+
+        if (!RtlpAddBrokerReference(Client, Name)) {
+                RtlpReleaseBrokerName(Table, Name, 0);
+                return RtlpSendBrokerReply(Socket, STATUS_NO_MEMORY, NULL, 0);
+        }
+
+        return RtlpSendBrokerReply(Socket, STATUS_SUCCESS, NULL, 0);
+}
+
+/* Serves one request, false drops the client */
+static bool RtlpServeBrokerRequest(PRTLP_NAME_TABLE Table, PRTLP_BROKER_CLIENT Client, int Socket)
+{
+        if (Client->HasPending) {
+                return RtlpServeBrokerCreate(Table, Client, Socket);
+        }
+
+        RTLP_NAME_REQUEST Request;
+        ssize_t ret = recv(Socket, &Request, sizeof(Request), 0);
+        if (ret != sizeof(Request) || Request.Length == 0 || Request.Length > RTLP_OBJECT_NAME_MAX) {
+                return false;
+        }
+
+        ULONG Hash = RtlpHashName(Request.Name, Request.Length);
+        PRTLP_NAME_ENTRY *Link = RtlpFindName(Table, Request.Name, Request.Length, Hash);
+        PRTLP_BROKER_NAME Name = Link != NULL ? (PRTLP_BROKER_NAME)*Link : NULL;
+
+        switch (Request.Operation) {
+                case RtlpNameClose:
+                        if (Name != NULL) {
+                                RtlpDropBrokerReference(Table, Client, Name);
+                        }
+                        return true;
+                case RtlpNameOpen:
+                        if (Name == NULL) {
+                                return RtlpSendBrokerReply(Socket, STATUS_OBJECT_NAME_NOT_FOUND, NULL, 0);
+                        }
+                        if (Name->Type != Request.Type) {
+                                return RtlpSendBrokerReply(Socket, STATUS_OBJECT_TYPE_MISMATCH, NULL, 0);
+                        }
+                        if (!RtlpAddBrokerReference(Client, Name)) {
+                                return RtlpSendBrokerReply(Socket, STATUS_NO_MEMORY, NULL, 0);
+                        }
+                        return RtlpSendBrokerReply(Socket, STATUS_SUCCESS, Name, Request.DesiredAccess);
+                case RtlpNameCreate:
+                        Client->Pending = Request;
+                        Client->HasPending = true;
+                        return true;
+                default:
+                        return false;
+        }
+}
+
+/* Runs in a process of its own, see RtlpStartBroker. It serves requests
+ * until the last client is gone and exits. */
+static void __attribute__((noreturn)) RtlpRunBroker(int Listener)
+{
+        setsid();
+        if (Listener > 0) {
+                close_range(0, Listener - 1, 0);
+        }
+        close_range(Listener + 1, ~0U, 0);
+        ntsync = -1;
+
+        RTLP_NAME_TABLE Table = {0};
+        struct pollfd *Sockets = NULL;
+        PRTLP_BROKER_CLIENT Clients = NULL;
+        ULONG Count = 1, Capacity = 0;
+
+        for (;;) {
+                if (Count == Capacity || Sockets == NULL) {
+                        Capacity = Capacity != 0 ? Capacity * 2 : 16;
+                        Sockets = realloc(Sockets, Capacity * sizeof(*Sockets));
+                        Clients = realloc(Clients, Capacity * sizeof(*Clients));
+                        if (Sockets == NULL || Clients == NULL) {
+                                _exit(1);
+                        }
+                        Sockets[0].fd = Listener;
+                        Sockets[0].events = POLLIN;
+                }
+
+                if (poll(Sockets, Count, -1) == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        _exit(1);
+                }
+
+                for (ULONG i = Count - 1; i > 0; i--) {
+                        if (Sockets[i].revents == 0) {
+                                continue;
+                        }
+
+                        if ((Sockets[i].revents & POLLIN) && RtlpServeBrokerRequest(&Table, &Clients[i], Sockets[i].fd)) {
+                                continue;
+                        }
+
+                        /* Everything the client still referenced goes with it */
+                        for (ULONG j = 0; j < Clients[i].Count; j++) {
+                                RtlpReleaseBrokerName(&Table, Clients[i].References[j].Name, Clients[i].References[j].Count);
+                        }
+                        free(Clients[i].References);
+                        close(Sockets[i].fd);
+                        Sockets[i] = Sockets[--Count];
+                        Clients[i] = Clients[Count];
+
+                        if (Count == 1) {
+                                _exit(0);
+                        }
+                }
+
+                if (Sockets[0].revents & POLLIN) {
+                        int Socket = accept4(Listener, NULL, NULL, SOCK_CLOEXEC);
+                        if (Socket != -1 && !RtlpIsSameUser(Socket)) {
+                                close(Socket);
+                        } else if (Socket != -1) {
+                                Sockets[Count].fd = Socket;
+                                Sockets[Count].events = POLLIN;
+                                memset(&Clients[Count], 0, sizeof(Clients[Count]));
+                                Count++;
+                        }
+                }
+        }
+}
+
+/* Finds the image holding libntsync. Name is left NULL for the program
+ * itself, which dl_iterate_phdr reports first and without a name. */
+static int RtlpFindBrokerImage(struct dl_phdr_info *Info, size_t Size, PVOID Context)
+{
+        (void)Size;
+        ElfW(Addr) Address = (ElfW(Addr))RtlpRunBroker;
+        for (ElfW(Half) i = 0; i < Info->dlpi_phnum; i++) {
+                const ElfW(Phdr) *Header = &Info->dlpi_phdr[i];
+                ElfW(Addr) Start = Info->dlpi_addr + Header->p_vaddr;
+                if (Header->p_type == PT_LOAD && Address >= Start && Address < Start + Header->p_memsz) {
+                        *(const char **)Context = Info->dlpi_name[0] != '\0' ? Info->dlpi_name : NULL;
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+/* The environment of the program with the broker variable added, and the
+ * shared object holding libntsync preloaded when it isn't in the program,
+ * so the broker starts even if the program only loads it later. The
+ * entries built here come first, see RtlpFreeBrokerEnvironment. */
+static char **RtlpGetBrokerEnvironment(void)
+{
+        const char *Image = NULL;
+        dl_iterate_phdr(RtlpFindBrokerImage, &Image);
+
+        size_t Count = 0;
+        const char *Preload = NULL;
+        for (; environ[Count] != NULL; Count++) {
+                if (strncmp(environ[Count], "LD_PRELOAD=", 11) == 0) {
+                        Preload = environ[Count] + 11;
+                }
+        }
+
+        char **Environment = calloc(Count + 3, sizeof(*Environment));
+        if (Environment == NULL) {
+                return NULL;
+        }
+
+        size_t Used = 0;
+        if (asprintf(&Environment[Used++], RTLP_BROKER_ENVIRONMENT "=%d", RTLP_BROKER_LISTENER) == -1) {
+                free(Environment);
+                return NULL;
+        }
+        if (Image != NULL || Preload != NULL) {
+                if (asprintf(&Environment[Used++], "LD_PRELOAD=%s%s%s", Image != NULL ? Image : "",
+                             Image != NULL && Preload != NULL ? ":" : "", Preload != NULL ? Preload : "") == -1) {
+                        free(Environment[0]);
+                        free(Environment);
+                        return NULL;
+                }
+        }
+
+        for (size_t i = 0; i < Count; i++) {
+                if (strncmp(environ[i], "LD_PRELOAD=", 11) != 0 &&
+                    strncmp(environ[i], RTLP_BROKER_ENVIRONMENT "=", sizeof(RTLP_BROKER_ENVIRONMENT)) != 0) {
+                        Environment[Used++] = environ[i];
+                }
+        }
+
+        return Environment;
+}
+
+static void RtlpFreeBrokerEnvironment(char **Environment)
+{
+        free(Environment[0]);
+        if (Environment[1] != NULL && strncmp(Environment[1], "LD_PRELOAD=", 11) == 0) {
+                free(Environment[1]);
+        }
+        free(Environment);
+}
+
+/* Binds the broker address and starts the broker behind it by executing
+ * the program again, a fork of a program that may have threads could only
+ * call async-signal-safe functions. Losing the race to another process is
+ * fine, its broker serves us as well. */
+static void RtlpSpawnBroker(void)
+{
+        struct sockaddr_un Address;
+        socklen_t AddressLength;
+        RtlpGetBrokerAddress(&Address, &AddressLength);
+
+        int Listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (Listener == -1) {
+                return;
+        }
+
+        if (bind(Listener, (struct sockaddr *)&Address, AddressLength) == -1 || listen(Listener, SOMAXCONN) == -1) {
+                close(Listener);
+                return;
+        }
+
+        char **Environment = RtlpGetBrokerEnvironment();
+        if (Environment == NULL) {
+                close(Listener);
+                return;
+        }
+
+        posix_spawn_file_actions_t Actions;
+        posix_spawnattr_t Attributes;
+        sigset_t Signals;
+        sigemptyset(&Signals);
+        posix_spawn_file_actions_init(&Actions);
+        posix_spawn_file_actions_adddup2(&Actions, Listener, RTLP_BROKER_LISTENER);
+        posix_spawnattr_init(&Attributes);
+        posix_spawnattr_setsigmask(&Attributes, &Signals);
+        posix_spawnattr_setflags(&Attributes, POSIX_SPAWN_SETSIGMASK);
+
+        /* The process started here only forks the broker and exits, so the
+         * broker is not our child */
+        pid_t Child;
+        char *Arguments[] = {"libntsync-broker", NULL};
+        if (posix_spawn(&Child, "/proc/self/exe", &Actions, &Attributes, Arguments, Environment) == 0) {
+                waitpid(Child, NULL, 0);
+        }
+
+        posix_spawnattr_destroy(&Attributes);
+        posix_spawn_file_actions_destroy(&Actions);
+        RtlpFreeBrokerEnvironment(Environment);
+        close(Listener);
+}
+
+static NTSTATUS RtlpCallBroker(int Socket, PRTLP_NAME_REQUEST Request, PRTLP_OBJECT Record, PHANDLE Handle);
+
+/* A child created with fork has a cache of names it never told the broker
+ * about, they are registered again on its own connection. */
+static void RtlpRegisterCachedNames(void)
+{
+        RtlpNameForked = false;
+        for (ULONG i = 0; i < RtlpNameCache.Size; i++) {
+                for (PRTLP_NAME_ENTRY Entry = RtlpNameCache.Buckets[i]; Entry != NULL; Entry = Entry->Next) {
+                        PRTLP_OBJECT_NAME Name = (PRTLP_OBJECT_NAME)Entry;
+                        RTLP_NAME_REQUEST Request = {.Operation = RtlpNameCreate,
+                                                     .Type = Name->Record->Type,
+                                                     .DesiredAccess = 0,
+                                                     .Length = Entry->Length};
+                        memcpy(Request.Name, Entry->Name, Entry->Length);
+
+                        HANDLE Existing;
+                        if (RtlpCallBroker(RtlpBrokerSocket, &Request, Name->Record, &Existing) == STATUS_OBJECT_NAME_EXISTS) {
+                                NtClose(Existing);
+                        }
+                }
+        }
+}
+
+static bool RtlpConnectBroker(void)
+{
+        if (RtlpBrokerSocket != -1) {
+                return true;
+        }
+
+        struct sockaddr_un Address;
+        socklen_t AddressLength;
+        RtlpGetBrokerAddress(&Address, &AddressLength);
+
+        for (int i = 0; i < RTLP_BROKER_CONNECT_RETRIES; i++) {
+                int Socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+                if (Socket == -1) {
+                        return false;
+                }
+
+                if (connect(Socket, (struct sockaddr *)&Address, AddressLength) == 0) {
+                        if (!RtlpIsSameUser(Socket)) {
+                                close(Socket);
+                                errno = EPERM;
+                                return false;
+                        }
+
+                        RtlpBrokerSocket = Socket;
+                        if (RtlpNameForked) {
+                                RtlpRegisterCachedNames();
+                        }
+                        return true;
+                }
+
+                int Error = errno;
+                close(Socket);
+                if (Error != ECONNREFUSED && Error != ENOENT && Error != EAGAIN) {
+                        return false;
+                }
+
+                /* An exiting broker may still hold the address for a moment */
+                if (i != 0) {
+                        struct timespec Delay = {.tv_sec = 0, .tv_nsec = 1000000};
+                        nanosleep(&Delay, NULL);
+                }
+                RtlpSpawnBroker();
+        }
+
+        errno = ECONNREFUSED;
+        return false;
+}
+
+static void RtlpDisconnectBroker(void)
+{
+        close(RtlpBrokerSocket);
+        RtlpBrokerSocket = -1;
+}
+
+static NTSTATUS RtlpCallBroker(int Socket, PRTLP_NAME_REQUEST Request, PRTLP_OBJECT Record, PHANDLE Handle)
+{
+        if (send(Socket, Request, sizeof(*Request), MSG_NOSIGNAL) != sizeof(*Request)) {
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+
+        if (Record != NULL) {
+                NTSTATUS Status = RtlpSendObject(Socket, Record, 0);
+                if (Status != STATUS_SUCCESS) {
+                        return Status;
+                }
+        }
+
+        if (Request->Operation == RtlpNameClose) {
+                return STATUS_SUCCESS;
+        }
+
+        RTLP_NAME_REPLY Reply;
+        ssize_t ret = recv(Socket, &Reply, sizeof(Reply), 0);
+        if (ret != sizeof(Reply)) {
+                errno = ret == -1 ? errno : EPIPE;
+                return ret == -1 ? RtlpGetNtStatusFromUnixErrno() : STATUS_PIPE_BROKEN;
+        }
+
+        if (Reply.Status == STATUS_OBJECT_NAME_EXISTS || (Request->Operation == RtlpNameOpen && Reply.Status == STATUS_SUCCESS)) {
+                NTSTATUS Status = RtlpReceiveObject(Socket, Handle);
+                if (Status != STATUS_SUCCESS) {
+                        return Status;
+                }
+        }
+
+        return Reply.Status;
+}
+
+/* Sends Request to the broker. A fresh connection can meet a broker that is
+ * exiting as its last client left, the request then goes to a new one. */
+static NTSTATUS RtlpRequestBroker(PRTLP_NAME_REQUEST Request, PRTLP_OBJECT Record, PHANDLE Handle)
+{
+        for (int i = 0; i < 2; i++) {
+                bool Connected = RtlpBrokerSocket != -1;
+                if (!RtlpConnectBroker()) {
+                        return RtlpGetNtStatusFromUnixErrno();
+                }
+
+                NTSTATUS Status = RtlpCallBroker(RtlpBrokerSocket, Request, Record, Handle);
+                bool Broken = Status == STATUS_PIPE_BROKEN || (Status == STATUS_UNSUCCESSFUL && (errno == EPIPE || errno == ECONNRESET));
+                if (!Broken) {
+                        return Status;
+                }
+
+                RtlpDisconnectBroker();
+                if (Connected) {
+                        return Status;
+                }
+        }
+
+        return STATUS_PIPE_BROKEN;
+}
+
+static NTSTATUS RtlpCacheObjectName(PRTLP_NAME_REQUEST Request, HANDLE Handle)
+{
+        PRTLP_OBJECT_NAME Name = calloc(1, sizeof(*Name));
+        if (Name == NULL) {
+                return STATUS_NO_MEMORY;
+        }
+
+        Name->Entry.Hash = RtlpHashName(Request->Name, Request->Length);
+        Name->Entry.Length = Request->Length;
+        memcpy(Name->Entry.Name, Request->Name, Request->Length);
+        Name->Record = RtlpLookupObject(Handle.Object);
+        Name->Object = Handle.Object;
+        Name->Linked = true;
+
+        if (!RtlpInsertName(&RtlpNameCache, &Name->Entry)) {
+                free(Name);
+                return STATUS_NO_MEMORY;
+        }
+        Name->Record->Name = Name;
+
+        return STATUS_SUCCESS;
+}
+
+/* Looks Request up in the cache and takes one more handle to the object.
+ * An object whose last handle is being closed is unlinked, its name will
+ * come from the broker again. */
+static NTSTATUS RtlpLookupObjectName(PRTLP_NAME_REQUEST Request, ULONG DesiredAccess, PHANDLE Handle)
+{
+        PRTLP_NAME_ENTRY *Link = RtlpFindName(&RtlpNameCache, Request->Name, Request->Length, RtlpHashName(Request->Name, Request->Length));
+        if (Link == NULL) {
+                return STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+
+        PRTLP_OBJECT_NAME Name = (PRTLP_OBJECT_NAME)*Link;
+        if (Name->Record->Type != Request->Type) {
+                errno = EBADF;
+                return STATUS_OBJECT_TYPE_MISMATCH;
+        }
+
+        LONG HandleCount = atomic_load_explicit(&Name->Record->HandleCount, memory_order_relaxed);
+        do {
+                if (HandleCount < 0) {
+                        RtlpUnlinkName(&RtlpNameCache, Link);
+                        Name->Linked = false;
+                        return STATUS_OBJECT_NAME_NOT_FOUND;
+                }
+        } while (!atomic_compare_exchange_weak_explicit(&Name->Record->HandleCount, &HandleCount, HandleCount + 1,
+                                                        memory_order_relaxed, memory_order_relaxed));
+
+        Handle->DesiredAccess = DesiredAccess;
+        Handle->Object = Name->Object;
+        return STATUS_SUCCESS;
+}
+
+/* With Create set only the cache is looked at, STATUS_OBJECT_NAME_NOT_FOUND
+ * tells the caller to create the object and call RtlpInsertObjectName. */
+NTSTATUS RtlpOpenObjectName(POBJECT_ATTRIBUTES ObjectAttributes, RTLP_OBJECT_TYPE Type, ULONG DesiredAccess, bool Create, PHANDLE Handle)
+{
+        RTLP_NAME_REQUEST Request;
+        NTSTATUS Status = RtlpFormatObjectName(ObjectAttributes, &Request);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+        Request.Operation = RtlpNameOpen;
+        Request.Type = Type;
+        Request.DesiredAccess = DesiredAccess;
+
+        pthread_mutex_lock(&RtlpNameLock);
+        HANDLE Existing;
+        Status = RtlpLookupObjectName(&Request, DesiredAccess, &Existing);
+        if (Status == STATUS_SUCCESS && Create) {
+                if (!(ObjectAttributes->Attributes & OBJ_OPENIF)) {
+                        pthread_mutex_unlock(&RtlpNameLock);
+                        NtClose(Existing);
+                        errno = EEXIST;
+                        return STATUS_OBJECT_NAME_COLLISION;
+                }
+                Status = STATUS_OBJECT_NAME_EXISTS;
+        } else if (Status == STATUS_OBJECT_NAME_NOT_FOUND && !Create) {
+                Status = RtlpRequestBroker(&Request, NULL, &Existing);
+                if (Status == STATUS_SUCCESS && RtlpCacheObjectName(&Request, Existing) != STATUS_SUCCESS) {
+                        NtClose(Existing);
+                        Status = STATUS_NO_MEMORY;
+                }
+        }
+        pthread_mutex_unlock(&RtlpNameLock);
+
+        if (Status == STATUS_SUCCESS || Status == STATUS_OBJECT_NAME_EXISTS) {
+                *Handle = Existing;
+        } else if (Status == STATUS_OBJECT_NAME_NOT_FOUND) {
+                errno = ENOENT;
+        }
+
+        return Status;
+}
+
+/* Handle is a new object, it is given the name unless another thread or
+ * process got there first. Then the new object is closed and Handle is
+ * replaced by the existing one. */
+NTSTATUS RtlpInsertObjectName(POBJECT_ATTRIBUTES ObjectAttributes, RTLP_OBJECT_TYPE Type, PHANDLE Handle)
+{
+        RTLP_NAME_REQUEST Request;
+        NTSTATUS Status = RtlpFormatObjectName(ObjectAttributes, &Request);
+        if (Status != STATUS_SUCCESS) {
+                NtClose(*Handle);
+                return Status;
+        }
+        Request.Operation = RtlpNameCreate;
+        Request.Type = Type;
+        Request.DesiredAccess = Handle->DesiredAccess;
+
+        pthread_mutex_lock(&RtlpNameLock);
+        HANDLE Existing;
+        Status = RtlpLookupObjectName(&Request, Handle->DesiredAccess, &Existing);
+        if (Status == STATUS_SUCCESS) {
+                Status = STATUS_OBJECT_NAME_EXISTS;
+        } else if (Status == STATUS_OBJECT_NAME_NOT_FOUND) {
+                Status = RtlpRequestBroker(&Request, RtlpLookupObject(Handle->Object), &Existing);
+                if (Status == STATUS_SUCCESS && RtlpCacheObjectName(&Request, *Handle) != STATUS_SUCCESS) {
+                        Request.Operation = RtlpNameClose;
+                        RtlpRequestBroker(&Request, NULL, NULL);
+                        Status = STATUS_NO_MEMORY;
+                } else if (Status == STATUS_OBJECT_NAME_EXISTS && RtlpCacheObjectName(&Request, Existing) != STATUS_SUCCESS) {
+                        NtClose(Existing);
+                        Status = STATUS_NO_MEMORY;
+                }
+        }
+        pthread_mutex_unlock(&RtlpNameLock);
+
+        if (Status == STATUS_SUCCESS) {
+                return STATUS_SUCCESS;
+        }
+
+        NtClose(*Handle);
+        if (Status != STATUS_OBJECT_NAME_EXISTS) {
+                return Status;
+        }
+
+        if (!(ObjectAttributes->Attributes & OBJ_OPENIF)) {
+                NtClose(Existing);
+                errno = EEXIST;
+                return STATUS_OBJECT_NAME_COLLISION;
+        }
+
+        *Handle = Existing;
+        return STATUS_OBJECT_NAME_EXISTS;
+}
+
+/* Called by NtClose once the last handle of a named object is gone */
+void RtlpCloseObjectName(PRTLP_OBJECT_NAME Name)
+{
+        pthread_mutex_lock(&RtlpNameLock);
+        if (Name->Linked) {
+                RtlpUnlinkName(&RtlpNameCache, RtlpFindName(&RtlpNameCache, Name->Entry.Name, Name->Entry.Length, Name->Entry.Hash));
+        }
+
+        if (RtlpBrokerSocket != -1 || RtlpNameForked) {
+                RTLP_NAME_REQUEST Request = {.Operation = RtlpNameClose, .Type = Name->Record->Type, .Length = Name->Entry.Length};
+                memcpy(Request.Name, Name->Entry.Name, Name->Entry.Length);
+                RtlpRequestBroker(&Request, NULL, NULL);
+        }
+        pthread_mutex_unlock(&RtlpNameLock);
+
+        free(Name);
+}
+
+static void RtlpNameForkChild(void)
+{
+        pthread_mutex_init(&RtlpNameLock, NULL);
+        if (RtlpBrokerSocket != -1) {
+                RtlpDisconnectBroker();
+        }
+        RtlpNameForked = RtlpNameCache.Count != 0;
+}
+
+static void __attribute__((constructor)) RtlpInitializeNames(void)
+{
+        pthread_atfork(NULL, NULL, RtlpNameForkChild);
+}
+
+/* Runs before every other constructor of libntsync. In a process started
+ * by RtlpSpawnBroker it never returns, the broker runs instead of the
+ * program and nothing of libntsync was set up yet. */
+static void __attribute__((constructor(101))) RtlpStartBroker(void)
+{
+        const char *Value = getenv(RTLP_BROKER_ENVIRONMENT);
+        if (Value == NULL) {
+                return;
+        }
+
+        int Listener = atoi(Value);
+        unsetenv(RTLP_BROKER_ENVIRONMENT);
+
+        int Accepting = 0;
+        socklen_t Length = sizeof(Accepting);
+        if (getsockopt(Listener, SOL_SOCKET, SO_ACCEPTCONN, &Accepting, &Length) == -1 || !Accepting) {
+                return;
+        }
+
+        pid_t Child = fork();
+        if (Child == 0) {
+                RtlpRunBroker(Listener);
+        }
+        _exit(Child == -1);
+}
+
+void RtlInitAnsiString(PANSI_STRING DestinationString, PCSZ SourceString)
+{
+        size_t Length = SourceString != NULL ? strlen(SourceString) : 0;
+        if (Length > 0xfffe) {
+                Length = 0xfffe;
+        }
+
+        DestinationString->Buffer = (PCHAR)SourceString;
+        DestinationString->Length = Length;
+        DestinationString->MaximumLength = SourceString != NULL ? Length + 1 : 0;
+}
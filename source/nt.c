@@ -9,15 +9,155 @@
  * 28/10/2025 GMT +0 23.17
  * - Fix wrong event type returned from NtQueryEvent
  * - NtReleaseSemaphore now will return STATUS_SEMAPHORE_LIMIT_EXCEEDED if ioctl return EOVERFLOW
+ * 19/10/2026 GMT +7 09.12
+ * - Add NT Mutant with userspace fast path and abandonment on thread exit
+ * - Waits report STATUS_ABANDONED_WAIT_0 + n when NTSYNC returns EOWNERDEAD
+ * 19/10/2026 GMT +7 16.30
+ * - NtCreateEvent creates a manual-reset NTSYNC event for NotificationEvent
+ * 20/10/2026 GMT +7 08.45
+ * - Thread exit hook also signals thread handles
+ * 20/10/2026 GMT +7 13.20
+ * - Events and semaphores keep their state in a shared region with a userspace fast path
+ * - Add NtDuplicateObject, in-process duplicates share the fd
+ * 20/10/2026 GMT +7 18.10
+ * - Named events and semaphores, add NtOpenEvent and NtOpenSemaphore
+ * 20/10/2026 GMT +7 21.30
+ * - Events and semaphores can use the userspace backend, see userwait.c
+ * - Waits on thread handles go through the dispatcher of the thread event
+ * 21/10/2026 GMT +7 09.40
+ * - Creates, opens, signals, waits and closes are recorded while a sync trace runs
+ * 21/10/2026 GMT +7 14.15
+ * - Add NtAcquireSemaphoreEx
+ * 21/10/2026 GMT +7 17.05
+ * - Add RtlQueryObjectStates, the event, semaphore and mutant queries share their state readers with it
+ * 21/10/2026 GMT +7 20.30
+ * - Objects, holders and waits are reported to the object registry while it runs
+ * 22/10/2026 GMT +7 09.20
+ * - Waits on a broadcast event go through its current generation
+ * 22/10/2026 GMT +7 13.40
+ * - RtlpGetRemainingTimeOut is shared with the channels
+ * 23/10/2026 GMT +7 09.15
+ * - A mutant closed while another thread owns it is freed once that thread lets go of it
+ * 23/10/2026 GMT +7 11.00
+ * - A failed move of the state to NTSYNC gives the state back to userspace
+ * 23/10/2026 GMT +7 11.40
+ * - Semaphore releases wait for a drain and count the NTSYNC part against the limit
+ * - Event resets and pulses wait for a drain as well
+ * 23/10/2026 GMT +7 17.10
+ * - NtAcquireSemaphoreEx lines up collectors of every process through the shared state,
+ *   without one it gives back what it collected before blocking again
+ * 23/10/2026 GMT +7 18.30
+ * - Events and semaphores created or opened with OBJ_REGISTRY_LOCK are marked for the registry
+ * 24/10/2026 GMT +7 09.30
+ * - Moving the userspace part to NTSYNC has a bit of its own, releases wait for it
+ * - A unit NTSYNC won't take back during a drain stays in userspace
+ * 24/10/2026 GMT +7 11.20
+ * - Drop RtlpForgetObjects, the name broker starts from a fresh program
+ * 24/10/2026 GMT +7 12.00
+ * - RtlQueryObjectStates reports broadcasts, keyed events and NTSYNC objects without a record
+ * 24/10/2026 GMT +7 12.30
+ * - NtAcquireSemaphoreEx gives back what a dead collector took and blocks instead of backing off
+ * 24/10/2026 GMT +7 13.00
+ * - RtlpCreateEvent is shared with the events the library makes for itself, they aren't traced
  */
 
-#include "nt.h"
+#include "ntp.h"
 #include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <time.h>
 #include <unistd.h>
 
+#define RTLP_OBJECT_PAGE_SHIFT 10
+#define RTLP_OBJECT_PAGE_SIZE (1 << RTLP_OBJECT_PAGE_SHIFT)
+#define RTLP_OBJECT_DIRECTORY_SIZE 1024
+
+/* Mutant state word
+ * bits 0-31  : tid of the thread owning the mutant in userspace, 0 if none
+ * bit 32     : a waiter is acquiring the NTSYNC mutex on behalf of that owner
+ * bit 33     : the NTSYNC mutex is held on behalf of that owner
+ * bits 34-63 : threads waiting on or holding the NTSYNC mutex
+ * The userspace fast path is only taken when the whole word is zero.
+ */
+#define RTLP_MUTANT_OWNER_MASK 0xffffffffULL
+#define RTLP_MUTANT_MIGRATING (1ULL << 32)
+#define RTLP_MUTANT_MIGRATED (1ULL << 33)
+#define RTLP_MUTANT_KERNEL_USER (1ULL << 34)
+
+typedef enum _RTLP_MUTANT_ABANDON_STATE
+{
+        RtlpMutantNotAbandoned,
+        RtlpMutantAbandonedUser,
+        RtlpMutantAbandonedKernel,
+} RTLP_MUTANT_ABANDON_STATE;
+
+typedef struct _RTLP_MUTANT
+{
+        RTLP_OBJECT Header;
+        int Object;
+        _Atomic ULONGLONG State;
+        _Atomic ULONG Owner;
+        _Atomic int Abandoned;
+        /* One for the handles, one while a thread owns it. The last one
+         * closes the NTSYNC mutex and frees the mutant. */
+        _Atomic LONG References;
+        /* Only touched by the owning thread */
+        LONG Recursion;
+        LONG KernelCount;
+        bool UserOwned;
+        struct _RTLP_MUTANT *Next;
+        struct _RTLP_MUTANT **Prev;
+} RTLP_MUTANT, *PRTLP_MUTANT;
+
+/* Event and semaphore state word
+ * bits 0-30  : semaphore count, or event state, held in userspace
+ * bit 31     : the NTSYNC object may hold some of the state as well
+ * bit 32     : a thread is moving the NTSYNC state back to userspace
+ * bit 33     : the userspace part, or a release, is on its way to NTSYNC
+ * bits 34-63 : threads registered as waiting on the NTSYNC object
+ * While a thread is registered the userspace part is zero and the NTSYNC
+ * object has the whole state, so any kernel wait sees it. The last thread
+ * to leave moves the state back to userspace. While either move is under
+ * way part of the state is in neither place, so releases, resets and new
+ * waiters wait for it to land.
+ */
+#define RTLP_DISPATCHER_VALUE_MASK 0x7fffffffULL
+#define RTLP_DISPATCHER_KERNEL_STATE (1ULL << 31)
+#define RTLP_DISPATCHER_DRAINING (1ULL << 32)
+#define RTLP_DISPATCHER_TRANSFERRING (1ULL << 33)
+#define RTLP_DISPATCHER_MOVING (RTLP_DISPATCHER_DRAINING | RTLP_DISPATCHER_TRANSFERRING)
+#define RTLP_DISPATCHER_WAITER (1ULL << 34)
+
+typedef struct _RTLP_DUPLICATE_MESSAGE
+{
+        RTLP_OBJECT_TYPE Type;
+        ULONG DesiredAccess;
+        ULONG SharedIndex;
+        LONG MaximumCount;
+        bool ManualReset;
+        bool RegistryLock;
+} RTLP_DUPLICATE_MESSAGE;
+
 int ntsync;
+int ntsync_backend = NTSYNC_BACKEND_KERNEL;
+
+static _Atomic(_Atomic(PRTLP_OBJECT) *) RtlpObjectDirectory[RTLP_OBJECT_DIRECTORY_SIZE];
+static pthread_key_t RtlpThreadExitKey;
+static __thread ULONG RtlpOwnerId;
+static __thread PRTLP_MUTANT RtlpOwnedMutants;
+static __thread bool RtlpThreadExitArmed;
+
+/* Lines up the NtAcquireSemaphoreEx callers of this process on semaphores
+ * it only has a bare NTSYNC fd of */
+static pthread_mutex_t RtlpBareAcquireLock = PTHREAD_MUTEX_INITIALIZER;
 
 NTSTATUS RtlpGetNtStatusFromUnixErrno(void)
 {
@@ -43,168 +183,1615 @@ NTSTATUS RtlpGetNtStatusFromUnixErrno(void)
                 case ENOSYS:
                         return STATUS_NOT_IMPLEMENTED;
                         break;
+                case ENOMEM:
+                        return STATUS_NO_MEMORY;
+                        break;
                 default:
                         return STATUS_UNSUCCESSFUL;
                         break;
         }
 }
 
-NTSTATUS NtCreateSemaphore(PHANDLE SemaphoreHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, LONG InitialCount, LONG MaximumCount)
+NTSTATUS RtlpFormatTimeOut(PLARGE_INTEGER TimeOut, __u64 *Deadline)
 {
-        if (SemaphoreHandle == NULL) {
-                errno = EINVAL;
-                return STATUS_INVALID_PARAMETER_1;
+        if (TimeOut == NULL) {
+                *Deadline = UINT64_MAX;
+                return STATUS_SUCCESS;
         }
 
-        if (ObjectAttributes != NULL) {
-                errno = ENOSYS;
-                return STATUS_NOT_IMPLEMENTED;
+        struct timespec ts;
+        if (timespec_get(&ts, TIME_UTC) != TIME_UTC) {
+                return RtlpGetNtStatusFromUnixErrno();
         }
+        *Deadline = -(TimeOut->QuadPart) * 100 + ts.tv_nsec + ts.tv_sec * NSEC_PER_SEC;
+        return STATUS_SUCCESS;
+}
 
-        struct ntsync_sem_args args = {.count = InitialCount, .max = MaximumCount};
-        int ret = ioctl(ntsync, NTSYNC_IOC_CREATE_SEM, &args);
-        if (ret == -1) {
-                return RtlpGetNtStatusFromUnixErrno();
+/* Deadline is an absolute CLOCK_REALTIME time in nanoseconds, as produced
+ * by RtlpFormatTimeOut. */
+NTSTATUS RtlpFutexWait(_Atomic ULONG *Address, ULONG Value, __u64 Deadline)
+{
+        struct timespec ts = {.tv_sec = Deadline / NSEC_PER_SEC, .tv_nsec = Deadline % NSEC_PER_SEC};
+        int ret = syscall(SYS_futex, Address, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, Value,
+                          Deadline == UINT64_MAX ? NULL : &ts, NULL, FUTEX_BITSET_MATCH_ANY);
+        if (ret == -1 && errno == ETIMEDOUT) {
+                return STATUS_TIMEOUT;
         }
 
-        SemaphoreHandle->DesiredAccess = DesiredAccess;
-        SemaphoreHandle->Object = ret;
+        return STATUS_SUCCESS;
+}
+
+void RtlpFutexWake(_Atomic ULONG *Address, int Count)
+{
+        syscall(SYS_futex, Address, FUTEX_WAKE_PRIVATE, Count, NULL, NULL, 0);
+}
+
+static _Atomic(PRTLP_OBJECT) *RtlpGetObjectSlot(int Object, bool Create)
+{
+        if (Object < 0 || Object >= RTLP_OBJECT_DIRECTORY_SIZE * RTLP_OBJECT_PAGE_SIZE) {
+                return NULL;
+        }
+
+        _Atomic(PRTLP_OBJECT) *Page = atomic_load_explicit(&RtlpObjectDirectory[Object >> RTLP_OBJECT_PAGE_SHIFT], memory_order_acquire);
+        if (Page == NULL) {
+                if (!Create) {
+                        return NULL;
+                }
+
+                _Atomic(PRTLP_OBJECT) *NewPage = calloc(RTLP_OBJECT_PAGE_SIZE, sizeof(*NewPage));
+                if (NewPage == NULL) {
+                        return NULL;
+                }
+
+                if (atomic_compare_exchange_strong_explicit(&RtlpObjectDirectory[Object >> RTLP_OBJECT_PAGE_SHIFT], &Page, NewPage,
+                                                            memory_order_acq_rel, memory_order_acquire)) {
+                        Page = NewPage;
+                } else {
+                        free(NewPage);
+                }
+        }
+
+        return &Page[Object & (RTLP_OBJECT_PAGE_SIZE - 1)];
+}
+
+bool RtlpInsertObject(int Object, PRTLP_OBJECT Record)
+{
+        _Atomic(PRTLP_OBJECT) *Slot = RtlpGetObjectSlot(Object, true);
+        if (Slot == NULL) {
+                errno = ENOMEM;
+                return false;
+        }
+
+        atomic_store_explicit(Slot, Record, memory_order_release);
+        RtlpRegistryInsertObject(Object, Record);
+        return true;
+}
+
+PRTLP_OBJECT RtlpLookupObject(int Object)
+{
+        _Atomic(PRTLP_OBJECT) *Slot = RtlpGetObjectSlot(Object, false);
+        if (Slot == NULL) {
+                return NULL;
+        }
+
+        return atomic_load_explicit(Slot, memory_order_acquire);
+}
+
+PRTLP_OBJECT RtlpRemoveObject(int Object)
+{
+        _Atomic(PRTLP_OBJECT) *Slot = RtlpGetObjectSlot(Object, false);
+        if (Slot == NULL) {
+                return NULL;
+        }
+
+        PRTLP_OBJECT Record = atomic_exchange_explicit(Slot, NULL, memory_order_acq_rel);
+        if (Record != NULL) {
+                RtlpRegistryRemoveObject(Object);
+        }
+
+        return Record;
+}
+
+static void RtlpAbandonOwnedMutants(void);
+
+static void RtlpThreadExitRoutine(PVOID Context)
+{
+        (void)Context;
+        /* Mutants are abandoned before the thread handle gets signaled,
+         * like on Windows */
+        RtlpAbandonOwnedMutants();
+        RtlpUserThreadExit();
+}
+
+/* The dispatcher behind a record, the thread event for a thread */
+static PRTLP_DISPATCHER RtlpGetDispatcher(PRTLP_OBJECT Record)
+{
+        if (Record == NULL) {
+                return NULL;
+        }
+
+        switch (Record->Type) {
+                case RtlpEventObject:
+                case RtlpSemaphoreObject:
+                        return (PRTLP_DISPATCHER)Record;
+                case RtlpThreadObject:
+                        return RtlpGetThreadEvent(Record);
+                default:
+                        return NULL;
+        }
+}
+
+/* Its inherited handles keep the shared states alive as well, and
+ * userspace objects lose the waiters of the parent. A semaphore lock may
+ * have been held by a thread that isn't there anymore. */
+void RtlpForkDispatcher(PRTLP_DISPATCHER Dispatcher)
+{
+        if (Dispatcher->Shared) {
+                RtlpReferenceSharedState(&Dispatcher->Slot);
+        }
+        if (Dispatcher->Userspace) {
+                RtlpResetUserDispatcher(Dispatcher);
+        } else {
+                pthread_mutex_init(&Dispatcher->Lock, NULL);
+        }
+}
+
+static void RtlpForkChild(void)
+{
+        /* The child only has the forking thread, with a new tid and none of
+         * the parent's ownership. */
+        RtlpOwnerId = 0;
+        RtlpOwnedMutants = NULL;
+        RtlpThreadExitArmed = false;
+        pthread_mutex_init(&RtlpBareAcquireLock, NULL);
+
+        for (size_t i = 0; i < RTLP_OBJECT_DIRECTORY_SIZE; i++) {
+                _Atomic(PRTLP_OBJECT) *Page = atomic_load_explicit(&RtlpObjectDirectory[i], memory_order_relaxed);
+                for (size_t j = 0; Page != NULL && j < RTLP_OBJECT_PAGE_SIZE; j++) {
+                        PRTLP_OBJECT Record = atomic_load_explicit(&Page[j], memory_order_relaxed);
+                        if (Record != NULL && Record->Type == RtlpBroadcastObject) {
+                                RtlpForkBroadcast(Record);
+                                continue;
+                        }
+
+                        PRTLP_DISPATCHER Dispatcher = RtlpGetDispatcher(Record);
+                        if (Dispatcher != NULL) {
+                                RtlpForkDispatcher(Dispatcher);
+                        }
+                }
+        }
+}
+
+static void __attribute__((constructor)) RtlpInitializeThreadExit(void)
+{
+        pthread_key_create(&RtlpThreadExitKey, RtlpThreadExitRoutine);
+        pthread_atfork(NULL, NULL, RtlpForkChild);
+}
+
+void RtlpArmThreadExit(void)
+{
+        if (!RtlpThreadExitArmed) {
+                pthread_setspecific(RtlpThreadExitKey, &RtlpThreadExitArmed);
+                RtlpThreadExitArmed = true;
+        }
+}
+
+ULONG RtlpGetOwnerId(void)
+{
+        if (RtlpOwnerId == 0) {
+                RtlpOwnerId = syscall(SYS_gettid);
+        }
+
+        return RtlpOwnerId;
+}
+
+static PRTLP_MUTANT RtlpLookupMutant(int Object)
+{
+        PRTLP_OBJECT Record = RtlpLookupObject(Object);
+        if (Record == NULL || Record->Type != RtlpMutantObject) {
+                return NULL;
+        }
+
+        return (PRTLP_MUTANT)Record;
+}
+
+static void RtlpDereferenceMutant(PRTLP_MUTANT Mutant)
+{
+        if (atomic_fetch_sub_explicit(&Mutant->References, 1, memory_order_acq_rel) == 1) {
+                close(Mutant->Object);
+                free(Mutant);
+        }
+}
+
+static void RtlpLinkOwnedMutant(PRTLP_MUTANT Mutant)
+{
+        atomic_fetch_add_explicit(&Mutant->References, 1, memory_order_relaxed);
+        Mutant->Next = RtlpOwnedMutants;
+        Mutant->Prev = &RtlpOwnedMutants;
+        if (RtlpOwnedMutants != NULL) {
+                RtlpOwnedMutants->Prev = &Mutant->Next;
+        }
+        RtlpOwnedMutants = Mutant;
+        RtlpArmThreadExit();
+}
+
+static void RtlpUnlinkOwnedMutant(PRTLP_MUTANT Mutant)
+{
+        *Mutant->Prev = Mutant->Next;
+        if (Mutant->Next != NULL) {
+                Mutant->Next->Prev = Mutant->Prev;
+        }
+        Mutant->Next = NULL;
+        Mutant->Prev = NULL;
+}
+
+/* Acquire the NTSYNC mutex on behalf of the thread owning the mutant in
+ * userspace, so that kernel waiters queue behind it. State is the value
+ * last observed, with an owner and no migration bit set.
+ */
+static NTSTATUS RtlpMigrateMutant(PRTLP_MUTANT Mutant, ULONGLONG State)
+{
+        if (!atomic_compare_exchange_strong_explicit(&Mutant->State, &State, State | RTLP_MUTANT_MIGRATING,
+                                                     memory_order_acquire, memory_order_relaxed)) {
+                return STATUS_SUCCESS;
+        }
+
+        struct ntsync_wait_args args = {.timeout = 0,
+                                        .objs = (uintptr_t)&Mutant->Object,
+                                        .count = 1,
+                                        .flags = NTSYNC_WAIT_REALTIME,
+                                        .owner = (ULONG)(State & RTLP_MUTANT_OWNER_MASK),
+                                        .alert = 0,
+                                        .pad = 0};
+
+        int ret = ioctl(ntsync, NTSYNC_IOC_WAIT_ANY, &args);
+        if (ret == -1 && errno != EOWNERDEAD) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                atomic_fetch_and_explicit(&Mutant->State, ~RTLP_MUTANT_MIGRATING, memory_order_release);
+                return Status;
+        }
 
+        atomic_fetch_xor_explicit(&Mutant->State, RTLP_MUTANT_MIGRATING | RTLP_MUTANT_MIGRATED, memory_order_release);
         return STATUS_SUCCESS;
 }
 
-NTSTATUS NtReleaseSemaphore(HANDLE SemaphoreHandle, LONG ReleaseCount, PLONG PreviousCount)
+static bool RtlpTryAcquireMutant(PRTLP_MUTANT Mutant, ULONG OwnerId, NTSTATUS *Status)
 {
-        if (!(SemaphoreHandle.DesiredAccess & SEMAPHORE_MODIFY_STATE)) {
-                errno = EPERM;
-                return STATUS_ACCESS_DENIED;
+        if (atomic_load_explicit(&Mutant->Owner, memory_order_relaxed) == OwnerId) {
+                if (Mutant->Recursion == INT32_MAX) {
+                        errno = EOVERFLOW;
+                        *Status = STATUS_MUTANT_LIMIT_EXCEEDED;
+                } else {
+                        Mutant->Recursion++;
+                        *Status = STATUS_WAIT_0;
+                }
+                return true;
         }
 
-        int ret = ioctl(SemaphoreHandle.Object, NTSYNC_IOC_SEM_RELEASE, &ReleaseCount);
+        ULONGLONG State = 0;
+        if (!atomic_compare_exchange_strong_explicit(&Mutant->State, &State, OwnerId, memory_order_acquire, memory_order_relaxed)) {
+                return false;
+        }
+
+        atomic_store_explicit(&Mutant->Owner, OwnerId, memory_order_relaxed);
+        Mutant->Recursion = 1;
+        Mutant->KernelCount = 0;
+        Mutant->UserOwned = true;
+        RtlpLinkOwnedMutant(Mutant);
+
+        *Status = STATUS_WAIT_0;
+        int Abandoned = atomic_exchange_explicit(&Mutant->Abandoned, RtlpMutantNotAbandoned, memory_order_relaxed);
+        if (Abandoned != RtlpMutantNotAbandoned) {
+                *Status = STATUS_ABANDONED_WAIT_0;
+        }
+        if (Abandoned == RtlpMutantAbandonedKernel) {
+                /* Consume the abandoned flag left on the NTSYNC mutex, the
+                 * migrated hold is dropped on release as usual. */
+                RtlpMigrateMutant(Mutant, OwnerId);
+        }
+
+        return true;
+}
+
+/* Register the caller as a user of the NTSYNC mutex. Once this returns
+ * the mutant is either free or held through the NTSYNC mutex, so a kernel
+ * wait on it is correct.
+ */
+static NTSTATUS RtlpEnterMutantKernel(PRTLP_MUTANT Mutant)
+{
+        ULONGLONG State = atomic_fetch_add_explicit(&Mutant->State, RTLP_MUTANT_KERNEL_USER, memory_order_acq_rel) + RTLP_MUTANT_KERNEL_USER;
+        for (;;) {
+                if ((State & RTLP_MUTANT_OWNER_MASK) == 0 || (State & RTLP_MUTANT_MIGRATED)) {
+                        return STATUS_SUCCESS;
+                }
+
+                if (State & RTLP_MUTANT_MIGRATING) {
+                        sched_yield();
+                } else {
+                        NTSTATUS Status = RtlpMigrateMutant(Mutant, State);
+                        if (Status != STATUS_SUCCESS) {
+                                atomic_fetch_sub_explicit(&Mutant->State, RTLP_MUTANT_KERNEL_USER, memory_order_release);
+                                return Status;
+                        }
+                }
+
+                State = atomic_load_explicit(&Mutant->State, memory_order_acquire);
+        }
+}
+
+static bool RtlpAcquiredMutantKernel(PRTLP_MUTANT Mutant, ULONG OwnerId)
+{
+        if (atomic_load_explicit(&Mutant->Owner, memory_order_relaxed) == OwnerId) {
+                Mutant->Recursion++;
+                Mutant->KernelCount++;
+        } else {
+                atomic_store_explicit(&Mutant->Owner, OwnerId, memory_order_relaxed);
+                Mutant->Recursion = 1;
+                Mutant->KernelCount = 1;
+                Mutant->UserOwned = false;
+                RtlpLinkOwnedMutant(Mutant);
+        }
+
+        return atomic_exchange_explicit(&Mutant->Abandoned, RtlpMutantNotAbandoned, memory_order_relaxed) != RtlpMutantNotAbandoned;
+}
+
+/* Give up the userspace ownership, dropping the migrated NTSYNC hold if a
+ * waiter made one. Abandon kills the NTSYNC mutex instead of unlocking it.
+ */
+static void RtlpReleaseUserMutant(PRTLP_MUTANT Mutant, ULONG OwnerId, bool Abandon)
+{
+        ULONGLONG State = atomic_load_explicit(&Mutant->State, memory_order_relaxed);
+        for (;;) {
+                if (State & RTLP_MUTANT_MIGRATING) {
+                        sched_yield();
+                        State = atomic_load_explicit(&Mutant->State, memory_order_relaxed);
+                        continue;
+                }
+
+                if (State & RTLP_MUTANT_MIGRATED) {
+                        if (Abandon) {
+                                atomic_store_explicit(&Mutant->Abandoned, RtlpMutantAbandonedKernel, memory_order_relaxed);
+                                ioctl(Mutant->Object, NTSYNC_IOC_MUTEX_KILL, &OwnerId);
+                        } else {
+                                struct ntsync_mutex_args args = {.owner = OwnerId, .count = 0};
+                                ioctl(Mutant->Object, NTSYNC_IOC_MUTEX_UNLOCK, &args);
+                        }
+                        atomic_fetch_and_explicit(&Mutant->State, ~(RTLP_MUTANT_OWNER_MASK | RTLP_MUTANT_MIGRATED), memory_order_release);
+                        return;
+                }
+
+                if (Abandon) {
+                        atomic_store_explicit(&Mutant->Abandoned, RtlpMutantAbandonedUser, memory_order_relaxed);
+                }
+                if (atomic_compare_exchange_weak_explicit(&Mutant->State, &State, State & ~RTLP_MUTANT_OWNER_MASK,
+                                                          memory_order_release, memory_order_relaxed)) {
+                        return;
+                }
+        }
+}
+
+static void RtlpAbandonOwnedMutants(void)
+{
+        ULONG OwnerId = RtlpGetOwnerId();
+        while (RtlpOwnedMutants != NULL) {
+                PRTLP_MUTANT Mutant = RtlpOwnedMutants;
+                LONG KernelCount = Mutant->KernelCount;
+                bool UserOwned = Mutant->UserOwned;
+
+                RtlpUnlinkOwnedMutant(Mutant);
+                Mutant->Recursion = 0;
+                Mutant->KernelCount = 0;
+                Mutant->UserOwned = false;
+                atomic_store_explicit(&Mutant->Owner, 0, memory_order_relaxed);
+
+                if (UserOwned) {
+                        /* The migrated hold is killed along with any
+                         * recursive NTSYNC acquisition. */
+                        RtlpReleaseUserMutant(Mutant, OwnerId, true);
+                } else {
+                        atomic_store_explicit(&Mutant->Abandoned, RtlpMutantAbandonedKernel, memory_order_relaxed);
+                        ioctl(Mutant->Object, NTSYNC_IOC_MUTEX_KILL, &OwnerId);
+                }
+                atomic_fetch_sub_explicit(&Mutant->State, KernelCount * RTLP_MUTANT_KERNEL_USER, memory_order_release);
+                RtlpDereferenceMutant(Mutant);
+        }
+}
+
+static PRTLP_DISPATCHER RtlpLookupDispatcher(int Object, RTLP_OBJECT_TYPE Type)
+{
+        PRTLP_OBJECT Record = RtlpLookupObject(Object);
+        if (Record == NULL || Record->Type != Type) {
+                return NULL;
+        }
+
+        return (PRTLP_DISPATCHER)Record;
+}
+
+/* Shared is false when the state has to live in the NTSYNC object */
+static PRTLP_DISPATCHER RtlpAllocateDispatcher(RTLP_OBJECT_TYPE Type, PRTLP_SHARED_SLOT Slot)
+{
+        PRTLP_DISPATCHER Dispatcher = calloc(1, sizeof(*Dispatcher));
+        if (Dispatcher == NULL) {
+                return NULL;
+        }
+
+        Dispatcher->Header.Type = Type;
+        pthread_mutex_init(&Dispatcher->Lock, NULL);
+        if (Slot != NULL) {
+                Dispatcher->Shared = true;
+                Dispatcher->Slot = *Slot;
+                Dispatcher->State = &Slot->Entry->State;
+        } else {
+                atomic_init(&Dispatcher->PrivateState, RTLP_DISPATCHER_WAITER);
+                Dispatcher->State = &Dispatcher->PrivateState;
+        }
+
+        return Dispatcher;
+}
+
+void RtlpFreeDispatcher(PRTLP_DISPATCHER Dispatcher)
+{
+        if (Dispatcher->Shared) {
+                RtlpReleaseSharedState(&Dispatcher->Slot);
+        }
+        pthread_mutex_destroy(&Dispatcher->Lock);
+        free(Dispatcher);
+}
+
+static bool RtlpTryWaitDispatcher(PRTLP_DISPATCHER Dispatcher)
+{
+        ULONGLONG State = atomic_load_explicit(Dispatcher->State, memory_order_relaxed);
+        do {
+                if (State >= RTLP_DISPATCHER_WAITER || (State & RTLP_DISPATCHER_VALUE_MASK) == 0) {
+                        return false;
+                }
+
+                if (Dispatcher->ManualReset) {
+                        atomic_thread_fence(memory_order_acquire);
+                        return true;
+                }
+        } while (!atomic_compare_exchange_weak_explicit(Dispatcher->State, &State, State - 1, memory_order_acquire, memory_order_relaxed));
+
+        return true;
+}
+
+/* Hand Value back to userspace, unless a waiter registered in the meantime */
+static bool RtlpReturnDispatcherState(PRTLP_DISPATCHER Dispatcher, ULONG Value)
+{
+        ULONGLONG State = atomic_load_explicit(Dispatcher->State, memory_order_relaxed);
+        do {
+                if (State >= RTLP_DISPATCHER_WAITER) {
+                        return false;
+                }
+        } while (!atomic_compare_exchange_weak_explicit(Dispatcher->State, &State,
+                                                        Dispatcher->Header.Type == RtlpEventObject ? State | Value : State + Value,
+                                                        memory_order_release, memory_order_relaxed));
+
+        return true;
+}
+
+static bool RtlpSignalDispatcherKernel(PRTLP_DISPATCHER Dispatcher, ULONG Value)
+{
+        int ret = Dispatcher->Header.Type == RtlpSemaphoreObject ? ioctl(Dispatcher->Object, NTSYNC_IOC_SEM_RELEASE, &Value)
+                                                                 : ioctl(Dispatcher->Object, NTSYNC_IOC_EVENT_SET, &Value);
         if (ret == -1) {
-                return RtlpGetNtStatusFromUnixErrno();
+                return false;
         }
 
-        if (PreviousCount != NULL) {
-                *PreviousCount = ReleaseCount;
+        atomic_fetch_or_explicit(Dispatcher->State, RTLP_DISPATCHER_KERNEL_STATE, memory_order_release);
+        return true;
+}
+
+static bool RtlpTryWaitKernel(int Object)
+{
+        struct ntsync_wait_args args = {.timeout = 0,
+                                        .objs = (uintptr_t)&Object,
+                                        .count = 1,
+                                        .flags = NTSYNC_WAIT_REALTIME,
+                                        .owner = RtlpGetOwnerId(),
+                                        .alert = 0,
+                                        .pad = 0};
+
+        return ioctl(ntsync, NTSYNC_IOC_WAIT_ANY, &args) == 0;
+}
+
+/* Move what the NTSYNC object still holds back to the state word, one unit
+ * at a time as NTSYNC can only take a semaphore unit by waiting on it. */
+static void RtlpDrainKernelState(PRTLP_DISPATCHER Dispatcher)
+{
+        for (;;) {
+                if (Dispatcher->ManualReset) {
+                        __u32 Signaled = 0;
+                        if (ioctl(Dispatcher->Object, NTSYNC_IOC_EVENT_RESET, &Signaled) == -1 || !Signaled) {
+                                return;
+                        }
+                } else if (!RtlpTryWaitKernel(Dispatcher->Object)) {
+                        return;
+                }
+
+                if (!RtlpReturnDispatcherState(Dispatcher, 1)) {
+                        /* A unit NTSYNC won't take back stays in userspace
+                         * rather than getting lost, the waiters find it
+                         * once they leave the kernel */
+                        if (!RtlpSignalDispatcherKernel(Dispatcher, 1)) {
+                                atomic_fetch_add_explicit(Dispatcher->State, 1, memory_order_release);
+                        }
+                        return;
+                }
+
+                if (Dispatcher->Header.Type == RtlpEventObject) {
+                        return;
+                }
         }
+}
 
-        return STATUS_SUCCESS;
+/* One thread drains at a time, and again if the NTSYNC object got some of
+ * the state back in the meantime. Until it is done the count is split
+ * between both, a release has to wait for it to check the limit. A release
+ * on its way to NTSYNC drains after itself instead. */
+static void RtlpDrainDispatcher(PRTLP_DISPATCHER Dispatcher)
+{
+        ULONGLONG State = atomic_load_explicit(Dispatcher->State, memory_order_relaxed);
+        for (;;) {
+                do {
+                        if (State >= RTLP_DISPATCHER_WAITER || !(State & RTLP_DISPATCHER_KERNEL_STATE) || (State & RTLP_DISPATCHER_MOVING)) {
+                                return;
+                        }
+                } while (!atomic_compare_exchange_weak_explicit(Dispatcher->State, &State,
+                                                                (State & ~RTLP_DISPATCHER_KERNEL_STATE) | RTLP_DISPATCHER_DRAINING,
+                                                                memory_order_acquire, memory_order_relaxed));
+
+                RtlpDrainKernelState(Dispatcher);
+                State = atomic_fetch_and_explicit(Dispatcher->State, ~RTLP_DISPATCHER_DRAINING, memory_order_release) & ~RTLP_DISPATCHER_DRAINING;
+        }
 }
 
-NTSTATUS NtQuerySemaphore(HANDLE SemaphoreHandle, SEMAPHORE_INFORMATION_CLASS SemaphoreInformationClass, PVOID SemaphoreInformation, ULONG SemaphoreInformationLength, PULONG ReturnLength)
+/* Register the caller as a waiter on the NTSYNC object. Once this returns
+ * the NTSYNC object has the whole state, so a kernel wait on it is correct.
+ * A waiter finding a userspace part is the only one registered, and stays
+ * so until it is done moving it.
+ */
+static NTSTATUS RtlpEnterDispatcherKernel(PRTLP_DISPATCHER Dispatcher)
 {
-        if (SemaphoreInformationClass != SemaphoreBasicInformation) {
-                errno = EINVAL;
-                return STATUS_INVALID_PARAMETER_2;
+        ULONGLONG State = atomic_load_explicit(Dispatcher->State, memory_order_relaxed);
+        for (;;) {
+                if (State & RTLP_DISPATCHER_TRANSFERRING) {
+                        sched_yield();
+                        State = atomic_load_explicit(Dispatcher->State, memory_order_relaxed);
+                        continue;
+                }
+
+                ULONGLONG NewState = ((State & ~RTLP_DISPATCHER_VALUE_MASK) | RTLP_DISPATCHER_KERNEL_STATE) + RTLP_DISPATCHER_WAITER;
+                if (State & RTLP_DISPATCHER_VALUE_MASK) {
+                        NewState |= RTLP_DISPATCHER_TRANSFERRING;
+                }
+                if (atomic_compare_exchange_weak_explicit(Dispatcher->State, &State, NewState, memory_order_acq_rel, memory_order_relaxed)) {
+                        break;
+                }
         }
 
-        if (SemaphoreInformation == NULL) {
-                errno = EINVAL;
-                return STATUS_INVALID_PARAMETER_3;
+        __u32 Value = State & RTLP_DISPATCHER_VALUE_MASK;
+        if (Value == 0) {
+                return STATUS_SUCCESS;
         }
 
-        if (SemaphoreInformationLength != sizeof(SEMAPHORE_BASIC_INFORMATION)) {
-                errno = EINVAL;
-                return STATUS_INVALID_PARAMETER_4;
-        } 
+        int ret = Dispatcher->Header.Type == RtlpSemaphoreObject ? ioctl(Dispatcher->Object, NTSYNC_IOC_SEM_RELEASE, &Value)
+                                                                 : ioctl(Dispatcher->Object, NTSYNC_IOC_EVENT_SET, &Value);
+        if (ret == -1) {
+                /* The value never reached NTSYNC. Nobody else registered
+                 * meanwhile, so it goes back with the registration. */
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                atomic_fetch_add_explicit(Dispatcher->State, (ULONGLONG)Value - RTLP_DISPATCHER_WAITER - RTLP_DISPATCHER_TRANSFERRING,
+                                          memory_order_release);
+                return Status;
+        }
+
+        atomic_fetch_and_explicit(Dispatcher->State, ~RTLP_DISPATCHER_TRANSFERRING, memory_order_release);
+        return STATUS_SUCCESS;
+}
+
+static void RtlpLeaveDispatcherKernel(PRTLP_DISPATCHER Dispatcher)
+{
+        ULONGLONG State = atomic_fetch_sub_explicit(Dispatcher->State, RTLP_DISPATCHER_WAITER, memory_order_acq_rel) - RTLP_DISPATCHER_WAITER;
+        if (State < RTLP_DISPATCHER_WAITER) {
+                RtlpDrainDispatcher(Dispatcher);
+        }
+}
+
+/* Wait through NTSYNC. Records holds the record of every object in
+ * Objects, NULL for objects without one, or is NULL itself if there is none.
+ */
+static NTSTATUS RtlpWaitForKernelObjects(ULONG Count, const int *Objects, PRTLP_OBJECT *Records, unsigned long Opcode, PLARGE_INTEGER TimeOut)
+{
+        struct ntsync_wait_args args = {.objs = (uintptr_t)Objects,
+                                        .count = Count,
+                                        .flags = NTSYNC_WAIT_REALTIME,
+                                        .owner = RtlpGetOwnerId(),
+                                        .alert = 0,
+                                        .pad = 0};
+
+        NTSTATUS Status = RtlpFormatTimeOut(TimeOut, &args.timeout);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        ULONG Entered = 0;
+        if (Records != NULL) {
+                for (; Entered < Count; Entered++) {
+                        if (Records[Entered] == NULL) {
+                                continue;
+                        }
+
+                        switch (Records[Entered]->Type) {
+                                case RtlpMutantObject:
+                                        Status = RtlpEnterMutantKernel((PRTLP_MUTANT)Records[Entered]);
+                                        break;
+                                case RtlpEventObject:
+                                case RtlpSemaphoreObject:
+                                        Status = RtlpEnterDispatcherKernel((PRTLP_DISPATCHER)Records[Entered]);
+                                        break;
+                                default:
+                                        break;
+                        }
+                        if (Status != STATUS_SUCCESS) {
+                                break;
+                        }
+                }
+        }
+
+        if (Status == STATUS_SUCCESS) {
+                int ret = ioctl(ntsync, Opcode, &args);
+                if (ret == -1 && errno == EOWNERDEAD) {
+                        Status = STATUS_ABANDONED_WAIT_0 + args.index;
+                } else if (ret == -1) {
+                        Status = RtlpGetNtStatusFromUnixErrno();
+                } else {
+                        Status = args.index;
+                }
+        }
+
+        bool Satisfied = Status <= STATUS_WAIT_63 || (Status >= STATUS_ABANDONED_WAIT_0 && Status <= STATUS_ABANDONED_WAIT_63);
+        for (ULONG i = 0; i < Entered; i++) {
+                if (Records[i] == NULL) {
+                        continue;
+                }
+
+                if (Records[i]->Type == RtlpEventObject || Records[i]->Type == RtlpSemaphoreObject) {
+                        RtlpLeaveDispatcherKernel((PRTLP_DISPATCHER)Records[i]);
+                        continue;
+                }
+
+                if (Records[i]->Type != RtlpMutantObject) {
+                        continue;
+                }
+
+                PRTLP_MUTANT Mutant = (PRTLP_MUTANT)Records[i];
+                if (Satisfied && (Opcode == NTSYNC_IOC_WAIT_ALL || args.index == i)) {
+                        if (RtlpAcquiredMutantKernel(Mutant, args.owner) && Status <= STATUS_WAIT_63) {
+                                Status = STATUS_ABANDONED_WAIT_0 + (Opcode == NTSYNC_IOC_WAIT_ALL ? i : args.index);
+                        }
+                } else {
+                        atomic_fetch_sub_explicit(&Mutant->State, RTLP_MUTANT_KERNEL_USER, memory_order_release);
+                }
+        }
+
+        return Status;
+}
+
+/* The handle a traced create or open returned, -1 if it failed */
+static int RtlpGetTracedObject(PHANDLE Handle, NTSTATUS Status)
+{
+        if (Handle == NULL || (Status != STATUS_SUCCESS && Status != STATUS_OBJECT_NAME_EXISTS)) {
+                return -1;
+        }
+
+        return Handle->Object;
+}
+
+static NTSTATUS RtlpCreateMutant(PHANDLE MutantHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, BOOLEAN InitialOwner)
+{
+        if (MutantHandle == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (ObjectAttributes != NULL) {
+                errno = ENOSYS;
+                return STATUS_NOT_IMPLEMENTED;
+        }
+
+        PRTLP_MUTANT Mutant = calloc(1, sizeof(*Mutant));
+        if (Mutant == NULL) {
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+
+        /* Always created unowned, an initial owner holds it in userspace */
+        struct ntsync_mutex_args args = {.owner = 0, .count = 0};
+        int ret = ioctl(ntsync, NTSYNC_IOC_CREATE_MUTEX, &args);
+        if (ret == -1) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                free(Mutant);
+                return Status;
+        }
+
+        Mutant->Header.Type = RtlpMutantObject;
+        Mutant->Object = ret;
+        atomic_init(&Mutant->References, 1);
+        if (InitialOwner) {
+                ULONG OwnerId = RtlpGetOwnerId();
+                atomic_init(&Mutant->State, OwnerId);
+                atomic_init(&Mutant->Owner, OwnerId);
+                Mutant->Recursion = 1;
+                Mutant->UserOwned = true;
+                RtlpLinkOwnedMutant(Mutant);
+        }
+
+        if (!RtlpInsertObject(ret, &Mutant->Header)) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                if (InitialOwner) {
+                        RtlpUnlinkOwnedMutant(Mutant);
+                }
+                close(ret);
+                free(Mutant);
+                return Status;
+        }
+
+        MutantHandle->DesiredAccess = DesiredAccess;
+        MutantHandle->Object = ret;
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS NtCreateMutant(PHANDLE MutantHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, BOOLEAN InitialOwner)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpCreateMutant(MutantHandle, DesiredAccess, ObjectAttributes, InitialOwner);
+        if (Status == STATUS_SUCCESS && InitialOwner) {
+                RtlpRegistryAcquire(MutantHandle->Object);
+        }
+        RtlpTraceCall(Start, RtlpTraceCreateMutant, RtlpGetTracedObject(MutantHandle, Status), InitialOwner, 0, Status);
+        return Status;
+}
+
+static NTSTATUS RtlpReleaseMutant(HANDLE MutantHandle, PLONG PreviousCount)
+{
+        PRTLP_MUTANT Mutant = RtlpLookupMutant(MutantHandle.Object);
+        if (Mutant == NULL) {
+                errno = EINVAL;
+                return STATUS_OBJECT_TYPE_MISMATCH;
+        }
+
+        ULONG OwnerId = RtlpGetOwnerId();
+        if (atomic_load_explicit(&Mutant->Owner, memory_order_relaxed) != OwnerId) {
+                errno = EPERM;
+                return STATUS_MUTANT_NOT_OWNED;
+        }
+
+        if (PreviousCount != NULL) {
+                *PreviousCount = 1 - Mutant->Recursion;
+        }
+
+        /* Everything the next owner writes has to be settled before the
+         * NTSYNC mutex or the userspace owner is released. */
+        bool UserOwned = Mutant->UserOwned;
+        LONG Recursion = --Mutant->Recursion;
+        bool Unlock = Mutant->KernelCount > Recursion;
+        if (Unlock) {
+                Mutant->KernelCount--;
+        }
+        if (Recursion == 0) {
+                RtlpUnlinkOwnedMutant(Mutant);
+                Mutant->UserOwned = false;
+                atomic_store_explicit(&Mutant->Owner, 0, memory_order_relaxed);
+        }
+
+        NTSTATUS Status = STATUS_SUCCESS;
+        if (Unlock) {
+                struct ntsync_mutex_args args = {.owner = OwnerId, .count = 0};
+                if (ioctl(Mutant->Object, NTSYNC_IOC_MUTEX_UNLOCK, &args) == -1) {
+                        Status = RtlpGetNtStatusFromUnixErrno();
+                }
+                atomic_fetch_sub_explicit(&Mutant->State, RTLP_MUTANT_KERNEL_USER, memory_order_release);
+        }
+
+        if (Recursion == 0 && UserOwned) {
+                RtlpReleaseUserMutant(Mutant, OwnerId, false);
+        }
+        if (Recursion == 0) {
+                RtlpDereferenceMutant(Mutant);
+        }
+
+        return Status;
+}
+
+NTSTATUS NtReleaseMutant(HANDLE MutantHandle, PLONG PreviousCount)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        /* 1 is never a previous count, it stays if nothing was released */
+        LONG Previous = 1;
+        NTSTATUS Status = RtlpReleaseMutant(MutantHandle, &Previous);
+        if (Previous == 0) {
+                RtlpRegistryRelease(MutantHandle.Object);
+        }
+        if (Previous != 1 && PreviousCount != NULL) {
+                *PreviousCount = Previous;
+        }
+        RtlpTraceCall(Start, RtlpTraceReleaseMutant, MutantHandle.Object, 0, 0, Status);
+        return Status;
+}
+
+/* The recursion count is private to the owner, other threads only learn
+ * that the mutant is taken. */
+static LONG RtlpQueryMutantState(PRTLP_MUTANT Mutant, bool *OwnedByCaller)
+{
+        ULONG Owner = atomic_load_explicit(&Mutant->Owner, memory_order_relaxed);
+        *OwnedByCaller = Owner != 0 && Owner == RtlpGetOwnerId();
+        return *OwnedByCaller ? 1 - Mutant->Recursion : Owner == 0;
+}
+
+NTSTATUS NtQueryMutant(HANDLE MutantHandle, MUTANT_INFORMATION_CLASS MutantInformationClass, PVOID MutantInformation, ULONG MutantInformationLength, PULONG ReturnLength)
+{
+        if (MutantInformationClass != MutantBasicInformation) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if (MutantInformation == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        if (MutantInformationLength != sizeof(MUTANT_BASIC_INFORMATION)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_4;
+        }
+
+        if (!(MutantHandle.DesiredAccess & MUTANT_QUERY_STATE)) {
+                errno = EPERM;
+                return STATUS_ACCESS_DENIED;
+        }
+
+        PRTLP_MUTANT Mutant = RtlpLookupMutant(MutantHandle.Object);
+        if (Mutant == NULL) {
+                errno = EINVAL;
+                return STATUS_OBJECT_TYPE_MISMATCH;
+        }
+
+        bool OwnedByCaller;
+        ((MUTANT_BASIC_INFORMATION *)MutantInformation)->CurrentCount = RtlpQueryMutantState(Mutant, &OwnedByCaller);
+        ((MUTANT_BASIC_INFORMATION *)MutantInformation)->OwnedByCaller = OwnedByCaller;
+        ((MUTANT_BASIC_INFORMATION *)MutantInformation)->AbandonedState = atomic_load_explicit(&Mutant->Abandoned, memory_order_relaxed) != RtlpMutantNotAbandoned;
+
+        if (ReturnLength != NULL) {
+                *ReturnLength = sizeof(MUTANT_BASIC_INFORMATION);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/* Inserts the record for a new NTSYNC object, closing the object if that
+ * fails. */
+static NTSTATUS RtlpInsertDispatcher(PRTLP_DISPATCHER Dispatcher, int Object)
+{
+        Dispatcher->Object = Object;
+        if (!RtlpInsertObject(Object, &Dispatcher->Header)) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                close(Object);
+                RtlpFreeDispatcher(Dispatcher);
+                return Status;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/* Unnamed objects use the userspace backend when asked to, their handle
+ * value comes from an eventfd that is never signaled, like keyed events. */
+static bool RtlpIsUserDispatcher(POBJECT_ATTRIBUTES ObjectAttributes)
+{
+        if (ObjectAttributes != NULL && (ObjectAttributes->Attributes & OBJ_PROCESS_LOCAL)) {
+                return true;
+        }
+
+        return ntsync_backend == NTSYNC_BACKEND_USERSPACE && (ObjectAttributes == NULL || ObjectAttributes->ObjectName == NULL);
+}
+
+static NTSTATUS RtlpCreateUserDispatcher(PHANDLE Handle, ULONG DesiredAccess, RTLP_OBJECT_TYPE Type, ULONG Value, LONG MaximumCount, bool ManualReset)
+{
+        PRTLP_DISPATCHER Dispatcher = calloc(1, sizeof(*Dispatcher));
+        if (Dispatcher == NULL) {
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+        Dispatcher->Header.Type = Type;
+        Dispatcher->MaximumCount = MaximumCount;
+        Dispatcher->ManualReset = ManualReset;
+        RtlpInitializeUserDispatcher(Dispatcher, Value);
+
+        int ret = eventfd(0, EFD_CLOEXEC);
+        if (ret == -1) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                RtlpFreeDispatcher(Dispatcher);
+                return Status;
+        }
+
+        NTSTATUS Status = RtlpInsertDispatcher(Dispatcher, ret);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        Handle->DesiredAccess = DesiredAccess;
+        Handle->Object = ret;
+
+        return STATUS_SUCCESS;
+}
+
+static NTSTATUS RtlpCreateSemaphore(PHANDLE SemaphoreHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, LONG InitialCount, LONG MaximumCount)
+{
+        if (SemaphoreHandle == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (InitialCount < 0 || MaximumCount < 0 || InitialCount > MaximumCount) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        bool Named = ObjectAttributes != NULL && ObjectAttributes->ObjectName != NULL;
+        if (Named && (ObjectAttributes->Attributes & OBJ_PROCESS_LOCAL)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        if (RtlpIsUserDispatcher(ObjectAttributes)) {
+                return RtlpCreateUserDispatcher(SemaphoreHandle, DesiredAccess, RtlpSemaphoreObject, InitialCount, MaximumCount, false);
+        }
+
+        if (Named) {
+                NTSTATUS Status = RtlpOpenObjectName(ObjectAttributes, RtlpSemaphoreObject, DesiredAccess, true, SemaphoreHandle);
+                if (Status != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        return Status;
+                }
+        }
+
+        /* With a shared state the count starts in userspace */
+        RTLP_SHARED_SLOT Slot;
+        bool Shared = RtlpAllocateSharedState(&Slot);
+        PRTLP_DISPATCHER Semaphore = RtlpAllocateDispatcher(RtlpSemaphoreObject, Shared ? &Slot : NULL);
+        if (Semaphore == NULL) {
+                if (Shared) {
+                        RtlpReleaseSharedState(&Slot);
+                }
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+        Semaphore->MaximumCount = MaximumCount;
+        if (Shared) {
+                atomic_store_explicit(Semaphore->State, InitialCount, memory_order_relaxed);
+        }
+
+        struct ntsync_sem_args args = {.count = Shared ? 0 : InitialCount, .max = MaximumCount};
+        int ret = ioctl(ntsync, NTSYNC_IOC_CREATE_SEM, &args);
+        if (ret == -1) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                RtlpFreeDispatcher(Semaphore);
+                return Status;
+        }
+
+        NTSTATUS Status = RtlpInsertDispatcher(Semaphore, ret);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        SemaphoreHandle->DesiredAccess = DesiredAccess;
+        SemaphoreHandle->Object = ret;
+
+        if (Named) {
+                return RtlpInsertObjectName(ObjectAttributes, RtlpSemaphoreObject, SemaphoreHandle);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/* The handle only gets to the caller after this, so nobody reads the flag
+ * yet. A named object opened again without the attribute keeps its own
+ * record and isn't a lock through that handle. */
+static void RtlpSetRegistryLock(PHANDLE Handle, POBJECT_ATTRIBUTES ObjectAttributes, NTSTATUS Status)
+{
+        if ((Status != STATUS_SUCCESS && Status != STATUS_OBJECT_NAME_EXISTS) || ObjectAttributes == NULL ||
+            !(ObjectAttributes->Attributes & OBJ_REGISTRY_LOCK)) {
+                return;
+        }
+
+        PRTLP_OBJECT Record = RtlpLookupObject(Handle->Object);
+        if (Record != NULL && (Record->Type == RtlpEventObject || Record->Type == RtlpSemaphoreObject)) {
+                ((PRTLP_DISPATCHER)Record)->RegistryLock = true;
+        }
+}
+
+NTSTATUS NtCreateSemaphore(PHANDLE SemaphoreHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, LONG InitialCount, LONG MaximumCount)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpCreateSemaphore(SemaphoreHandle, DesiredAccess, ObjectAttributes, InitialCount, MaximumCount);
+        RtlpSetRegistryLock(SemaphoreHandle, ObjectAttributes, Status);
+        RtlpTraceCallEx(Start, RtlpTraceCreateSemaphore, RtlpGetTracedObject(SemaphoreHandle, Status), InitialCount, 0, 1, &MaximumCount, Status);
+        return Status;
+}
+
+static NTSTATUS RtlpOpenSemaphore(PHANDLE SemaphoreHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes)
+{
+        if (SemaphoreHandle == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (ObjectAttributes == NULL || ObjectAttributes->ObjectName == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        return RtlpOpenObjectName(ObjectAttributes, RtlpSemaphoreObject, DesiredAccess, false, SemaphoreHandle);
+}
+
+NTSTATUS NtOpenSemaphore(PHANDLE SemaphoreHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpOpenSemaphore(SemaphoreHandle, DesiredAccess, ObjectAttributes);
+        RtlpSetRegistryLock(SemaphoreHandle, ObjectAttributes, Status);
+        RtlpTraceCall(Start, RtlpTraceOpenSemaphore, RtlpGetTracedObject(SemaphoreHandle, Status), 0, 0, Status);
+        return Status;
+}
+
+static NTSTATUS RtlpReleaseSemaphore(HANDLE SemaphoreHandle, LONG ReleaseCount, PLONG PreviousCount)
+{
+        if (!(SemaphoreHandle.DesiredAccess & SEMAPHORE_MODIFY_STATE)) {
+                errno = EPERM;
+                return STATUS_ACCESS_DENIED;
+        }
+
+        PRTLP_DISPATCHER Semaphore = RtlpLookupDispatcher(SemaphoreHandle.Object, RtlpSemaphoreObject);
+        if (Semaphore != NULL && Semaphore->Userspace) {
+                return RtlpReleaseUserSemaphore(Semaphore, ReleaseCount, PreviousCount);
+        }
+
+        if (Semaphore != NULL) {
+                ULONGLONG State = atomic_load_explicit(Semaphore->State, memory_order_relaxed);
+                for (;;) {
+                        /* Units on their way between userspace and NTSYNC
+                         * count against the limit too, wherever this one
+                         * goes */
+                        if (State & RTLP_DISPATCHER_MOVING) {
+                                sched_yield();
+                                State = atomic_load_explicit(Semaphore->State, memory_order_relaxed);
+                                continue;
+                        }
+                        if (State >= RTLP_DISPATCHER_WAITER) {
+                                if (atomic_compare_exchange_weak_explicit(Semaphore->State, &State, State | RTLP_DISPATCHER_TRANSFERRING,
+                                                                          memory_order_acquire, memory_order_relaxed)) {
+                                        break;
+                                }
+                                continue;
+                        }
+                        /* Units still in NTSYNC count against the limit too,
+                         * bring them back first */
+                        if (State & RTLP_DISPATCHER_KERNEL_STATE) {
+                                RtlpDrainDispatcher(Semaphore);
+                                State = atomic_load_explicit(Semaphore->State, memory_order_relaxed);
+                                continue;
+                        }
+
+                        ULONG Count = State & RTLP_DISPATCHER_VALUE_MASK;
+                        if ((ULONG)ReleaseCount > (ULONG)Semaphore->MaximumCount - Count) {
+                                errno = EOVERFLOW;
+                                return STATUS_SEMAPHORE_LIMIT_EXCEEDED;
+                        }
+
+                        if (atomic_compare_exchange_weak_explicit(Semaphore->State, &State, State + ReleaseCount,
+                                                                  memory_order_release, memory_order_relaxed)) {
+                                if (PreviousCount != NULL) {
+                                        *PreviousCount = Count;
+                                }
+                                return STATUS_SUCCESS;
+                        }
+                }
+        }
+
+        /* Somebody is blocked, the count goes to NTSYNC which wakes them.
+         * Nothing else moves to NTSYNC until it got there, so its limit
+         * check sees the whole count. */
+        int ret = ioctl(SemaphoreHandle.Object, NTSYNC_IOC_SEM_RELEASE, &ReleaseCount);
+        NTSTATUS Status = ret == -1 ? RtlpGetNtStatusFromUnixErrno() : STATUS_SUCCESS;
+        if (Semaphore != NULL) {
+                if (ret != -1) {
+                        atomic_fetch_or_explicit(Semaphore->State, RTLP_DISPATCHER_KERNEL_STATE, memory_order_release);
+                }
+
+                /* The waiters may all have left meanwhile, their drain was
+                 * held back by the move */
+                ULONGLONG State = atomic_fetch_and_explicit(Semaphore->State, ~RTLP_DISPATCHER_TRANSFERRING, memory_order_release);
+                if ((State & ~RTLP_DISPATCHER_TRANSFERRING) < RTLP_DISPATCHER_WAITER) {
+                        RtlpDrainDispatcher(Semaphore);
+                }
+        }
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        if (PreviousCount != NULL) {
+                *PreviousCount = ReleaseCount;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS NtReleaseSemaphore(HANDLE SemaphoreHandle, LONG ReleaseCount, PLONG PreviousCount)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpReleaseSemaphore(SemaphoreHandle, ReleaseCount, PreviousCount);
+        if (Status == STATUS_SUCCESS) {
+                RtlpRegistryRelease(SemaphoreHandle.Object);
+        }
+        RtlpTraceCall(Start, RtlpTraceReleaseSemaphore, SemaphoreHandle.Object, ReleaseCount, 0, Status);
+        return Status;
+}
+
+/* Semaphore is the record of Object, NULL if it has none */
+static NTSTATUS RtlpQuerySemaphoreState(int Object, PRTLP_DISPATCHER Semaphore, struct ntsync_sem_args *args)
+{
+        if (Semaphore != NULL && Semaphore->Userspace) {
+                args->count = atomic_load_explicit(Semaphore->State, memory_order_relaxed);
+                args->max = Semaphore->MaximumCount;
+        } else if (ioctl(Object, NTSYNC_IOC_SEM_READ, args) == -1) {
+                return RtlpGetNtStatusFromUnixErrno();
+        } else if (Semaphore != NULL) {
+                args->count += atomic_load_explicit(Semaphore->State, memory_order_relaxed) & RTLP_DISPATCHER_VALUE_MASK;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS NtQuerySemaphore(HANDLE SemaphoreHandle, SEMAPHORE_INFORMATION_CLASS SemaphoreInformationClass, PVOID SemaphoreInformation, ULONG SemaphoreInformationLength, PULONG ReturnLength)
+{
+        if (SemaphoreInformationClass != SemaphoreBasicInformation) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if (SemaphoreInformation == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        if (SemaphoreInformationLength != sizeof(SEMAPHORE_BASIC_INFORMATION)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_4;
+        } 
+
+        if (!(SemaphoreHandle.DesiredAccess & SEMAPHORE_QUERY_STATE)) {
+                errno = EPERM;
+                return STATUS_ACCESS_DENIED;
+        }
+
+        struct ntsync_sem_args args;
+        PRTLP_DISPATCHER Semaphore = RtlpLookupDispatcher(SemaphoreHandle.Object, RtlpSemaphoreObject);
+        NTSTATUS Status = RtlpQuerySemaphoreState(SemaphoreHandle.Object, Semaphore, &args);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        ((SEMAPHORE_BASIC_INFORMATION *)SemaphoreInformation)->CurrentCount = args.count;
+        ((SEMAPHORE_BASIC_INFORMATION *)SemaphoreInformation)->MaximumCount = args.max;
+        
+        if (ReturnLength != NULL) {
+                *ReturnLength = sizeof(SEMAPHORE_BASIC_INFORMATION);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/* Take up to Count units from the state word at once, without NTSYNC */
+static LONG RtlpTryAcquireDispatcher(PRTLP_DISPATCHER Semaphore, LONG Count)
+{
+        ULONGLONG State = atomic_load_explicit(Semaphore->State, memory_order_relaxed);
+        LONG Taken;
+        do {
+                if (State >= RTLP_DISPATCHER_WAITER || (State & RTLP_DISPATCHER_VALUE_MASK) == 0) {
+                        return 0;
+                }
+                Taken = (State & RTLP_DISPATCHER_VALUE_MASK) < (ULONG)Count ? (LONG)(State & RTLP_DISPATCHER_VALUE_MASK) : Count;
+        } while (!atomic_compare_exchange_weak_explicit(Semaphore->State, &State, State - Taken, memory_order_acquire, memory_order_relaxed));
+
+        return Taken;
+}
+
+/* The rest of the time to Deadline as a relative NT timeout, false once it
+ * has passed. */
+bool RtlpGetRemainingTimeOut(__u64 Deadline, PLARGE_INTEGER TimeOut)
+{
+        struct timespec ts;
+        timespec_get(&ts, TIME_UTC);
+        __u64 Now = ts.tv_nsec + ts.tv_sec * NSEC_PER_SEC;
+        if (Now >= Deadline) {
+                return false;
+        }
+
+        TimeOut->QuadPart = -(LONGLONG)((Deadline - Now + 99) / 100);
+        return true;
+}
+
+/* How long a collector that can't be lined up with other processes holds
+ * its units while no new one arrives, doubled every time it gave up */
+#define RTLP_ACQUIRE_HOLD_TIME (10 * 1000 * 1000)
+#define RTLP_ACQUIRE_HOLD_TIME_MAX (1000 * 1000 * 1000)
+
+/* NTSYNC takes a single unit per satisfied wait, so the units are collected
+ * one wait at a time and whatever was collected goes back if the time runs
+ * out. One caller of the process collects at a time and keeps what it has
+ * while it blocks for the rest, so smaller requests can't starve it.
+ *
+ * With a shared state its acquire lock lines up the callers of every
+ * process and the collector publishes its units there. A caller that finds
+ * the lock owner dead gives those back, only a unit taken in the instant
+ * before the death is lost. Without one, a collector of another process may
+ * sit on the units this one waits for, so the units go back when none
+ * arrived for a while and collecting starts over.
+ */
+static NTSTATUS RtlpAcquireKernelSemaphore(HANDLE SemaphoreHandle, PRTLP_DISPATCHER Semaphore, LONG AcquireCount, PLARGE_INTEGER TimeOut)
+{
+        __u64 Deadline = UINT64_MAX;
+        NTSTATUS Status = RtlpFormatTimeOut(TimeOut, &Deadline);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        HANDLE Handle = {.Object = SemaphoreHandle.Object, .DesiredAccess = SEMAPHORE_MODIFY_STATE};
+        PRTLP_SHARED_STATE Shared = Semaphore != NULL && Semaphore->Shared ? Semaphore->Slot.Entry : NULL;
+        pthread_mutex_t *Lock = Shared != NULL ? &Shared->AcquireLock : Semaphore != NULL ? &Semaphore->Lock : &RtlpBareAcquireLock;
+
+        struct timespec ts = {.tv_sec = Deadline / NSEC_PER_SEC, .tv_nsec = Deadline % NSEC_PER_SEC};
+        int ret = Deadline == UINT64_MAX ? pthread_mutex_lock(Lock) : pthread_mutex_timedlock(Lock, &ts);
+        if (ret == EOWNERDEAD) {
+                LONG Collected = atomic_exchange_explicit(&Shared->Collected, 0, memory_order_relaxed);
+                if (Collected != 0) {
+                        RtlpReleaseSemaphore(Handle, Collected, NULL);
+                }
+                ret = pthread_mutex_consistent(Lock);
+        }
+        if (ret != 0) {
+                errno = ret;
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+
+        PRTLP_OBJECT Record = Semaphore != NULL ? &Semaphore->Header : NULL;
+        __u64 HoldTime = RTLP_ACQUIRE_HOLD_TIME;
+        bool Collect = true;
+        LONG Taken = 0;
+        for (;;) {
+                if (Semaphore != NULL && Collect) {
+                        Taken += RtlpTryAcquireDispatcher(Semaphore, AcquireCount - Taken);
+                }
+                while (Taken < AcquireCount && Collect && RtlpTryWaitKernel(SemaphoreHandle.Object)) {
+                        Taken++;
+                }
+                Collect = true;
+                if (Shared != NULL) {
+                        atomic_store_explicit(&Shared->Collected, Taken, memory_order_relaxed);
+                }
+                if (Taken == AcquireCount) {
+                        break;
+                }
+
+                struct timespec Now;
+                timespec_get(&Now, TIME_UTC);
+                __u64 WaitDeadline = Deadline;
+                if (Shared == NULL && Taken != 0) {
+                        /* Up to twice as long, so two collectors that
+                         * started together don't give up together */
+                        WaitDeadline = Now.tv_nsec + Now.tv_sec * NSEC_PER_SEC + HoldTime + Now.tv_nsec % HoldTime;
+                        WaitDeadline = WaitDeadline < Deadline ? WaitDeadline : Deadline;
+                }
+
+                LARGE_INTEGER Remaining;
+                PLARGE_INTEGER WaitTimeOut = NULL;
+                if (WaitDeadline != UINT64_MAX) {
+                        if (!RtlpGetRemainingTimeOut(WaitDeadline, &Remaining)) {
+                                errno = ETIMEDOUT;
+                                Status = STATUS_TIMEOUT;
+                                break;
+                        }
+                        WaitTimeOut = &Remaining;
+                }
+
+                Status = RtlpWaitForKernelObjects(1, &SemaphoreHandle.Object, Record != NULL ? &Record : NULL, NTSYNC_IOC_WAIT_ANY, WaitTimeOut);
+                if (Status == STATUS_TIMEOUT && WaitDeadline != Deadline) {
+                        /* Nothing came in while holding, let a collector of
+                         * another process have them. Blocking right away
+                         * moves them to NTSYNC, where that collector waits
+                         * ahead of this one, instead of taking them back. */
+                        RtlpReleaseSemaphore(Handle, Taken, NULL);
+                        Taken = 0;
+                        if (HoldTime < RTLP_ACQUIRE_HOLD_TIME_MAX) {
+                                HoldTime *= 2;
+                        }
+                        Collect = false;
+                        continue;
+                }
+                if (Status != STATUS_WAIT_0) {
+                        break;
+                }
+                Taken++;
+        }
+
+        if (Taken != AcquireCount && Taken != 0) {
+                int Error = errno;
+                RtlpReleaseSemaphore(Handle, Taken, NULL);
+                errno = Error;
+        }
+
+        /* The units belong to the caller before the lock is let go */
+        if (Shared != NULL) {
+                atomic_store_explicit(&Shared->Collected, 0, memory_order_relaxed);
+        }
+        pthread_mutex_unlock(Lock);
+        return Taken == AcquireCount ? STATUS_WAIT_0 : Status;
+}
+
+static NTSTATUS RtlpAcquireSemaphore(HANDLE SemaphoreHandle, LONG AcquireCount, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
+{
+        if (Alertable) {
+                errno = ENOSYS;
+                return STATUS_NOT_IMPLEMENTED;
+        }
+
+        if (!(SemaphoreHandle.DesiredAccess & SYNCHRONIZE)) {
+                errno = EPERM;
+                return STATUS_ACCESS_DENIED;
+        }
+
+        LONG MaximumCount;
+        PRTLP_DISPATCHER Semaphore = RtlpLookupDispatcher(SemaphoreHandle.Object, RtlpSemaphoreObject);
+        if (Semaphore != NULL) {
+                MaximumCount = Semaphore->MaximumCount;
+        } else {
+                struct ntsync_sem_args args;
+                if (RtlpLookupObject(SemaphoreHandle.Object) != NULL || ioctl(SemaphoreHandle.Object, NTSYNC_IOC_SEM_READ, &args) == -1) {
+                        errno = EINVAL;
+                        return STATUS_OBJECT_TYPE_MISMATCH;
+                }
+                MaximumCount = args.max;
+        }
+
+        if (AcquireCount <= 0 || AcquireCount > MaximumCount) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if (Semaphore != NULL && Semaphore->Userspace) {
+                return RtlpAcquireUserSemaphore(Semaphore, AcquireCount, TimeOut);
+        }
+
+        return RtlpAcquireKernelSemaphore(SemaphoreHandle, Semaphore, AcquireCount, TimeOut);
+}
+
+NTSTATUS NtAcquireSemaphoreEx(HANDLE SemaphoreHandle, LONG AcquireCount, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        bool Registered = RtlpRegistryBeginWait(1, &SemaphoreHandle, WaitAny);
+        NTSTATUS Status = RtlpAcquireSemaphore(SemaphoreHandle, AcquireCount, Alertable, TimeOut);
+        if (Registered) {
+                RtlpRegistryLeaveWait(1, &SemaphoreHandle, WaitAny, Status);
+        }
+        RtlpTraceCallEx(Start, RtlpTraceAcquireSemaphore, SemaphoreHandle.Object, RtlpGetTraceTimeOut(TimeOut), 0, 1, &AcquireCount, Status);
+        return Status;
+}
+
+/* Also makes the events the library needs for itself, those aren't traced */
+NTSTATUS RtlpCreateEvent(PHANDLE EventHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, EVENT_TYPE EventType, BOOLEAN InitialState)
+{
+        if (EventHandle == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        bool Named = ObjectAttributes != NULL && ObjectAttributes->ObjectName != NULL;
+        if (Named && (ObjectAttributes->Attributes & OBJ_PROCESS_LOCAL)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        if (RtlpIsUserDispatcher(ObjectAttributes)) {
+                return RtlpCreateUserDispatcher(EventHandle, DesiredAccess, RtlpEventObject, InitialState != 0, 1, EventType == NotificationEvent);
+        }
+
+        if (Named) {
+                NTSTATUS Status = RtlpOpenObjectName(ObjectAttributes, RtlpEventObject, DesiredAccess, true, EventHandle);
+                if (Status != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        return Status;
+                }
+        }
 
-        if (!(SemaphoreHandle.DesiredAccess & SEMAPHORE_QUERY_STATE)) {
-                errno = EPERM;
-                return STATUS_ACCESS_DENIED;
+        RTLP_SHARED_SLOT Slot;
+        bool Shared = RtlpAllocateSharedState(&Slot);
+        PRTLP_DISPATCHER Event = RtlpAllocateDispatcher(RtlpEventObject, Shared ? &Slot : NULL);
+        if (Event == NULL) {
+                if (Shared) {
+                        RtlpReleaseSharedState(&Slot);
+                }
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+        Event->ManualReset = EventType == NotificationEvent;
+        if (Shared) {
+                atomic_store_explicit(Event->State, InitialState != 0, memory_order_relaxed);
         }
 
-        struct ntsync_sem_args args;
-        int ret = ioctl(SemaphoreHandle.Object, NTSYNC_IOC_SEM_READ, &args);
+        struct ntsync_event_args args = {.manual = EventType == NotificationEvent, .signaled = Shared ? 0 : InitialState};
+        int ret = ioctl(ntsync, NTSYNC_IOC_CREATE_EVENT, &args);
         if (ret == -1) {
-                return RtlpGetNtStatusFromUnixErrno();
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                RtlpFreeDispatcher(Event);
+                return Status;
         }
 
-        ((SEMAPHORE_BASIC_INFORMATION *)SemaphoreInformation)->CurrentCount = args.count;
-        ((SEMAPHORE_BASIC_INFORMATION *)SemaphoreInformation)->MaximumCount = args.max;
-        
-        if (ReturnLength != NULL) {
-                *ReturnLength = sizeof(SEMAPHORE_BASIC_INFORMATION);
+        NTSTATUS Status = RtlpInsertDispatcher(Event, ret);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        EventHandle->DesiredAccess = DesiredAccess;
+        EventHandle->Object = ret;
+
+        if (Named) {
+                return RtlpInsertObjectName(ObjectAttributes, RtlpEventObject, EventHandle);
         }
 
         return STATUS_SUCCESS;
 }
 
 NTSTATUS NtCreateEvent(PHANDLE EventHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, EVENT_TYPE EventType, BOOLEAN InitialState)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpCreateEvent(EventHandle, DesiredAccess, ObjectAttributes, EventType, InitialState);
+        RtlpSetRegistryLock(EventHandle, ObjectAttributes, Status);
+        RtlpTraceCall(Start, RtlpTraceCreateEvent, RtlpGetTracedObject(EventHandle, Status), InitialState, EventType, Status);
+        return Status;
+}
+
+static NTSTATUS RtlpOpenEvent(PHANDLE EventHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes)
 {
         if (EventHandle == NULL) {
                 errno = EINVAL;
                 return STATUS_INVALID_PARAMETER_1;
         }
 
-        if (ObjectAttributes != NULL) {
-                return STATUS_NOT_IMPLEMENTED;
-        }
-
-        struct ntsync_event_args args = {.manual = EventType, .signaled = InitialState};
-        int ret = ioctl(ntsync, NTSYNC_IOC_CREATE_EVENT, &args);
-        if (ret == -1) {
-                return RtlpGetNtStatusFromUnixErrno();
+        if (ObjectAttributes == NULL || ObjectAttributes->ObjectName == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
         }
 
-        EventHandle->DesiredAccess = DesiredAccess;
-        EventHandle->Object = ret;
+        return RtlpOpenObjectName(ObjectAttributes, RtlpEventObject, DesiredAccess, false, EventHandle);
+}
 
-        return STATUS_SUCCESS;
+NTSTATUS NtOpenEvent(PHANDLE EventHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpOpenEvent(EventHandle, DesiredAccess, ObjectAttributes);
+        RtlpSetRegistryLock(EventHandle, ObjectAttributes, Status);
+        RtlpTraceCall(Start, RtlpTraceOpenEvent, RtlpGetTracedObject(EventHandle, Status), 0, 0, Status);
+        return Status;
 }
 
-NTSTATUS NtSetEvent(HANDLE EventHandle, PLONG PreviousState)
+/* Set, reset and pulse only touch the state word while nobody is blocked
+ * in NTSYNC. Reset and pulse still have to clear whatever NTSYNC may hold.
+ */
+static NTSTATUS RtlpModifyEventObject(int Object, PRTLP_DISPATCHER Event, unsigned long Opcode, PLONG PreviousState)
 {
-        if (!(EventHandle.DesiredAccess & EVENT_MODIFY_STATE)) {
-                return STATUS_ACCESS_DENIED;
+        if (Event != NULL && Event->Userspace) {
+                return RtlpModifyUserEvent(Event, Opcode, PreviousState);
+        }
+
+        LONG State = 0;
+        if (Event != NULL) {
+                ULONGLONG Word = atomic_load_explicit(Event->State, memory_order_relaxed);
+                for (;;) {
+                        /* A move could set the state again right after it
+                         * was cleared, in userspace or in NTSYNC */
+                        if (Opcode != NTSYNC_IOC_EVENT_SET && (Word & RTLP_DISPATCHER_MOVING)) {
+                                sched_yield();
+                                Word = atomic_load_explicit(Event->State, memory_order_relaxed);
+                                continue;
+                        }
+                        if (Word >= RTLP_DISPATCHER_WAITER) {
+                                break;
+                        }
+                        ULONGLONG NewWord = Opcode == NTSYNC_IOC_EVENT_SET ? Word | 1 : Word & ~1ULL;
+                        if (atomic_compare_exchange_weak_explicit(Event->State, &Word, NewWord, memory_order_release, memory_order_relaxed)) {
+                                if (Opcode == NTSYNC_IOC_EVENT_SET || !(Word & RTLP_DISPATCHER_KERNEL_STATE)) {
+                                        if (PreviousState != NULL) {
+                                                *PreviousState = Word & 1;
+                                        }
+                                        return STATUS_SUCCESS;
+                                }
+                                State = Word & 1;
+                                Opcode = NTSYNC_IOC_EVENT_RESET;
+                                break;
+                        }
+                }
         }
 
-        LONG State;
-        int ret = ioctl(EventHandle.Object, NTSYNC_IOC_EVENT_SET, &State);
+        LONG KernelState;
+        int ret = ioctl(Object, Opcode, &KernelState);
         if (ret == -1) {
                 return RtlpGetNtStatusFromUnixErrno();
         }
+        if (Event != NULL && Opcode == NTSYNC_IOC_EVENT_SET) {
+                atomic_fetch_or_explicit(Event->State, RTLP_DISPATCHER_KERNEL_STATE, memory_order_release);
+        }
         
         if (PreviousState != NULL) {
-                *PreviousState = State;
+                *PreviousState = State | KernelState;
         }
 
         return STATUS_SUCCESS;
 }
 
-NTSTATUS NtResetEvent(HANDLE EventHandle, PLONG PreviousState)
+static NTSTATUS RtlpModifyEvent(HANDLE EventHandle, unsigned long Opcode, PLONG PreviousState)
 {
         if (!(EventHandle.DesiredAccess & EVENT_MODIFY_STATE)) {
                 return STATUS_ACCESS_DENIED;
         }
 
-        LONG State;
-        int ret = ioctl(EventHandle.Object, NTSYNC_IOC_EVENT_RESET, &State);
-        if (ret == -1) {
-                return RtlpGetNtStatusFromUnixErrno();
-        }
-        
-        if (PreviousState != NULL) {
-                *PreviousState = State;
+        return RtlpModifyEventObject(EventHandle.Object, RtlpLookupDispatcher(EventHandle.Object, RtlpEventObject), Opcode, PreviousState);
+}
+
+/* For events without a handle of their own, like the thread events */
+NTSTATUS RtlpSetEventDispatcher(PRTLP_DISPATCHER Event)
+{
+        return RtlpModifyEventObject(Event->Object, Event, NTSYNC_IOC_EVENT_SET, NULL);
+}
+
+NTSTATUS RtlpResetEventDispatcher(PRTLP_DISPATCHER Event)
+{
+        return RtlpModifyEventObject(Event->Object, Event, NTSYNC_IOC_EVENT_RESET, NULL);
+}
+
+NTSTATUS NtSetEvent(HANDLE EventHandle, PLONG PreviousState)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpModifyEvent(EventHandle, NTSYNC_IOC_EVENT_SET, PreviousState);
+        if (Status == STATUS_SUCCESS) {
+                RtlpRegistryRelease(EventHandle.Object);
         }
+        RtlpTraceCall(Start, RtlpTraceSetEvent, EventHandle.Object, 0, 0, Status);
+        return Status;
+}
 
-        return STATUS_SUCCESS;
+NTSTATUS NtResetEvent(HANDLE EventHandle, PLONG PreviousState)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpModifyEvent(EventHandle, NTSYNC_IOC_EVENT_RESET, PreviousState);
+        RtlpTraceCall(Start, RtlpTraceResetEvent, EventHandle.Object, 0, 0, Status);
+        return Status;
 }
 
 NTSTATUS NtPulseEvent(HANDLE EventHandle, PLONG PreviousState)
 {
-        if (!(EventHandle.DesiredAccess & EVENT_MODIFY_STATE)) {
-                return STATUS_ACCESS_DENIED;
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpModifyEvent(EventHandle, NTSYNC_IOC_EVENT_PULSE, PreviousState);
+        if (Status == STATUS_SUCCESS) {
+                RtlpRegistryRelease(EventHandle.Object);
         }
+        RtlpTraceCall(Start, RtlpTracePulseEvent, EventHandle.Object, 0, 0, Status);
+        return Status;
+}
 
-        LONG State;
-        int ret = ioctl(EventHandle.Object, NTSYNC_IOC_EVENT_PULSE, &State);
-        if (ret == -1) {
+/* Event is the record of Object, NULL if it has none */
+static NTSTATUS RtlpQueryEventState(int Object, PRTLP_DISPATCHER Event, struct ntsync_event_args *args)
+{
+        if (Event != NULL && Event->Userspace) {
+                args->signaled = atomic_load_explicit(Event->State, memory_order_relaxed);
+                args->manual = Event->ManualReset;
+        } else if (ioctl(Object, NTSYNC_IOC_EVENT_READ, args) == -1) {
                 return RtlpGetNtStatusFromUnixErrno();
-        }
-        
-        if (PreviousState != NULL) {
-                *PreviousState = State;
+        } else if (Event != NULL) {
+                args->signaled |= atomic_load_explicit(Event->State, memory_order_relaxed) & 1;
         }
 
         return STATUS_SUCCESS;
@@ -234,9 +1821,10 @@ NTSTATUS NtQueryEvent(HANDLE EventHandle, EVENT_INFORMATION_CLASS EventInformati
         }
 
         struct ntsync_event_args args;
-        int ret = ioctl(EventHandle.Object, NTSYNC_IOC_EVENT_READ, &args);
-        if (ret == -1) {
-                return RtlpGetNtStatusFromUnixErrno();
+        PRTLP_DISPATCHER Event = RtlpLookupDispatcher(EventHandle.Object, RtlpEventObject);
+        NTSTATUS Status = RtlpQueryEventState(EventHandle.Object, Event, &args);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
         }
 
         ((EVENT_BASIC_INFORMATION *)EventInformation)->EventState = args.signaled;
@@ -249,7 +1837,143 @@ NTSTATUS NtQueryEvent(HANDLE EventHandle, EVENT_INFORMATION_CLASS EventInformati
         return STATUS_SUCCESS;
 }
 
-NTSTATUS NtWaitForSingleObject(HANDLE Handle, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
+/* An NTSYNC object without a record, one that was opened or received
+ * some other way. Only events and semaphores can be read that way. */
+static NTSTATUS RtlpQueryKernelObjectState(HANDLE Handle, UCHAR *Type, LONG *State, LONG *MaximumCount)
+{
+        struct ntsync_event_args EventArgs;
+        struct ntsync_sem_args SemaphoreArgs;
+        if (ioctl(Handle.Object, NTSYNC_IOC_EVENT_READ, &EventArgs) == 0) {
+                if (!(Handle.DesiredAccess & EVENT_QUERY_STATE)) {
+                        return STATUS_ACCESS_DENIED;
+                }
+
+                *Type = EventArgs.manual ? RtlObjectStateNotificationEvent : RtlObjectStateSynchronizationEvent;
+                *State = EventArgs.signaled;
+                *MaximumCount = 1;
+                return STATUS_SUCCESS;
+        }
+
+        if (ioctl(Handle.Object, NTSYNC_IOC_SEM_READ, &SemaphoreArgs) == 0) {
+                if (!(Handle.DesiredAccess & SEMAPHORE_QUERY_STATE)) {
+                        return STATUS_ACCESS_DENIED;
+                }
+
+                *Type = RtlObjectStateSemaphore;
+                *State = SemaphoreArgs.count;
+                *MaximumCount = SemaphoreArgs.max;
+                return STATUS_SUCCESS;
+        }
+
+        return errno == EBADF ? STATUS_INVALID_HANDLE : STATUS_OBJECT_TYPE_MISMATCH;
+}
+
+/* One entry of RtlQueryObjectStates, the record is looked up once and
+ * decides the kind of query. */
+static NTSTATUS RtlpQueryObjectState(HANDLE Handle, UCHAR *Type, LONG *State, LONG *MaximumCount)
+{
+        PRTLP_OBJECT Record = RtlpLookupObject(Handle.Object);
+        RTLP_OBJECT_TYPE RecordType = Record != NULL ? Record->Type : 0;
+        struct ntsync_event_args EventArgs;
+        struct ntsync_sem_args SemaphoreArgs;
+        PRTLP_BROADCAST_GENERATION Generation;
+        NTSTATUS Status;
+        bool OwnedByCaller;
+
+        *Type = RtlObjectStateInvalid;
+        *State = 0;
+        *MaximumCount = 0;
+        switch (RecordType) {
+                case RtlpEventObject:
+                case RtlpThreadObject:
+                        if (!(Handle.DesiredAccess & (RecordType == RtlpEventObject ? EVENT_QUERY_STATE
+                                                                                    : THREAD_QUERY_INFORMATION | THREAD_QUERY_LIMITED_INFORMATION))) {
+                                return STATUS_ACCESS_DENIED;
+                        }
+
+                        PRTLP_DISPATCHER Event = RtlpGetDispatcher(Record);
+                        Status = RtlpQueryEventState(Event->Object, Event, &EventArgs);
+                        if (Status != STATUS_SUCCESS) {
+                                return Status;
+                        }
+                        *Type = RecordType == RtlpThreadObject ? RtlObjectStateThread
+                                : EventArgs.manual             ? RtlObjectStateNotificationEvent
+                                                               : RtlObjectStateSynchronizationEvent;
+                        *State = EventArgs.signaled;
+                        *MaximumCount = 1;
+                        return STATUS_SUCCESS;
+                case RtlpSemaphoreObject:
+                        if (!(Handle.DesiredAccess & SEMAPHORE_QUERY_STATE)) {
+                                return STATUS_ACCESS_DENIED;
+                        }
+
+                        Status = RtlpQuerySemaphoreState(Handle.Object, (PRTLP_DISPATCHER)Record, &SemaphoreArgs);
+                        if (Status != STATUS_SUCCESS) {
+                                return Status;
+                        }
+                        *Type = RtlObjectStateSemaphore;
+                        *State = SemaphoreArgs.count;
+                        *MaximumCount = SemaphoreArgs.max;
+                        return STATUS_SUCCESS;
+                case RtlpMutantObject:
+                        if (!(Handle.DesiredAccess & MUTANT_QUERY_STATE)) {
+                                return STATUS_ACCESS_DENIED;
+                        }
+
+                        *Type = RtlObjectStateMutant;
+                        *State = RtlpQueryMutantState((PRTLP_MUTANT)Record, &OwnedByCaller);
+                        *MaximumCount = 1;
+                        return STATUS_SUCCESS;
+                case RtlpBroadcastObject:
+                        if (!(Handle.DesiredAccess & EVENT_QUERY_STATE)) {
+                                return STATUS_ACCESS_DENIED;
+                        }
+
+                        /* A broadcast is seen through its current generation,
+                         * like a wait on it */
+                        Generation = RtlpReferenceBroadcast(Record);
+                        Status = RtlpQueryEventState(Generation->Event->Object, Generation->Event, &EventArgs);
+                        RtlpDereferenceBroadcast(Generation);
+                        if (Status != STATUS_SUCCESS) {
+                                return Status;
+                        }
+                        *Type = RtlObjectStateNotificationEvent;
+                        *State = EventArgs.signaled;
+                        *MaximumCount = 1;
+                        return STATUS_SUCCESS;
+                case RtlpKeyedEventObject:
+                        /* Has no state of its own, every wait is paired with
+                         * a release */
+                        *Type = RtlObjectStateKeyedEvent;
+                        *MaximumCount = 1;
+                        return STATUS_SUCCESS;
+                default:
+                        return RtlpQueryKernelObjectState(Handle, Type, State, MaximumCount);
+        }
+}
+
+NTSTATUS RtlQueryObjectStates(ULONG Count, const HANDLE *Handles, PRTL_OBJECT_STATES States)
+{
+        if (Handles == NULL && Count != 0) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if (States == NULL || States->Type == NULL || States->State == NULL || States->MaximumCount == NULL || States->Status == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        for (ULONG i = 0; i < Count; i++) {
+                States->Status[i] = RtlpQueryObjectState(Handles[i], &States->Type[i], &States->State[i], &States->MaximumCount[i]);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+static NTSTATUS RtlpWaitForMultipleObjects(ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType, BOOLEAN Alertable, PLARGE_INTEGER TimeOut);
+
+static NTSTATUS RtlpWaitForSingleObject(HANDLE Handle, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
 {
         if (Alertable) {
                 return STATUS_NOT_IMPLEMENTED;
@@ -260,32 +1984,43 @@ NTSTATUS NtWaitForSingleObject(HANDLE Handle, BOOLEAN Alertable, PLARGE_INTEGER
                 return STATUS_ACCESS_DENIED;
         }
 
-        struct ntsync_wait_args args = {.objs = (uintptr_t)&Handle.Object,
-                                        .count = 1,
-                                        .flags = NTSYNC_WAIT_REALTIME,
-                                        .owner = 0,
-                                        .alert = 0,
-                                        .pad = 0};
+        PRTLP_OBJECT Record = RtlpLookupObject(Handle.Object);
+        if (Record != NULL && Record->Type == RtlpBroadcastObject) {
+                return RtlpWaitForMultipleObjects(1, &Handle, WaitAny, Alertable, TimeOut);
+        }
 
-        if (TimeOut == NULL) {
-                args.timeout = UINT64_MAX;
-        } else {
-                struct timespec ts;
-                if (timespec_get(&ts, TIME_UTC) != TIME_UTC) {
-                        return RtlpGetNtStatusFromUnixErrno();
-                }
-                args.timeout = -(TimeOut->QuadPart) * 100 + ts.tv_nsec + ts.tv_sec * NSEC_PER_SEC;
+        PRTLP_DISPATCHER Dispatcher = RtlpGetDispatcher(Record);
+        if (Dispatcher != NULL) {
+                Record = &Dispatcher->Header;
         }
-        
-        int ret = ioctl(ntsync, NTSYNC_IOC_WAIT_ANY, &args);
-        if (ret == -1) {
-                return RtlpGetNtStatusFromUnixErrno();
+
+        if (Record != NULL && Record->Type == RtlpMutantObject) {
+                NTSTATUS Status;
+                if (RtlpTryAcquireMutant((PRTLP_MUTANT)Record, RtlpGetOwnerId(), &Status)) {
+                        return Status;
+                }
+        } else if (Dispatcher != NULL && Dispatcher->Userspace) {
+                return RtlpWaitForUserObjects(1, &Dispatcher, WaitAny, TimeOut);
+        } else if (Dispatcher != NULL && RtlpTryWaitDispatcher(Dispatcher)) {
+                return STATUS_WAIT_0;
         }
 
-        return args.index;
+        return RtlpWaitForKernelObjects(1, &Handle.Object, Record != NULL ? &Record : NULL, NTSYNC_IOC_WAIT_ANY, TimeOut);
 }
 
-NTSTATUS NtWaitForMultipleObjects(ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
+NTSTATUS NtWaitForSingleObject(HANDLE Handle, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        bool Registered = RtlpRegistryBeginWait(1, &Handle, WaitAny);
+        NTSTATUS Status = RtlpWaitForSingleObject(Handle, Alertable, TimeOut);
+        if (Registered) {
+                RtlpRegistryLeaveWait(1, &Handle, WaitAny, Status);
+        }
+        RtlpTraceCall(Start, RtlpTraceWaitForSingleObject, Handle.Object, RtlpGetTraceTimeOut(TimeOut), 0, Status);
+        return Status;
+}
+
+static NTSTATUS RtlpWaitForMultipleObjects(ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
 {
         if (Count > MAXIMUM_WAIT_OBJECTS) {
                 errno = EINVAL;
@@ -297,7 +2032,7 @@ NTSTATUS NtWaitForMultipleObjects(ULONG Count, const HANDLE *Handles, WAIT_TYPE
                 return STATUS_INVALID_PARAMETER_2;
         }
 
-        int opcode;
+        unsigned long opcode;
         if (WaitType == WaitAll) {
                 opcode = NTSYNC_IOC_WAIT_ALL;
         } else if (WaitType == WaitAny) {
@@ -312,42 +2047,302 @@ NTSTATUS NtWaitForMultipleObjects(ULONG Count, const HANDLE *Handles, WAIT_TYPE
                 return STATUS_NOT_IMPLEMENTED;
         }
 
-        int Objects[MAXIMUM_WAIT_OBJECTS];
         for (size_t i = 0; i < Count; i++) {
                 if (!(Handles[i].DesiredAccess & SYNCHRONIZE)) {
                         errno = EPERM;
                         return STATUS_ACCESS_DENIED;
                 }
-                Objects[i] = Handles[i].Object;
         }
 
-        struct ntsync_wait_args args = {.objs = (uintptr_t)Objects,
-                                        .count = Count,
-                                        .flags = NTSYNC_WAIT_REALTIME,
-                                        .owner = 0,
-                                        .alert = 0,
-                                        .pad = 0};
+        /* A broadcast event is waited on through its current generation,
+         * referenced until the wait is over */
+        int Objects[MAXIMUM_WAIT_OBJECTS];
+        PRTLP_OBJECT Records[MAXIMUM_WAIT_OBJECTS];
+        PRTLP_DISPATCHER Dispatchers[MAXIMUM_WAIT_OBJECTS];
+        PRTLP_BROADCAST_GENERATION Generations[MAXIMUM_WAIT_OBJECTS];
+        ULONG GenerationCount = 0;
+        bool HasRecord = false;
+        ULONG UserCount = 0;
+        for (size_t i = 0; i < Count; i++) {
+                Objects[i] = Handles[i].Object;
+                Records[i] = RtlpLookupObject(Handles[i].Object);
+                if (Records[i] != NULL && Records[i]->Type == RtlpBroadcastObject) {
+                        Generations[GenerationCount] = RtlpReferenceBroadcast(Records[i]);
+                        Dispatchers[i] = Generations[GenerationCount++]->Event;
+                        Objects[i] = Dispatchers[i]->Object;
+                } else {
+                        Dispatchers[i] = RtlpGetDispatcher(Records[i]);
+                }
+                if (Dispatchers[i] != NULL) {
+                        Records[i] = &Dispatchers[i]->Header;
+                        UserCount += Dispatchers[i]->Userspace;
+                }
+                HasRecord |= Records[i] != NULL;
+        }
 
-        if (TimeOut == NULL) {
-                args.timeout = UINT64_MAX;
+        NTSTATUS Status;
+        if (UserCount != 0 && UserCount != Count) {
+                /* Userspace objects have nothing NTSYNC could wait on */
+                errno = ENOSYS;
+                Status = STATUS_NOT_SUPPORTED;
+        } else if (UserCount != 0) {
+                Status = RtlpWaitForUserObjects(Count, Dispatchers, WaitType, TimeOut);
         } else {
-                struct timespec ts;
-                if (timespec_get(&ts, TIME_UTC) != TIME_UTC) {
-                        return RtlpGetNtStatusFromUnixErrno();
+                Status = RtlpWaitForKernelObjects(Count, Objects, HasRecord ? Records : NULL, opcode, TimeOut);
+        }
+
+        for (ULONG i = 0; i < GenerationCount; i++) {
+                RtlpDereferenceBroadcast(Generations[i]);
+        }
+
+        return Status;
+}
+
+NTSTATUS NtWaitForMultipleObjects(ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType, BOOLEAN Alertable, PLARGE_INTEGER TimeOut)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        bool Registered = RtlpRegistryBeginWait(Count, Handles, WaitType);
+        NTSTATUS Status = RtlpWaitForMultipleObjects(Count, Handles, WaitType, Alertable, TimeOut);
+        if (Registered) {
+                RtlpRegistryLeaveWait(Count, Handles, WaitType, Status);
+        }
+        RtlpTraceWait(Start, Count, Handles, WaitType, TimeOut, Status);
+        return Status;
+}
+
+NTSTATUS RtlpSendObject(int Socket, PRTLP_OBJECT Record, ULONG DesiredAccess)
+{
+        if (Record == NULL || (Record->Type != RtlpEventObject && Record->Type != RtlpSemaphoreObject)) {
+                errno = EINVAL;
+                return STATUS_OBJECT_TYPE_MISMATCH;
+        }
+
+        PRTLP_DISPATCHER Dispatcher = (PRTLP_DISPATCHER)Record;
+        if (Dispatcher->Userspace) {
+                errno = ENOSYS;
+                return STATUS_NOT_SUPPORTED;
+        }
+
+        RTLP_DUPLICATE_MESSAGE Message = {.Type = Record->Type,
+                                          .DesiredAccess = DesiredAccess,
+                                          .SharedIndex = Dispatcher->Shared ? Dispatcher->Slot.Index : 0,
+                                          .MaximumCount = Dispatcher->MaximumCount,
+                                          .ManualReset = Dispatcher->ManualReset,
+                                          .RegistryLock = Dispatcher->RegistryLock};
+        int Objects[2] = {Dispatcher->Object, Dispatcher->Shared ? RtlpGetSharedRegionObject(&Dispatcher->Slot) : -1};
+        size_t Count = Dispatcher->Shared ? 2 : 1;
+
+        union {
+                struct cmsghdr Header;
+                char Buffer[CMSG_SPACE(sizeof(Objects))];
+        } Control = {0};
+        struct iovec iov = {.iov_base = &Message, .iov_len = sizeof(Message)};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = Control.Buffer, .msg_controllen = CMSG_SPACE(Count * sizeof(int))};
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(Count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), Objects, Count * sizeof(int));
+
+        /* The reference belongs to the receiving process from now on */
+        if (Dispatcher->Shared) {
+                RtlpReferenceSharedState(&Dispatcher->Slot);
+        }
+
+        if (sendmsg(Socket, &msg, MSG_NOSIGNAL) == -1) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                if (Dispatcher->Shared) {
+                        RtlpReleaseSharedState(&Dispatcher->Slot);
                 }
-                args.timeout = -(TimeOut->QuadPart) * 100 + ts.tv_nsec + ts.tv_sec * NSEC_PER_SEC;
+                return Status;
         }
 
-        int ret = ioctl(ntsync, opcode, &args);
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlpReceiveObject(int Socket, PHANDLE TargetHandle)
+{
+        RTLP_DUPLICATE_MESSAGE Message;
+        union {
+                struct cmsghdr Header;
+                char Buffer[CMSG_SPACE(2 * sizeof(int))];
+        } Control;
+        struct iovec iov = {.iov_base = &Message, .iov_len = sizeof(Message)};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = Control.Buffer, .msg_controllen = sizeof(Control.Buffer)};
+
+        ssize_t ret = recvmsg(Socket, &msg, MSG_CMSG_CLOEXEC);
         if (ret == -1) {
                 return RtlpGetNtStatusFromUnixErrno();
         }
 
-        return args.index;
+        int Objects[2] = {-1, -1};
+        size_t Count = 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                        Count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                        memcpy(Objects, CMSG_DATA(cmsg), (Count > 2 ? 2 : Count) * sizeof(int));
+                }
+        }
+
+        bool Valid = ret == sizeof(Message) && !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) &&
+                     (Message.Type == RtlpEventObject || Message.Type == RtlpSemaphoreObject) &&
+                     Count == (Message.SharedIndex != 0 ? 2 : 1);
+        if (!Valid) {
+                for (size_t i = 0; i < Count && i < 2; i++) {
+                        close(Objects[i]);
+                }
+                errno = EINVAL;
+                return ret == 0 ? STATUS_PIPE_BROKEN : STATUS_INVALID_PARAMETER;
+        }
+
+        RTLP_SHARED_SLOT Slot;
+        if (Message.SharedIndex != 0 && !RtlpMapSharedState(Objects[1], Message.SharedIndex, &Slot)) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                close(Objects[0]);
+                return Status;
+        }
+
+        PRTLP_DISPATCHER Dispatcher = RtlpAllocateDispatcher(Message.Type, Message.SharedIndex != 0 ? &Slot : NULL);
+        if (Dispatcher == NULL) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                if (Message.SharedIndex != 0) {
+                        RtlpReleaseSharedState(&Slot);
+                }
+                close(Objects[0]);
+                return Status;
+        }
+        Dispatcher->MaximumCount = Message.MaximumCount;
+        Dispatcher->ManualReset = Message.ManualReset;
+        Dispatcher->RegistryLock = Message.RegistryLock;
+
+        NTSTATUS Status = RtlpInsertDispatcher(Dispatcher, Objects[0]);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        TargetHandle->DesiredAccess = Message.DesiredAccess;
+        TargetHandle->Object = Objects[0];
+
+        return STATUS_SUCCESS;
 }
 
-NTSTATUS NtClose(HANDLE Handle)
+NTSTATUS RtlOpenProcessSocket(PHANDLE ProcessHandle, ULONG DesiredAccess, int Socket)
+{
+        if (ProcessHandle == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (Socket < 0) {
+                errno = EBADF;
+                return STATUS_INVALID_HANDLE;
+        }
+
+        ProcessHandle->DesiredAccess = DesiredAccess;
+        ProcessHandle->Object = Socket;
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS NtDuplicateObject(HANDLE SourceProcessHandle, HANDLE SourceHandle, HANDLE TargetProcessHandle, PHANDLE TargetHandle, ULONG DesiredAccess, ULONG HandleAttributes, ULONG Options)
+{
+        (void)HandleAttributes;
+        bool SourceLocal = SourceProcessHandle.Object == -1;
+        bool TargetLocal = TargetProcessHandle.Object == -1;
+
+        if (!(SourceProcessHandle.DesiredAccess & PROCESS_DUP_HANDLE) || !(TargetProcessHandle.DesiredAccess & PROCESS_DUP_HANDLE)) {
+                errno = EPERM;
+                return STATUS_ACCESS_DENIED;
+        }
+
+        if (!SourceLocal && !TargetLocal) {
+                errno = ENOSYS;
+                return STATUS_NOT_SUPPORTED;
+        }
+
+        if (Options & ~(DUPLICATE_CLOSE_SOURCE | DUPLICATE_SAME_ACCESS)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_7;
+        }
+
+        if (!SourceLocal) {
+                if (TargetHandle == NULL) {
+                        errno = EINVAL;
+                        return STATUS_INVALID_PARAMETER_4;
+                }
+                return RtlpReceiveObject(SourceProcessHandle.Object, TargetHandle);
+        }
+
+        ULONG Access = (Options & DUPLICATE_SAME_ACCESS) ? SourceHandle.DesiredAccess : DesiredAccess;
+        if (Access & ~SourceHandle.DesiredAccess) {
+                errno = EPERM;
+                return STATUS_ACCESS_DENIED;
+        }
+
+        PRTLP_OBJECT Record = RtlpLookupObject(SourceHandle.Object);
+        if (!TargetLocal) {
+                NTSTATUS Status = RtlpSendObject(TargetProcessHandle.Object, Record, Access);
+                if (Status == STATUS_SUCCESS && (Options & DUPLICATE_CLOSE_SOURCE)) {
+                        NtClose(SourceHandle);
+                }
+                return Status;
+        }
+
+        if (TargetHandle == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_4;
+        }
+
+        if (Record == NULL) {
+                errno = EBADF;
+                return STATUS_INVALID_HANDLE;
+        }
+
+        /* Both handles share the fd, closing the source simply hands it over */
+        if (!(Options & DUPLICATE_CLOSE_SOURCE)) {
+                atomic_fetch_add_explicit(&Record->HandleCount, 1, memory_order_relaxed);
+        }
+
+        TargetHandle->DesiredAccess = Access;
+        TargetHandle->Object = SourceHandle.Object;
+
+        return STATUS_SUCCESS;
+}
+
+static NTSTATUS RtlpClose(HANDLE Handle)
 {
+        PRTLP_OBJECT Record = RtlpLookupObject(Handle.Object);
+        if (Record != NULL && atomic_fetch_sub_explicit(&Record->HandleCount, 1, memory_order_acq_rel) > 0) {
+                return STATUS_SUCCESS;
+        }
+
+        Record = RtlpRemoveObject(Handle.Object);
+        if (Record != NULL && Record->Name != NULL) {
+                RtlpCloseObjectName(Record->Name);
+        }
+
+        /* A mutant owned by another thread stays, fd included, until that
+         * thread releases or abandons it. */
+        if (Record != NULL && Record->Type == RtlpMutantObject) {
+                PRTLP_MUTANT Mutant = (PRTLP_MUTANT)Record;
+                if (atomic_load_explicit(&Mutant->Owner, memory_order_relaxed) == RtlpGetOwnerId()) {
+                        RtlpUnlinkOwnedMutant(Mutant);
+                        RtlpDereferenceMutant(Mutant);
+                }
+                RtlpDereferenceMutant(Mutant);
+                return STATUS_SUCCESS;
+        }
+
+        if (Record != NULL && Record->Type == RtlpThreadObject) {
+                RtlpCloseThread(Record);
+        } else if (Record != NULL && Record->Type == RtlpBroadcastObject) {
+                RtlpCloseBroadcast(Record);
+        } else if (Record != NULL && (Record->Type == RtlpEventObject || Record->Type == RtlpSemaphoreObject)) {
+                RtlpFreeDispatcher((PRTLP_DISPATCHER)Record);
+        } else if (Record != NULL) {
+                free(Record);
+        }
+
         int ret = close(Handle.Object);
         if (ret == -1) {
                 return RtlpGetNtStatusFromUnixErrno();
@@ -355,3 +2350,11 @@ NTSTATUS NtClose(HANDLE Handle)
                 return STATUS_SUCCESS;
         }
 }
+
+NTSTATUS NtClose(HANDLE Handle)
+{
+        ULONGLONG Start = RtlpTraceBegin();
+        NTSTATUS Status = RtlpClose(Handle);
+        RtlpTraceCall(Start, RtlpTraceClose, Handle.Object, 0, 0, Status);
+        return Status;
+}
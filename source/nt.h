@@ -8,30 +8,103 @@
 /* Changelog
  * 30/10/2025 GMT +7 05.54
  * Define STATUS_SEMAPHORE_LIMIT_EXCEEDED
+ * 19/10/2026 GMT +7 09.12
+ * - Add NT Mutant (NtCreateMutant, NtReleaseMutant, NtQueryMutant)
+ * 19/10/2026 GMT +7 11.40
+ * - Add keyed events (NtCreateKeyedEvent, NtWaitForKeyedEvent, NtReleaseKeyedEvent)
+ * 19/10/2026 GMT +7 14.05
+ * - Add RTL critical sections
+ * 19/10/2026 GMT +7 16.30
+ * - Add RTL barriers and run once
+ * 20/10/2026 GMT +7 08.45
+ * - Add waitable threads (RtlCreateUserThread, RtlExitUserThread, NtQueryInformationThread)
+ * 20/10/2026 GMT +7 13.20
+ * - Add NtDuplicateObject and RtlOpenProcessSocket
+ * 20/10/2026 GMT +7 18.10
+ * - OBJECT_ATTRIBUTES is a structure now, events and semaphores can be named
+ * - Add NtOpenEvent, NtOpenSemaphore and RtlInitAnsiString
+ * 20/10/2026 GMT +7 21.30
+ * - Add ntsync_backend and OBJ_PROCESS_LOCAL for the userspace backend
+ * 21/10/2026 GMT +7 09.40
+ * - Add RtlStartSyncTrace, RtlStopSyncTrace and RtlReplaySyncTrace
+ * 21/10/2026 GMT +7 14.15
+ * - Add NtAcquireSemaphoreEx
+ * 21/10/2026 GMT +7 17.05
+ * - Add RtlQueryObjectStates
+ * 21/10/2026 GMT +7 20.30
+ * - Add the object registry (RtlStartObjectRegistry, RtlStopObjectRegistry, RtlQueryObjectRegistry, RtlDumpObjectRegistry)
+ * 22/10/2026 GMT +7 09.20
+ * - Add NtCreateBroadcastEvent and NtBroadcastEvent
+ * 22/10/2026 GMT +7 13.40
+ * - Add channels (RtlInitChannel, RtlSendChannel, RtlReceiveChannel, RtlSelectChannels, RtlDeleteChannel)
+ * 23/10/2026 GMT +7 14.00
+ * - Document that a wait can't mix userspace and NTSYNC objects
+ * 23/10/2026 GMT +7 17.10
+ * - NtAcquireSemaphoreEx collectors are lined up across processes
+ * 23/10/2026 GMT +7 18.30
+ * - Add OBJ_REGISTRY_LOCK, events and semaphores only count as locks with it
+ * 24/10/2026 GMT +7 12.00
+ * - Document what RtlQueryObjectStates reports for keyed and broadcast events
+ * 24/10/2026 GMT +7 13.00
+ * - The sync trace records broadcast events
  */
 #pragma once
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <linux/ntsync.h>
 
 extern int ntsync;
 
+/* Backend of new unnamed events and semaphores, NTSYNC by default.
+ * Userspace objects are waited on with futexes and can't leave the process.
+ * Mutexes and named objects stay on NTSYNC, and a wait mixing them with
+ * userspace objects fails with STATUS_NOT_SUPPORTED.
+ */
+#define NTSYNC_BACKEND_KERNEL 0
+#define NTSYNC_BACKEND_USERSPACE 1
+
+extern int ntsync_backend;
+
 typedef bool BOOL;
 typedef bool BOOLEAN;
 typedef uint32_t DWORD;
+typedef uint8_t UCHAR;
+typedef uint16_t USHORT;
+typedef char CHAR;
+typedef CHAR* PCHAR;
+typedef const CHAR* PCSZ;
 typedef int32_t LONG;
 typedef LONG* PLONG;
 typedef uint32_t ULONG;
 typedef ULONG* PULONG;
 typedef int64_t LONGLONG;
 typedef uint64_t ULONGLONG;
+typedef uintptr_t ULONG_PTR;
+typedef size_t SIZE_T;
 typedef uint32_t NTSTATUS;
 typedef void VOID;
 typedef VOID* PVOID;
-typedef PVOID _OBJECT_ATTRIBUTES;
-typedef _OBJECT_ATTRIBUTES OBJECT_ATTRIBUTES;
-typedef OBJECT_ATTRIBUTES* POBJECT_ATTRIBUTES;
+
+typedef struct _STRING
+{
+        USHORT Length;
+        USHORT MaximumLength;
+        PCHAR Buffer;
+} STRING, ANSI_STRING, *PSTRING, *PANSI_STRING;
+
+/* Names are ANSI strings, there is no UNICODE_STRING in libntsync.
+ * RootDirectory and the security fields must be NULL. */
+typedef struct _OBJECT_ATTRIBUTES
+{
+        ULONG Length;
+        PVOID RootDirectory;
+        PANSI_STRING ObjectName;
+        ULONG Attributes;
+        PVOID SecurityDescriptor;
+        PVOID SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
 
 #ifdef WIN32
 typedef PVOID _HANDLE;
@@ -91,12 +164,151 @@ typedef struct _SEMAPHORE_BASIC_INFORMATION
     LONG MaximumCount;
 } SEMAPHORE_BASIC_INFORMATION, *PSEMAPHORE_BASIC_INFORMATION;
 
+typedef enum _THREADINFOCLASS
+{
+    ThreadBasicInformation
+} THREADINFOCLASS;
+
+typedef struct _CLIENT_ID
+{
+    PVOID UniqueProcess;
+    PVOID UniqueThread;
+} CLIENT_ID, *PCLIENT_ID;
+
+typedef struct _THREAD_BASIC_INFORMATION
+{
+    NTSTATUS ExitStatus;
+    PVOID TebBaseAddress;
+    CLIENT_ID ClientId;
+    ULONG_PTR AffinityMask;
+    LONG Priority;
+    LONG BasePriority;
+} THREAD_BASIC_INFORMATION, *PTHREAD_BASIC_INFORMATION;
+
+typedef NTSTATUS (*PUSER_THREAD_START_ROUTINE)(PVOID ThreadParameter);
+
+typedef enum _MUTANT_INFORMATION_CLASS
+{
+    MutantBasicInformation
+} MUTANT_INFORMATION_CLASS;
+
+typedef struct _MUTANT_BASIC_INFORMATION
+{
+    LONG CurrentCount;
+    BOOLEAN OwnedByCaller;
+    BOOLEAN AbandonedState;
+} MUTANT_BASIC_INFORMATION, *PMUTANT_BASIC_INFORMATION;
+
+/* Unlike Windows, the owner is a tid and the semaphore an fd, so the
+ * layout is the same for nt.h and win32.h users. LockSemaphore stays -1
+ * until the first contended enter creates it. */
+typedef struct _RTL_CRITICAL_SECTION
+{
+        PVOID DebugInfo;
+        LONG LockCount;
+        LONG RecursionCount;
+        ULONG OwningThread;
+        int LockSemaphore;
+        ULONG SpinCount;
+} RTL_CRITICAL_SECTION, *PRTL_CRITICAL_SECTION;
+
+/* Remaining is written by every arriving thread, it gets a cache line of
+ * its own so threads spinning on Phase aren't disturbed by arrivals. */
+typedef struct _RTL_BARRIER
+{
+        LONG Remaining __attribute__((aligned(64)));
+        ULONG Phase __attribute__((aligned(64)));
+        LONG TotalThreads;
+        LONG SpinCount;
+        LONG Sleepers[2];
+        int Events[2];
+        BOOLEAN EventSet[2];
+} RTL_BARRIER, *PRTL_BARRIER;
+
+/* A bounded ring of messages. Senders write Head and FreeSlots, receivers
+ * Tail and Messages, each pair on a cache line of its own. A count goes
+ * negative by the number of threads blocked on it, only those and the
+ * threads waking them touch the semaphores. */
+typedef struct _RTL_CHANNEL
+{
+        ULONGLONG Head __attribute__((aligned(64)));
+        LONG FreeSlots;
+        ULONGLONG Tail __attribute__((aligned(64)));
+        LONG Messages;
+        PVOID Cells __attribute__((aligned(64)));
+        ULONG Capacity;
+        ULONG Mask;
+        int SendSemaphore;
+        int ReceiveSemaphore;
+} RTL_CHANNEL, *PRTL_CHANNEL;
+
+/* Ptr holds the context once initialization completed, the two low bits of
+ * it are reserved for the state. */
+typedef struct _RTL_RUN_ONCE
+{
+        PVOID Ptr;
+} RTL_RUN_ONCE, *PRTL_RUN_ONCE;
+
+typedef BOOLEAN (*PRTL_RUN_ONCE_INIT_FN)(PRTL_RUN_ONCE RunOnce, PVOID Parameter, PVOID *Context);
+
+#define RTL_RUN_ONCE_INIT {0}
+#define RTL_RUN_ONCE_CHECK_ONLY 0x00000001
+#define RTL_RUN_ONCE_ASYNC 0x00000002
+#define RTL_RUN_ONCE_INIT_FAILED 0x00000004
+#define RTL_RUN_ONCE_CTX_RESERVED_BITS 2
+
+#define RTL_BARRIER_FLAGS_SPIN_ONLY 0x00000001
+#define RTL_BARRIER_FLAGS_BLOCK_ONLY 0x00000002
+#define RTL_BARRIER_FLAGS_NO_DELETE 0x00000004
+
+/* Elapsed is in 100ns units. A call is skipped when one of its objects
+ * wasn't created in the traced process, and a mismatch when it returned a
+ * different status than it did there. */
+typedef struct _RTL_SYNC_TRACE_REPLAY_INFORMATION
+{
+        ULONG Threads;
+        ULONG Objects;
+        ULONG Calls;
+        ULONG Skipped;
+        ULONG Mismatches;
+        LARGE_INTEGER Elapsed;
+} RTL_SYNC_TRACE_REPLAY_INFORMATION, *PRTL_SYNC_TRACE_REPLAY_INFORMATION;
+
+#define RTL_SYNC_TRACE_REPLAY_TIMED 0x00000001
+
+typedef enum _RTL_OBJECT_STATE_TYPE
+{
+        RtlObjectStateInvalid,
+        RtlObjectStateNotificationEvent,
+        RtlObjectStateSynchronizationEvent,
+        RtlObjectStateSemaphore,
+        RtlObjectStateMutant,
+        RtlObjectStateThread,
+        RtlObjectStateKeyedEvent,
+} RTL_OBJECT_STATE_TYPE;
+
+/* Struct of arrays filled by RtlQueryObjectStates, every array has one
+ * entry per handle. Type holds an RTL_OBJECT_STATE_TYPE. State is 1 for a
+ * signaled event or an exited thread, the count of a semaphore, the
+ * CurrentCount of a mutant as NtQueryMutant reports it and 0 for a keyed
+ * event. A broadcast event reports as a notification event. MaximumCount is
+ * the maximum of a semaphore and 1 for the rest. An entry whose Status
+ * isn't STATUS_SUCCESS has all three zeroed. */
+typedef struct _RTL_OBJECT_STATES
+{
+        UCHAR *Type;
+        LONG *State;
+        LONG *MaximumCount;
+        NTSTATUS *Status;
+} RTL_OBJECT_STATES, *PRTL_OBJECT_STATES;
+
 #define TRUE true
 #define FALSE false
 #define NSEC_PER_SEC 1000000000LL
 
 #define MAXIMUM_WAIT_OBJECTS NTSYNC_MAX_WAIT_COUNT
 #define STATUS_SUCCESS 0
+#define STATUS_PENDING 0x00000103
 #define STATUS_WAIT_0 0
 #define STATUS_WAIT_1 1
 #define STATUS_WAIT_2 2
@@ -161,6 +373,9 @@ typedef struct _SEMAPHORE_BASIC_INFORMATION
 #define STATUS_WAIT_61 61
 #define STATUS_WAIT_62 62
 #define STATUS_WAIT_63 63
+#define STATUS_ABANDONED 0x00000080
+#define STATUS_ABANDONED_WAIT_0 0x00000080
+#define STATUS_ABANDONED_WAIT_63 0x000000BF
 #define STATUS_INVALID_PARAMETER 0xC000000D
 #define STATUS_INVALID_PARAMETER_1  0xC00000EF
 #define STATUS_INVALID_PARAMETER_2  0xC00000F0
@@ -183,6 +398,17 @@ typedef struct _SEMAPHORE_BASIC_INFORMATION
 #define STATUS_UNSUCCESSFUL 0xc0000001
 #define STATUS_NOT_IMPLEMENTED 0xC0000002L
 #define STATUS_SEMAPHORE_LIMIT_EXCEEDED 0xc0000047
+#define STATUS_MUTANT_NOT_OWNED 0xC0000046
+#define STATUS_MUTANT_LIMIT_EXCEEDED 0xC0000191
+#define STATUS_OBJECT_TYPE_MISMATCH 0xC0000024
+#define STATUS_NO_MEMORY 0xC0000017
+#define STATUS_RESOURCE_NOT_OWNED 0xC0000264
+#define STATUS_OBJECT_NAME_COLLISION 0xC0000035
+#define STATUS_PIPE_BROKEN 0xC000014B
+#define STATUS_OBJECT_NAME_EXISTS 0x40000000
+#define STATUS_BUFFER_OVERFLOW 0x80000005
+#define STATUS_OBJECT_NAME_INVALID 0xC0000033
+#define STATUS_OBJECT_NAME_NOT_FOUND 0xC0000034
 
 #define SYNCHRONIZE 0x00100000L
 #define DELETE 0x00010000L
@@ -198,6 +424,101 @@ typedef struct _SEMAPHORE_BASIC_INFORMATION
 #define SEMAPHORE_MODIFY_STATE 0x0002
 #define SEMAPHORE_ALL_ACCESS (SEMAPHORE_QUERY_STATE | SEMAPHORE_MODIFY_STATE | STANDARD_RIGHT_REQUIRED | SYNCHRONIZE)
 
+#define KEYEDEVENT_WAIT 0x0001
+#define KEYEDEVENT_WAKE 0x0002
+#define KEYEDEVENT_ALL_ACCESS (KEYEDEVENT_WAIT | KEYEDEVENT_WAKE | STANDARD_RIGHT_REQUIRED)
+
+#define THREAD_TERMINATE 0x0001
+#define THREAD_QUERY_INFORMATION 0x0040
+#define THREAD_QUERY_LIMITED_INFORMATION 0x0800
+#define THREAD_ALL_ACCESS (STANDARD_RIGHT_REQUIRED | SYNCHRONIZE | 0xFFFF)
+
+#define MUTANT_QUERY_STATE 0x0001
+#define MUTANT_ALL_ACCESS (MUTANT_QUERY_STATE | STANDARD_RIGHT_REQUIRED | SYNCHRONIZE)
+
+#define PROCESS_DUP_HANDLE 0x0040
+#define PROCESS_ALL_ACCESS (STANDARD_RIGHT_REQUIRED | SYNCHRONIZE | 0xFFFF)
+
+#define DUPLICATE_CLOSE_SOURCE 0x00000001
+#define DUPLICATE_SAME_ACCESS 0x00000002
+
+#define OBJ_OPENIF 0x00000080
+/* libntsync extension, the object uses the userspace backend whatever
+ * ntsync_backend says. Can't be combined with a name, nor waited on
+ * together with NTSYNC objects. */
+#define OBJ_PROCESS_LOCAL 0x00010000
+/* libntsync extension, the object registry treats the event or semaphore
+ * as a lock held by the thread whose wait took it until it is released or
+ * set. Meant for auto-reset events and semaphores with a maximum count of
+ * one that guard something, it only affects deadlock detection. */
+#define OBJ_REGISTRY_LOCK 0x00020000
+
+#define InitializeObjectAttributes(p, n, a, r, s) \
+        do { \
+                (p)->Length = sizeof(OBJECT_ATTRIBUTES); \
+                (p)->RootDirectory = (r); \
+                (p)->ObjectName = (n); \
+                (p)->Attributes = (a); \
+                (p)->SecurityDescriptor = (s); \
+                (p)->SecurityQualityOfService = NULL; \
+        } while (0)
+
+#ifdef WIN32
+#define NtCurrentProcess() ((HANDLE)(intptr_t)-1)
+#else
+#define NtCurrentProcess() ((HANDLE){.DesiredAccess = PROCESS_ALL_ACCESS, .Object = -1})
+#endif
+
+/* Holder is the thread holding an object used as a lock: a mutant, or an
+ * auto-reset event or semaphore created or opened with OBJ_REGISTRY_LOCK,
+ * 0 if none does or the object isn't one. */
+typedef struct _RTL_REGISTRY_OBJECT
+{
+        int Object;
+        RTL_OBJECT_STATE_TYPE Type;
+        ULONG Holder;
+} RTL_REGISTRY_OBJECT, *PRTL_REGISTRY_OBJECT;
+
+/* WaitTime is how long the thread waits so far, in 100ns units. Types and
+ * Holders describe each of Objects as RTL_REGISTRY_OBJECT does. */
+typedef struct _RTL_REGISTRY_WAITER
+{
+        ULONG ThreadId;
+        WAIT_TYPE WaitType;
+        ULONG Count;
+        BOOLEAN Deadlocked;
+        LARGE_INTEGER WaitTime;
+        int Objects[MAXIMUM_WAIT_OBJECTS];
+        UCHAR Types[MAXIMUM_WAIT_OBJECTS];
+        ULONG Holders[MAXIMUM_WAIT_OBJECTS];
+} RTL_REGISTRY_WAITER, *PRTL_REGISTRY_WAITER;
+
+/* The caller sets the arrays and their capacities. ObjectCount and
+ * WaiterCount are the full counts, even when the arrays were too small. */
+typedef struct _RTL_REGISTRY_SNAPSHOT
+{
+        PRTL_REGISTRY_OBJECT Objects;
+        ULONG ObjectCapacity;
+        ULONG ObjectCount;
+        PRTL_REGISTRY_WAITER Waiters;
+        ULONG WaiterCapacity;
+        ULONG WaiterCount;
+        ULONG DeadlockedCount;
+} RTL_REGISTRY_SNAPSHOT, *PRTL_REGISTRY_SNAPSHOT;
+
+void
+RtlInitAnsiString(
+        PANSI_STRING DestinationString,
+        PCSZ SourceString
+        );
+
+/* Named events and semaphores live in a per-user namespace kept by a broker
+ * process, started on first use. Names opened before are served from a
+ * cache in the process without asking the broker. A "Global\" or "Local\"
+ * prefix is ignored. Creating an existing name returns
+ * STATUS_OBJECT_NAME_EXISTS with OBJ_OPENIF, else
+ * STATUS_OBJECT_NAME_COLLISION.
+ */
 NTSTATUS
 NtCreateEvent(
         PHANDLE EventHandle,
@@ -219,12 +540,21 @@ NtResetEvent(
         PLONG PreviousState
         );
 
+/* Misses the waiters that aren't blocked at the time of the pulse, use a
+ * broadcast event instead */
 NTSTATUS 
 NtPulseEvent(
         HANDLE EventHandle,
         PLONG PreviousState
         ) __attribute__((deprecated));
 
+NTSTATUS
+NtOpenEvent(
+        PHANDLE EventHandle,
+        ULONG DesiredAccess,
+        POBJECT_ATTRIBUTES ObjectAttributes
+        );
+
 NTSTATUS
 NtQueryEvent(
         HANDLE EventHandle,
@@ -234,6 +564,26 @@ NtQueryEvent(
         PULONG ReturnLength
         );
 
+/* libntsync extension. A broadcast event is waited on like any other
+ * object and never signaled in between, NtBroadcastEvent releases every
+ * thread that started waiting before it exactly once and none that start
+ * after it. Generation receives the number of broadcasts made before this
+ * one. Unnamed only, OBJ_PROCESS_LOCAL picks the userspace backend like
+ * for NtCreateEvent.
+ */
+NTSTATUS
+NtCreateBroadcastEvent(
+        PHANDLE EventHandle,
+        ULONG DesiredAccess,
+        POBJECT_ATTRIBUTES ObjectAttributes
+        );
+
+NTSTATUS
+NtBroadcastEvent(
+        HANDLE EventHandle,
+        PULONG Generation
+        );
+
 NTSTATUS
 NtCreateSemaphore(
         PHANDLE SemaphoreHandle,
@@ -250,6 +600,13 @@ NtReleaseSemaphore(
         PLONG PreviousCount
         );
 
+NTSTATUS
+NtOpenSemaphore(
+        PHANDLE SemaphoreHandle,
+        ULONG DesiredAccess,
+        POBJECT_ATTRIBUTES ObjectAttributes
+        );
+
 NTSTATUS
 NtQuerySemaphore(
         HANDLE SemaphoreHandle,
@@ -259,6 +616,266 @@ NtQuerySemaphore(
         PULONG ReturnLength
         );
 
+/* libntsync extension. Takes AcquireCount units of a semaphore at once, or
+ * none of them if TimeOut runs out first. A caller waiting for several
+ * units holds back the smaller requests that come after it, so it isn't
+ * starved by them. On an NTSYNC semaphore the units are collected as they
+ * are released by one caller at a time across every process sharing it,
+ * and given back on timeout, on a userspace one they are taken in a single
+ * step. Needs SYNCHRONIZE access.
+ */
+NTSTATUS
+NtAcquireSemaphoreEx(
+        HANDLE SemaphoreHandle,
+        LONG AcquireCount,
+        BOOLEAN Alertable,
+        PLARGE_INTEGER TimeOut
+        );
+
+/* Mutants are owned by the calling thread, identified by its tid.
+ * An uncontended acquire or release never leaves userspace; the NTSYNC mutex
+ * only takes over while another thread waits for it or it is part of
+ * NtWaitForMultipleObjects. Mutants still owned by an exiting thread are
+ * killed, so the next waiter gets STATUS_ABANDONED_WAIT_0.
+ */
+NTSTATUS
+NtCreateMutant(
+        PHANDLE MutantHandle,
+        ULONG DesiredAccess,
+        POBJECT_ATTRIBUTES ObjectAttributes,
+        BOOLEAN InitialOwner
+        );
+
+NTSTATUS
+NtReleaseMutant(
+        HANDLE MutantHandle,
+        PLONG PreviousCount
+        );
+
+NTSTATUS
+NtQueryMutant(
+        HANDLE MutantHandle,
+        MUTANT_INFORMATION_CLASS MutantInformationClass,
+        PVOID MutantInformation,
+        ULONG MutantInformationLength,
+        PULONG ReturnLength
+        );
+
+/* Keyed events have no NTSYNC object behind them. Waiters and releasers
+ * meet in a process-wide hash table keyed by (keyed event, Key), so any
+ * number of keys can share one handle. NtReleaseKeyedEvent blocks until a
+ * waiter on the same key takes the wake-up, and NtWaitForKeyedEvent blocks
+ * until a release on its key hands one over. Keyed event handles can't be
+ * passed to NtWaitForSingleObject or NtWaitForMultipleObjects.
+ */
+NTSTATUS
+NtCreateKeyedEvent(
+        PHANDLE KeyedEventHandle,
+        ULONG DesiredAccess,
+        POBJECT_ATTRIBUTES ObjectAttributes,
+        ULONG Flags
+        );
+
+NTSTATUS
+NtWaitForKeyedEvent(
+        HANDLE KeyedEventHandle,
+        PVOID Key,
+        BOOLEAN Alertable,
+        PLARGE_INTEGER TimeOut
+        );
+
+NTSTATUS
+NtReleaseKeyedEvent(
+        HANDLE KeyedEventHandle,
+        PVOID Key,
+        BOOLEAN Alertable,
+        PLARGE_INTEGER TimeOut
+        );
+
+NTSTATUS
+RtlInitializeCriticalSection(
+        PRTL_CRITICAL_SECTION CriticalSection
+        );
+
+NTSTATUS
+RtlInitializeCriticalSectionAndSpinCount(
+        PRTL_CRITICAL_SECTION CriticalSection,
+        ULONG SpinCount
+        );
+
+ULONG
+RtlSetCriticalSectionSpinCount(
+        PRTL_CRITICAL_SECTION CriticalSection,
+        ULONG SpinCount
+        );
+
+NTSTATUS
+RtlEnterCriticalSection(
+        PRTL_CRITICAL_SECTION CriticalSection
+        );
+
+BOOLEAN
+RtlTryEnterCriticalSection(
+        PRTL_CRITICAL_SECTION CriticalSection
+        );
+
+NTSTATUS
+RtlLeaveCriticalSection(
+        PRTL_CRITICAL_SECTION CriticalSection
+        );
+
+NTSTATUS
+RtlDeleteCriticalSection(
+        PRTL_CRITICAL_SECTION CriticalSection
+        );
+
+/* The last thread to enter a phase wakes every blocked thread with a single
+ * set of a manual-reset event, and returns TRUE. */
+NTSTATUS
+RtlInitBarrier(
+        PRTL_BARRIER Barrier,
+        LONG TotalThreads,
+        LONG SpinCount
+        );
+
+BOOLEAN
+RtlBarrier(
+        PRTL_BARRIER Barrier,
+        ULONG Flags
+        );
+
+NTSTATUS
+RtlDeleteBarrier(
+        PRTL_BARRIER Barrier
+        );
+
+/* libntsync extension. Capacity is the most messages a channel holds, up to
+ * 0x40000000. RtlSendChannel blocks while the channel is full until all of
+ * Messages are sent, RtlReceiveChannel until there is at least one message
+ * and then takes up to Count of them. Sent and Received tell how many made
+ * it when the time runs out. RtlSelectChannels receives one message from
+ * the first of up to MAXIMUM_WAIT_OBJECTS channels that has one and returns
+ * STATUS_WAIT_0 plus its index.
+ */
+NTSTATUS
+RtlInitChannel(
+        PRTL_CHANNEL Channel,
+        ULONG Capacity
+        );
+
+NTSTATUS
+RtlSendChannel(
+        PRTL_CHANNEL Channel,
+        PVOID const *Messages,
+        ULONG Count,
+        PULONG Sent,
+        PLARGE_INTEGER TimeOut
+        );
+
+NTSTATUS
+RtlReceiveChannel(
+        PRTL_CHANNEL Channel,
+        PVOID *Messages,
+        ULONG Count,
+        PULONG Received,
+        PLARGE_INTEGER TimeOut
+        );
+
+NTSTATUS
+RtlSelectChannels(
+        ULONG Count,
+        PRTL_CHANNEL const *Channels,
+        PVOID *Message,
+        PLARGE_INTEGER TimeOut
+        );
+
+NTSTATUS
+RtlDeleteChannel(
+        PRTL_CHANNEL Channel
+        );
+
+void
+RtlRunOnceInitialize(
+        PRTL_RUN_ONCE RunOnce
+        );
+
+NTSTATUS
+RtlRunOnceExecuteOnce(
+        PRTL_RUN_ONCE RunOnce,
+        PRTL_RUN_ONCE_INIT_FN InitFn,
+        PVOID Parameter,
+        PVOID *Context
+        );
+
+/* Returns STATUS_PENDING when the caller has to initialize and then call
+ * RtlRunOnceComplete, STATUS_SUCCESS once initialization is done. */
+NTSTATUS
+RtlRunOnceBeginInitialize(
+        PRTL_RUN_ONCE RunOnce,
+        ULONG Flags,
+        PVOID *Context
+        );
+
+NTSTATUS
+RtlRunOnceComplete(
+        PRTL_RUN_ONCE RunOnce,
+        ULONG Flags,
+        PVOID Context
+        );
+
+/* The thread handle is a manual-reset event signaled when the
+ * thread exits, so it works with NtWaitForMultipleObjects like any other
+ * object. Stacks come from a pool and are reused once a thread is gone.
+ * ExitStatus is STATUS_PENDING (STILL_ACTIVE) while the thread runs.
+ */
+NTSTATUS
+RtlCreateUserThread(
+        PHANDLE ThreadHandle,
+        ULONG DesiredAccess,
+        BOOLEAN CreateSuspended,
+        SIZE_T StackSize,
+        PUSER_THREAD_START_ROUTINE StartAddress,
+        PVOID Parameter,
+        PCLIENT_ID ClientId
+        );
+
+void
+RtlExitUserThread(
+        NTSTATUS ExitStatus
+        ) __attribute__((noreturn));
+
+NTSTATUS
+NtQueryInformationThread(
+        HANDLE ThreadHandle,
+        THREADINFOCLASS ThreadInformationClass,
+        PVOID ThreadInformation,
+        ULONG ThreadInformationLength,
+        PULONG ReturnLength
+        );
+
+/* libntsync has no process objects. Another process is reached through a
+ * connected AF_UNIX socket: NtDuplicateObject sends an event or semaphore
+ * when it is the target process, and receives one when it is the source.
+ * Both sides share the object and its userspace state.
+ */
+NTSTATUS
+RtlOpenProcessSocket(
+        PHANDLE ProcessHandle,
+        ULONG DesiredAccess,
+        int Socket
+        );
+
+NTSTATUS
+NtDuplicateObject(
+        HANDLE SourceProcessHandle,
+        HANDLE SourceHandle,
+        HANDLE TargetProcessHandle,
+        PHANDLE TargetHandle,
+        ULONG DesiredAccess,
+        ULONG HandleAttributes,
+        ULONG Options
+        );
+
 NTSTATUS
 NtWaitForSingleObject(
         HANDLE Handle,
@@ -279,3 +896,77 @@ NTSTATUS
 NtClose(
         HANDLE Handle
         );
+
+/* libntsync extension. Records every create, open, signal, wait and close
+ * of events, broadcast events, semaphores and mutexes into a file,
+ * MaximumRecords of 32 bytes each (0 picks 1M). Setting LIBNTSYNC_TRACE to
+ * a file name starts one when the library is loaded. Only one trace is
+ * recorded at a time.
+ */
+NTSTATUS
+RtlStartSyncTrace(
+        PCSZ FileName,
+        ULONG MaximumRecords
+        );
+
+NTSTATUS
+RtlStopSyncTrace(
+        void
+        );
+
+/* Makes the calls of a trace again, with one thread per traced thread and
+ * every object created unnamed up front with the current ntsync_backend.
+ * With RTL_SYNC_TRACE_REPLAY_TIMED each call waits for the time it was made
+ * at, else the threads run flat out. Infinite waits give up a second after
+ * the traced one returned.
+ */
+NTSTATUS
+RtlReplaySyncTrace(
+        PCSZ FileName,
+        ULONG Flags,
+        PRTL_SYNC_TRACE_REPLAY_INFORMATION Information
+        );
+
+/* libntsync extension. Queries events, semaphores, mutants and threads in
+ * one call. The arguments are checked once for the whole batch, each
+ * handle only needs the query access of its own type and gets its own
+ * Status. Mutants and objects of the userspace backend are read without
+ * a system call.
+ */
+NTSTATUS
+RtlQueryObjectStates(
+        ULONG Count,
+        const HANDLE *Handles,
+        PRTL_OBJECT_STATES States
+        );
+
+/* libntsync extension. Keeps track of the live objects, of the threads
+ * holding the ones used as locks and of what every thread waits on.
+ * Objects created before it started show up once they are waited on.
+ * Every Interval milliseconds, if not 0, a thread looks for waiters that
+ * can never wake up and reports them to stderr. Signal, if not 0, makes
+ * the same thread write everything the registry knows to stderr.
+ * LIBNTSYNC_REGISTRY set to "Interval[,Signal]" starts it when the library
+ * is loaded.
+ */
+NTSTATUS
+RtlStartObjectRegistry(
+        ULONG Interval,
+        int Signal
+        );
+
+NTSTATUS
+RtlStopObjectRegistry(
+        void
+        );
+
+/* STATUS_BUFFER_OVERFLOW if one of the arrays was too small */
+NTSTATUS
+RtlQueryObjectRegistry(
+        PRTL_REGISTRY_SNAPSHOT Snapshot
+        );
+
+NTSTATUS
+RtlDumpObjectRegistry(
+        int FileDescriptor
+        );
@@ -0,0 +1,199 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Private declarations shared between the libntsync translation units.
+ * Never include this from a program, use nt.h or win32.h instead.
+ */
+#pragma once
+
+#include "nt.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Objects that need userspace state beside the NTSYNC fd get a record in
+ * the object table, indexed by the fd stored in HANDLE.Object.
+ * HandleCount counts the in-process duplicates sharing the fd, the fd and
+ * the record go away with the last handle. Name is set for named objects
+ * and points to their entry in the name cache.
+ */
+typedef enum _RTLP_OBJECT_TYPE
+{
+        RtlpMutantObject = 1,
+        RtlpKeyedEventObject,
+        RtlpThreadObject,
+        RtlpEventObject,
+        RtlpSemaphoreObject,
+        RtlpBroadcastObject,
+} RTLP_OBJECT_TYPE;
+
+typedef struct _RTLP_OBJECT
+{
+        RTLP_OBJECT_TYPE Type;
+        _Atomic LONG HandleCount;
+        struct _RTLP_OBJECT_NAME *Name;
+} RTLP_OBJECT, *PRTLP_OBJECT;
+
+/* One slot of a shared state region, a memfd mapped by every process that
+ * has a handle to one of its objects. AcquireLock is a robust, process
+ * shared mutex that lines up NtAcquireSemaphoreEx callers of every process,
+ * Collected the units its owner took so far.
+ */
+typedef struct __attribute__((aligned(64))) _RTLP_SHARED_STATE
+{
+        _Atomic ULONGLONG State;
+        _Atomic ULONG References;
+        ULONG Next;
+        pthread_mutex_t AcquireLock;
+        _Atomic LONG Collected;
+} RTLP_SHARED_STATE, *PRTLP_SHARED_STATE;
+
+typedef struct _RTLP_SHARED_SLOT
+{
+        PRTLP_SHARED_STATE Entry;
+        ULONG Region;
+        ULONG Index;
+} RTLP_SHARED_SLOT, *PRTLP_SHARED_SLOT;
+
+/* Events and semaphores. State points into a shared region so that every
+ * process holding the object sees the same word. Without one it points to
+ * PrivateState, which keeps a waiter forever and leaves the whole state to
+ * NTSYNC. Userspace objects have no NTSYNC object at all, PrivateState is
+ * their count and is only changed under Lock, see userwait.c. For the
+ * others Lock only lines up NtAcquireSemaphoreEx callers when there is no
+ * shared state. RegistryLock is OBJ_REGISTRY_LOCK, see registry.c.
+ */
+typedef struct _RTLP_DISPATCHER
+{
+        RTLP_OBJECT Header;
+        int Object;
+        LONG MaximumCount;
+        bool ManualReset;
+        bool Shared;
+        bool Userspace;
+        bool RegistryLock;
+        RTLP_SHARED_SLOT Slot;
+        _Atomic ULONGLONG *State;
+        _Atomic ULONGLONG PrivateState;
+        pthread_mutex_t Lock;
+        struct _RTLP_WAIT_ENTRY *FirstWaiter;
+        struct _RTLP_WAIT_ENTRY *LastWaiter;
+        ULONG WaitAllCount;
+        ULONG AcquireWaitCount;
+} RTLP_DISPATCHER, *PRTLP_DISPATCHER;
+
+NTSTATUS RtlpGetNtStatusFromUnixErrno(void);
+NTSTATUS RtlpFormatTimeOut(PLARGE_INTEGER TimeOut, __u64 *Deadline);
+bool RtlpGetRemainingTimeOut(__u64 Deadline, PLARGE_INTEGER TimeOut);
+ULONG RtlpGetOwnerId(void);
+void RtlpArmThreadExit(void);
+void RtlpUserThreadExit(void);
+void RtlpCloseThread(PRTLP_OBJECT Record);
+PRTLP_DISPATCHER RtlpGetThreadEvent(PRTLP_OBJECT Record);
+HANDLE RtlpGetGlobalKeyedEvent(void);
+NTSTATUS RtlpFutexWait(_Atomic ULONG *Address, ULONG Value, __u64 Deadline);
+void RtlpFutexWake(_Atomic ULONG *Address, int Count);
+
+bool RtlpAllocateSharedState(PRTLP_SHARED_SLOT Slot);
+void RtlpReferenceSharedState(PRTLP_SHARED_SLOT Slot);
+void RtlpReleaseSharedState(PRTLP_SHARED_SLOT Slot);
+int RtlpGetSharedRegionObject(PRTLP_SHARED_SLOT Slot);
+bool RtlpMapSharedState(int Object, ULONG Index, PRTLP_SHARED_SLOT Slot);
+
+NTSTATUS RtlpSendObject(int Socket, PRTLP_OBJECT Record, ULONG DesiredAccess);
+NTSTATUS RtlpReceiveObject(int Socket, PHANDLE TargetHandle);
+NTSTATUS RtlpOpenObjectName(POBJECT_ATTRIBUTES ObjectAttributes, RTLP_OBJECT_TYPE Type, ULONG DesiredAccess, bool Create, PHANDLE Handle);
+NTSTATUS RtlpInsertObjectName(POBJECT_ATTRIBUTES ObjectAttributes, RTLP_OBJECT_TYPE Type, PHANDLE Handle);
+void RtlpCloseObjectName(struct _RTLP_OBJECT_NAME *Name);
+
+bool RtlpInsertObject(int Object, PRTLP_OBJECT Record);
+PRTLP_OBJECT RtlpLookupObject(int Object);
+PRTLP_OBJECT RtlpRemoveObject(int Object);
+void RtlpFreeDispatcher(PRTLP_DISPATCHER Dispatcher);
+void RtlpForkDispatcher(PRTLP_DISPATCHER Dispatcher);
+NTSTATUS RtlpCreateEvent(PHANDLE EventHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes, EVENT_TYPE EventType, BOOLEAN InitialState);
+NTSTATUS RtlpSetEventDispatcher(PRTLP_DISPATCHER Event);
+NTSTATUS RtlpResetEventDispatcher(PRTLP_DISPATCHER Event);
+
+/* One generation of a broadcast event, a notification event that is set
+ * once and reused once nobody references it anymore. Waiters hold a
+ * reference from before they look at the event until they are done. */
+typedef struct _RTLP_BROADCAST_GENERATION
+{
+        PRTLP_DISPATCHER Event;
+        _Atomic LONG References;
+        struct _RTLP_BROADCAST_GENERATION *Next;
+} RTLP_BROADCAST_GENERATION, *PRTLP_BROADCAST_GENERATION;
+
+PRTLP_BROADCAST_GENERATION RtlpReferenceBroadcast(PRTLP_OBJECT Record);
+void RtlpDereferenceBroadcast(PRTLP_BROADCAST_GENERATION Generation);
+void RtlpCloseBroadcast(PRTLP_OBJECT Record);
+void RtlpForkBroadcast(PRTLP_OBJECT Record);
+
+void RtlpInitializeUserDispatcher(PRTLP_DISPATCHER Dispatcher, ULONG Value);
+void RtlpResetUserDispatcher(PRTLP_DISPATCHER Dispatcher);
+NTSTATUS RtlpWaitForUserObjects(ULONG Count, PRTLP_DISPATCHER *Objects, WAIT_TYPE WaitType, PLARGE_INTEGER TimeOut);
+NTSTATUS RtlpAcquireUserSemaphore(PRTLP_DISPATCHER Semaphore, LONG AcquireCount, PLARGE_INTEGER TimeOut);
+NTSTATUS RtlpReleaseUserSemaphore(PRTLP_DISPATCHER Semaphore, LONG ReleaseCount, PLONG PreviousCount);
+NTSTATUS RtlpModifyUserEvent(PRTLP_DISPATCHER Event, unsigned long Opcode, PLONG PreviousState);
+
+/* Calls recorded by the sync trace, see trace.c */
+typedef enum _RTLP_TRACE_OPERATION
+{
+        RtlpTraceCreateEvent = 1,
+        RtlpTraceOpenEvent,
+        RtlpTraceSetEvent,
+        RtlpTraceResetEvent,
+        RtlpTracePulseEvent,
+        RtlpTraceCreateSemaphore,
+        RtlpTraceOpenSemaphore,
+        RtlpTraceReleaseSemaphore,
+        RtlpTraceCreateMutant,
+        RtlpTraceReleaseMutant,
+        RtlpTraceWaitForSingleObject,
+        RtlpTraceWaitForMultipleObjects,
+        RtlpTraceClose,
+        RtlpTraceAcquireSemaphore,
+        RtlpTraceCreateBroadcastEvent,
+        RtlpTraceBroadcastEvent,
+        RtlpTraceExtension = 0xff,
+} RTLP_TRACE_OPERATION;
+
+extern _Atomic bool RtlpTraceActive;
+ULONGLONG RtlpGetTraceTime(void);
+LONG RtlpGetTraceTimeOut(PLARGE_INTEGER TimeOut);
+void RtlpTraceCall(ULONGLONG Start, RTLP_TRACE_OPERATION Operation, int Object, LONG Argument, USHORT Flags, NTSTATUS Status);
+void RtlpTraceCallEx(ULONGLONG Start, RTLP_TRACE_OPERATION Operation, int Object, LONG Argument, USHORT Flags, ULONG ExtraCount,
+                     const int *Extra, NTSTATUS Status);
+void RtlpTraceWait(ULONGLONG Start, ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType, PLARGE_INTEGER TimeOut, NTSTATUS Status);
+
+/* Start time of a traced call, 0 while nothing is recorded, which every
+ * RtlpTrace function takes as a call to ignore */
+static inline ULONGLONG RtlpTraceBegin(void)
+{
+        return atomic_load_explicit(&RtlpTraceActive, memory_order_relaxed) ? RtlpGetTraceTime() : 0;
+}
+
+/* Object registry and deadlock detector, see registry.c */
+extern _Atomic bool RtlpRegistryActive;
+void RtlpRegistryInsertObject(int Object, PRTLP_OBJECT Record);
+void RtlpRegistryRemoveObject(int Object);
+void RtlpRegistryAcquire(int Object);
+void RtlpRegistryRelease(int Object);
+void RtlpRegistryEnterWait(ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType);
+void RtlpRegistryLeaveWait(ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType, NTSTATUS Status);
+
+/* Publishes the wait of the caller, false while the registry is off, in
+ * which case RtlpRegistryLeaveWait isn't needed either */
+static inline bool RtlpRegistryBeginWait(ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType)
+{
+        if (!atomic_load_explicit(&RtlpRegistryActive, memory_order_relaxed)) {
+                return false;
+        }
+
+        RtlpRegistryEnterWait(Count, Handles, WaitType);
+        return true;
+}
@@ -0,0 +1,759 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 21/10/2026 GMT +7 20.30
+ * - Initial object registry, wait-for graph and deadlock detector
+ * 22/10/2026 GMT +7 09.20
+ * - Broadcast events are listed as notification events
+ * 23/10/2026 GMT +7 18.30
+ * - Events and semaphores are only locks with OBJ_REGISTRY_LOCK
+ * - A waiter is never held back by an object it holds itself
+ */
+
+/* The registry is off until RtlStartObjectRegistry, or LIBNTSYNC_REGISTRY
+ * when the library is loaded, and costs a relaxed load per call until then.
+ *
+ * While it runs every fd holding an object has an entry in a table of its
+ * own with the type of the object and, for objects used as locks, the
+ * thread holding it. Mutants are locks, and so are auto-reset events and
+ * semaphores marked with OBJ_REGISTRY_LOCK, held by the thread whose wait
+ * took them until they are released or set. The table never points to a record, so
+ * reading it can't race with a close.
+ *
+ * Each thread publishes what it waits on in a wait record of its own,
+ * written only by that thread under a sequence count. Readers copy the
+ * record and try again if the count moved. Records are never freed, the
+ * record of a thread that exited goes to the next new thread.
+ *
+ * The detector reduces the wait-for graph of a snapshot: an object without
+ * a holder, or held by a thread that isn't stuck, lets its waiters go on,
+ * a wait-all needs all of its objects for that. The waiters left over can
+ * never wake up. They are reported once seen stuck in the same wait twice
+ * in a row, which rules out a holder that was just being updated.
+ */
+
+#define _GNU_SOURCE
+#include "ntp.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RTLP_REGISTRY_PAGE_SHIFT 10
+#define RTLP_REGISTRY_PAGE_SIZE (1 << RTLP_REGISTRY_PAGE_SHIFT)
+#define RTLP_REGISTRY_DIRECTORY_SIZE 1024
+
+/* Bits of RtlpRegistryWake, what the registry thread was woken up for */
+#define RTLP_REGISTRY_WAKE_DUMP 0x1
+#define RTLP_REGISTRY_WAKE_STOP 0x2
+
+typedef struct _RTLP_REGISTRY_ENTRY
+{
+        _Atomic UCHAR Type;
+        _Atomic bool Lock;
+        _Atomic ULONG Holder;
+} RTLP_REGISTRY_ENTRY, *PRTLP_REGISTRY_ENTRY;
+
+typedef struct _RTLP_WAIT_RECORD
+{
+        struct _RTLP_WAIT_RECORD *Next;
+        _Atomic ULONG ThreadId;
+        _Atomic ULONG Sequence;
+        _Atomic UCHAR WaitType;
+        _Atomic UCHAR Count;
+        _Atomic ULONGLONG Since;
+        _Atomic int Objects[MAXIMUM_WAIT_OBJECTS];
+        /* Only used by the registry thread */
+        ULONGLONG StuckSince;
+        ULONGLONG ReportedSince;
+} RTLP_WAIT_RECORD, *PRTLP_WAIT_RECORD;
+
+_Atomic bool RtlpRegistryActive;
+static _Atomic(PRTLP_REGISTRY_ENTRY) RtlpRegistryDirectory[RTLP_REGISTRY_DIRECTORY_SIZE];
+static _Atomic(PRTLP_WAIT_RECORD) RtlpWaitRecords;
+static __thread PRTLP_WAIT_RECORD RtlpCurrentWaitRecord;
+static pthread_key_t RtlpWaitRecordKey;
+static pthread_mutex_t RtlpRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t RtlpRegistryThread;
+static bool RtlpRegistryThreadRunning;
+static _Atomic ULONG RtlpRegistryWake;
+static ULONG RtlpRegistryInterval;
+static int RtlpRegistrySignal;
+static struct sigaction RtlpRegistryOldAction;
+
+static const char *const RtlpRegistryTypeNames[] = {
+        [RtlObjectStateInvalid] = "object",
+        [RtlObjectStateNotificationEvent] = "notification event",
+        [RtlObjectStateSynchronizationEvent] = "synchronization event",
+        [RtlObjectStateSemaphore] = "semaphore",
+        [RtlObjectStateMutant] = "mutant",
+        [RtlObjectStateThread] = "thread",
+        [RtlObjectStateKeyedEvent] = "keyed event",
+};
+
+static ULONGLONG RtlpGetRegistryTime(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static PRTLP_REGISTRY_ENTRY RtlpGetRegistryEntry(int Object, bool Create)
+{
+        if (Object < 0 || Object >= RTLP_REGISTRY_DIRECTORY_SIZE * RTLP_REGISTRY_PAGE_SIZE) {
+                return NULL;
+        }
+
+        PRTLP_REGISTRY_ENTRY Page = atomic_load_explicit(&RtlpRegistryDirectory[Object >> RTLP_REGISTRY_PAGE_SHIFT], memory_order_acquire);
+        if (Page == NULL) {
+                if (!Create) {
+                        return NULL;
+                }
+
+                PRTLP_REGISTRY_ENTRY NewPage = calloc(RTLP_REGISTRY_PAGE_SIZE, sizeof(*NewPage));
+                if (NewPage == NULL) {
+                        return NULL;
+                }
+
+                if (atomic_compare_exchange_strong_explicit(&RtlpRegistryDirectory[Object >> RTLP_REGISTRY_PAGE_SHIFT], &Page, NewPage,
+                                                            memory_order_acq_rel, memory_order_acquire)) {
+                        Page = NewPage;
+                } else {
+                        free(NewPage);
+                }
+        }
+
+        return &Page[Object & (RTLP_REGISTRY_PAGE_SIZE - 1)];
+}
+
+/* Only called by threads holding a handle to the record */
+static UCHAR RtlpGetRegistryType(PRTLP_OBJECT Record, bool *Lock)
+{
+        PRTLP_DISPATCHER Dispatcher = (PRTLP_DISPATCHER)Record;
+        *Lock = false;
+        switch (Record->Type) {
+                case RtlpMutantObject:
+                        *Lock = true;
+                        return RtlObjectStateMutant;
+                case RtlpEventObject:
+                        *Lock = !Dispatcher->ManualReset && Dispatcher->RegistryLock;
+                        return Dispatcher->ManualReset ? RtlObjectStateNotificationEvent : RtlObjectStateSynchronizationEvent;
+                case RtlpSemaphoreObject:
+                        *Lock = Dispatcher->RegistryLock;
+                        return RtlObjectStateSemaphore;
+                case RtlpThreadObject:
+                        return RtlObjectStateThread;
+                case RtlpBroadcastObject:
+                        return RtlObjectStateNotificationEvent;
+                case RtlpKeyedEventObject:
+                        return RtlObjectStateKeyedEvent;
+                default:
+                        return RtlObjectStateInvalid;
+        }
+}
+
+static PRTLP_REGISTRY_ENTRY RtlpUpdateRegistryEntry(int Object, PRTLP_OBJECT Record)
+{
+        PRTLP_REGISTRY_ENTRY Entry = RtlpGetRegistryEntry(Object, true);
+        if (Entry == NULL || Record == NULL) {
+                return Entry;
+        }
+
+        bool Lock;
+        atomic_store_explicit(&Entry->Type, RtlpGetRegistryType(Record, &Lock), memory_order_relaxed);
+        atomic_store_explicit(&Entry->Lock, Lock, memory_order_relaxed);
+        return Entry;
+}
+
+void RtlpRegistryInsertObject(int Object, PRTLP_OBJECT Record)
+{
+        if (!atomic_load_explicit(&RtlpRegistryActive, memory_order_relaxed)) {
+                return;
+        }
+
+        PRTLP_REGISTRY_ENTRY Entry = RtlpUpdateRegistryEntry(Object, Record);
+        if (Entry != NULL) {
+                atomic_store_explicit(&Entry->Holder, 0, memory_order_relaxed);
+        }
+}
+
+void RtlpRegistryRemoveObject(int Object)
+{
+        if (!atomic_load_explicit(&RtlpRegistryActive, memory_order_relaxed)) {
+                return;
+        }
+
+        PRTLP_REGISTRY_ENTRY Entry = RtlpGetRegistryEntry(Object, false);
+        if (Entry != NULL) {
+                atomic_store_explicit(&Entry->Type, RtlObjectStateInvalid, memory_order_relaxed);
+                atomic_store_explicit(&Entry->Lock, false, memory_order_relaxed);
+                atomic_store_explicit(&Entry->Holder, 0, memory_order_relaxed);
+        }
+}
+
+/* The caller took Object, which it holds if Object is a lock */
+void RtlpRegistryAcquire(int Object)
+{
+        if (!atomic_load_explicit(&RtlpRegistryActive, memory_order_relaxed)) {
+                return;
+        }
+
+        PRTLP_REGISTRY_ENTRY Entry = RtlpUpdateRegistryEntry(Object, RtlpLookupObject(Object));
+        if (Entry != NULL && atomic_load_explicit(&Entry->Lock, memory_order_relaxed)) {
+                atomic_store_explicit(&Entry->Holder, RtlpGetOwnerId(), memory_order_relaxed);
+        }
+}
+
+void RtlpRegistryRelease(int Object)
+{
+        if (!atomic_load_explicit(&RtlpRegistryActive, memory_order_relaxed)) {
+                return;
+        }
+
+        PRTLP_REGISTRY_ENTRY Entry = RtlpGetRegistryEntry(Object, false);
+        if (Entry != NULL) {
+                atomic_store_explicit(&Entry->Holder, 0, memory_order_relaxed);
+        }
+}
+
+static void RtlpReleaseWaitRecord(PVOID Context)
+{
+        PRTLP_WAIT_RECORD Record = Context;
+        atomic_store_explicit(&Record->Count, 0, memory_order_relaxed);
+        atomic_store_explicit(&Record->ThreadId, 0, memory_order_release);
+        RtlpCurrentWaitRecord = NULL;
+}
+
+static PRTLP_WAIT_RECORD RtlpGetWaitRecord(void)
+{
+        if (RtlpCurrentWaitRecord != NULL) {
+                return RtlpCurrentWaitRecord;
+        }
+
+        ULONG ThreadId = RtlpGetOwnerId();
+        PRTLP_WAIT_RECORD Record = atomic_load_explicit(&RtlpWaitRecords, memory_order_acquire);
+        for (; Record != NULL; Record = Record->Next) {
+                ULONG Free = 0;
+                if (atomic_compare_exchange_strong_explicit(&Record->ThreadId, &Free, ThreadId, memory_order_acquire, memory_order_relaxed)) {
+                        break;
+                }
+        }
+
+        if (Record == NULL) {
+                Record = calloc(1, sizeof(*Record));
+                if (Record == NULL) {
+                        return NULL;
+                }
+                atomic_init(&Record->ThreadId, ThreadId);
+
+                PRTLP_WAIT_RECORD Head = atomic_load_explicit(&RtlpWaitRecords, memory_order_relaxed);
+                do {
+                        Record->Next = Head;
+                } while (!atomic_compare_exchange_weak_explicit(&RtlpWaitRecords, &Head, Record, memory_order_release, memory_order_relaxed));
+        }
+
+        pthread_setspecific(RtlpWaitRecordKey, Record);
+        RtlpCurrentWaitRecord = Record;
+        return Record;
+}
+
+static ULONG RtlpBeginWaitRecordUpdate(PRTLP_WAIT_RECORD Record)
+{
+        ULONG Sequence = atomic_load_explicit(&Record->Sequence, memory_order_relaxed);
+        atomic_store_explicit(&Record->Sequence, Sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        return Sequence + 2;
+}
+
+static void RtlpEndWaitRecordUpdate(PRTLP_WAIT_RECORD Record, ULONG Sequence)
+{
+        atomic_store_explicit(&Record->Sequence, Sequence, memory_order_release);
+}
+
+void RtlpRegistryEnterWait(ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType)
+{
+        PRTLP_WAIT_RECORD Record = RtlpGetWaitRecord();
+        if (Record == NULL || Handles == NULL || Count == 0 || Count > MAXIMUM_WAIT_OBJECTS) {
+                return;
+        }
+
+        ULONG Sequence = RtlpBeginWaitRecordUpdate(Record);
+        for (ULONG i = 0; i < Count; i++) {
+                atomic_store_explicit(&Record->Objects[i], Handles[i].Object, memory_order_relaxed);
+        }
+        atomic_store_explicit(&Record->WaitType, WaitType, memory_order_relaxed);
+        atomic_store_explicit(&Record->Since, RtlpGetRegistryTime(), memory_order_relaxed);
+        atomic_store_explicit(&Record->Count, Count, memory_order_relaxed);
+        RtlpEndWaitRecordUpdate(Record, Sequence);
+}
+
+void RtlpRegistryLeaveWait(ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType, NTSTATUS Status)
+{
+        PRTLP_WAIT_RECORD Record = RtlpCurrentWaitRecord;
+        if (Record == NULL || Handles == NULL || Count == 0 || Count > MAXIMUM_WAIT_OBJECTS) {
+                return;
+        }
+
+        ULONG Sequence = RtlpBeginWaitRecordUpdate(Record);
+        atomic_store_explicit(&Record->Count, 0, memory_order_relaxed);
+        RtlpEndWaitRecordUpdate(Record, Sequence);
+
+        ULONG Index;
+        if (Status <= STATUS_WAIT_63) {
+                Index = Status;
+        } else if (Status >= STATUS_ABANDONED_WAIT_0 && Status <= STATUS_ABANDONED_WAIT_63) {
+                Index = Status - STATUS_ABANDONED_WAIT_0;
+        } else {
+                return;
+        }
+
+        for (ULONG i = 0; i < Count; i++) {
+                if (WaitType == WaitAll || i == Index) {
+                        RtlpRegistryAcquire(Handles[i].Object);
+                }
+        }
+}
+
+/* A consistent copy of Record, false if its thread isn't waiting. A holder
+ * the waiter is itself never holds it back: a mutant it owns is taken again
+ * at once, and an event or semaphore it took last is usually set again by
+ * another thread, like a worker going back to wait for its next job. */
+static bool RtlpReadWaitRecord(PRTLP_WAIT_RECORD Record, PRTL_REGISTRY_WAITER Waiter, ULONGLONG Now)
+{
+        ULONG Sequence;
+        ULONG Count;
+        do {
+                while ((Sequence = atomic_load_explicit(&Record->Sequence, memory_order_acquire)) & 1) {
+                }
+
+                Waiter->ThreadId = atomic_load_explicit(&Record->ThreadId, memory_order_relaxed);
+                Count = atomic_load_explicit(&Record->Count, memory_order_relaxed);
+                for (ULONG i = 0; i < Count; i++) {
+                        Waiter->Objects[i] = atomic_load_explicit(&Record->Objects[i], memory_order_relaxed);
+                }
+                Waiter->WaitType = atomic_load_explicit(&Record->WaitType, memory_order_relaxed);
+                Waiter->WaitTime.QuadPart = atomic_load_explicit(&Record->Since, memory_order_relaxed);
+                atomic_thread_fence(memory_order_acquire);
+        } while (atomic_load_explicit(&Record->Sequence, memory_order_relaxed) != Sequence);
+
+        if (Waiter->ThreadId == 0 || Count == 0) {
+                return false;
+        }
+
+        Waiter->Count = Count;
+        Waiter->Deadlocked = FALSE;
+        for (ULONG i = 0; i < Count; i++) {
+                PRTLP_REGISTRY_ENTRY Entry = RtlpGetRegistryEntry(Waiter->Objects[i], false);
+                Waiter->Types[i] = Entry != NULL ? atomic_load_explicit(&Entry->Type, memory_order_relaxed) : RtlObjectStateInvalid;
+                Waiter->Holders[i] = Entry != NULL ? atomic_load_explicit(&Entry->Holder, memory_order_relaxed) : 0;
+                if (Waiter->Holders[i] == Waiter->ThreadId) {
+                        Waiter->Holders[i] = 0;
+                }
+        }
+
+        /* Since is kept in WaitTime until the caller is done with it */
+        ULONGLONG Since = Waiter->WaitTime.QuadPart;
+        Waiter->WaitTime.QuadPart = Now > Since ? (Now - Since) / 100 : 0;
+        return true;
+}
+
+/* Copies every waiting thread into Waiters, up to Capacity of them, and
+ * their records into Records if it isn't NULL. Returns how many threads
+ * wait, which may be more than Capacity. */
+static ULONG RtlpCollectWaiters(PRTL_REGISTRY_WAITER Waiters, PRTLP_WAIT_RECORD *Records, ULONGLONG *Since, ULONG Capacity)
+{
+        ULONGLONG Now = RtlpGetRegistryTime();
+        RTL_REGISTRY_WAITER Spare;
+        ULONG Count = 0;
+        for (PRTLP_WAIT_RECORD Record = atomic_load_explicit(&RtlpWaitRecords, memory_order_acquire); Record != NULL; Record = Record->Next) {
+                PRTL_REGISTRY_WAITER Waiter = Count < Capacity ? &Waiters[Count] : &Spare;
+                if (!RtlpReadWaitRecord(Record, Waiter, Now)) {
+                        continue;
+                }
+
+                if (Count < Capacity && Records != NULL) {
+                        Records[Count] = Record;
+                        Since[Count] = Now - Waiter->WaitTime.QuadPart * 100;
+                }
+                Count++;
+        }
+
+        return Count;
+}
+
+typedef struct _RTLP_WAITER_INDEX
+{
+        ULONG ThreadId;
+        ULONG Index;
+} RTLP_WAITER_INDEX, *PRTLP_WAITER_INDEX;
+
+static int RtlpCompareWaiterIndex(const void *Left, const void *Right)
+{
+        ULONG LeftId = ((const RTLP_WAITER_INDEX *)Left)->ThreadId;
+        ULONG RightId = ((const RTLP_WAITER_INDEX *)Right)->ThreadId;
+        return (LeftId > RightId) - (LeftId < RightId);
+}
+
+/* Marks the waiters that can never wake up, returns how many there are */
+static ULONG RtlpReduceWaitGraph(PRTL_REGISTRY_WAITER Waiters, ULONG Count)
+{
+        PRTLP_WAITER_INDEX Index = malloc(Count * sizeof(*Index));
+        if (Count != 0 && Index == NULL) {
+                return 0;
+        }
+
+        for (ULONG i = 0; i < Count; i++) {
+                Waiters[i].Deadlocked = TRUE;
+                Index[i].ThreadId = Waiters[i].ThreadId;
+                Index[i].Index = i;
+        }
+        qsort(Index, Count, sizeof(*Index), RtlpCompareWaiterIndex);
+
+        ULONG Deadlocked = Count;
+        bool Changed = true;
+        while (Changed) {
+                Changed = false;
+                for (ULONG i = 0; i < Count; i++) {
+                        PRTL_REGISTRY_WAITER Waiter = &Waiters[i];
+                        if (!Waiter->Deadlocked) {
+                                continue;
+                        }
+
+                        ULONG Available = 0;
+                        for (ULONG j = 0; j < Waiter->Count; j++) {
+                                RTLP_WAITER_INDEX Key = {.ThreadId = Waiter->Holders[j]};
+                                PRTLP_WAITER_INDEX Holder = Key.ThreadId != 0 ? bsearch(&Key, Index, Count, sizeof(*Index), RtlpCompareWaiterIndex) : NULL;
+                                Available += Holder == NULL || !Waiters[Holder->Index].Deadlocked;
+                        }
+
+                        if (Waiter->WaitType == WaitAll ? Available == Waiter->Count : Available != 0) {
+                                Waiter->Deadlocked = FALSE;
+                                Deadlocked--;
+                                Changed = true;
+                        }
+                }
+        }
+
+        free(Index);
+        return Deadlocked;
+}
+
+static void RtlpWriteRegistryReport(int Output, const char *Title, PRTL_REGISTRY_WAITER Waiters, ULONG Count)
+{
+        ULONG Objects[RtlObjectStateKeyedEvent + 1] = {0};
+        ULONG Held = 0;
+        for (size_t i = 0; i < RTLP_REGISTRY_DIRECTORY_SIZE; i++) {
+                PRTLP_REGISTRY_ENTRY Page = atomic_load_explicit(&RtlpRegistryDirectory[i], memory_order_acquire);
+                for (size_t j = 0; Page != NULL && j < RTLP_REGISTRY_PAGE_SIZE; j++) {
+                        UCHAR Type = atomic_load_explicit(&Page[j].Type, memory_order_relaxed);
+                        if (Type != RtlObjectStateInvalid && Type <= RtlObjectStateKeyedEvent) {
+                                Objects[Type]++;
+                                Held += atomic_load_explicit(&Page[j].Holder, memory_order_relaxed) != 0;
+                        }
+                }
+        }
+
+        dprintf(Output, "libntsync: %s, pid %d\n", Title, getpid());
+        dprintf(Output, "  objects: %u notification events, %u synchronization events, %u semaphores, %u mutants, %u threads, %u keyed events, %u held\n",
+                Objects[RtlObjectStateNotificationEvent], Objects[RtlObjectStateSynchronizationEvent], Objects[RtlObjectStateSemaphore],
+                Objects[RtlObjectStateMutant], Objects[RtlObjectStateThread], Objects[RtlObjectStateKeyedEvent], Held);
+
+        for (ULONG i = 0; i < Count; i++) {
+                PRTL_REGISTRY_WAITER Waiter = &Waiters[i];
+                dprintf(Output, "  thread %u%s waits %lld.%03llds for %s of", Waiter->ThreadId, Waiter->Deadlocked ? " (deadlocked)" : "",
+                        (long long)Waiter->WaitTime.QuadPart / 10000000, (long long)Waiter->WaitTime.QuadPart / 10000 % 1000, Waiter->WaitType == WaitAll ? "all" : "any");
+                for (ULONG j = 0; j < Waiter->Count; j++) {
+                        UCHAR Type = Waiter->Types[j] <= RtlObjectStateKeyedEvent ? Waiter->Types[j] : RtlObjectStateInvalid;
+                        if (Waiter->Holders[j] != 0) {
+                                dprintf(Output, " %d (%s held by %u)", Waiter->Objects[j], RtlpRegistryTypeNames[Type], Waiter->Holders[j]);
+                        } else {
+                                dprintf(Output, " %d (%s)", Waiter->Objects[j], RtlpRegistryTypeNames[Type]);
+                        }
+                }
+                dprintf(Output, "\n");
+        }
+}
+
+/* Collects every waiter into a buffer grown as needed */
+static ULONG RtlpSnapshotWaiters(PRTL_REGISTRY_WAITER *Waiters, PRTLP_WAIT_RECORD **Records, ULONGLONG **Since, ULONG *Capacity)
+{
+        for (;;) {
+                ULONG Count = RtlpCollectWaiters(*Waiters, Records != NULL ? *Records : NULL, Since != NULL ? *Since : NULL, *Capacity);
+                if (Count <= *Capacity) {
+                        return Count;
+                }
+
+                ULONG NewCapacity = Count + Count / 2;
+                PRTL_REGISTRY_WAITER NewWaiters = realloc(*Waiters, NewCapacity * sizeof(**Waiters));
+                if (NewWaiters == NULL) {
+                        return *Capacity;
+                }
+                *Waiters = NewWaiters;
+
+                if (Records != NULL) {
+                        PRTLP_WAIT_RECORD *NewRecords = realloc(*Records, NewCapacity * sizeof(**Records));
+                        ULONGLONG *NewSince = NewRecords != NULL ? realloc(*Since, NewCapacity * sizeof(**Since)) : NULL;
+                        if (NewRecords != NULL) {
+                                *Records = NewRecords;
+                        }
+                        if (NewSince == NULL) {
+                                return *Capacity;
+                        }
+                        *Since = NewSince;
+                }
+                *Capacity = NewCapacity;
+        }
+}
+
+NTSTATUS RtlDumpObjectRegistry(int FileDescriptor)
+{
+        if (!atomic_load_explicit(&RtlpRegistryActive, memory_order_relaxed)) {
+                errno = EINVAL;
+                return STATUS_UNSUCCESSFUL;
+        }
+
+        PRTL_REGISTRY_WAITER Waiters = NULL;
+        ULONG Capacity = 0;
+        ULONG Count = RtlpSnapshotWaiters(&Waiters, NULL, NULL, &Capacity);
+        RtlpReduceWaitGraph(Waiters, Count);
+        RtlpWriteRegistryReport(FileDescriptor, "registry dump", Waiters, Count);
+        free(Waiters);
+        return STATUS_SUCCESS;
+}
+
+/* Reports the threads found stuck in the same wait by two passes in a row,
+ * each wait only once. */
+static void RtlpDetectDeadlocks(PRTL_REGISTRY_WAITER *Waiters, PRTLP_WAIT_RECORD **Records, ULONGLONG **Since, ULONG *Capacity)
+{
+        ULONG Count = RtlpSnapshotWaiters(Waiters, Records, Since, Capacity);
+        if (RtlpReduceWaitGraph(*Waiters, Count) == 0) {
+                return;
+        }
+
+        bool Report = false;
+        for (ULONG i = 0; i < Count; i++) {
+                PRTLP_WAIT_RECORD Record = (*Records)[i];
+                if (!(*Waiters)[i].Deadlocked) {
+                        Record->StuckSince = 0;
+                } else if (Record->StuckSince != (*Since)[i]) {
+                        Record->StuckSince = (*Since)[i];
+                } else if (Record->ReportedSince != (*Since)[i]) {
+                        Record->ReportedSince = (*Since)[i];
+                        Report = true;
+                }
+        }
+
+        if (Report) {
+                RtlpWriteRegistryReport(STDERR_FILENO, "deadlock detected", *Waiters, Count);
+        }
+}
+
+static void *RtlpRegistryThreadStart(void *Context)
+{
+        (void)Context;
+        PRTL_REGISTRY_WAITER Waiters = NULL;
+        PRTLP_WAIT_RECORD *Records = NULL;
+        ULONGLONG *Since = NULL;
+        ULONG Capacity = 0;
+
+        for (;;) {
+                __u64 Deadline = UINT64_MAX;
+                if (RtlpRegistryInterval != 0) {
+                        LARGE_INTEGER TimeOut = {.QuadPart = -(LONGLONG)RtlpRegistryInterval * 10000};
+                        RtlpFormatTimeOut(&TimeOut, &Deadline);
+                }
+                RtlpFutexWait(&RtlpRegistryWake, 0, Deadline);
+
+                ULONG Wake = atomic_exchange_explicit(&RtlpRegistryWake, 0, memory_order_acquire);
+                if (Wake & RTLP_REGISTRY_WAKE_STOP) {
+                        break;
+                }
+
+                if (Wake & RTLP_REGISTRY_WAKE_DUMP) {
+                        RtlDumpObjectRegistry(STDERR_FILENO);
+                }
+
+                if (RtlpRegistryInterval != 0) {
+                        RtlpDetectDeadlocks(&Waiters, &Records, &Since, &Capacity);
+                }
+        }
+
+        free(Waiters);
+        free(Records);
+        free(Since);
+        return NULL;
+}
+
+/* Only wakes the registry thread, nothing else is safe in a handler */
+static void RtlpRegistrySignalHandler(int Signal)
+{
+        (void)Signal;
+        int Error = errno;
+        atomic_fetch_or_explicit(&RtlpRegistryWake, RTLP_REGISTRY_WAKE_DUMP, memory_order_release);
+        RtlpFutexWake(&RtlpRegistryWake, 1);
+        errno = Error;
+}
+
+NTSTATUS RtlStartObjectRegistry(ULONG Interval, int Signal)
+{
+        if (Signal < 0 || Signal >= NSIG || Signal == SIGKILL || Signal == SIGSTOP) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        pthread_mutex_lock(&RtlpRegistryLock);
+        if (atomic_load_explicit(&RtlpRegistryActive, memory_order_relaxed)) {
+                pthread_mutex_unlock(&RtlpRegistryLock);
+                errno = EBUSY;
+                return STATUS_UNSUCCESSFUL;
+        }
+
+        /* Whatever a previous run left is stale by now */
+        for (size_t i = 0; i < RTLP_REGISTRY_DIRECTORY_SIZE; i++) {
+                PRTLP_REGISTRY_ENTRY Page = atomic_load_explicit(&RtlpRegistryDirectory[i], memory_order_relaxed);
+                for (size_t j = 0; Page != NULL && j < RTLP_REGISTRY_PAGE_SIZE; j++) {
+                        atomic_store_explicit(&Page[j].Type, RtlObjectStateInvalid, memory_order_relaxed);
+                        atomic_store_explicit(&Page[j].Lock, false, memory_order_relaxed);
+                        atomic_store_explicit(&Page[j].Holder, 0, memory_order_relaxed);
+                }
+        }
+
+        RtlpRegistryInterval = Interval;
+        RtlpRegistrySignal = Signal;
+        atomic_store_explicit(&RtlpRegistryWake, 0, memory_order_relaxed);
+        atomic_store_explicit(&RtlpRegistryActive, true, memory_order_release);
+
+        if (Interval != 0 || Signal != 0) {
+                int ret = pthread_create(&RtlpRegistryThread, NULL, RtlpRegistryThreadStart, NULL);
+                if (ret != 0) {
+                        atomic_store_explicit(&RtlpRegistryActive, false, memory_order_relaxed);
+                        pthread_mutex_unlock(&RtlpRegistryLock);
+                        errno = ret;
+                        return RtlpGetNtStatusFromUnixErrno();
+                }
+                RtlpRegistryThreadRunning = true;
+        }
+
+        if (Signal != 0) {
+                struct sigaction Action = {.sa_handler = RtlpRegistrySignalHandler, .sa_flags = SA_RESTART};
+                sigemptyset(&Action.sa_mask);
+                sigaction(Signal, &Action, &RtlpRegistryOldAction);
+        }
+        pthread_mutex_unlock(&RtlpRegistryLock);
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlStopObjectRegistry(void)
+{
+        pthread_mutex_lock(&RtlpRegistryLock);
+        if (!atomic_load_explicit(&RtlpRegistryActive, memory_order_relaxed)) {
+                pthread_mutex_unlock(&RtlpRegistryLock);
+                errno = EINVAL;
+                return STATUS_UNSUCCESSFUL;
+        }
+
+        if (RtlpRegistrySignal != 0) {
+                sigaction(RtlpRegistrySignal, &RtlpRegistryOldAction, NULL);
+        }
+
+        if (RtlpRegistryThreadRunning) {
+                atomic_fetch_or_explicit(&RtlpRegistryWake, RTLP_REGISTRY_WAKE_STOP, memory_order_release);
+                RtlpFutexWake(&RtlpRegistryWake, 1);
+                pthread_join(RtlpRegistryThread, NULL);
+                RtlpRegistryThreadRunning = false;
+        }
+        atomic_store_explicit(&RtlpRegistryActive, false, memory_order_relaxed);
+        pthread_mutex_unlock(&RtlpRegistryLock);
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlQueryObjectRegistry(PRTL_REGISTRY_SNAPSHOT Snapshot)
+{
+        if (Snapshot == NULL || (Snapshot->Objects == NULL && Snapshot->ObjectCapacity != 0) ||
+            (Snapshot->Waiters == NULL && Snapshot->WaiterCapacity != 0)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (!atomic_load_explicit(&RtlpRegistryActive, memory_order_relaxed)) {
+                errno = EINVAL;
+                return STATUS_UNSUCCESSFUL;
+        }
+
+        Snapshot->ObjectCount = 0;
+        for (size_t i = 0; i < RTLP_REGISTRY_DIRECTORY_SIZE; i++) {
+                PRTLP_REGISTRY_ENTRY Page = atomic_load_explicit(&RtlpRegistryDirectory[i], memory_order_acquire);
+                for (size_t j = 0; Page != NULL && j < RTLP_REGISTRY_PAGE_SIZE; j++) {
+                        UCHAR Type = atomic_load_explicit(&Page[j].Type, memory_order_relaxed);
+                        if (Type == RtlObjectStateInvalid) {
+                                continue;
+                        }
+
+                        if (Snapshot->ObjectCount < Snapshot->ObjectCapacity) {
+                                PRTL_REGISTRY_OBJECT Object = &Snapshot->Objects[Snapshot->ObjectCount];
+                                Object->Object = i * RTLP_REGISTRY_PAGE_SIZE + j;
+                                Object->Type = Type;
+                                Object->Holder = atomic_load_explicit(&Page[j].Holder, memory_order_relaxed);
+                        }
+                        Snapshot->ObjectCount++;
+                }
+        }
+
+        /* The graph needs every waiter, even those that don't fit */
+        PRTL_REGISTRY_WAITER Waiters = NULL;
+        ULONG Capacity = 0;
+        ULONG Count = RtlpSnapshotWaiters(&Waiters, NULL, NULL, &Capacity);
+        Snapshot->WaiterCount = Count;
+        Snapshot->DeadlockedCount = RtlpReduceWaitGraph(Waiters, Count);
+        memcpy(Snapshot->Waiters, Waiters, (Count < Snapshot->WaiterCapacity ? Count : Snapshot->WaiterCapacity) * sizeof(*Waiters));
+        free(Waiters);
+
+        if (Snapshot->ObjectCount > Snapshot->ObjectCapacity || Snapshot->WaiterCount > Snapshot->WaiterCapacity) {
+                return STATUS_BUFFER_OVERFLOW;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/* The child has no registry thread and only the forking thread, whose
+ * tid changed as well. */
+static void RtlpRegistryForkChild(void)
+{
+        pthread_mutex_init(&RtlpRegistryLock, NULL);
+        atomic_store_explicit(&RtlpRegistryActive, false, memory_order_relaxed);
+        RtlpRegistryThreadRunning = false;
+        for (PRTLP_WAIT_RECORD Record = atomic_load_explicit(&RtlpWaitRecords, memory_order_relaxed); Record != NULL; Record = Record->Next) {
+                atomic_store_explicit(&Record->Count, 0, memory_order_relaxed);
+                atomic_store_explicit(&Record->ThreadId, 0, memory_order_relaxed);
+        }
+        RtlpCurrentWaitRecord = NULL;
+        pthread_setspecific(RtlpWaitRecordKey, NULL);
+}
+
+/* LIBNTSYNC_REGISTRY is the detector interval in milliseconds, optionally
+ * followed by a comma and the number of the signal asking for a dump. */
+static void __attribute__((constructor)) RtlpInitializeRegistry(void)
+{
+        pthread_key_create(&RtlpWaitRecordKey, RtlpReleaseWaitRecord);
+        pthread_atfork(NULL, NULL, RtlpRegistryForkChild);
+
+        const char *Value = getenv("LIBNTSYNC_REGISTRY");
+        if (Value == NULL || *Value == '\0') {
+                return;
+        }
+
+        char *End;
+        ULONG Interval = strtoul(Value, &End, 10);
+        int Signal = *End == ',' ? (int)strtol(End + 1, NULL, 10) : 0;
+        RtlStartObjectRegistry(Interval, Signal);
+}
@@ -0,0 +1,162 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 19/10/2026 GMT +7 16.30
+ * - Initial run once implementation
+ */
+
+#include "ntp.h"
+#include <errno.h>
+#include <sched.h>
+
+/* Low bits of RTL_RUN_ONCE.Ptr
+ * 0 : not initialized
+ * 1 : synchronous initialization in progress, the other bits count waiters
+ * 2 : initialized, the other bits are the context
+ * 3 : asynchronous initialization in progress
+ */
+#define RTLP_RUN_ONCE_STATE_MASK ((uintptr_t)((1 << RTL_RUN_ONCE_CTX_RESERVED_BITS) - 1))
+#define RTLP_RUN_ONCE_UNINITIALIZED 0
+#define RTLP_RUN_ONCE_PENDING 1
+#define RTLP_RUN_ONCE_COMPLETED 2
+#define RTLP_RUN_ONCE_ASYNC_PENDING 3
+#define RTLP_RUN_ONCE_WAITER ((uintptr_t)1 << RTL_RUN_ONCE_CTX_RESERVED_BITS)
+
+void RtlRunOnceInitialize(PRTL_RUN_ONCE RunOnce)
+{
+        RunOnce->Ptr = NULL;
+}
+
+NTSTATUS RtlRunOnceBeginInitialize(PRTL_RUN_ONCE RunOnce, ULONG Flags, PVOID *Context)
+{
+        if (Flags & ~(RTL_RUN_ONCE_CHECK_ONLY | RTL_RUN_ONCE_ASYNC)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        uintptr_t Value = (uintptr_t)__atomic_load_n(&RunOnce->Ptr, __ATOMIC_ACQUIRE);
+        for (;;) {
+                switch (Value & RTLP_RUN_ONCE_STATE_MASK) {
+                        case RTLP_RUN_ONCE_COMPLETED:
+                                if (Context != NULL) {
+                                        *Context = (PVOID)(Value & ~RTLP_RUN_ONCE_STATE_MASK);
+                                }
+                                return STATUS_SUCCESS;
+
+                        case RTLP_RUN_ONCE_UNINITIALIZED:
+                                if (Flags & RTL_RUN_ONCE_CHECK_ONLY) {
+                                        errno = EINVAL;
+                                        return STATUS_UNSUCCESSFUL;
+                                }
+                                if (__atomic_compare_exchange_n(&RunOnce->Ptr, (PVOID *)&Value,
+                                                                (PVOID)(uintptr_t)(Flags & RTL_RUN_ONCE_ASYNC ? RTLP_RUN_ONCE_ASYNC_PENDING : RTLP_RUN_ONCE_PENDING),
+                                                                false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+                                        return STATUS_PENDING;
+                                }
+                                break;
+
+                        case RTLP_RUN_ONCE_ASYNC_PENDING:
+                                if (Flags & RTL_RUN_ONCE_CHECK_ONLY) {
+                                        errno = EINVAL;
+                                        return STATUS_UNSUCCESSFUL;
+                                }
+                                if (!(Flags & RTL_RUN_ONCE_ASYNC)) {
+                                        errno = EINVAL;
+                                        return STATUS_INVALID_PARAMETER;
+                                }
+                                return STATUS_PENDING;
+
+                        case RTLP_RUN_ONCE_PENDING:
+                                if (Flags & RTL_RUN_ONCE_CHECK_ONLY) {
+                                        errno = EINVAL;
+                                        return STATUS_UNSUCCESSFUL;
+                                }
+                                if (Flags & RTL_RUN_ONCE_ASYNC) {
+                                        errno = EINVAL;
+                                        return STATUS_INVALID_PARAMETER;
+                                }
+                                if (__atomic_compare_exchange_n(&RunOnce->Ptr, (PVOID *)&Value, (PVOID)(Value + RTLP_RUN_ONCE_WAITER),
+                                                                false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+                                        /* Counted, RtlRunOnceComplete hands us one release
+                                         * of the global keyed event. */
+                                        if (NtWaitForKeyedEvent(RtlpGetGlobalKeyedEvent(), RunOnce, FALSE, NULL) != STATUS_SUCCESS) {
+                                                while ((__atomic_load_n((uintptr_t *)&RunOnce->Ptr, __ATOMIC_ACQUIRE) & RTLP_RUN_ONCE_STATE_MASK) == RTLP_RUN_ONCE_PENDING) {
+                                                        sched_yield();
+                                                }
+                                        }
+                                        Value = (uintptr_t)__atomic_load_n(&RunOnce->Ptr, __ATOMIC_ACQUIRE);
+                                }
+                                break;
+                }
+        }
+}
+
+NTSTATUS RtlRunOnceComplete(PRTL_RUN_ONCE RunOnce, ULONG Flags, PVOID Context)
+{
+        if (Flags & ~(RTL_RUN_ONCE_ASYNC | RTL_RUN_ONCE_INIT_FAILED)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if ((Flags & RTL_RUN_ONCE_ASYNC) && (Flags & RTL_RUN_ONCE_INIT_FAILED)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if ((uintptr_t)Context & RTLP_RUN_ONCE_STATE_MASK) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        uintptr_t NewValue = Flags & RTL_RUN_ONCE_INIT_FAILED ? RTLP_RUN_ONCE_UNINITIALIZED : (uintptr_t)Context | RTLP_RUN_ONCE_COMPLETED;
+
+        if (Flags & RTL_RUN_ONCE_ASYNC) {
+                PVOID Value = (PVOID)(uintptr_t)RTLP_RUN_ONCE_ASYNC_PENDING;
+                if (!__atomic_compare_exchange_n(&RunOnce->Ptr, &Value, (PVOID)NewValue, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                        /* Another thread won the race, its context stays */
+                        errno = EINVAL;
+                        return STATUS_OBJECT_NAME_COLLISION;
+                }
+                return STATUS_SUCCESS;
+        }
+
+        uintptr_t Value = (uintptr_t)__atomic_load_n(&RunOnce->Ptr, __ATOMIC_RELAXED);
+        if ((Value & RTLP_RUN_ONCE_STATE_MASK) != RTLP_RUN_ONCE_PENDING) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        Value = (uintptr_t)__atomic_exchange_n(&RunOnce->Ptr, (PVOID)NewValue, __ATOMIC_ACQ_REL);
+        for (uintptr_t Waiters = Value / RTLP_RUN_ONCE_WAITER; Waiters != 0; Waiters--) {
+                NtReleaseKeyedEvent(RtlpGetGlobalKeyedEvent(), RunOnce, FALSE, NULL);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlRunOnceExecuteOnce(PRTL_RUN_ONCE RunOnce, PRTL_RUN_ONCE_INIT_FN InitFn, PVOID Parameter, PVOID *Context)
+{
+        NTSTATUS Status = RtlRunOnceBeginInitialize(RunOnce, 0, Context);
+        if (Status != STATUS_PENDING) {
+                return Status;
+        }
+
+        PVOID InitContext = NULL;
+        if (!InitFn(RunOnce, Parameter, &InitContext)) {
+                RtlRunOnceComplete(RunOnce, RTL_RUN_ONCE_INIT_FAILED, NULL);
+                errno = EINVAL;
+                return STATUS_UNSUCCESSFUL;
+        }
+
+        Status = RtlRunOnceComplete(RunOnce, 0, InitContext);
+        if (Status == STATUS_SUCCESS && Context != NULL) {
+                *Context = InitContext;
+        }
+
+        return Status;
+}
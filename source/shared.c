@@ -0,0 +1,225 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 20/10/2026 GMT +7 13.20
+ * - Initial shared state regions
+ * 20/10/2026 GMT +7 18.10
+ * - Add RtlpResetSharedRegions for the name broker
+ * 23/10/2026 GMT +7 17.10
+ * - Every state gets a robust, process shared acquire lock
+ * 24/10/2026 GMT +7 11.20
+ * - Drop RtlpResetSharedRegions, the name broker starts from a fresh program
+ * 24/10/2026 GMT +7 12.30
+ * - A state starts with no units collected
+ */
+
+#define _GNU_SOURCE
+#include "ntp.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RTLP_SHARED_REGION_SLOTS 16384
+#define RTLP_SHARED_REGION_MAX 64
+
+/* Slot 0 of every region holds its header instead of a state */
+typedef struct __attribute__((aligned(64))) _RTLP_SHARED_HEADER
+{
+        _Atomic ULONGLONG FreeList;
+        _Atomic ULONG Allocated;
+} RTLP_SHARED_HEADER, *PRTLP_SHARED_HEADER;
+
+typedef struct _RTLP_SHARED_REGION
+{
+        int Object;
+        dev_t Device;
+        ino_t Inode;
+        PRTLP_SHARED_STATE Base;
+} RTLP_SHARED_REGION, *PRTLP_SHARED_REGION;
+
+_Static_assert(sizeof(RTLP_SHARED_HEADER) <= sizeof(RTLP_SHARED_STATE), "header must fit in slot 0");
+_Static_assert(sizeof(RTLP_SHARED_STATE) == 64, "a state must stay one cache line");
+
+static pthread_mutex_t RtlpSharedRegionLock = PTHREAD_MUTEX_INITIALIZER;
+static RTLP_SHARED_REGION RtlpSharedRegions[RTLP_SHARED_REGION_MAX];
+static _Atomic ULONG RtlpSharedRegionCount;
+static bool RtlpSharedRegionFailed;
+
+static void RtlpSharedRegionForkChild(void)
+{
+        pthread_mutex_init(&RtlpSharedRegionLock, NULL);
+}
+
+static void __attribute__((constructor)) RtlpInitializeSharedRegions(void)
+{
+        pthread_atfork(NULL, NULL, RtlpSharedRegionForkChild);
+}
+
+static bool RtlpInsertSharedRegion(int Object, PULONG Region)
+{
+        struct stat st;
+        if (fstat(Object, &st) == -1) {
+                return false;
+        }
+
+        ULONG Count = atomic_load_explicit(&RtlpSharedRegionCount, memory_order_relaxed);
+        for (ULONG i = 0; i < Count; i++) {
+                if (RtlpSharedRegions[i].Device == st.st_dev && RtlpSharedRegions[i].Inode == st.st_ino) {
+                        close(Object);
+                        *Region = i;
+                        return true;
+                }
+        }
+
+        if (Count == RTLP_SHARED_REGION_MAX || st.st_size != RTLP_SHARED_REGION_SLOTS * sizeof(RTLP_SHARED_STATE)) {
+                errno = ENOMEM;
+                return false;
+        }
+
+        PVOID Base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, Object, 0);
+        if (Base == MAP_FAILED) {
+                return false;
+        }
+
+        RtlpSharedRegions[Count].Object = Object;
+        RtlpSharedRegions[Count].Device = st.st_dev;
+        RtlpSharedRegions[Count].Inode = st.st_ino;
+        RtlpSharedRegions[Count].Base = Base;
+        atomic_store_explicit(&RtlpSharedRegionCount, Count + 1, memory_order_release);
+
+        *Region = Count;
+        return true;
+}
+
+/* New states come from region 0, the first region the process mapped. It
+ * is created by the first object unless one was received before, and a
+ * child created with fork keeps sharing it with its parent. */
+static bool RtlpGetLocalSharedRegion(void)
+{
+        if (atomic_load_explicit(&RtlpSharedRegionCount, memory_order_acquire) != 0) {
+                return true;
+        }
+
+        pthread_mutex_lock(&RtlpSharedRegionLock);
+        if (atomic_load_explicit(&RtlpSharedRegionCount, memory_order_relaxed) == 0 && !RtlpSharedRegionFailed) {
+                int Object = memfd_create("libntsync", MFD_CLOEXEC);
+                ULONG Region;
+                if (Object == -1 || ftruncate(Object, RTLP_SHARED_REGION_SLOTS * sizeof(RTLP_SHARED_STATE)) == -1 ||
+                    !RtlpInsertSharedRegion(Object, &Region)) {
+                        if (Object != -1) {
+                                close(Object);
+                        }
+                        RtlpSharedRegionFailed = true;
+                }
+        }
+        pthread_mutex_unlock(&RtlpSharedRegionLock);
+
+        return atomic_load_explicit(&RtlpSharedRegionCount, memory_order_acquire) != 0;
+}
+
+/* The free list is shared by every process mapping the region, the high
+ * half of its head is a tag against ABA. */
+bool RtlpAllocateSharedState(PRTLP_SHARED_SLOT Slot)
+{
+        if (!RtlpGetLocalSharedRegion()) {
+                return false;
+        }
+
+        PRTLP_SHARED_STATE Base = RtlpSharedRegions[0].Base;
+        PRTLP_SHARED_HEADER Header = (PRTLP_SHARED_HEADER)Base;
+        ULONG Index;
+
+        ULONGLONG Head = atomic_load_explicit(&Header->FreeList, memory_order_acquire);
+        for (;;) {
+                Index = (ULONG)Head;
+                if (Index == 0) {
+                        Index = atomic_fetch_add_explicit(&Header->Allocated, 1, memory_order_relaxed) + 1;
+                        if (Index >= RTLP_SHARED_REGION_SLOTS) {
+                                atomic_fetch_sub_explicit(&Header->Allocated, 1, memory_order_relaxed);
+                                return false;
+                        }
+                        break;
+                }
+
+                ULONGLONG Next = ((Head >> 32) + 1) << 32 | Base[Index].Next;
+                if (atomic_compare_exchange_weak_explicit(&Header->FreeList, &Head, Next, memory_order_acquire, memory_order_acquire)) {
+                        break;
+                }
+        }
+
+        /* Nobody else can see the state yet, a reused one gets its lock back
+         * even if a process died holding it. */
+        pthread_mutexattr_t Attributes;
+        pthread_mutexattr_init(&Attributes);
+        pthread_mutexattr_setpshared(&Attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&Attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&Base[Index].AcquireLock, &Attributes);
+        pthread_mutexattr_destroy(&Attributes);
+
+        atomic_store_explicit(&Base[Index].Collected, 0, memory_order_relaxed);
+        atomic_store_explicit(&Base[Index].References, 1, memory_order_relaxed);
+        Slot->Entry = &Base[Index];
+        Slot->Region = 0;
+        Slot->Index = Index;
+        return true;
+}
+
+void RtlpReferenceSharedState(PRTLP_SHARED_SLOT Slot)
+{
+        atomic_fetch_add_explicit(&Slot->Entry->References, 1, memory_order_relaxed);
+}
+
+void RtlpReleaseSharedState(PRTLP_SHARED_SLOT Slot)
+{
+        if (atomic_fetch_sub_explicit(&Slot->Entry->References, 1, memory_order_acq_rel) != 1) {
+                return;
+        }
+
+        PRTLP_SHARED_STATE Base = RtlpSharedRegions[Slot->Region].Base;
+        PRTLP_SHARED_HEADER Header = (PRTLP_SHARED_HEADER)Base;
+        atomic_store_explicit(&Slot->Entry->State, 0, memory_order_relaxed);
+
+        ULONGLONG Head = atomic_load_explicit(&Header->FreeList, memory_order_relaxed);
+        do {
+                Slot->Entry->Next = (ULONG)Head;
+        } while (!atomic_compare_exchange_weak_explicit(&Header->FreeList, &Head, ((Head >> 32) + 1) << 32 | Slot->Index,
+                                                        memory_order_release, memory_order_relaxed));
+}
+
+int RtlpGetSharedRegionObject(PRTLP_SHARED_SLOT Slot)
+{
+        return RtlpSharedRegions[Slot->Region].Object;
+}
+
+/* Takes over Object, a region fd received from another process. The slot
+ * reference was already taken by the sender. */
+bool RtlpMapSharedState(int Object, ULONG Index, PRTLP_SHARED_SLOT Slot)
+{
+        if (Index == 0 || Index >= RTLP_SHARED_REGION_SLOTS) {
+                close(Object);
+                errno = EINVAL;
+                return false;
+        }
+
+        pthread_mutex_lock(&RtlpSharedRegionLock);
+        ULONG Region;
+        bool Mapped = RtlpInsertSharedRegion(Object, &Region);
+        pthread_mutex_unlock(&RtlpSharedRegionLock);
+
+        if (!Mapped) {
+                close(Object);
+                return false;
+        }
+
+        Slot->Entry = &RtlpSharedRegions[Region].Base[Index];
+        Slot->Region = Region;
+        Slot->Index = Index;
+        return true;
+}
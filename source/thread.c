@@ -0,0 +1,411 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 20/10/2026 GMT +7 08.45
+ * - Initial waitable thread implementation
+ * 20/10/2026 GMT +7 21.30
+ * - The thread keeps the dispatcher of its event and signals it on exit
+ * 23/10/2026 GMT +7 10.30
+ * - Stacks are at least PTHREAD_STACK_MIN, a stack pthread refuses fails the create
+ * 24/10/2026 GMT +7 13.00
+ * - The event of a thread isn't recorded by the sync trace
+ */
+
+#include "ntp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define RTLP_THREAD_STACK_POOL_MAX 64
+
+/* Kept at the lowest address of a free stack, nothing else uses it then */
+typedef struct _RTLP_THREAD_STACK
+{
+        struct _RTLP_THREAD_STACK *Next;
+        SIZE_T Size;
+} RTLP_THREAD_STACK, *PRTLP_THREAD_STACK;
+
+/* Referenced by the handle and by the running thread. The thread's
+ * reference is dropped once it has been joined, which is also when its
+ * stack can go back to the pool. The thread record takes the place of the
+ * event record in the object table, Event is that event, bound to
+ * SignalObject so that it outlives the handle. */
+typedef struct _RTLP_THREAD
+{
+        RTLP_OBJECT Header;
+        _Atomic NTSTATUS ExitStatus;
+        _Atomic ULONG ThreadId;
+        _Atomic int References;
+        bool ReportThreadId;
+        bool HasExitStatus;
+        int SignalObject;
+        PRTLP_DISPATCHER Event;
+        pthread_t Thread;
+        PVOID Stack;
+        SIZE_T StackSize;
+        PUSER_THREAD_START_ROUTINE StartAddress;
+        PVOID Parameter;
+        struct _RTLP_THREAD *Next;
+} RTLP_THREAD, *PRTLP_THREAD;
+
+static pthread_mutex_t RtlpThreadPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static PRTLP_THREAD RtlpFreeThreads;
+static PRTLP_THREAD RtlpExitedThreads;
+static PRTLP_THREAD_STACK RtlpFreeStacks;
+static ULONG RtlpFreeStackCount;
+static SIZE_T RtlpDefaultStackSize;
+static SIZE_T RtlpPageSize;
+static __thread PRTLP_THREAD RtlpCurrentThread;
+
+static void RtlpThreadForkChild(void)
+{
+        /* Exited threads of the parent can't be joined from the child, their
+         * stacks are simply left behind. */
+        pthread_mutex_init(&RtlpThreadPoolLock, NULL);
+        RtlpExitedThreads = NULL;
+        RtlpCurrentThread = NULL;
+}
+
+static void RtlpThreadForkPrepare(void)
+{
+        pthread_mutex_lock(&RtlpThreadPoolLock);
+}
+
+static void RtlpThreadForkParent(void)
+{
+        pthread_mutex_unlock(&RtlpThreadPoolLock);
+}
+
+static void __attribute__((constructor)) RtlpInitializeThreadPool(void)
+{
+        pthread_attr_t Attributes;
+        pthread_attr_init(&Attributes);
+        pthread_attr_getstacksize(&Attributes, &RtlpDefaultStackSize);
+        pthread_attr_destroy(&Attributes);
+
+        RtlpPageSize = sysconf(_SC_PAGESIZE);
+        pthread_atfork(RtlpThreadForkPrepare, RtlpThreadForkParent, RtlpThreadForkChild);
+}
+
+static PVOID RtlpAllocateStack(SIZE_T Size)
+{
+        pthread_mutex_lock(&RtlpThreadPoolLock);
+        for (PRTLP_THREAD_STACK *Link = &RtlpFreeStacks; *Link != NULL; Link = &(*Link)->Next) {
+                if ((*Link)->Size == Size) {
+                        PRTLP_THREAD_STACK Stack = *Link;
+                        *Link = Stack->Next;
+                        RtlpFreeStackCount--;
+                        pthread_mutex_unlock(&RtlpThreadPoolLock);
+                        return Stack;
+                }
+        }
+        pthread_mutex_unlock(&RtlpThreadPoolLock);
+
+        char *Base = mmap(NULL, Size + RtlpPageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (Base == MAP_FAILED) {
+                return NULL;
+        }
+
+        /* Guard page below the stack */
+        mprotect(Base, RtlpPageSize, PROT_NONE);
+        return Base + RtlpPageSize;
+}
+
+static void RtlpFreeStack(PVOID Stack, SIZE_T Size)
+{
+        pthread_mutex_lock(&RtlpThreadPoolLock);
+        if (RtlpFreeStackCount < RTLP_THREAD_STACK_POOL_MAX) {
+                PRTLP_THREAD_STACK Entry = Stack;
+                Entry->Size = Size;
+                Entry->Next = RtlpFreeStacks;
+                RtlpFreeStacks = Entry;
+                RtlpFreeStackCount++;
+                pthread_mutex_unlock(&RtlpThreadPoolLock);
+                return;
+        }
+        pthread_mutex_unlock(&RtlpThreadPoolLock);
+
+        munmap((char *)Stack - RtlpPageSize, Size + RtlpPageSize);
+}
+
+static PRTLP_THREAD RtlpAllocateThread(void)
+{
+        pthread_mutex_lock(&RtlpThreadPoolLock);
+        PRTLP_THREAD Thread = RtlpFreeThreads;
+        if (Thread != NULL) {
+                RtlpFreeThreads = Thread->Next;
+        }
+        pthread_mutex_unlock(&RtlpThreadPoolLock);
+
+        if (Thread == NULL) {
+                Thread = malloc(sizeof(*Thread));
+        }
+
+        return Thread;
+}
+
+static void RtlpFreeThread(PRTLP_THREAD Thread)
+{
+        pthread_mutex_lock(&RtlpThreadPoolLock);
+        Thread->Next = RtlpFreeThreads;
+        RtlpFreeThreads = Thread;
+        pthread_mutex_unlock(&RtlpThreadPoolLock);
+}
+
+static void RtlpDereferenceThread(PRTLP_THREAD Thread)
+{
+        if (atomic_fetch_sub_explicit(&Thread->References, 1, memory_order_acq_rel) != 1) {
+                return;
+        }
+
+        RtlpFreeDispatcher(Thread->Event);
+        close(Thread->SignalObject);
+        RtlpFreeThread(Thread);
+}
+
+/* Join the threads that already signaled their exit. They are at most a
+ * few instructions away from being gone, so this doesn't block for long. */
+static void RtlpReapExitedThreads(void)
+{
+        pthread_mutex_lock(&RtlpThreadPoolLock);
+        PRTLP_THREAD Thread = RtlpExitedThreads;
+        RtlpExitedThreads = NULL;
+        pthread_mutex_unlock(&RtlpThreadPoolLock);
+
+        while (Thread != NULL) {
+                PRTLP_THREAD Next = Thread->Next;
+                pthread_join(Thread->Thread, NULL);
+                RtlpFreeStack(Thread->Stack, Thread->StackSize);
+                RtlpDereferenceThread(Thread);
+                Thread = Next;
+        }
+}
+
+static void *RtlpUserThreadStart(void *Context)
+{
+        PRTLP_THREAD Thread = Context;
+        RtlpCurrentThread = Thread;
+        RtlpArmThreadExit();
+
+        atomic_store_explicit(&Thread->ThreadId, RtlpGetOwnerId(), memory_order_release);
+        if (Thread->ReportThreadId) {
+                RtlpFutexWake(&Thread->ThreadId, INT_MAX);
+        }
+
+        NTSTATUS ExitStatus = Thread->StartAddress(Thread->Parameter);
+        atomic_store_explicit(&Thread->ExitStatus, ExitStatus, memory_order_relaxed);
+        Thread->HasExitStatus = true;
+        return NULL;
+}
+
+void RtlpUserThreadExit(void)
+{
+        PRTLP_THREAD Thread = RtlpCurrentThread;
+        if (Thread == NULL) {
+                return;
+        }
+        RtlpCurrentThread = NULL;
+
+        /* Left by pthread_exit without an exit status. A thread may return
+         * STATUS_PENDING itself, so the value alone doesn't tell. */
+        if (!Thread->HasExitStatus) {
+                atomic_store_explicit(&Thread->ExitStatus, STATUS_SUCCESS, memory_order_relaxed);
+        }
+
+        RtlpSetEventDispatcher(Thread->Event);
+
+        pthread_mutex_lock(&RtlpThreadPoolLock);
+        Thread->Next = RtlpExitedThreads;
+        RtlpExitedThreads = Thread;
+        pthread_mutex_unlock(&RtlpThreadPoolLock);
+}
+
+PRTLP_DISPATCHER RtlpGetThreadEvent(PRTLP_OBJECT Record)
+{
+        return ((PRTLP_THREAD)Record)->Event;
+}
+
+void RtlpCloseThread(PRTLP_OBJECT Record)
+{
+        RtlpDereferenceThread((PRTLP_THREAD)Record);
+        RtlpReapExitedThreads();
+}
+
+NTSTATUS RtlCreateUserThread(PHANDLE ThreadHandle, ULONG DesiredAccess, BOOLEAN CreateSuspended, SIZE_T StackSize, PUSER_THREAD_START_ROUTINE StartAddress, PVOID Parameter, PCLIENT_ID ClientId)
+{
+        if (ThreadHandle == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (CreateSuspended) {
+                errno = ENOSYS;
+                return STATUS_NOT_IMPLEMENTED;
+        }
+
+        if (StartAddress == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_5;
+        }
+
+        RtlpReapExitedThreads();
+
+        if (StackSize == 0) {
+                StackSize = RtlpDefaultStackSize;
+        }
+        if (StackSize < PTHREAD_STACK_MIN) {
+                StackSize = PTHREAD_STACK_MIN;
+        }
+        StackSize = (StackSize + RtlpPageSize - 1) & ~(RtlpPageSize - 1);
+
+        HANDLE Event;
+        NTSTATUS Status = RtlpCreateEvent(&Event, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        int SignalObject = fcntl(Event.Object, F_DUPFD_CLOEXEC, 0);
+        if (SignalObject == -1) {
+                Status = RtlpGetNtStatusFromUnixErrno();
+                NtClose(Event);
+                return Status;
+        }
+
+        /* The thread signals its own duplicate of the event, the handle may
+         * already be closed and its fd reused. */
+        PRTLP_DISPATCHER EventDispatcher = (PRTLP_DISPATCHER)RtlpRemoveObject(Event.Object);
+        EventDispatcher->Object = SignalObject;
+
+        PRTLP_THREAD Thread = RtlpAllocateThread();
+        PVOID Stack = Thread != NULL ? RtlpAllocateStack(StackSize) : NULL;
+        if (Stack == NULL) {
+                errno = ENOMEM;
+                Status = STATUS_NO_MEMORY;
+                goto Fail;
+        }
+
+        Thread->Header.Type = RtlpThreadObject;
+        atomic_init(&Thread->Header.HandleCount, 0);
+        Thread->Header.Name = NULL;
+        atomic_init(&Thread->ExitStatus, STATUS_PENDING);
+        atomic_init(&Thread->ThreadId, 0);
+        atomic_init(&Thread->References, 2);
+        Thread->ReportThreadId = ClientId != NULL;
+        Thread->HasExitStatus = false;
+        Thread->SignalObject = SignalObject;
+        Thread->Event = EventDispatcher;
+        Thread->Stack = Stack;
+        Thread->StackSize = StackSize;
+        Thread->StartAddress = StartAddress;
+        Thread->Parameter = Parameter;
+        Thread->Next = NULL;
+
+        if (!RtlpInsertObject(Event.Object, &Thread->Header)) {
+                Status = RtlpGetNtStatusFromUnixErrno();
+                goto Fail;
+        }
+
+        pthread_attr_t Attributes;
+        pthread_attr_init(&Attributes);
+        int ret = pthread_attr_setstack(&Attributes, Stack, StackSize);
+        if (ret == 0) {
+                ret = pthread_create(&Thread->Thread, &Attributes, RtlpUserThreadStart, Thread);
+        }
+        pthread_attr_destroy(&Attributes);
+        if (ret != 0) {
+                errno = ret;
+                Status = ret == EAGAIN ? STATUS_NO_MEMORY : RtlpGetNtStatusFromUnixErrno();
+                RtlpRemoveObject(Event.Object);
+                goto Fail;
+        }
+
+        if (ClientId != NULL) {
+                ULONG ThreadId;
+                while ((ThreadId = atomic_load_explicit(&Thread->ThreadId, memory_order_acquire)) == 0) {
+                        RtlpFutexWait(&Thread->ThreadId, 0, UINT64_MAX);
+                }
+                ClientId->UniqueProcess = (PVOID)(uintptr_t)getpid();
+                ClientId->UniqueThread = (PVOID)(uintptr_t)ThreadId;
+        }
+
+        ThreadHandle->DesiredAccess = DesiredAccess;
+        ThreadHandle->Object = Event.Object;
+
+        return STATUS_SUCCESS;
+
+Fail:
+        if (Stack != NULL) {
+                RtlpFreeStack(Stack, StackSize);
+        }
+        if (Thread != NULL) {
+                RtlpFreeThread(Thread);
+        }
+        RtlpFreeDispatcher(EventDispatcher);
+        close(SignalObject);
+        NtClose(Event);
+        return Status;
+}
+
+void RtlExitUserThread(NTSTATUS ExitStatus)
+{
+        if (RtlpCurrentThread != NULL) {
+                atomic_store_explicit(&RtlpCurrentThread->ExitStatus, ExitStatus, memory_order_relaxed);
+                RtlpCurrentThread->HasExitStatus = true;
+        }
+
+        pthread_exit(NULL);
+}
+
+NTSTATUS NtQueryInformationThread(HANDLE ThreadHandle, THREADINFOCLASS ThreadInformationClass, PVOID ThreadInformation, ULONG ThreadInformationLength, PULONG ReturnLength)
+{
+        if (ThreadInformationClass != ThreadBasicInformation) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        if (ThreadInformation == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_3;
+        }
+
+        if (ThreadInformationLength != sizeof(THREAD_BASIC_INFORMATION)) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_4;
+        }
+
+        if (!(ThreadHandle.DesiredAccess & (THREAD_QUERY_INFORMATION | THREAD_QUERY_LIMITED_INFORMATION))) {
+                errno = EPERM;
+                return STATUS_ACCESS_DENIED;
+        }
+
+        PRTLP_OBJECT Record = RtlpLookupObject(ThreadHandle.Object);
+        if (Record == NULL || Record->Type != RtlpThreadObject) {
+                errno = EINVAL;
+                return STATUS_OBJECT_TYPE_MISMATCH;
+        }
+
+        PRTLP_THREAD Thread = (PRTLP_THREAD)Record;
+        PTHREAD_BASIC_INFORMATION Information = ThreadInformation;
+        Information->ExitStatus = atomic_load_explicit(&Thread->ExitStatus, memory_order_relaxed);
+        Information->TebBaseAddress = NULL;
+        Information->ClientId.UniqueProcess = (PVOID)(uintptr_t)getpid();
+        Information->ClientId.UniqueThread = (PVOID)(uintptr_t)atomic_load_explicit(&Thread->ThreadId, memory_order_relaxed);
+        Information->AffinityMask = 0;
+        Information->Priority = 0;
+        Information->BasePriority = 0;
+
+        if (ReturnLength != NULL) {
+                *ReturnLength = sizeof(THREAD_BASIC_INFORMATION);
+        }
+
+        return STATUS_SUCCESS;
+}
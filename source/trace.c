@@ -0,0 +1,746 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 21/10/2026 GMT +7 09.40
+ * - Initial sync trace recording and replay
+ * 21/10/2026 GMT +7 14.15
+ * - Record and replay NtAcquireSemaphoreEx
+ * 23/10/2026 GMT +7 16.20
+ * - Replay rejects records with too many objects and acquires without their count
+ * 24/10/2026 GMT +7 13.00
+ * - Record and replay broadcast events
+ */
+
+/* A trace is a file mapped by the process, a header followed by fixed-size
+ * records. Threads reserve their records with a single fetch-add on the
+ * header and fill them in place, nothing is written with a system call.
+ * The record is filled when the call returns, with its start time and how
+ * long it took. A wait on more than one object is followed by extension
+ * records holding the rest of its handles, a semaphore create by one with
+ * its maximum count and a semaphore acquire by one with its unit count.
+ *
+ * Replay reads the trace back and gives every traced thread a thread of
+ * its own, which makes the same calls in the same order. The handles are
+ * resolved to objects once up front, so every object is created before the
+ * threads start and closed after they are done.
+ */
+
+#define _GNU_SOURCE
+#include "ntp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RTLP_TRACE_MAGIC 0x5254544eU /* "NTTR" */
+#define RTLP_TRACE_VERSION 1
+#define RTLP_TRACE_DEFAULT_RECORDS (1U << 20)
+#define RTLP_TRACE_EXTENSION_OBJECTS 7
+#define RTLP_TRACE_INFINITE -1
+/* How much longer than recorded a replayed infinite wait may take before
+ * it is given up, in microseconds */
+#define RTLP_TRACE_REPLAY_SLACK 1000000
+#define RTLP_TRACE_NO_OBJECT UINT32_MAX
+
+/* Replay threads wait at the gate until every one of them is created */
+#define RTLP_REPLAY_GATE_CLOSED 0
+#define RTLP_REPLAY_GATE_OPEN 1
+#define RTLP_REPLAY_GATE_ABORTED 2
+
+typedef struct _RTLP_TRACE_HEADER
+{
+        ULONG Magic;
+        ULONG Version;
+        ULONGLONG Capacity;
+        _Atomic ULONGLONG Count;
+        _Atomic ULONGLONG Dropped;
+        ULONGLONG StartTime;
+        ULONG Backend;
+        ULONG Reserved[5];
+} RTLP_TRACE_HEADER, *PRTLP_TRACE_HEADER;
+
+/* Operation is stored last, a record still being filled reads as zero.
+ * Time is in nanoseconds since the start of the trace, Duration in
+ * microseconds. Argument is the timeout of a wait in microseconds, or the
+ * count, state or owner a call passes. */
+typedef struct _RTLP_TRACE_RECORD
+{
+        UCHAR Operation;
+        UCHAR Count;
+        USHORT Flags;
+        ULONG ThreadId;
+        ULONGLONG Time;
+        ULONG Duration;
+        int Object;
+        LONG Argument;
+        NTSTATUS Status;
+} RTLP_TRACE_RECORD, *PRTLP_TRACE_RECORD;
+
+typedef struct _RTLP_TRACE_EXTENSION
+{
+        UCHAR Operation;
+        UCHAR Reserved[3];
+        int Objects[RTLP_TRACE_EXTENSION_OBJECTS];
+} RTLP_TRACE_EXTENSION, *PRTLP_TRACE_EXTENSION;
+
+_Static_assert(sizeof(RTLP_TRACE_HEADER) == 64, "trace header layout");
+_Static_assert(sizeof(RTLP_TRACE_RECORD) == 32, "trace record layout");
+_Static_assert(sizeof(RTLP_TRACE_EXTENSION) == sizeof(RTLP_TRACE_RECORD), "trace extension layout");
+
+typedef struct _RTLP_REPLAY_OBJECT
+{
+        RTLP_TRACE_OPERATION Operation;
+        LONG Argument;
+        LONG MaximumCount;
+        USHORT Flags;
+        HANDLE Handle;
+        bool Created;
+} RTLP_REPLAY_OBJECT, *PRTLP_REPLAY_OBJECT;
+
+/* Objects is an index into the object ids of the replay, Count how many
+ * of them the call uses */
+typedef struct _RTLP_REPLAY_CALL
+{
+        PRTLP_TRACE_RECORD Record;
+        ULONG Objects;
+        ULONG Count;
+} RTLP_REPLAY_CALL, *PRTLP_REPLAY_CALL;
+
+typedef struct _RTLP_REPLAY_THREAD
+{
+        struct _RTLP_REPLAY *Replay;
+        ULONG ThreadId;
+        PRTLP_REPLAY_CALL Calls;
+        ULONG Count;
+        ULONG Capacity;
+        ULONG Skipped;
+        ULONG Mismatches;
+        pthread_t Thread;
+} RTLP_REPLAY_THREAD, *PRTLP_REPLAY_THREAD;
+
+typedef struct _RTLP_REPLAY
+{
+        PRTLP_REPLAY_OBJECT Objects;
+        ULONG ObjectCount;
+        ULONG ObjectCapacity;
+        ULONG *ObjectIds;
+        ULONG ObjectIdCount;
+        ULONG ObjectIdCapacity;
+        PRTLP_REPLAY_THREAD Threads;
+        ULONG ThreadCount;
+        ULONG ThreadCapacity;
+        ULONG *Handles;
+        ULONG HandleCapacity;
+        ULONG Flags;
+        ULONGLONG StartTime;
+        _Atomic ULONG Gate;
+} RTLP_REPLAY, *PRTLP_REPLAY;
+
+_Atomic bool RtlpTraceActive;
+static _Atomic(PRTLP_TRACE_HEADER) RtlpTraceHeader;
+static pthread_mutex_t RtlpTraceLock = PTHREAD_MUTEX_INITIALIZER;
+
+ULONGLONG RtlpGetTraceTime(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Relative timeouts in microseconds, the only ones RtlpFormatTimeOut takes */
+LONG RtlpGetTraceTimeOut(PLARGE_INTEGER TimeOut)
+{
+        if (TimeOut == NULL) {
+                return RTLP_TRACE_INFINITE;
+        }
+
+        if (TimeOut->QuadPart >= 0) {
+                return 0;
+        }
+
+        LONGLONG Microseconds = -TimeOut->QuadPart / 10;
+        return Microseconds > INT32_MAX ? INT32_MAX : Microseconds;
+}
+
+void RtlpTraceCallEx(ULONGLONG Start, RTLP_TRACE_OPERATION Operation, int Object, LONG Argument, USHORT Flags, ULONG ExtraCount,
+                     const int *Extra, NTSTATUS Status)
+{
+        PRTLP_TRACE_HEADER Header = atomic_load_explicit(&RtlpTraceHeader, memory_order_acquire);
+        if (Start == 0 || Header == NULL || Start < Header->StartTime) {
+                return;
+        }
+
+        ULONGLONG Duration = (RtlpGetTraceTime() - Start) / 1000;
+        ULONG Extensions = (ExtraCount + RTLP_TRACE_EXTENSION_OBJECTS - 1) / RTLP_TRACE_EXTENSION_OBJECTS;
+        ULONGLONG Index = atomic_fetch_add_explicit(&Header->Count, 1 + Extensions, memory_order_relaxed);
+        if (Index + 1 + Extensions > Header->Capacity) {
+                atomic_fetch_add_explicit(&Header->Dropped, 1, memory_order_relaxed);
+                return;
+        }
+
+        PRTLP_TRACE_RECORD Record = (PRTLP_TRACE_RECORD)(Header + 1) + Index;
+        for (ULONG i = 0; i < Extensions; i++) {
+                PRTLP_TRACE_EXTENSION Extension = (PRTLP_TRACE_EXTENSION)&Record[1 + i];
+                ULONG Count = ExtraCount - i * RTLP_TRACE_EXTENSION_OBJECTS;
+                memcpy(Extension->Objects, Extra + i * RTLP_TRACE_EXTENSION_OBJECTS,
+                       (Count > RTLP_TRACE_EXTENSION_OBJECTS ? RTLP_TRACE_EXTENSION_OBJECTS : Count) * sizeof(int));
+                __atomic_store_n(&Extension->Operation, RtlpTraceExtension, __ATOMIC_RELEASE);
+        }
+
+        Record->Count = ExtraCount;
+        Record->Flags = Flags;
+        Record->ThreadId = RtlpGetOwnerId();
+        Record->Time = Start - Header->StartTime;
+        Record->Duration = Duration > UINT32_MAX ? UINT32_MAX : Duration;
+        Record->Object = Object;
+        Record->Argument = Argument;
+        Record->Status = Status;
+        __atomic_store_n(&Record->Operation, Operation, __ATOMIC_RELEASE);
+}
+
+void RtlpTraceCall(ULONGLONG Start, RTLP_TRACE_OPERATION Operation, int Object, LONG Argument, USHORT Flags, NTSTATUS Status)
+{
+        RtlpTraceCallEx(Start, Operation, Object, Argument, Flags, 0, NULL, Status);
+}
+
+void RtlpTraceWait(ULONGLONG Start, ULONG Count, const HANDLE *Handles, WAIT_TYPE WaitType, PLARGE_INTEGER TimeOut, NTSTATUS Status)
+{
+        if (Start == 0 || Count == 0 || Count > MAXIMUM_WAIT_OBJECTS) {
+                return;
+        }
+
+        int Objects[MAXIMUM_WAIT_OBJECTS];
+        for (ULONG i = 0; i < Count; i++) {
+                Objects[i] = Handles[i].Object;
+        }
+
+        RtlpTraceCallEx(Start, RtlpTraceWaitForMultipleObjects, Objects[0], RtlpGetTraceTimeOut(TimeOut), WaitType, Count - 1,
+                        Objects + 1, Status);
+}
+
+NTSTATUS RtlStartSyncTrace(PCSZ FileName, ULONG MaximumRecords)
+{
+        if (FileName == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (MaximumRecords == 0) {
+                MaximumRecords = RTLP_TRACE_DEFAULT_RECORDS;
+        }
+
+        pthread_mutex_lock(&RtlpTraceLock);
+        if (atomic_load_explicit(&RtlpTraceHeader, memory_order_relaxed) != NULL) {
+                pthread_mutex_unlock(&RtlpTraceLock);
+                errno = EBUSY;
+                return STATUS_UNSUCCESSFUL;
+        }
+
+        /* The file stays sparse, pages nobody recorded into take no space */
+        size_t Size = sizeof(RTLP_TRACE_HEADER) + (size_t)MaximumRecords * sizeof(RTLP_TRACE_RECORD);
+        int Object = open(FileName, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (Object == -1 || ftruncate(Object, Size) == -1) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                if (Object != -1) {
+                        close(Object);
+                }
+                pthread_mutex_unlock(&RtlpTraceLock);
+                return Status;
+        }
+
+        PRTLP_TRACE_HEADER Header = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Object, 0);
+        close(Object);
+        if (Header == MAP_FAILED) {
+                pthread_mutex_unlock(&RtlpTraceLock);
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+
+        Header->Magic = RTLP_TRACE_MAGIC;
+        Header->Version = RTLP_TRACE_VERSION;
+        Header->Capacity = MaximumRecords;
+        Header->Backend = ntsync_backend;
+        Header->StartTime = RtlpGetTraceTime();
+        atomic_store_explicit(&RtlpTraceHeader, Header, memory_order_release);
+        atomic_store_explicit(&RtlpTraceActive, true, memory_order_relaxed);
+        pthread_mutex_unlock(&RtlpTraceLock);
+
+        return STATUS_SUCCESS;
+}
+
+/* A thread may still be filling a record it reserved, so the mapping of a
+ * stopped trace is only flushed and stays until the process exits. */
+NTSTATUS RtlStopSyncTrace(void)
+{
+        pthread_mutex_lock(&RtlpTraceLock);
+        PRTLP_TRACE_HEADER Header = atomic_exchange_explicit(&RtlpTraceHeader, NULL, memory_order_acq_rel);
+        atomic_store_explicit(&RtlpTraceActive, false, memory_order_relaxed);
+        pthread_mutex_unlock(&RtlpTraceLock);
+
+        if (Header == NULL) {
+                errno = EINVAL;
+                return STATUS_UNSUCCESSFUL;
+        }
+
+        if (msync(Header, sizeof(RTLP_TRACE_HEADER) + Header->Capacity * sizeof(RTLP_TRACE_RECORD), MS_SYNC) == -1) {
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/* Records of a child would land in the trace of its parent */
+static void RtlpTraceForkChild(void)
+{
+        pthread_mutex_init(&RtlpTraceLock, NULL);
+        atomic_store_explicit(&RtlpTraceActive, false, memory_order_relaxed);
+        atomic_store_explicit(&RtlpTraceHeader, NULL, memory_order_relaxed);
+}
+
+static void __attribute__((constructor)) RtlpInitializeTrace(void)
+{
+        pthread_atfork(NULL, NULL, RtlpTraceForkChild);
+
+        const char *FileName = getenv("LIBNTSYNC_TRACE");
+        if (FileName != NULL && *FileName != '\0') {
+                RtlStartSyncTrace(FileName, 0);
+        }
+}
+
+static bool RtlpGrowArray(PVOID *Array, ULONG *Capacity, ULONG Count, size_t Size)
+{
+        if (Count < *Capacity) {
+                return true;
+        }
+
+        ULONG NewCapacity = *Capacity != 0 ? *Capacity * 2 : 64;
+        PVOID NewArray = realloc(*Array, NewCapacity * Size);
+        if (NewArray == NULL) {
+                return false;
+        }
+
+        *Array = NewArray;
+        *Capacity = NewCapacity;
+        return true;
+}
+
+static PRTLP_REPLAY_THREAD RtlpGetReplayThread(PRTLP_REPLAY Replay, ULONG ThreadId)
+{
+        for (ULONG i = Replay->ThreadCount; i > 0; i--) {
+                if (Replay->Threads[i - 1].ThreadId == ThreadId) {
+                        return &Replay->Threads[i - 1];
+                }
+        }
+
+        if (!RtlpGrowArray((PVOID *)&Replay->Threads, &Replay->ThreadCapacity, Replay->ThreadCount, sizeof(RTLP_REPLAY_THREAD))) {
+                return NULL;
+        }
+
+        PRTLP_REPLAY_THREAD Thread = &Replay->Threads[Replay->ThreadCount++];
+        memset(Thread, 0, sizeof(*Thread));
+        Thread->ThreadId = ThreadId;
+        return Thread;
+}
+
+static ULONG RtlpGetReplayHandle(PRTLP_REPLAY Replay, int Object)
+{
+        if (Object < 0 || (ULONG)Object >= Replay->HandleCapacity) {
+                return RTLP_TRACE_NO_OBJECT;
+        }
+
+        return Replay->Handles[Object];
+}
+
+static bool RtlpSetReplayHandle(PRTLP_REPLAY Replay, int Object, ULONG Id)
+{
+        if (Object < 0) {
+                return false;
+        }
+
+        if ((ULONG)Object >= Replay->HandleCapacity) {
+                ULONG Capacity = Replay->HandleCapacity != 0 ? Replay->HandleCapacity : 64;
+                while (Capacity <= (ULONG)Object) {
+                        Capacity *= 2;
+                }
+
+                ULONG *Handles = realloc(Replay->Handles, Capacity * sizeof(ULONG));
+                if (Handles == NULL) {
+                        return false;
+                }
+                for (ULONG i = Replay->HandleCapacity; i < Capacity; i++) {
+                        Handles[i] = RTLP_TRACE_NO_OBJECT;
+                }
+                Replay->Handles = Handles;
+                Replay->HandleCapacity = Capacity;
+        }
+
+        Replay->Handles[Object] = Id;
+        return true;
+}
+
+/* A create that returns a new object gets a new id, a named create or an
+ * open returning a handle the process already had gets the id of that
+ * handle. Handles are fds, reused once closed, so this has to run in the
+ * order the calls returned, which is the order of the records. */
+static bool RtlpResolveReplayObject(PRTLP_REPLAY Replay, PRTLP_TRACE_RECORD Record, LONG MaximumCount)
+{
+        bool Open = Record->Operation == RtlpTraceOpenEvent || Record->Operation == RtlpTraceOpenSemaphore;
+        if (Record->Status != STATUS_SUCCESS && Record->Status != STATUS_OBJECT_NAME_EXISTS) {
+                return true;
+        }
+
+        if ((Open || Record->Status == STATUS_OBJECT_NAME_EXISTS) &&
+            RtlpGetReplayHandle(Replay, Record->Object) != RTLP_TRACE_NO_OBJECT) {
+                return true;
+        }
+
+        /* Opened from another process, nothing says what it was created as */
+        if (Open) {
+                return RtlpSetReplayHandle(Replay, Record->Object, RTLP_TRACE_NO_OBJECT);
+        }
+
+        if (!RtlpGrowArray((PVOID *)&Replay->Objects, &Replay->ObjectCapacity, Replay->ObjectCount, sizeof(RTLP_REPLAY_OBJECT))) {
+                return false;
+        }
+
+        PRTLP_REPLAY_OBJECT Object = &Replay->Objects[Replay->ObjectCount];
+        Object->Operation = Record->Operation;
+        Object->Argument = Record->Argument;
+        Object->MaximumCount = MaximumCount;
+        Object->Flags = Record->Flags;
+        Object->Created = false;
+        return RtlpSetReplayHandle(Replay, Record->Object, Replay->ObjectCount++);
+}
+
+static bool RtlpAddReplayObjectId(PRTLP_REPLAY Replay, int Object)
+{
+        if (!RtlpGrowArray((PVOID *)&Replay->ObjectIds, &Replay->ObjectIdCapacity, Replay->ObjectIdCount, sizeof(ULONG))) {
+                return false;
+        }
+
+        Replay->ObjectIds[Replay->ObjectIdCount++] = RtlpGetReplayHandle(Replay, Object);
+        return true;
+}
+
+static NTSTATUS RtlpLoadReplay(PRTLP_REPLAY Replay, PRTLP_TRACE_HEADER Header, size_t Size)
+{
+        ULONGLONG Count = atomic_load_explicit(&Header->Count, memory_order_relaxed);
+        ULONGLONG Capacity = (Size - sizeof(RTLP_TRACE_HEADER)) / sizeof(RTLP_TRACE_RECORD);
+        if (Count > Capacity) {
+                Count = Capacity;
+        }
+
+        PRTLP_TRACE_RECORD Records = (PRTLP_TRACE_RECORD)(Header + 1);
+        for (ULONGLONG i = 0; i < Count; i++) {
+                PRTLP_TRACE_RECORD Record = &Records[i];
+                if (Record->Operation == 0 || Record->Operation == RtlpTraceExtension) {
+                        continue;
+                }
+
+                /* The file may come from anywhere. A wait has at most
+                 * MAXIMUM_WAIT_OBJECTS objects and an acquire keeps its
+                 * count in an extension. Count is read once, the file may
+                 * still be written. */
+                ULONG ExtraCount = Record->Count;
+                if (ExtraCount >= MAXIMUM_WAIT_OBJECTS || (Record->Operation == RtlpTraceAcquireSemaphore && ExtraCount == 0)) {
+                        errno = EINVAL;
+                        return STATUS_INVALID_PARAMETER;
+                }
+
+                ULONG Extensions = (ExtraCount + RTLP_TRACE_EXTENSION_OBJECTS - 1) / RTLP_TRACE_EXTENSION_OBJECTS;
+                if (i + Extensions >= Count) {
+                        break;
+                }
+
+                PRTLP_TRACE_EXTENSION Extension = (PRTLP_TRACE_EXTENSION)&Records[i + 1];
+                bool Resolved = true;
+                switch (Record->Operation) {
+                        case RtlpTraceCreateSemaphore:
+                                Resolved = RtlpResolveReplayObject(Replay, Record, ExtraCount != 0 ? Extension->Objects[0] : 0);
+                                break;
+                        case RtlpTraceCreateEvent:
+                        case RtlpTraceCreateMutant:
+                        case RtlpTraceCreateBroadcastEvent:
+                        case RtlpTraceOpenEvent:
+                        case RtlpTraceOpenSemaphore:
+                                Resolved = RtlpResolveReplayObject(Replay, Record, 0);
+                                break;
+                        default:
+                                break;
+                }
+
+                PRTLP_REPLAY_THREAD Thread = RtlpGetReplayThread(Replay, Record->ThreadId);
+                if (!Resolved || Thread == NULL ||
+                    !RtlpGrowArray((PVOID *)&Thread->Calls, &Thread->Capacity, Thread->Count, sizeof(RTLP_REPLAY_CALL))) {
+                        errno = ENOMEM;
+                        return STATUS_NO_MEMORY;
+                }
+
+                PRTLP_REPLAY_CALL Call = &Thread->Calls[Thread->Count++];
+                Call->Record = Record;
+                Call->Objects = Replay->ObjectIdCount;
+                Call->Count = Record->Operation == RtlpTraceWaitForMultipleObjects ? ExtraCount + 1 : 1;
+                if (!RtlpAddReplayObjectId(Replay, Record->Object)) {
+                        errno = ENOMEM;
+                        return STATUS_NO_MEMORY;
+                }
+
+                if (Record->Operation == RtlpTraceWaitForMultipleObjects) {
+                        for (ULONG j = 0; j < Call->Count - 1; j++) {
+                                Extension = (PRTLP_TRACE_EXTENSION)&Records[i + 1 + j / RTLP_TRACE_EXTENSION_OBJECTS];
+                                if (!RtlpAddReplayObjectId(Replay, Extension->Objects[j % RTLP_TRACE_EXTENSION_OBJECTS])) {
+                                        errno = ENOMEM;
+                                        return STATUS_NO_MEMORY;
+                                }
+                        }
+                }
+
+                i += Extensions;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/* Every object starts the way it was created. A mutant created owned is
+ * taken by its creator when the replay gets to that call. */
+static NTSTATUS RtlpCreateReplayObject(PRTLP_REPLAY_OBJECT Object)
+{
+        switch (Object->Operation) {
+                case RtlpTraceCreateEvent:
+                        return NtCreateEvent(&Object->Handle, EVENT_ALL_ACCESS, NULL, Object->Flags, Object->Argument != 0);
+                case RtlpTraceCreateSemaphore:
+                        return NtCreateSemaphore(&Object->Handle, SEMAPHORE_ALL_ACCESS, NULL, Object->Argument, Object->MaximumCount);
+                case RtlpTraceCreateMutant:
+                        return NtCreateMutant(&Object->Handle, MUTANT_ALL_ACCESS, NULL, FALSE);
+                case RtlpTraceCreateBroadcastEvent:
+                        return NtCreateBroadcastEvent(&Object->Handle, EVENT_ALL_ACCESS, NULL);
+                default:
+                        errno = EINVAL;
+                        return STATUS_INVALID_PARAMETER;
+        }
+}
+
+static PHANDLE RtlpGetReplayObject(PRTLP_REPLAY Replay, ULONG Id)
+{
+        if (Id == RTLP_TRACE_NO_OBJECT || !Replay->Objects[Id].Created) {
+                return NULL;
+        }
+
+        return &Replay->Objects[Id].Handle;
+}
+
+static NTSTATUS RtlpReplayCall(PRTLP_REPLAY Replay, PRTLP_REPLAY_CALL Call, bool *Skipped)
+{
+        PRTLP_TRACE_RECORD Record = Call->Record;
+        HANDLE Handles[MAXIMUM_WAIT_OBJECTS];
+        for (ULONG i = 0; i < Call->Count; i++) {
+                PHANDLE Handle = RtlpGetReplayObject(Replay, Replay->ObjectIds[Call->Objects + i]);
+                if (Handle == NULL) {
+                        *Skipped = true;
+                        return STATUS_SUCCESS;
+                }
+                Handles[i] = *Handle;
+        }
+
+        /* Infinite waits are given up a while after the recorded one
+         * returned, a replay racing differently must not hang forever */
+        LARGE_INTEGER TimeOut;
+        ULONGLONG Microseconds = Record->Argument != RTLP_TRACE_INFINITE ? (ULONGLONG)Record->Argument
+                                                                         : (ULONGLONG)Record->Duration + RTLP_TRACE_REPLAY_SLACK;
+        TimeOut.QuadPart = -(LONGLONG)(Microseconds * 10);
+
+        *Skipped = false;
+        switch (Record->Operation) {
+                case RtlpTraceCreateMutant:
+                        if (Record->Argument == 0) {
+                                return Record->Status;
+                        }
+                        TimeOut.QuadPart = -(LONGLONG)RTLP_TRACE_REPLAY_SLACK * 10;
+                        return NtWaitForSingleObject(Handles[0], FALSE, &TimeOut) == STATUS_WAIT_0 ? Record->Status : STATUS_UNSUCCESSFUL;
+                case RtlpTraceCreateEvent:
+                case RtlpTraceCreateSemaphore:
+                case RtlpTraceCreateBroadcastEvent:
+                case RtlpTraceOpenEvent:
+                case RtlpTraceOpenSemaphore:
+                case RtlpTraceClose:
+                        return Record->Status;
+                case RtlpTraceSetEvent:
+                        return NtSetEvent(Handles[0], NULL);
+                case RtlpTraceResetEvent:
+                        return NtResetEvent(Handles[0], NULL);
+                case RtlpTracePulseEvent:
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+                        return NtPulseEvent(Handles[0], NULL);
+#pragma GCC diagnostic pop
+                case RtlpTraceReleaseSemaphore:
+                        return NtReleaseSemaphore(Handles[0], Record->Argument, NULL);
+                case RtlpTraceReleaseMutant:
+                        return NtReleaseMutant(Handles[0], NULL);
+                case RtlpTraceBroadcastEvent:
+                        return NtBroadcastEvent(Handles[0], NULL);
+                case RtlpTraceWaitForSingleObject:
+                        return NtWaitForSingleObject(Handles[0], FALSE, &TimeOut);
+                case RtlpTraceAcquireSemaphore:
+                        return NtAcquireSemaphoreEx(Handles[0], ((PRTLP_TRACE_EXTENSION)(Record + 1))->Objects[0], FALSE, &TimeOut);
+                case RtlpTraceWaitForMultipleObjects:
+                        return NtWaitForMultipleObjects(Call->Count, Handles, Record->Flags, FALSE, &TimeOut);
+                default:
+                        *Skipped = true;
+                        return STATUS_SUCCESS;
+        }
+}
+
+static void *RtlpReplayThreadStart(void *Context)
+{
+        PRTLP_REPLAY_THREAD Thread = Context;
+        PRTLP_REPLAY Replay = Thread->Replay;
+        ULONG Gate;
+        while ((Gate = atomic_load_explicit(&Replay->Gate, memory_order_acquire)) == RTLP_REPLAY_GATE_CLOSED) {
+                RtlpFutexWait(&Replay->Gate, RTLP_REPLAY_GATE_CLOSED, UINT64_MAX);
+        }
+        if (Gate == RTLP_REPLAY_GATE_ABORTED) {
+                return NULL;
+        }
+
+        for (ULONG i = 0; i < Thread->Count; i++) {
+                PRTLP_REPLAY_CALL Call = &Thread->Calls[i];
+                if (Replay->Flags & RTL_SYNC_TRACE_REPLAY_TIMED) {
+                        ULONGLONG Time = Replay->StartTime + Call->Record->Time;
+                        struct timespec ts = {.tv_sec = Time / NSEC_PER_SEC, .tv_nsec = Time % NSEC_PER_SEC};
+                        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+                        }
+                }
+
+                bool Skipped;
+                NTSTATUS Status = RtlpReplayCall(Replay, Call, &Skipped);
+                if (Skipped) {
+                        Thread->Skipped++;
+                } else if (Status != Call->Record->Status) {
+                        Thread->Mismatches++;
+                }
+        }
+
+        return NULL;
+}
+
+static NTSTATUS RtlpRunReplay(PRTLP_REPLAY Replay, PRTL_SYNC_TRACE_REPLAY_INFORMATION Information)
+{
+        NTSTATUS Status = STATUS_SUCCESS;
+        for (ULONG i = 0; i < Replay->ObjectCount && Status == STATUS_SUCCESS; i++) {
+                Status = RtlpCreateReplayObject(&Replay->Objects[i]);
+                Replay->Objects[i].Created = Status == STATUS_SUCCESS;
+        }
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        ULONG Started = 0;
+        for (; Started < Replay->ThreadCount; Started++) {
+                Replay->Threads[Started].Replay = Replay;
+                int ret = pthread_create(&Replay->Threads[Started].Thread, NULL, RtlpReplayThreadStart, &Replay->Threads[Started]);
+                if (ret != 0) {
+                        errno = ret;
+                        Status = STATUS_NO_MEMORY;
+                        break;
+                }
+        }
+
+        Replay->StartTime = RtlpGetTraceTime();
+        atomic_store_explicit(&Replay->Gate, Status == STATUS_SUCCESS ? RTLP_REPLAY_GATE_OPEN : RTLP_REPLAY_GATE_ABORTED,
+                              memory_order_release);
+        RtlpFutexWake(&Replay->Gate, INT_MAX);
+        for (ULONG i = 0; i < Started; i++) {
+                pthread_join(Replay->Threads[i].Thread, NULL);
+        }
+        ULONGLONG Elapsed = RtlpGetTraceTime() - Replay->StartTime;
+
+        if (Status == STATUS_SUCCESS && Information != NULL) {
+                memset(Information, 0, sizeof(*Information));
+                Information->Threads = Replay->ThreadCount;
+                Information->Objects = Replay->ObjectCount;
+                Information->Elapsed.QuadPart = Elapsed / 100;
+                for (ULONG i = 0; i < Replay->ThreadCount; i++) {
+                        Information->Calls += Replay->Threads[i].Count;
+                        Information->Skipped += Replay->Threads[i].Skipped;
+                        Information->Mismatches += Replay->Threads[i].Mismatches;
+                }
+        }
+
+        return Status;
+}
+
+NTSTATUS RtlReplaySyncTrace(PCSZ FileName, ULONG Flags, PRTL_SYNC_TRACE_REPLAY_INFORMATION Information)
+{
+        if (FileName == NULL) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_1;
+        }
+
+        if (Flags & ~RTL_SYNC_TRACE_REPLAY_TIMED) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER_2;
+        }
+
+        int Object = open(FileName, O_RDONLY | O_CLOEXEC);
+        if (Object == -1) {
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+
+        struct stat st;
+        if (fstat(Object, &st) == -1) {
+                NTSTATUS Status = RtlpGetNtStatusFromUnixErrno();
+                close(Object);
+                return Status;
+        }
+
+        if ((size_t)st.st_size < sizeof(RTLP_TRACE_HEADER)) {
+                close(Object);
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        PRTLP_TRACE_HEADER Header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, Object, 0);
+        close(Object);
+        if (Header == MAP_FAILED) {
+                return RtlpGetNtStatusFromUnixErrno();
+        }
+
+        if (Header->Magic != RTLP_TRACE_MAGIC || Header->Version != RTLP_TRACE_VERSION) {
+                munmap(Header, st.st_size);
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        RTLP_REPLAY Replay = {.Flags = Flags};
+        NTSTATUS Status = RtlpLoadReplay(&Replay, Header, st.st_size);
+        if (Status == STATUS_SUCCESS) {
+                Status = RtlpRunReplay(&Replay, Information);
+        }
+
+        for (ULONG i = 0; i < Replay.ObjectCount; i++) {
+                if (Replay.Objects[i].Created) {
+                        NtClose(Replay.Objects[i].Handle);
+                }
+        }
+        for (ULONG i = 0; i < Replay.ThreadCount; i++) {
+                free(Replay.Threads[i].Calls);
+        }
+        free(Replay.Threads);
+        free(Replay.Objects);
+        free(Replay.ObjectIds);
+        free(Replay.Handles);
+        munmap(Header, st.st_size);
+
+        return Status;
+}
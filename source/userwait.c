@@ -0,0 +1,424 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 20/10/2026 GMT +7 21.30
+ * - Initial userspace backend for events and semaphores
+ * 21/10/2026 GMT +7 14.15
+ * - Multi-unit semaphore acquire
+ */
+
+/* Events and semaphores that never leave the process don't need NTSYNC.
+ * Their count is changed under the lock of the object, and a waiting thread
+ * links one entry per object it waits on into the waiter list of that
+ * object, then sleeps on the futex of its wait block. A wait locks all of
+ * its objects in address order, so a wait-all takes every object at once.
+ * A signaled object wakes as many wait-any waiters as it can satisfy, and
+ * every wait-all waiter as those have to check their other objects.
+ *
+ * A multi-unit acquire queues like any other waiter, but while one is
+ * queued the semaphore looks empty to everybody else and only the oldest
+ * acquire is woken, once the count covers it. Small requests can't starve
+ * a large one that way.
+ */
+
+#include "ntp.h"
+#include <errno.h>
+#include <linux/ntsync.h>
+
+typedef struct _RTLP_WAIT_BLOCK
+{
+        _Atomic ULONG Signaled;
+        _Atomic(PRTLP_DISPATCHER) Pulsed;
+        bool WaitAll;
+        /* Units a NtAcquireSemaphoreEx waits for, 0 for other waits */
+        LONG AcquireCount;
+} RTLP_WAIT_BLOCK, *PRTLP_WAIT_BLOCK;
+
+typedef struct _RTLP_WAIT_ENTRY
+{
+        struct _RTLP_WAIT_ENTRY *Next;
+        struct _RTLP_WAIT_ENTRY *Prev;
+        PRTLP_WAIT_BLOCK Block;
+} RTLP_WAIT_ENTRY, *PRTLP_WAIT_ENTRY;
+
+void RtlpInitializeUserDispatcher(PRTLP_DISPATCHER Dispatcher, ULONG Value)
+{
+        Dispatcher->Userspace = true;
+        Dispatcher->State = &Dispatcher->PrivateState;
+        atomic_init(&Dispatcher->PrivateState, Value);
+        pthread_mutex_init(&Dispatcher->Lock, NULL);
+        Dispatcher->FirstWaiter = NULL;
+        Dispatcher->LastWaiter = NULL;
+        Dispatcher->WaitAllCount = 0;
+        Dispatcher->AcquireWaitCount = 0;
+}
+
+/* Only the forking thread is left in a child, none of the waiters is */
+void RtlpResetUserDispatcher(PRTLP_DISPATCHER Dispatcher)
+{
+        pthread_mutex_init(&Dispatcher->Lock, NULL);
+        Dispatcher->FirstWaiter = NULL;
+        Dispatcher->LastWaiter = NULL;
+        Dispatcher->WaitAllCount = 0;
+        Dispatcher->AcquireWaitCount = 0;
+}
+
+static ULONG RtlpGetUserState(PRTLP_DISPATCHER Dispatcher)
+{
+        return atomic_load_explicit(&Dispatcher->PrivateState, memory_order_relaxed);
+}
+
+/* What a wait other than the oldest multi-unit acquire can take */
+static ULONG RtlpGetUserAvailable(PRTLP_DISPATCHER Dispatcher)
+{
+        return Dispatcher->AcquireWaitCount != 0 ? 0 : RtlpGetUserState(Dispatcher);
+}
+
+static PRTLP_WAIT_ENTRY RtlpGetFirstUserAcquire(PRTLP_DISPATCHER Dispatcher)
+{
+        PRTLP_WAIT_ENTRY Entry = Dispatcher->FirstWaiter;
+        while (Entry != NULL && Entry->Block->AcquireCount == 0) {
+                Entry = Entry->Next;
+        }
+
+        return Entry;
+}
+
+static void RtlpSetUserState(PRTLP_DISPATCHER Dispatcher, ULONG Value)
+{
+        atomic_store_explicit(&Dispatcher->PrivateState, Value, memory_order_relaxed);
+}
+
+/* The block lives on the stack of its thread, which can't leave the wait
+ * before it gets the lock held by the caller. */
+static void RtlpWakeBlock(PRTLP_WAIT_BLOCK Block)
+{
+        if (atomic_exchange_explicit(&Block->Signaled, 1, memory_order_release) == 0) {
+                RtlpFutexWake(&Block->Signaled, 1);
+        }
+}
+
+/* Called with the lock of Dispatcher held, Count is how many wait-any
+ * waiters the current state can satisfy. */
+static void RtlpWakeUserWaiters(PRTLP_DISPATCHER Dispatcher, ULONG Count)
+{
+        if (Dispatcher->AcquireWaitCount != 0) {
+                PRTLP_WAIT_ENTRY Entry = RtlpGetFirstUserAcquire(Dispatcher);
+                if ((ULONG)Entry->Block->AcquireCount <= RtlpGetUserState(Dispatcher)) {
+                        RtlpWakeBlock(Entry->Block);
+                }
+                return;
+        }
+
+        for (PRTLP_WAIT_ENTRY Entry = Dispatcher->FirstWaiter; Entry != NULL; Entry = Entry->Next) {
+                if (Count == 0 && Dispatcher->WaitAllCount == 0) {
+                        break;
+                }
+
+                if (!Entry->Block->WaitAll) {
+                        if (Count == 0) {
+                                continue;
+                        }
+                        Count--;
+                }
+                RtlpWakeBlock(Entry->Block);
+        }
+}
+
+static ULONG RtlpGetUserWakeCount(PRTLP_DISPATCHER Dispatcher)
+{
+        return Dispatcher->ManualReset ? UINT32_MAX : RtlpGetUserState(Dispatcher);
+}
+
+static void RtlpLockUserObjects(ULONG Count, PRTLP_DISPATCHER *Locks)
+{
+        for (ULONG i = 0; i < Count; i++) {
+                pthread_mutex_lock(&Locks[i]->Lock);
+        }
+}
+
+static void RtlpUnlockUserObjects(ULONG Count, PRTLP_DISPATCHER *Locks)
+{
+        for (ULONG i = Count; i > 0; i--) {
+                pthread_mutex_unlock(&Locks[i - 1]->Lock);
+        }
+}
+
+/* Sorts the objects by address into Locks, without duplicates */
+static ULONG RtlpSortUserObjects(ULONG Count, PRTLP_DISPATCHER *Objects, PRTLP_DISPATCHER *Locks)
+{
+        ULONG LockCount = 0;
+        for (ULONG i = 0; i < Count; i++) {
+                ULONG j = LockCount;
+                while (j > 0 && (uintptr_t)Locks[j - 1] > (uintptr_t)Objects[i]) {
+                        j--;
+                }
+                if (j > 0 && Locks[j - 1] == Objects[i]) {
+                        continue;
+                }
+
+                for (ULONG k = LockCount; k > j; k--) {
+                        Locks[k] = Locks[k - 1];
+                }
+                Locks[j] = Objects[i];
+                LockCount++;
+        }
+
+        return LockCount;
+}
+
+static void RtlpConsumeUserObject(PRTLP_DISPATCHER Dispatcher)
+{
+        if (!Dispatcher->ManualReset) {
+                RtlpSetUserState(Dispatcher, RtlpGetUserState(Dispatcher) - 1);
+        }
+}
+
+/* Called with every object locked, STATUS_PENDING if the wait can't be
+ * satisfied yet. A pulse satisfies a wait-any without touching the state. */
+static NTSTATUS RtlpSatisfyUserWait(ULONG Count, PRTLP_DISPATCHER *Objects, PRTLP_WAIT_BLOCK Block)
+{
+        if (Block->WaitAll) {
+                for (ULONG i = 0; i < Count; i++) {
+                        if (RtlpGetUserAvailable(Objects[i]) == 0) {
+                                return STATUS_PENDING;
+                        }
+                }
+
+                for (ULONG i = 0; i < Count; i++) {
+                        RtlpConsumeUserObject(Objects[i]);
+                }
+                return STATUS_WAIT_0;
+        }
+
+        PRTLP_DISPATCHER Pulsed = atomic_load_explicit(&Block->Pulsed, memory_order_relaxed);
+        for (ULONG i = 0; Pulsed != NULL && i < Count; i++) {
+                if (Objects[i] == Pulsed) {
+                        return STATUS_WAIT_0 + i;
+                }
+        }
+
+        for (ULONG i = 0; i < Count; i++) {
+                if (RtlpGetUserAvailable(Objects[i]) != 0) {
+                        RtlpConsumeUserObject(Objects[i]);
+                        return STATUS_WAIT_0 + i;
+                }
+        }
+
+        return STATUS_PENDING;
+}
+
+static void RtlpInsertUserWaiter(PRTLP_DISPATCHER Dispatcher, PRTLP_WAIT_ENTRY Entry, PRTLP_WAIT_BLOCK Block)
+{
+        Entry->Block = Block;
+        Entry->Next = NULL;
+        Entry->Prev = Dispatcher->LastWaiter;
+        if (Dispatcher->LastWaiter != NULL) {
+                Dispatcher->LastWaiter->Next = Entry;
+        } else {
+                Dispatcher->FirstWaiter = Entry;
+        }
+        Dispatcher->LastWaiter = Entry;
+        Dispatcher->WaitAllCount += Block->WaitAll;
+        Dispatcher->AcquireWaitCount += Block->AcquireCount != 0;
+}
+
+static void RtlpRemoveUserWaiter(PRTLP_DISPATCHER Dispatcher, PRTLP_WAIT_ENTRY Entry)
+{
+        if (Entry->Prev != NULL) {
+                Entry->Prev->Next = Entry->Next;
+        } else {
+                Dispatcher->FirstWaiter = Entry->Next;
+        }
+
+        if (Entry->Next != NULL) {
+                Entry->Next->Prev = Entry->Prev;
+        } else {
+                Dispatcher->LastWaiter = Entry->Prev;
+        }
+        Dispatcher->WaitAllCount -= Entry->Block->WaitAll;
+        Dispatcher->AcquireWaitCount -= Entry->Block->AcquireCount != 0;
+}
+
+NTSTATUS RtlpWaitForUserObjects(ULONG Count, PRTLP_DISPATCHER *Objects, WAIT_TYPE WaitType, PLARGE_INTEGER TimeOut)
+{
+        __u64 Deadline;
+        NTSTATUS Status = RtlpFormatTimeOut(TimeOut, &Deadline);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        PRTLP_DISPATCHER Locks[MAXIMUM_WAIT_OBJECTS];
+        ULONG LockCount = RtlpSortUserObjects(Count, Objects, Locks);
+        if (WaitType == WaitAll && LockCount != Count) {
+                errno = EINVAL;
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        RTLP_WAIT_BLOCK Block = {.WaitAll = WaitType == WaitAll};
+        RTLP_WAIT_ENTRY Entries[MAXIMUM_WAIT_OBJECTS];
+        bool Poll = TimeOut != NULL && TimeOut->QuadPart == 0;
+        bool Registered = false;
+        bool TimedOut = false;
+        atomic_init(&Block.Signaled, 0);
+        atomic_init(&Block.Pulsed, NULL);
+
+        for (;;) {
+                RtlpLockUserObjects(LockCount, Locks);
+                Status = RtlpSatisfyUserWait(Count, Objects, &Block);
+                if (Status == STATUS_PENDING && !TimedOut && !Poll) {
+                        if (!Registered) {
+                                for (ULONG i = 0; i < LockCount; i++) {
+                                        RtlpInsertUserWaiter(Locks[i], &Entries[i], &Block);
+                                }
+                                Registered = true;
+                        }
+
+                        atomic_store_explicit(&Block.Signaled, 0, memory_order_relaxed);
+                        RtlpUnlockUserObjects(LockCount, Locks);
+                        TimedOut = RtlpFutexWait(&Block.Signaled, 0, Deadline) == STATUS_TIMEOUT;
+                        continue;
+                }
+
+                /* A wake-up meant for this thread may have been for an
+                 * object it didn't take, it goes to the next waiter. */
+                if (Registered) {
+                        for (ULONG i = 0; i < LockCount; i++) {
+                                RtlpRemoveUserWaiter(Locks[i], &Entries[i]);
+                                if (RtlpGetUserState(Locks[i]) != 0) {
+                                        RtlpWakeUserWaiters(Locks[i], RtlpGetUserWakeCount(Locks[i]));
+                                }
+                        }
+                }
+                RtlpUnlockUserObjects(LockCount, Locks);
+                break;
+        }
+
+        if (Status == STATUS_PENDING) {
+                errno = ETIMEDOUT;
+                return STATUS_TIMEOUT;
+        }
+
+        return Status;
+}
+
+NTSTATUS RtlpAcquireUserSemaphore(PRTLP_DISPATCHER Semaphore, LONG AcquireCount, PLARGE_INTEGER TimeOut)
+{
+        __u64 Deadline;
+        NTSTATUS Status = RtlpFormatTimeOut(TimeOut, &Deadline);
+        if (Status != STATUS_SUCCESS) {
+                return Status;
+        }
+
+        RTLP_WAIT_BLOCK Block = {.WaitAll = false, .AcquireCount = AcquireCount};
+        RTLP_WAIT_ENTRY Entry;
+        bool Poll = TimeOut != NULL && TimeOut->QuadPart == 0;
+        bool Registered = false;
+        bool TimedOut = false;
+        atomic_init(&Block.Signaled, 0);
+        atomic_init(&Block.Pulsed, NULL);
+
+        pthread_mutex_lock(&Semaphore->Lock);
+        for (;;) {
+                ULONG Count = RtlpGetUserState(Semaphore);
+                bool First = Registered ? RtlpGetFirstUserAcquire(Semaphore) == &Entry : Semaphore->AcquireWaitCount == 0;
+                if (First && Count >= (ULONG)AcquireCount) {
+                        RtlpSetUserState(Semaphore, Count - AcquireCount);
+                        Status = STATUS_WAIT_0;
+                        break;
+                }
+
+                if (TimedOut || Poll) {
+                        Status = STATUS_TIMEOUT;
+                        break;
+                }
+
+                if (!Registered) {
+                        RtlpInsertUserWaiter(Semaphore, &Entry, &Block);
+                        Registered = true;
+                }
+
+                atomic_store_explicit(&Block.Signaled, 0, memory_order_relaxed);
+                pthread_mutex_unlock(&Semaphore->Lock);
+                TimedOut = RtlpFutexWait(&Block.Signaled, 0, Deadline) == STATUS_TIMEOUT;
+                pthread_mutex_lock(&Semaphore->Lock);
+        }
+
+        /* What is left, or all of it if this one gave up, goes to the
+         * waiters it held back. */
+        if (Registered) {
+                RtlpRemoveUserWaiter(Semaphore, &Entry);
+                if (RtlpGetUserState(Semaphore) != 0) {
+                        RtlpWakeUserWaiters(Semaphore, RtlpGetUserWakeCount(Semaphore));
+                }
+        }
+        pthread_mutex_unlock(&Semaphore->Lock);
+
+        if (Status == STATUS_TIMEOUT) {
+                errno = ETIMEDOUT;
+        }
+
+        return Status;
+}
+
+NTSTATUS RtlpReleaseUserSemaphore(PRTLP_DISPATCHER Semaphore, LONG ReleaseCount, PLONG PreviousCount)
+{
+        pthread_mutex_lock(&Semaphore->Lock);
+        ULONG Count = RtlpGetUserState(Semaphore);
+        if ((ULONG)ReleaseCount > (ULONG)Semaphore->MaximumCount - Count) {
+                pthread_mutex_unlock(&Semaphore->Lock);
+                errno = EOVERFLOW;
+                return STATUS_SEMAPHORE_LIMIT_EXCEEDED;
+        }
+
+        RtlpSetUserState(Semaphore, Count + ReleaseCount);
+        RtlpWakeUserWaiters(Semaphore, Count + ReleaseCount);
+        pthread_mutex_unlock(&Semaphore->Lock);
+
+        if (PreviousCount != NULL) {
+                *PreviousCount = Count;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/* Opcode is the NTSYNC ioctl the same operation would use */
+NTSTATUS RtlpModifyUserEvent(PRTLP_DISPATCHER Event, unsigned long Opcode, PLONG PreviousState)
+{
+        pthread_mutex_lock(&Event->Lock);
+        LONG State = RtlpGetUserState(Event);
+        if (Opcode == NTSYNC_IOC_EVENT_SET) {
+                RtlpSetUserState(Event, 1);
+                RtlpWakeUserWaiters(Event, RtlpGetUserWakeCount(Event));
+        } else if (Opcode == NTSYNC_IOC_EVENT_RESET) {
+                RtlpSetUserState(Event, 0);
+        } else {
+                /* Satisfies the wait-any waiters there are right now, or the
+                 * first of them for an auto-reset event, then resets. */
+                for (PRTLP_WAIT_ENTRY Entry = Event->FirstWaiter; Entry != NULL; Entry = Entry->Next) {
+                        PRTLP_DISPATCHER Pulsed = NULL;
+                        if (Entry->Block->WaitAll ||
+                            !atomic_compare_exchange_strong_explicit(&Entry->Block->Pulsed, &Pulsed, Event, memory_order_relaxed, memory_order_relaxed)) {
+                                continue;
+                        }
+
+                        RtlpWakeBlock(Entry->Block);
+                        if (!Event->ManualReset) {
+                                break;
+                        }
+                }
+                RtlpSetUserState(Event, 0);
+        }
+        pthread_mutex_unlock(&Event->Lock);
+
+        if (PreviousState != NULL) {
+                *PreviousState = State;
+        }
+
+        return STATUS_SUCCESS;
+}
@@ -8,10 +8,35 @@
 /* Changelog
  * 28/10/2025 GMT +7 06.24
  * Overflow Semaphore should return ERROR_TOO_MANY_POSTS now
+ * 19/10/2026 GMT +7 09.12
+ * - Add CreateMutexA, CreateMutexExA and ReleaseMutex
+ * - Wait functions pass through WAIT_ABANDONED_0 + n and no longer fail on success
+ * 19/10/2026 GMT +7 14.05
+ * - Add critical sections
+ * 19/10/2026 GMT +7 16.30
+ * - Add synchronization barriers and one-time initialization
+ * - Pass the EVENT_TYPE matching ManualReset to NtCreateEvent
+ * 20/10/2026 GMT +7 08.45
+ * - Add CreateThread, GetExitCodeThread and ExitThread
+ * 20/10/2026 GMT +7 13.20
+ * - Add DuplicateHandle and GetCurrentProcess
+ * 20/10/2026 GMT +7 18.10
+ * - Named events and semaphores, add OpenEventA and OpenSemaphoreA
+ * 20/10/2026 GMT +7 21.30
+ * - Add ntsync_init_ex to pick the backend of events and semaphores
+ * 21/10/2026 GMT +7 14.15
+ * - Add WaitForSemaphoreCount
+ * 22/10/2026 GMT +7 09.20
+ * - Add CreateBroadcastEvent and BroadcastEvent
+ * 23/10/2026 GMT +7 10.05
+ * - EnterCriticalSection aborts when the lock can't be waited for instead of running unlocked
+ * 23/10/2026 GMT +7 14.00
+ * - ntsync_init_ex refuses the userspace backend next to /dev/ntsync without NTSYNC_BACKEND_NO_MIXED_WAITS
  */
 
 #include "win32.h"
 #include <fcntl.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -25,6 +50,38 @@ bool ntsync_init(void)
         }
 }
 
+/* NTSYNC_BACKEND_AUTO falls back to the userspace backend without
+ * /dev/ntsync. The userspace backend still opens it for named objects and
+ * mutexes, but doesn't fail without it. A wait can't mix those with
+ * userspace objects, so while /dev/ntsync is there the userspace backend
+ * is only taken with NTSYNC_BACKEND_NO_MIXED_WAITS, and fails with EEXIST
+ * otherwise. */
+bool ntsync_init_ex(int Backend)
+{
+        bool NoMixedWaits = Backend & NTSYNC_BACKEND_NO_MIXED_WAITS;
+        Backend &= ~NTSYNC_BACKEND_NO_MIXED_WAITS;
+        if (Backend != NTSYNC_BACKEND_KERNEL && Backend != NTSYNC_BACKEND_USERSPACE && Backend != NTSYNC_BACKEND_AUTO) {
+                errno = EINVAL;
+                return false;
+        }
+
+        bool Opened = ntsync_init();
+        if (Backend == NTSYNC_BACKEND_KERNEL) {
+                ntsync_backend = NTSYNC_BACKEND_KERNEL;
+                return Opened;
+        }
+
+        if (Backend == NTSYNC_BACKEND_USERSPACE && Opened && !NoMixedWaits) {
+                close(ntsync);
+                ntsync = -1;
+                errno = EEXIST;
+                return false;
+        }
+
+        ntsync_backend = Backend == NTSYNC_BACKEND_USERSPACE || !Opened ? NTSYNC_BACKEND_USERSPACE : NTSYNC_BACKEND_KERNEL;
+        return true;
+}
+
 void ntsync_exit(void)
 {
         if (ntsync != -1) {
@@ -42,9 +99,35 @@ PLARGE_INTEGER BaseFormatTimeOut(PLARGE_INTEGER TimeOut, DWORD Milliseconds)
         return TimeOut;
 }
 
+/* Returns NULL for an unnamed object */
+POBJECT_ATTRIBUTES BaseFormatObjectAttributes(POBJECT_ATTRIBUTES ObjectAttributes, PANSI_STRING ObjectName, LPCSTR Name)
+{
+        if (Name == NULL) {
+                return NULL;
+        }
+
+        RtlInitAnsiString(ObjectName, Name);
+        InitializeObjectAttributes(ObjectAttributes, ObjectName, OBJ_OPENIF, NULL, NULL);
+        return ObjectAttributes;
+}
+
+/* Creating a named object that exists already succeeds, the caller tells
+ * the two apart with GetLastError. */
+static void BaseSetLastCreateError(NTSTATUS Status)
+{
+        if (Status == STATUS_OBJECT_NAME_EXISTS) {
+                errno = EEXIST;
+        } else if (Status == STATUS_SUCCESS) {
+                errno = 0;
+        }
+}
+
 DWORD GetLastError(void)
 {
         switch (errno) {
+                case 0:
+                        return ERROR_SUCCESS;
+                        break;
                 case EBADF:
                         return ERROR_INVALID_HANDLE;
                         break;
@@ -66,6 +149,15 @@ DWORD GetLastError(void)
                 case ENOSYS:
                         return ERROR_INVALID_FUNCTION;
                         break;
+                case ENOMEM:
+                        return ERROR_NOT_ENOUGH_MEMORY;
+                        break;
+                case EEXIST:
+                        return ERROR_ALREADY_EXISTS;
+                        break;
+                case ENOENT:
+                        return ERROR_FILE_NOT_FOUND;
+                        break;
                 default:
                         return ERROR_GEN_FAILURE;
                         break;
@@ -74,19 +166,22 @@ DWORD GetLastError(void)
 
 HANDLE CreateSemaphoreA(LPSECURITY_ATTRIBUTES SemaphoreAttributes, LONG InitialCount, LONG MaximumCount, LPCSTR Name)
 {
-        if (SemaphoreAttributes != NULL || Name != NULL) {
+        if (SemaphoreAttributes != NULL) {
                 errno = ENOSYS;
                 return NULL;
         }
 
         HANDLE Semaphore = NULL;
-        NtCreateSemaphore(&Semaphore, SEMAPHORE_ALL_ACCESS, NULL, InitialCount, MaximumCount);
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        ANSI_STRING ObjectName;
+        BaseSetLastCreateError(NtCreateSemaphore(&Semaphore, SEMAPHORE_ALL_ACCESS, BaseFormatObjectAttributes(&ObjectAttributes, &ObjectName, Name),
+                                                 InitialCount, MaximumCount));
         return Semaphore;
 }
 
 HANDLE CreateSemaphoreExA(LPSECURITY_ATTRIBUTES SemaphoreAttributes, LONG InitialCount, LONG MaximumCount, LPCSTR Name, DWORD Flags, DWORD DesiredAccess)
 {
-        if (SemaphoreAttributes != NULL || Name != NULL) {
+        if (SemaphoreAttributes != NULL) {
                 errno = ENOSYS;
                 return NULL;
         }
@@ -97,7 +192,25 @@ HANDLE CreateSemaphoreExA(LPSECURITY_ATTRIBUTES SemaphoreAttributes, LONG Initia
         }
 
         HANDLE Semaphore = NULL;
-        NtCreateSemaphore(&Semaphore, DesiredAccess, NULL, InitialCount, MaximumCount);
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        ANSI_STRING ObjectName;
+        BaseSetLastCreateError(NtCreateSemaphore(&Semaphore, DesiredAccess, BaseFormatObjectAttributes(&ObjectAttributes, &ObjectName, Name),
+                                                 InitialCount, MaximumCount));
+        return Semaphore;
+}
+
+HANDLE OpenSemaphoreA(DWORD DesiredAccess, BOOL InheritHandle, LPCSTR Name)
+{
+        (void)InheritHandle;
+        if (Name == NULL) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        HANDLE Semaphore = NULL;
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        ANSI_STRING ObjectName;
+        NtOpenSemaphore(&Semaphore, DesiredAccess, BaseFormatObjectAttributes(&ObjectAttributes, &ObjectName, Name));
         return Semaphore;
 }
 
@@ -106,30 +219,236 @@ BOOL ReleaseSemaphore(HANDLE Semaphore, LONG ReleaseCount, LONG *PreviousCount)
         return !NtReleaseSemaphore(Semaphore, ReleaseCount, PreviousCount);
 }
 
+DWORD WaitForSemaphoreCount(HANDLE Semaphore, LONG Count, DWORD Milliseconds)
+{
+        LARGE_INTEGER TimeOut;
+        NTSTATUS Status = NtAcquireSemaphoreEx(Semaphore, Count, FALSE, BaseFormatTimeOut(&TimeOut, Milliseconds));
+        if (Status == STATUS_WAIT_0 || Status == STATUS_TIMEOUT) {
+                return Status;
+        } else {
+                return WAIT_FAILED;
+        }
+}
+
 HANDLE CreateEventA(LPSECURITY_ATTRIBUTES EventAttributes, BOOL ManualReset, BOOL InitialState, LPCSTR Name)
 {
-        if (EventAttributes != NULL || Name != NULL) {
+        if (EventAttributes != NULL) {
                 errno = ENOSYS;
                 return NULL;
         }
 
         HANDLE Event = NULL;
-        NtCreateEvent(&Event, EVENT_ALL_ACCESS, NULL, ManualReset, InitialState);
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        ANSI_STRING ObjectName;
+        BaseSetLastCreateError(NtCreateEvent(&Event, EVENT_ALL_ACCESS, BaseFormatObjectAttributes(&ObjectAttributes, &ObjectName, Name),
+                                             ManualReset ? NotificationEvent : SynchronizationEvent, InitialState));
         return Event;
 }
 
 HANDLE CreateEventExA(LPSECURITY_ATTRIBUTES EventAttributes, LPCSTR Name, DWORD Flags, DWORD DesiredAccess)
 {
-        if (EventAttributes != NULL || Name != NULL) {
+        if (EventAttributes != NULL) {
                 errno = ENOSYS;
                 return NULL;
         }
 
         HANDLE Event = NULL;
-        NtCreateEvent(&Event, DesiredAccess, NULL, Flags & CREATE_EVENT_MANUAL_RESET, Flags & CREATE_EVENT_INITIAL_SET);
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        ANSI_STRING ObjectName;
+        BaseSetLastCreateError(NtCreateEvent(&Event, DesiredAccess, BaseFormatObjectAttributes(&ObjectAttributes, &ObjectName, Name),
+                                             Flags & CREATE_EVENT_MANUAL_RESET ? NotificationEvent : SynchronizationEvent, Flags & CREATE_EVENT_INITIAL_SET));
         return Event;
 }
 
+HANDLE OpenEventA(DWORD DesiredAccess, BOOL InheritHandle, LPCSTR Name)
+{
+        (void)InheritHandle;
+        if (Name == NULL) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        HANDLE Event = NULL;
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        ANSI_STRING ObjectName;
+        NtOpenEvent(&Event, DesiredAccess, BaseFormatObjectAttributes(&ObjectAttributes, &ObjectName, Name));
+        return Event;
+}
+
+HANDLE CreateMutexA(LPSECURITY_ATTRIBUTES MutexAttributes, BOOL InitialOwner, LPCSTR Name)
+{
+        if (MutexAttributes != NULL || Name != NULL) {
+                errno = ENOSYS;
+                return NULL;
+        }
+
+        HANDLE Mutex = NULL;
+        NtCreateMutant(&Mutex, MUTEX_ALL_ACCESS, NULL, InitialOwner);
+        return Mutex;
+}
+
+HANDLE CreateMutexExA(LPSECURITY_ATTRIBUTES MutexAttributes, LPCSTR Name, DWORD Flags, DWORD DesiredAccess)
+{
+        if (MutexAttributes != NULL || Name != NULL) {
+                errno = ENOSYS;
+                return NULL;
+        }
+
+        if (Flags & ~CREATE_MUTEX_INITIAL_OWNER) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        HANDLE Mutex = NULL;
+        NtCreateMutant(&Mutex, DesiredAccess, NULL, Flags & CREATE_MUTEX_INITIAL_OWNER);
+        return Mutex;
+}
+
+BOOL ReleaseMutex(HANDLE Mutex)
+{
+        return !NtReleaseMutant(Mutex, NULL);
+}
+
+HANDLE CreateThread(LPSECURITY_ATTRIBUTES ThreadAttributes, SIZE_T StackSize, LPTHREAD_START_ROUTINE StartAddress, LPVOID Parameter, DWORD CreationFlags, LPDWORD ThreadId)
+{
+        if (ThreadAttributes != NULL) {
+                errno = ENOSYS;
+                return NULL;
+        }
+
+        if (CreationFlags & ~(CREATE_SUSPENDED | STACK_SIZE_PARAM_IS_A_RESERVATION)) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        /* The whole stack is mapped up front, a reservation is a commit */
+        HANDLE Thread = NULL;
+        CLIENT_ID ClientId;
+        NTSTATUS Status = RtlCreateUserThread(&Thread, THREAD_ALL_ACCESS, CreationFlags & CREATE_SUSPENDED, StackSize,
+                                              (PUSER_THREAD_START_ROUTINE)StartAddress, Parameter, ThreadId != NULL ? &ClientId : NULL);
+        if (Status == STATUS_SUCCESS && ThreadId != NULL) {
+                *ThreadId = (DWORD)(uintptr_t)ClientId.UniqueThread;
+        }
+
+        return Thread;
+}
+
+BOOL GetExitCodeThread(HANDLE Thread, LPDWORD ExitCode)
+{
+        if (ExitCode == NULL) {
+                errno = EFAULT;
+                return false;
+        }
+
+        THREAD_BASIC_INFORMATION Information;
+        if (NtQueryInformationThread(Thread, ThreadBasicInformation, &Information, sizeof(Information), NULL) != STATUS_SUCCESS) {
+                return false;
+        }
+
+        *ExitCode = Information.ExitStatus;
+        return true;
+}
+
+void ExitThread(DWORD ExitCode)
+{
+        RtlExitUserThread(ExitCode);
+}
+
+HANDLE GetCurrentProcess(void)
+{
+        return NtCurrentProcess();
+}
+
+BOOL DuplicateHandle(HANDLE SourceProcessHandle, HANDLE SourceHandle, HANDLE TargetProcessHandle, LPHANDLE TargetHandle, DWORD DesiredAccess, BOOL InheritHandle, DWORD Options)
+{
+        /* Every fd is close-on-exec, there is nothing to inherit */
+        (void)InheritHandle;
+        return !NtDuplicateObject(SourceProcessHandle, SourceHandle, TargetProcessHandle, TargetHandle, DesiredAccess, 0, Options);
+}
+
+void InitializeCriticalSection(LPCRITICAL_SECTION CriticalSection)
+{
+        RtlInitializeCriticalSection(CriticalSection);
+}
+
+BOOL InitializeCriticalSectionAndSpinCount(LPCRITICAL_SECTION CriticalSection, DWORD SpinCount)
+{
+        return !RtlInitializeCriticalSectionAndSpinCount(CriticalSection, SpinCount);
+}
+
+DWORD SetCriticalSectionSpinCount(LPCRITICAL_SECTION CriticalSection, DWORD SpinCount)
+{
+        return RtlSetCriticalSectionSpinCount(CriticalSection, SpinCount);
+}
+
+void EnterCriticalSection(LPCRITICAL_SECTION CriticalSection)
+{
+        /* There is no way to tell the caller the lock wasn't taken. Windows
+         * raises an exception here, left unhandled it ends the process. */
+        if (RtlEnterCriticalSection(CriticalSection) != STATUS_SUCCESS) {
+                abort();
+        }
+}
+
+BOOL TryEnterCriticalSection(LPCRITICAL_SECTION CriticalSection)
+{
+        return RtlTryEnterCriticalSection(CriticalSection);
+}
+
+void LeaveCriticalSection(LPCRITICAL_SECTION CriticalSection)
+{
+        RtlLeaveCriticalSection(CriticalSection);
+}
+
+void DeleteCriticalSection(LPCRITICAL_SECTION CriticalSection)
+{
+        RtlDeleteCriticalSection(CriticalSection);
+}
+
+BOOL InitializeSynchronizationBarrier(LPSYNCHRONIZATION_BARRIER Barrier, LONG TotalThreads, LONG SpinCount)
+{
+        return !RtlInitBarrier(Barrier, TotalThreads, SpinCount);
+}
+
+BOOL EnterSynchronizationBarrier(LPSYNCHRONIZATION_BARRIER Barrier, DWORD Flags)
+{
+        return RtlBarrier(Barrier, Flags);
+}
+
+BOOL DeleteSynchronizationBarrier(LPSYNCHRONIZATION_BARRIER Barrier)
+{
+        RtlDeleteBarrier(Barrier);
+        return TRUE;
+}
+
+void InitOnceInitialize(PINIT_ONCE InitOnce)
+{
+        RtlRunOnceInitialize(InitOnce);
+}
+
+BOOL InitOnceExecuteOnce(PINIT_ONCE InitOnce, PINIT_ONCE_FN InitFn, PVOID Parameter, PVOID *Context)
+{
+        return !RtlRunOnceExecuteOnce(InitOnce, InitFn, Parameter, Context);
+}
+
+BOOL InitOnceBeginInitialize(LPINIT_ONCE InitOnce, DWORD Flags, BOOL *Pending, PVOID *Context)
+{
+        NTSTATUS Status = RtlRunOnceBeginInitialize(InitOnce, Flags, Context);
+        if (Status != STATUS_SUCCESS && Status != STATUS_PENDING) {
+                return FALSE;
+        }
+
+        if (Pending != NULL) {
+                *Pending = Status == STATUS_PENDING;
+        }
+        return TRUE;
+}
+
+BOOL InitOnceComplete(LPINIT_ONCE InitOnce, DWORD Flags, PVOID Context)
+{
+        return !RtlRunOnceComplete(InitOnce, Flags, Context);
+}
+
 BOOL SetEvent(HANDLE Event)
 {
         return !NtSetEvent(Event, NULL);
@@ -145,6 +464,23 @@ BOOL PulseEvent(HANDLE Event)
         return !NtPulseEvent(Event, NULL);
 }
 
+HANDLE CreateBroadcastEvent(LPSECURITY_ATTRIBUTES EventAttributes)
+{
+        if (EventAttributes != NULL) {
+                errno = ENOSYS;
+                return NULL;
+        }
+
+        HANDLE Event = NULL;
+        BaseSetLastCreateError(NtCreateBroadcastEvent(&Event, EVENT_ALL_ACCESS, NULL));
+        return Event;
+}
+
+BOOL BroadcastEvent(HANDLE Event)
+{
+        return !NtBroadcastEvent(Event, NULL);
+}
+
 DWORD WaitForSingleObject(HANDLE Handle, DWORD Milliseconds)
 {
         return WaitForSingleObjectEx(Handle, Milliseconds, FALSE);
@@ -154,10 +490,10 @@ DWORD WaitForSingleObjectEx(HANDLE Handle, DWORD Milliseconds, BOOL Alertable)
 {
         LARGE_INTEGER TimeOut;
         NTSTATUS Status = NtWaitForSingleObject(Handle, Alertable, BaseFormatTimeOut(&TimeOut, Milliseconds));
-        if (Status != STATUS_WAIT_0 || Status != STATUS_TIMEOUT) {
-                return WAIT_FAILED;
-        } else {
+        if (Status == STATUS_WAIT_0 || Status == STATUS_ABANDONED_WAIT_0 || Status == STATUS_TIMEOUT) {
                 return Status;
+        } else {
+                return WAIT_FAILED;
         }
 }
 
@@ -170,10 +506,10 @@ DWORD WaitForMultipleObjectsEx(DWORD Count, const HANDLE *Handles, BOOL WaitAll,
 {
         LARGE_INTEGER TimeOut;
         NTSTATUS Status = NtWaitForMultipleObjects(Count, Handles, !WaitAll, Alertable, BaseFormatTimeOut(&TimeOut, Milliseconds));
-        if (Status != STATUS_TIMEOUT || !(Status > STATUS_WAIT_0 && Status < Count - 1)) {
-                return WAIT_FAILED;
-        } else {
+        if (Status < STATUS_WAIT_0 + Count || (Status >= STATUS_ABANDONED_WAIT_0 && Status < STATUS_ABANDONED_WAIT_0 + Count) || Status == STATUS_TIMEOUT) {
                 return Status;
+        } else {
+                return WAIT_FAILED;
         }
 }
 
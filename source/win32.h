@@ -8,14 +8,49 @@
 /* Changelog
  * 30/10/2025 GMT +7 05.57
  * - Define ERROR_TOO_MANY_POSTS
+ * 19/10/2026 GMT +7 09.12
+ * - Add CreateMutexA, CreateMutexExA and ReleaseMutex
+ * - Define WAIT_ABANDONED_0, WAIT_TIMEOUT now matches STATUS_TIMEOUT
+ * 19/10/2026 GMT +7 14.05
+ * - Add critical sections
+ * 19/10/2026 GMT +7 16.30
+ * - Add synchronization barriers and one-time initialization
+ * 20/10/2026 GMT +7 08.45
+ * - Add CreateThread, GetExitCodeThread and ExitThread
+ * 20/10/2026 GMT +7 13.20
+ * - Add DuplicateHandle and GetCurrentProcess
+ * 20/10/2026 GMT +7 18.10
+ * - Add OpenEventA and OpenSemaphoreA, define ERROR_ALREADY_EXISTS and ERROR_FILE_NOT_FOUND
+ * 20/10/2026 GMT +7 21.30
+ * - Add ntsync_init_ex to pick the backend of events and semaphores
+ * 21/10/2026 GMT +7 14.15
+ * - Add WaitForSemaphoreCount
+ * 22/10/2026 GMT +7 09.20
+ * - Add CreateBroadcastEvent and BroadcastEvent
+ * 23/10/2026 GMT +7 14.00
+ * - Add NTSYNC_BACKEND_NO_MIXED_WAITS
  */
 #define WIN32
 #include "nt.h"
 
 typedef const char* LPCSTR;
+typedef void* LPVOID;
+typedef DWORD* LPDWORD;
+typedef HANDLE* LPHANDLE;
 typedef void* SECURITY_ATTRIBUTES;
 typedef SECURITY_ATTRIBUTES* PSECURITY_ATTRIBUTES;
 typedef SECURITY_ATTRIBUTES* LPSECURITY_ATTRIBUTES;
+typedef RTL_CRITICAL_SECTION CRITICAL_SECTION;
+typedef RTL_CRITICAL_SECTION* PCRITICAL_SECTION;
+typedef RTL_CRITICAL_SECTION* LPCRITICAL_SECTION;
+typedef RTL_BARRIER SYNCHRONIZATION_BARRIER;
+typedef RTL_BARRIER* PSYNCHRONIZATION_BARRIER;
+typedef RTL_BARRIER* LPSYNCHRONIZATION_BARRIER;
+typedef RTL_RUN_ONCE INIT_ONCE;
+typedef RTL_RUN_ONCE* PINIT_ONCE;
+typedef RTL_RUN_ONCE* LPINIT_ONCE;
+typedef BOOL (*PINIT_ONCE_FN)(PINIT_ONCE InitOnce, PVOID Parameter, PVOID *Context);
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID ThreadParameter);
 
 #define WAIT_OBJECT_0 0
 #define WAIT_OBJECT_1 1
@@ -81,14 +116,19 @@ typedef SECURITY_ATTRIBUTES* LPSECURITY_ATTRIBUTES;
 #define WAIT_OBJECT_61 61
 #define WAIT_OBJECT_62 62
 #define WAIT_OBJECT_63 63
-#define WAIT_TIMEOUT 102
+#define WAIT_ABANDONED 0x00000080
+#define WAIT_ABANDONED_0 0x00000080
+#define WAIT_TIMEOUT 0x00000102
 #define WAIT_FAILED UINT32_MAX
 
 #define ERROR_SUCCESS 0
 #define ERROR_INVALID_FUNCTION 1
+#define ERROR_FILE_NOT_FOUND 2
 #define ERROR_ACCESS_DENIED 5
 #define ERROR_INVALID_HANDLE 6
+#define ERROR_NOT_ENOUGH_MEMORY 8
 #define ERROR_INVALID_PARAMETER 87
+#define ERROR_ALREADY_EXISTS 183
 #define ERROR_TOO_MANY_POSTS 298
 #define ERROR_ARITHMETIC_OVERFLOW 534
 #define ERROR_NOACCESS 998
@@ -100,7 +140,31 @@ typedef SECURITY_ATTRIBUTES* LPSECURITY_ATTRIBUTES;
 #define CREATE_EVENT_MANUAL_RESET 1
 #define CREATE_EVENT_INITIAL_SET 2
 
+#define SYNCHRONIZATION_BARRIER_FLAGS_SPIN_ONLY RTL_BARRIER_FLAGS_SPIN_ONLY
+#define SYNCHRONIZATION_BARRIER_FLAGS_BLOCK_ONLY RTL_BARRIER_FLAGS_BLOCK_ONLY
+#define SYNCHRONIZATION_BARRIER_FLAGS_NO_DELETE RTL_BARRIER_FLAGS_NO_DELETE
+
+#define INIT_ONCE_STATIC_INIT RTL_RUN_ONCE_INIT
+#define INIT_ONCE_CHECK_ONLY RTL_RUN_ONCE_CHECK_ONLY
+#define INIT_ONCE_ASYNC RTL_RUN_ONCE_ASYNC
+#define INIT_ONCE_INIT_FAILED RTL_RUN_ONCE_INIT_FAILED
+#define INIT_ONCE_CTX_RESERVED_BITS RTL_RUN_ONCE_CTX_RESERVED_BITS
+
+#define CREATE_MUTEX_INITIAL_OWNER 1
+#define MUTEX_MODIFY_STATE 0x0001
+#define MUTEX_ALL_ACCESS MUTANT_ALL_ACCESS
+
+#define STILL_ACTIVE STATUS_PENDING
+#define CREATE_SUSPENDED 0x00000004
+#define STACK_SIZE_PARAM_IS_A_RESERVATION 0x00010000
+
+#define NTSYNC_BACKEND_AUTO 2
+/* Or'ed into the backend, the caller never waits on userspace objects
+ * together with mutexes or named objects */
+#define NTSYNC_BACKEND_NO_MIXED_WAITS 0x100
+
 bool ntsync_init(void);
+bool ntsync_init_ex(int Backend);
 void ntsync_exit(void);
 
 DWORD GetLastError(void);
@@ -121,12 +185,25 @@ HANDLE CreateSemaphoreExA(
         DWORD DesiredAccess
 );
 
+HANDLE OpenSemaphoreA(
+        DWORD DesiredAccess,
+        BOOL InheritHandle,
+        LPCSTR Name
+);
+
 BOOL ReleaseSemaphore(
         HANDLE Semaphore,
         LONG ReleaseCount,
         LONG *PreviousCount
 );
 
+/* libntsync extension, takes Count units at once or none of them */
+DWORD WaitForSemaphoreCount(
+        HANDLE Semaphore,
+        LONG Count,
+        DWORD Milliseconds
+);
+
 HANDLE CreateEventA(
         LPSECURITY_ATTRIBUTES EventAttributes,
         BOOL ManualReset,
@@ -141,10 +218,115 @@ HANDLE CreateEventExA(
         DWORD DesiredAccess
 );
 
+HANDLE OpenEventA(
+        DWORD DesiredAccess,
+        BOOL InheritHandle,
+        LPCSTR Name
+);
+
+HANDLE CreateMutexA(
+        LPSECURITY_ATTRIBUTES MutexAttributes,
+        BOOL InitialOwner,
+        LPCSTR Name
+);
+
+HANDLE CreateMutexExA(
+        LPSECURITY_ATTRIBUTES MutexAttributes,
+        LPCSTR Name,
+        DWORD Flags,
+        DWORD DesiredAccess
+);
+
+BOOL ReleaseMutex(HANDLE Mutex);
+
+HANDLE CreateThread(
+        LPSECURITY_ATTRIBUTES ThreadAttributes,
+        SIZE_T StackSize,
+        LPTHREAD_START_ROUTINE StartAddress,
+        LPVOID Parameter,
+        DWORD CreationFlags,
+        LPDWORD ThreadId
+);
+
+BOOL GetExitCodeThread(
+        HANDLE Thread,
+        LPDWORD ExitCode
+);
+
+void ExitThread(DWORD ExitCode) __attribute__((noreturn));
+
+HANDLE GetCurrentProcess(void);
+
+BOOL DuplicateHandle(
+        HANDLE SourceProcessHandle,
+        HANDLE SourceHandle,
+        HANDLE TargetProcessHandle,
+        LPHANDLE TargetHandle,
+        DWORD DesiredAccess,
+        BOOL InheritHandle,
+        DWORD Options
+);
+
+void InitializeCriticalSection(LPCRITICAL_SECTION CriticalSection);
+
+BOOL InitializeCriticalSectionAndSpinCount(
+        LPCRITICAL_SECTION CriticalSection,
+        DWORD SpinCount
+);
+
+DWORD SetCriticalSectionSpinCount(
+        LPCRITICAL_SECTION CriticalSection,
+        DWORD SpinCount
+);
+
+void EnterCriticalSection(LPCRITICAL_SECTION CriticalSection);
+BOOL TryEnterCriticalSection(LPCRITICAL_SECTION CriticalSection);
+void LeaveCriticalSection(LPCRITICAL_SECTION CriticalSection);
+void DeleteCriticalSection(LPCRITICAL_SECTION CriticalSection);
+
+BOOL InitializeSynchronizationBarrier(
+        LPSYNCHRONIZATION_BARRIER Barrier,
+        LONG TotalThreads,
+        LONG SpinCount
+);
+
+BOOL EnterSynchronizationBarrier(
+        LPSYNCHRONIZATION_BARRIER Barrier,
+        DWORD Flags
+);
+
+BOOL DeleteSynchronizationBarrier(LPSYNCHRONIZATION_BARRIER Barrier);
+
+void InitOnceInitialize(PINIT_ONCE InitOnce);
+
+BOOL InitOnceExecuteOnce(
+        PINIT_ONCE InitOnce,
+        PINIT_ONCE_FN InitFn,
+        PVOID Parameter,
+        PVOID *Context
+);
+
+BOOL InitOnceBeginInitialize(
+        LPINIT_ONCE InitOnce,
+        DWORD Flags,
+        BOOL *Pending,
+        PVOID *Context
+);
+
+BOOL InitOnceComplete(
+        LPINIT_ONCE InitOnce,
+        DWORD Flags,
+        PVOID Context
+);
+
 BOOL SetEvent(HANDLE Event);
 BOOL ResetEvent(HANDLE Event);
 BOOL PulseEvent(HANDLE Event) __attribute__((deprecated));
 
+/* libntsync extension, wakes every thread already waiting exactly once */
+HANDLE CreateBroadcastEvent(LPSECURITY_ATTRIBUTES EventAttributes);
+BOOL BroadcastEvent(HANDLE Event);
+
 DWORD WaitForSingleObject(
         HANDLE Handle,
         DWORD Milliseconds
@@ -0,0 +1,1389 @@
+/*
+ * libntsync - Linux NTSYNC helper libraries
+ * Author: Kawaii Ghost <frweird@outlook.co.id>
+ * Copyright (c) 2025 Kawaii Ghost. All Rights Reserved.
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Changelog
+ * 23/10/2026 GMT +7 15.30
+ * - Initial backend test and benchmark runner
+ * 24/10/2026 GMT +7 09.30
+ * - Check that a release can't slip in while a waiter moves a full count
+ * 24/10/2026 GMT +7 12.00
+ * - Query the state of every kind of handle
+ * 24/10/2026 GMT +7 12.30
+ * - Take several semaphore units at once next to small waiters
+ * 24/10/2026 GMT +7 13.00
+ * - Broadcast late arrivals and a traced broadcast replayed
+ * 24/10/2026 GMT +7 13.30
+ * - Channel select across producers, select timeouts and partial sends
+ * 24/10/2026 GMT +7 14.00
+ * - Mutant recursion, contention and abandonment
+ * 24/10/2026 GMT +7 14.30
+ * - Keyed events matched by key from either side
+ * 24/10/2026 GMT +7 15.00
+ * - Critical sections, recursion and the semaphore made on first block
+ * 24/10/2026 GMT +7 15.30
+ * - Barrier phases with every wait flag and racing one-time initialization
+ * 24/10/2026 GMT +7 16.00
+ * - Duplicates within the process and into a child over a socket
+ * 24/10/2026 GMT +7 16.30
+ * - Named events and semaphores opened again by name and from a child
+ * 24/10/2026 GMT +7 17.00
+ * - A two thread trace replayed flat out and timed
+ * 24/10/2026 GMT +7 17.30
+ * - Registry deadlock reports for a lock cycle next to an idle waiter
+ * 24/10/2026 GMT +7 18.00
+ * - Include stdlib.h for mkstemp
+ */
+
+/* Runs the same tests and benchmarks once per backend, each in a process
+ * of its own so nothing one backend created is seen by the other.
+ *
+ *     cc -O2 -pthread -I../source -o backends backends.c $(find ../source -name '*.c')
+ *     ./backends [--no-bench]
+ *
+ * The NTSYNC backend is skipped when /dev/ntsync can't be opened. The exit
+ * status is 0 when every test passed on every backend that ran.
+ */
+
+#include "win32.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_THREAD_COUNT 4
+#define TEST_STRESS_COUNT 20000
+#define BENCH_COUNT 200000
+#define BENCH_PING_PONG_COUNT 20000
+
+#define TEST_CHECK(Condition) \
+        do { \
+                if (!(Condition)) { \
+                        printf("    %s:%d: %s\n", __func__, __LINE__, #Condition); \
+                        return false; \
+                } \
+        } while (0)
+
+typedef bool (*TEST_ROUTINE)(void);
+
+static LARGE_INTEGER TestZeroTimeOut = {.QuadPart = 0};
+
+static ULONGLONG TestGetTime(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool TestAutoResetEvent(void)
+{
+        HANDLE Event;
+        TEST_CHECK(NtCreateEvent(&Event, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForSingleObject(Event, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+
+        LONG PreviousState;
+        TEST_CHECK(NtSetEvent(Event, &PreviousState) == STATUS_SUCCESS && PreviousState == 0);
+        TEST_CHECK(NtWaitForSingleObject(Event, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+        TEST_CHECK(NtWaitForSingleObject(Event, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtClose(Event) == STATUS_SUCCESS);
+        return true;
+}
+
+static bool TestManualResetEvent(void)
+{
+        HANDLE Event;
+        TEST_CHECK(NtCreateEvent(&Event, EVENT_ALL_ACCESS, NULL, NotificationEvent, TRUE) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForSingleObject(Event, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+        TEST_CHECK(NtWaitForSingleObject(Event, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+
+        LONG PreviousState;
+        TEST_CHECK(NtResetEvent(Event, &PreviousState) == STATUS_SUCCESS && PreviousState == 1);
+        TEST_CHECK(NtWaitForSingleObject(Event, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtClose(Event) == STATUS_SUCCESS);
+        return true;
+}
+
+static bool TestSemaphore(void)
+{
+        HANDLE Semaphore;
+        TEST_CHECK(NtCreateSemaphore(&Semaphore, SEMAPHORE_ALL_ACCESS, NULL, 2, 3) == STATUS_SUCCESS);
+
+        LONG PreviousCount;
+        TEST_CHECK(NtReleaseSemaphore(Semaphore, 2, NULL) == STATUS_SEMAPHORE_LIMIT_EXCEEDED);
+        TEST_CHECK(NtReleaseSemaphore(Semaphore, 1, &PreviousCount) == STATUS_SUCCESS && PreviousCount == 2);
+        TEST_CHECK(NtAcquireSemaphoreEx(Semaphore, 2, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+
+        SEMAPHORE_BASIC_INFORMATION Information;
+        TEST_CHECK(NtQuerySemaphore(Semaphore, SemaphoreBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.CurrentCount == 1 && Information.MaximumCount == 3);
+
+        TEST_CHECK(NtAcquireSemaphoreEx(Semaphore, 2, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtWaitForSingleObject(Semaphore, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+        TEST_CHECK(NtWaitForSingleObject(Semaphore, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtClose(Semaphore) == STATUS_SUCCESS);
+        return true;
+}
+
+static bool TestWaitAnyAll(void)
+{
+        HANDLE Handles[3];
+        TEST_CHECK(NtCreateEvent(&Handles[0], EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateEvent(&Handles[1], EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateSemaphore(&Handles[2], SEMAPHORE_ALL_ACCESS, NULL, 1, 1) == STATUS_SUCCESS);
+
+        /* Any takes the first signaled object only */
+        TEST_CHECK(NtWaitForMultipleObjects(3, Handles, WaitAny, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0 + 2);
+        TEST_CHECK(NtWaitForMultipleObjects(3, Handles, WaitAny, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+
+        /* All takes nothing until everything is signaled */
+        TEST_CHECK(NtSetEvent(Handles[0], NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtReleaseSemaphore(Handles[2], 1, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForMultipleObjects(3, Handles, WaitAll, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtSetEvent(Handles[1], NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForMultipleObjects(3, Handles, WaitAll, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+        TEST_CHECK(NtWaitForSingleObject(Handles[0], FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtWaitForSingleObject(Handles[1], FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+        TEST_CHECK(NtWaitForSingleObject(Handles[2], FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+
+        for (int i = 0; i < 3; i++) {
+                TEST_CHECK(NtClose(Handles[i]) == STATUS_SUCCESS);
+        }
+        return true;
+}
+
+static bool TestTimeOut(void)
+{
+        HANDLE Event;
+        TEST_CHECK(NtCreateEvent(&Event, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE) == STATUS_SUCCESS);
+
+        LARGE_INTEGER TimeOut = {.QuadPart = -200000};
+        ULONGLONG Start = TestGetTime();
+        TEST_CHECK(NtWaitForSingleObject(Event, FALSE, &TimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(TestGetTime() - Start >= 20000000);
+        TEST_CHECK(NtClose(Event) == STATUS_SUCCESS);
+        return true;
+}
+
+static NTSTATUS TestExitRoutine(PVOID Parameter)
+{
+        return (NTSTATUS)(uintptr_t)Parameter;
+}
+
+static bool TestThreadHandle(void)
+{
+        HANDLE Thread;
+        TEST_CHECK(RtlCreateUserThread(&Thread, THREAD_ALL_ACCESS, FALSE, 0, TestExitRoutine, (PVOID)42, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForSingleObject(Thread, FALSE, NULL) == STATUS_WAIT_0);
+
+        THREAD_BASIC_INFORMATION Information;
+        TEST_CHECK(NtQueryInformationThread(Thread, ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.ExitStatus == 42);
+        TEST_CHECK(NtClose(Thread) == STATUS_SUCCESS);
+        return true;
+}
+
+/* Producers and consumers move TEST_STRESS_COUNT units through a
+ * semaphore, every one of them has to come out exactly once */
+static HANDLE TestItems;
+static HANDLE TestSlots;
+static _Atomic LONG TestConsumed;
+
+static NTSTATUS TestProducer(PVOID Parameter)
+{
+        (void)Parameter;
+        for (int i = 0; i < TEST_STRESS_COUNT / TEST_THREAD_COUNT; i++) {
+                if (NtWaitForSingleObject(TestSlots, FALSE, NULL) != STATUS_WAIT_0 ||
+                    NtReleaseSemaphore(TestItems, 1, NULL) != STATUS_SUCCESS) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+        }
+        return STATUS_SUCCESS;
+}
+
+static NTSTATUS TestConsumer(PVOID Parameter)
+{
+        (void)Parameter;
+        for (int i = 0; i < TEST_STRESS_COUNT / TEST_THREAD_COUNT; i++) {
+                if (NtWaitForSingleObject(TestItems, FALSE, NULL) != STATUS_WAIT_0) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+                atomic_fetch_add(&TestConsumed, 1);
+                if (NtReleaseSemaphore(TestSlots, 1, NULL) != STATUS_SUCCESS) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+        }
+        return STATUS_SUCCESS;
+}
+
+static bool TestSemaphoreStress(void)
+{
+        TEST_CHECK(NtCreateSemaphore(&TestItems, SEMAPHORE_ALL_ACCESS, NULL, 0, TEST_STRESS_COUNT) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateSemaphore(&TestSlots, SEMAPHORE_ALL_ACCESS, NULL, 8, 8) == STATUS_SUCCESS);
+        atomic_store(&TestConsumed, 0);
+
+        HANDLE Threads[2 * TEST_THREAD_COUNT];
+        for (int i = 0; i < 2 * TEST_THREAD_COUNT; i++) {
+                TEST_CHECK(RtlCreateUserThread(&Threads[i], THREAD_ALL_ACCESS, FALSE, 0, i % 2 ? TestConsumer : TestProducer, NULL, NULL) == STATUS_SUCCESS);
+        }
+        TEST_CHECK(NtWaitForMultipleObjects(2 * TEST_THREAD_COUNT, Threads, WaitAll, FALSE, NULL) == STATUS_WAIT_0);
+
+        for (int i = 0; i < 2 * TEST_THREAD_COUNT; i++) {
+                THREAD_BASIC_INFORMATION Information;
+                TEST_CHECK(NtQueryInformationThread(Threads[i], ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Information.ExitStatus == STATUS_SUCCESS);
+                NtClose(Threads[i]);
+        }
+
+        SEMAPHORE_BASIC_INFORMATION Information;
+        TEST_CHECK(NtQuerySemaphore(TestSlots, SemaphoreBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.CurrentCount == 8);
+        TEST_CHECK(NtWaitForSingleObject(TestItems, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(atomic_load(&TestConsumed) == TEST_STRESS_COUNT);
+        NtClose(TestItems);
+        NtClose(TestSlots);
+        return true;
+}
+
+/* A waiter moving a full count to NTSYNC must not let a release in on top
+ * of it, the release fails and the wait simply times out */
+static HANDLE TestLimitSemaphore;
+static HANDLE TestLimitEvent;
+
+static NTSTATUS TestLimitWaiter(PVOID Parameter)
+{
+        (void)Parameter;
+        HANDLE Handles[2] = {TestLimitSemaphore, TestLimitEvent};
+        LARGE_INTEGER TimeOut = {.QuadPart = -500000};
+        return NtWaitForMultipleObjects(2, Handles, WaitAll, FALSE, &TimeOut);
+}
+
+static bool TestSemaphoreLimit(void)
+{
+        for (int i = 0; i < 40; i++) {
+                TEST_CHECK(NtCreateSemaphore(&TestLimitSemaphore, SEMAPHORE_ALL_ACCESS, NULL, 2, 2) == STATUS_SUCCESS);
+                TEST_CHECK(NtCreateEvent(&TestLimitEvent, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE) == STATUS_SUCCESS);
+
+                HANDLE Thread;
+                TEST_CHECK(RtlCreateUserThread(&Thread, THREAD_ALL_ACCESS, FALSE, 0, TestLimitWaiter, NULL, NULL) == STATUS_SUCCESS);
+                /* A varying head start lands the release before, during or
+                 * after the move of the waiter */
+                usleep(i % 4 * 500);
+                NTSTATUS Status = NtReleaseSemaphore(TestLimitSemaphore, 1, NULL);
+                TEST_CHECK(NtWaitForSingleObject(Thread, FALSE, NULL) == STATUS_WAIT_0);
+
+                THREAD_BASIC_INFORMATION Information;
+                TEST_CHECK(NtQueryInformationThread(Thread, ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Information.ExitStatus == STATUS_TIMEOUT);
+                TEST_CHECK(Status == STATUS_SEMAPHORE_LIMIT_EXCEEDED);
+
+                SEMAPHORE_BASIC_INFORMATION Semaphore;
+                TEST_CHECK(NtQuerySemaphore(TestLimitSemaphore, SemaphoreBasicInformation, &Semaphore, sizeof(Semaphore), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Semaphore.CurrentCount == 2);
+                NtClose(Thread);
+                NtClose(TestLimitSemaphore);
+                NtClose(TestLimitEvent);
+        }
+        return true;
+}
+
+/* Threads count under a mutant through both kinds of wait, a mutant left
+ * owned by a thread that exits is abandoned to the next waiter, whether it
+ * was already waiting or not */
+static HANDLE TestMutant;
+static LONG TestMutantCount;
+
+static NTSTATUS TestMutantWorker(PVOID Parameter)
+{
+        (void)Parameter;
+        for (int i = 0; i < TEST_STRESS_COUNT / TEST_THREAD_COUNT; i++) {
+                NTSTATUS Status = i % 3 ? NtWaitForSingleObject(TestMutant, FALSE, NULL) : NtWaitForMultipleObjects(1, &TestMutant, WaitAny, FALSE, NULL);
+                if (Status != STATUS_WAIT_0 || NtWaitForSingleObject(TestMutant, FALSE, NULL) != STATUS_WAIT_0) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+                TestMutantCount++;
+                if (NtReleaseMutant(TestMutant, NULL) != STATUS_SUCCESS || NtReleaseMutant(TestMutant, NULL) != STATUS_SUCCESS) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+        }
+        return STATUS_SUCCESS;
+}
+
+static NTSTATUS TestMutantOwner(PVOID Parameter)
+{
+        NTSTATUS Status = NtWaitForSingleObject(TestMutant, FALSE, NULL);
+        usleep((uintptr_t)Parameter);
+        return Status;
+}
+
+static bool TestMutantOwnership(void)
+{
+        /* Mutants always need an NTSYNC mutex */
+        if (ntsync == -1) {
+                return true;
+        }
+
+        TEST_CHECK(NtCreateMutant(&TestMutant, MUTANT_ALL_ACCESS, NULL, FALSE) == STATUS_SUCCESS);
+        TEST_CHECK(NtReleaseMutant(TestMutant, NULL) == STATUS_MUTANT_NOT_OWNED);
+        TEST_CHECK(NtWaitForSingleObject(TestMutant, FALSE, NULL) == STATUS_WAIT_0);
+        TEST_CHECK(NtWaitForSingleObject(TestMutant, FALSE, NULL) == STATUS_WAIT_0);
+
+        MUTANT_BASIC_INFORMATION Information;
+        TEST_CHECK(NtQueryMutant(TestMutant, MutantBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.CurrentCount == -1 && Information.OwnedByCaller && !Information.AbandonedState);
+        LONG PreviousCount;
+        TEST_CHECK(NtReleaseMutant(TestMutant, &PreviousCount) == STATUS_SUCCESS && PreviousCount == -1);
+        TEST_CHECK(NtReleaseMutant(TestMutant, &PreviousCount) == STATUS_SUCCESS && PreviousCount == 0);
+        TEST_CHECK(NtQueryMutant(TestMutant, MutantBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.CurrentCount == 1 && !Information.OwnedByCaller);
+
+        TestMutantCount = 0;
+        HANDLE Threads[TEST_THREAD_COUNT];
+        for (int i = 0; i < TEST_THREAD_COUNT; i++) {
+                TEST_CHECK(RtlCreateUserThread(&Threads[i], THREAD_ALL_ACCESS, FALSE, 0, TestMutantWorker, NULL, NULL) == STATUS_SUCCESS);
+        }
+        TEST_CHECK(NtWaitForMultipleObjects(TEST_THREAD_COUNT, Threads, WaitAll, FALSE, NULL) == STATUS_WAIT_0);
+        for (int i = 0; i < TEST_THREAD_COUNT; i++) {
+                THREAD_BASIC_INFORMATION Thread;
+                TEST_CHECK(NtQueryInformationThread(Threads[i], ThreadBasicInformation, &Thread, sizeof(Thread), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Thread.ExitStatus == STATUS_SUCCESS);
+                NtClose(Threads[i]);
+        }
+        TEST_CHECK(TestMutantCount == TEST_STRESS_COUNT / TEST_THREAD_COUNT * TEST_THREAD_COUNT);
+
+        /* Once abandoned with nobody waiting, once to a waiter already blocked */
+        for (uintptr_t Delay = 0; Delay <= 20000; Delay += 20000) {
+                HANDLE Owner;
+                TEST_CHECK(RtlCreateUserThread(&Owner, THREAD_ALL_ACCESS, FALSE, 0, TestMutantOwner, (PVOID)Delay, NULL) == STATUS_SUCCESS);
+                if (Delay == 0) {
+                        TEST_CHECK(NtWaitForSingleObject(Owner, FALSE, NULL) == STATUS_WAIT_0);
+                        TEST_CHECK(NtQueryMutant(TestMutant, MutantBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+                        TEST_CHECK(Information.AbandonedState);
+                } else {
+                        usleep(5000);
+                        TEST_CHECK(NtReleaseMutant(TestMutant, NULL) == STATUS_MUTANT_NOT_OWNED);
+                }
+                TEST_CHECK(NtWaitForSingleObject(TestMutant, FALSE, NULL) == STATUS_ABANDONED_WAIT_0);
+                TEST_CHECK(NtReleaseMutant(TestMutant, NULL) == STATUS_SUCCESS);
+                TEST_CHECK(NtWaitForSingleObject(TestMutant, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+                TEST_CHECK(NtReleaseMutant(TestMutant, NULL) == STATUS_SUCCESS);
+
+                THREAD_BASIC_INFORMATION Thread;
+                TEST_CHECK(NtQueryInformationThread(Owner, ThreadBasicInformation, &Thread, sizeof(Thread), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Thread.ExitStatus == STATUS_WAIT_0);
+                NtClose(Owner);
+        }
+        TEST_CHECK(NtClose(TestMutant) == STATUS_SUCCESS);
+        return true;
+}
+
+/* Keyed event waiters and releasers only meet on the same key, either
+ * side may come first and blocks until the other one does */
+#define TEST_KEYED_COUNT 200
+
+static HANDLE TestKeyedEvent;
+static int TestKeys[TEST_THREAD_COUNT];
+
+static NTSTATUS TestKeyedWaiter(PVOID Parameter)
+{
+        for (int i = 0; i < TEST_KEYED_COUNT; i++) {
+                NTSTATUS Status = NtWaitForKeyedEvent(TestKeyedEvent, &TestKeys[(uintptr_t)Parameter], FALSE, NULL);
+                if (Status != STATUS_SUCCESS) {
+                        return Status;
+                }
+        }
+        return STATUS_SUCCESS;
+}
+
+static NTSTATUS TestKeyedReleaser(PVOID Parameter)
+{
+        (void)Parameter;
+        return NtReleaseKeyedEvent(TestKeyedEvent, &TestKeys[0], FALSE, NULL);
+}
+
+static bool TestKeyedEvents(void)
+{
+        TEST_CHECK(NtCreateKeyedEvent(&TestKeyedEvent, KEYEDEVENT_ALL_ACCESS, NULL, 0) == STATUS_SUCCESS);
+        LARGE_INTEGER TimeOut = {.QuadPart = -100000};
+        TEST_CHECK(NtWaitForKeyedEvent(TestKeyedEvent, &TestKeys[0], FALSE, &TimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtReleaseKeyedEvent(TestKeyedEvent, &TestKeys[0], FALSE, &TimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtWaitForSingleObject(TestKeyedEvent, FALSE, &TestZeroTimeOut) != STATUS_WAIT_0);
+
+        /* The access mask is the low half of the handle */
+        HANDLE WaitOnly = (HANDLE)(((uintptr_t)TestKeyedEvent & ~(uintptr_t)UINT32_MAX) | KEYEDEVENT_WAIT);
+        TEST_CHECK(NtReleaseKeyedEvent(WaitOnly, &TestKeys[0], FALSE, &TimeOut) == STATUS_ACCESS_DENIED);
+
+        /* A release that came first is taken by the next waiter on its key
+         * and by nobody waiting on another one */
+        HANDLE Thread;
+        TEST_CHECK(RtlCreateUserThread(&Thread, THREAD_ALL_ACCESS, FALSE, 0, TestKeyedReleaser, NULL, NULL) == STATUS_SUCCESS);
+        usleep(5000);
+        TEST_CHECK(NtWaitForKeyedEvent(TestKeyedEvent, &TestKeys[1], FALSE, &TimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtWaitForKeyedEvent(TestKeyedEvent, &TestKeys[0], FALSE, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForSingleObject(Thread, FALSE, NULL) == STATUS_WAIT_0);
+        THREAD_BASIC_INFORMATION Information;
+        TEST_CHECK(NtQueryInformationThread(Thread, ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.ExitStatus == STATUS_SUCCESS);
+        NtClose(Thread);
+
+        HANDLE Threads[TEST_THREAD_COUNT];
+        for (uintptr_t i = 0; i < TEST_THREAD_COUNT; i++) {
+                TEST_CHECK(RtlCreateUserThread(&Threads[i], THREAD_ALL_ACCESS, FALSE, 0, TestKeyedWaiter, (PVOID)i, NULL) == STATUS_SUCCESS);
+        }
+        for (int i = 0; i < TEST_KEYED_COUNT; i++) {
+                for (int j = 0; j < TEST_THREAD_COUNT; j++) {
+                        TEST_CHECK(NtReleaseKeyedEvent(TestKeyedEvent, &TestKeys[j], FALSE, NULL) == STATUS_SUCCESS);
+                }
+        }
+        TEST_CHECK(NtWaitForMultipleObjects(TEST_THREAD_COUNT, Threads, WaitAll, FALSE, NULL) == STATUS_WAIT_0);
+        for (int i = 0; i < TEST_THREAD_COUNT; i++) {
+                TEST_CHECK(NtQueryInformationThread(Threads[i], ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Information.ExitStatus == STATUS_SUCCESS);
+                NtClose(Threads[i]);
+        }
+        TEST_CHECK(NtReleaseKeyedEvent(TestKeyedEvent, &TestKeys[0], FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtClose(TestKeyedEvent) == STATUS_SUCCESS);
+        return true;
+}
+
+/* A critical section costs no semaphore until a thread has to block on
+ * it, and keeps counting right under contention once it has one */
+static RTL_CRITICAL_SECTION TestCriticalSection;
+static LONG TestCriticalCount;
+
+static NTSTATUS TestCriticalWorker(PVOID Parameter)
+{
+        (void)Parameter;
+        for (int i = 0; i < TEST_STRESS_COUNT / TEST_THREAD_COUNT; i++) {
+                if (RtlEnterCriticalSection(&TestCriticalSection) != STATUS_SUCCESS) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+                if (i % 2 && !RtlTryEnterCriticalSection(&TestCriticalSection)) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+                TestCriticalCount++;
+                if (i % 2 && RtlLeaveCriticalSection(&TestCriticalSection) != STATUS_SUCCESS) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+                if (RtlLeaveCriticalSection(&TestCriticalSection) != STATUS_SUCCESS) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+        }
+        return STATUS_SUCCESS;
+}
+
+static NTSTATUS TestCriticalTry(PVOID Parameter)
+{
+        (void)Parameter;
+        if (RtlTryEnterCriticalSection(&TestCriticalSection)) {
+                return STATUS_UNSUCCESSFUL;
+        }
+        return RtlLeaveCriticalSection(&TestCriticalSection);
+}
+
+static bool TestCriticalSections(void)
+{
+        TEST_CHECK(RtlInitializeCriticalSectionAndSpinCount(&TestCriticalSection, 0) == STATUS_SUCCESS);
+        TEST_CHECK(RtlTryEnterCriticalSection(&TestCriticalSection));
+        TEST_CHECK(RtlEnterCriticalSection(&TestCriticalSection) == STATUS_SUCCESS);
+        TEST_CHECK(TestCriticalSection.RecursionCount == 2);
+
+        /* Another thread neither gets in nor lets go of it */
+        HANDLE Thread;
+        TEST_CHECK(RtlCreateUserThread(&Thread, THREAD_ALL_ACCESS, FALSE, 0, TestCriticalTry, NULL, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForSingleObject(Thread, FALSE, NULL) == STATUS_WAIT_0);
+        THREAD_BASIC_INFORMATION Information;
+        TEST_CHECK(NtQueryInformationThread(Thread, ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.ExitStatus == STATUS_RESOURCE_NOT_OWNED);
+        NtClose(Thread);
+        TEST_CHECK(RtlLeaveCriticalSection(&TestCriticalSection) == STATUS_SUCCESS);
+        TEST_CHECK(RtlLeaveCriticalSection(&TestCriticalSection) == STATUS_SUCCESS);
+        TEST_CHECK(RtlLeaveCriticalSection(&TestCriticalSection) == STATUS_RESOURCE_NOT_OWNED);
+        TEST_CHECK(TestCriticalSection.LockSemaphore == -1);
+
+        /* Without spinning the first thread that finds it owned blocks */
+        TestCriticalCount = 0;
+        TEST_CHECK(RtlEnterCriticalSection(&TestCriticalSection) == STATUS_SUCCESS);
+        HANDLE Threads[TEST_THREAD_COUNT];
+        for (int i = 0; i < TEST_THREAD_COUNT; i++) {
+                TEST_CHECK(RtlCreateUserThread(&Threads[i], THREAD_ALL_ACCESS, FALSE, 0, TestCriticalWorker, NULL, NULL) == STATUS_SUCCESS);
+        }
+        usleep(20000);
+        TEST_CHECK(TestCriticalSection.LockSemaphore != -1);
+        TEST_CHECK(RtlSetCriticalSectionSpinCount(&TestCriticalSection, 4000) == 0);
+        TEST_CHECK(RtlLeaveCriticalSection(&TestCriticalSection) == STATUS_SUCCESS);
+
+        TEST_CHECK(NtWaitForMultipleObjects(TEST_THREAD_COUNT, Threads, WaitAll, FALSE, NULL) == STATUS_WAIT_0);
+        for (int i = 0; i < TEST_THREAD_COUNT; i++) {
+                TEST_CHECK(NtQueryInformationThread(Threads[i], ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Information.ExitStatus == STATUS_SUCCESS);
+                NtClose(Threads[i]);
+        }
+        TEST_CHECK(TestCriticalCount == TEST_STRESS_COUNT / TEST_THREAD_COUNT * TEST_THREAD_COUNT);
+        TEST_CHECK(TestCriticalSection.OwningThread == 0 && TestCriticalSection.LockCount == 0);
+        TEST_CHECK(RtlDeleteCriticalSection(&TestCriticalSection) == STATUS_SUCCESS);
+        return true;
+}
+
+/* Nobody leaves a barrier phase before everybody arrived, whether it
+ * spins, blocks or does both, and exactly one thread per phase is last */
+#define TEST_BARRIER_PHASES 100
+
+static RTL_BARRIER TestBarrier;
+static _Atomic LONG TestBarrierArrived[TEST_BARRIER_PHASES];
+static _Atomic LONG TestBarrierLast;
+
+static NTSTATUS TestBarrierWorker(PVOID Parameter)
+{
+        static const ULONG Flags[] = {0, RTL_BARRIER_FLAGS_SPIN_ONLY, RTL_BARRIER_FLAGS_BLOCK_ONLY};
+        for (int i = 0; i < TEST_BARRIER_PHASES; i++) {
+                atomic_fetch_add(&TestBarrierArrived[i], 1);
+                if (RtlBarrier(&TestBarrier, Flags[(uintptr_t)Parameter % 3])) {
+                        atomic_fetch_add(&TestBarrierLast, 1);
+                }
+                if (atomic_load(&TestBarrierArrived[i]) != TEST_THREAD_COUNT) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+        }
+        return STATUS_SUCCESS;
+}
+
+static bool TestBarrierPhases(void)
+{
+        TEST_CHECK(RtlInitBarrier(&TestBarrier, TEST_THREAD_COUNT, 10) == STATUS_SUCCESS);
+        for (int i = 0; i < TEST_BARRIER_PHASES; i++) {
+                atomic_store(&TestBarrierArrived[i], 0);
+        }
+        atomic_store(&TestBarrierLast, 0);
+
+        HANDLE Threads[TEST_THREAD_COUNT];
+        for (uintptr_t i = 0; i < TEST_THREAD_COUNT; i++) {
+                TEST_CHECK(RtlCreateUserThread(&Threads[i], THREAD_ALL_ACCESS, FALSE, 0, TestBarrierWorker, (PVOID)i, NULL) == STATUS_SUCCESS);
+        }
+        TEST_CHECK(NtWaitForMultipleObjects(TEST_THREAD_COUNT, Threads, WaitAll, FALSE, NULL) == STATUS_WAIT_0);
+        for (int i = 0; i < TEST_THREAD_COUNT; i++) {
+                THREAD_BASIC_INFORMATION Information;
+                TEST_CHECK(NtQueryInformationThread(Threads[i], ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Information.ExitStatus == STATUS_SUCCESS);
+                NtClose(Threads[i]);
+        }
+        TEST_CHECK(atomic_load(&TestBarrierLast) == TEST_BARRIER_PHASES);
+        TEST_CHECK(RtlDeleteBarrier(&TestBarrier) == STATUS_SUCCESS);
+        return true;
+}
+
+/* Racing threads see one initialization and its context, a failed one is
+ * tried again and asynchronous ones keep the first context completed */
+static RTL_RUN_ONCE TestRunOnce;
+static _Atomic LONG TestRunOnceCalls;
+
+static BOOLEAN TestRunOnceRoutine(PRTL_RUN_ONCE RunOnce, PVOID Parameter, PVOID *Context)
+{
+        (void)RunOnce;
+        usleep(20000);
+        *Context = Parameter;
+        return atomic_fetch_add(&TestRunOnceCalls, 1) != 0;
+}
+
+static NTSTATUS TestRunOnceWorker(PVOID Parameter)
+{
+        (void)Parameter;
+        PVOID Context = NULL;
+        NTSTATUS Status = RtlRunOnceExecuteOnce(&TestRunOnce, TestRunOnceRoutine, (PVOID)0x1230, &Context);
+        return Status == STATUS_SUCCESS && Context != (PVOID)0x1230 ? STATUS_UNSUCCESSFUL : Status;
+}
+
+static bool TestRunOnceInitialization(void)
+{
+        RtlRunOnceInitialize(&TestRunOnce);
+        atomic_store(&TestRunOnceCalls, 0);
+        PVOID Context;
+        TEST_CHECK(RtlRunOnceBeginInitialize(&TestRunOnce, RTL_RUN_ONCE_CHECK_ONLY, &Context) == STATUS_UNSUCCESSFUL);
+
+        /* The first call fails, one of the racing threads does it again */
+        TEST_CHECK(RtlRunOnceExecuteOnce(&TestRunOnce, TestRunOnceRoutine, (PVOID)0x1230, &Context) == STATUS_UNSUCCESSFUL);
+        HANDLE Threads[TEST_THREAD_COUNT];
+        for (int i = 0; i < TEST_THREAD_COUNT; i++) {
+                TEST_CHECK(RtlCreateUserThread(&Threads[i], THREAD_ALL_ACCESS, FALSE, 0, TestRunOnceWorker, NULL, NULL) == STATUS_SUCCESS);
+        }
+        TEST_CHECK(NtWaitForMultipleObjects(TEST_THREAD_COUNT, Threads, WaitAll, FALSE, NULL) == STATUS_WAIT_0);
+        for (int i = 0; i < TEST_THREAD_COUNT; i++) {
+                THREAD_BASIC_INFORMATION Information;
+                TEST_CHECK(NtQueryInformationThread(Threads[i], ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Information.ExitStatus == STATUS_SUCCESS);
+                NtClose(Threads[i]);
+        }
+        TEST_CHECK(atomic_load(&TestRunOnceCalls) == 2);
+        TEST_CHECK(RtlRunOnceBeginInitialize(&TestRunOnce, RTL_RUN_ONCE_CHECK_ONLY, &Context) == STATUS_SUCCESS && Context == (PVOID)0x1230);
+
+        RtlRunOnceInitialize(&TestRunOnce);
+        TEST_CHECK(RtlRunOnceBeginInitialize(&TestRunOnce, RTL_RUN_ONCE_ASYNC, NULL) == STATUS_PENDING);
+        TEST_CHECK(RtlRunOnceBeginInitialize(&TestRunOnce, RTL_RUN_ONCE_ASYNC, NULL) == STATUS_PENDING);
+        TEST_CHECK(RtlRunOnceBeginInitialize(&TestRunOnce, 0, NULL) == STATUS_INVALID_PARAMETER);
+        TEST_CHECK(RtlRunOnceComplete(&TestRunOnce, RTL_RUN_ONCE_ASYNC, (PVOID)0x4560) == STATUS_SUCCESS);
+        TEST_CHECK(RtlRunOnceComplete(&TestRunOnce, RTL_RUN_ONCE_ASYNC, (PVOID)0x7890) == STATUS_OBJECT_NAME_COLLISION);
+        TEST_CHECK(RtlRunOnceBeginInitialize(&TestRunOnce, 0, &Context) == STATUS_SUCCESS && Context == (PVOID)0x4560);
+        return true;
+}
+
+/* A duplicate within the process shares the object with a narrower mask
+ * and outlives the source. Across processes both sides share the count,
+ * which only NTSYNC objects can do. */
+#define TEST_DUPLICATE_COUNT 3000
+
+static int TestDuplicateChild(int Socket)
+{
+        HANDLE Peer;
+        HANDLE Semaphore;
+        HANDLE Event;
+        if (RtlOpenProcessSocket(&Peer, PROCESS_DUP_HANDLE, Socket) != STATUS_SUCCESS ||
+            NtDuplicateObject(Peer, NULL, NtCurrentProcess(), &Semaphore, 0, 0, 0) != STATUS_SUCCESS ||
+            NtDuplicateObject(Peer, NULL, NtCurrentProcess(), &Event, 0, 0, 0) != STATUS_SUCCESS) {
+                return 1;
+        }
+
+        LARGE_INTEGER TimeOut = {.QuadPart = -50000000};
+        for (int i = 0; i < TEST_DUPLICATE_COUNT; i++) {
+                if (NtWaitForSingleObject(Semaphore, FALSE, &TimeOut) != STATUS_WAIT_0) {
+                        return 2;
+                }
+        }
+        return NtSetEvent(Event, NULL) == STATUS_SUCCESS ? 0 : 3;
+}
+
+static bool TestDuplicateObject(void)
+{
+        HANDLE Semaphore;
+        HANDLE Event;
+        HANDLE Duplicate;
+        TEST_CHECK(NtCreateSemaphore(&Semaphore, SEMAPHORE_ALL_ACCESS, NULL, 1, TEST_DUPLICATE_COUNT) == STATUS_SUCCESS);
+        TEST_CHECK(NtDuplicateObject(NtCurrentProcess(), Semaphore, NtCurrentProcess(), &Duplicate, SYNCHRONIZE, 0, 0) == STATUS_SUCCESS);
+        TEST_CHECK(NtReleaseSemaphore(Duplicate, 1, NULL) == STATUS_ACCESS_DENIED);
+        HANDLE Wider;
+        TEST_CHECK(NtDuplicateObject(NtCurrentProcess(), Duplicate, NtCurrentProcess(), &Wider, SEMAPHORE_ALL_ACCESS, 0, 0) == STATUS_ACCESS_DENIED);
+        TEST_CHECK(NtClose(Semaphore) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForSingleObject(Duplicate, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+        TEST_CHECK(NtWaitForSingleObject(Duplicate, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtClose(Duplicate) == STATUS_SUCCESS);
+
+        int Sockets[2];
+        TEST_CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, Sockets) == 0);
+        HANDLE Peer;
+        TEST_CHECK(RtlOpenProcessSocket(&Peer, PROCESS_DUP_HANDLE, Sockets[0]) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateSemaphore(&Semaphore, SEMAPHORE_ALL_ACCESS, NULL, 0, TEST_DUPLICATE_COUNT) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateEvent(&Event, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE) == STATUS_SUCCESS);
+        if (ntsync_backend == NTSYNC_BACKEND_USERSPACE) {
+                TEST_CHECK(NtDuplicateObject(NtCurrentProcess(), Semaphore, Peer, NULL, 0, 0, DUPLICATE_SAME_ACCESS) == STATUS_NOT_SUPPORTED);
+        } else {
+                pid_t Child = fork();
+                if (Child == 0) {
+                        close(Sockets[0]);
+                        _exit(TestDuplicateChild(Sockets[1]));
+                }
+                TEST_CHECK(Child != -1);
+                TEST_CHECK(NtDuplicateObject(NtCurrentProcess(), Semaphore, Peer, NULL, 0, 0, DUPLICATE_SAME_ACCESS) == STATUS_SUCCESS);
+                TEST_CHECK(NtDuplicateObject(NtCurrentProcess(), Event, Peer, NULL, 0, 0, DUPLICATE_SAME_ACCESS) == STATUS_SUCCESS);
+                for (int i = 0; i < TEST_DUPLICATE_COUNT; i++) {
+                        TEST_CHECK(NtReleaseSemaphore(Semaphore, 1, NULL) == STATUS_SUCCESS);
+                }
+
+                LARGE_INTEGER TimeOut = {.QuadPart = -100000000};
+                TEST_CHECK(NtWaitForSingleObject(Event, FALSE, &TimeOut) == STATUS_WAIT_0);
+                int Status;
+                TEST_CHECK(waitpid(Child, &Status, 0) == Child && WIFEXITED(Status) && WEXITSTATUS(Status) == 0);
+                TEST_CHECK(NtWaitForSingleObject(Semaphore, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        }
+
+        close(Sockets[1]);
+        TEST_CHECK(NtClose(Peer) == STATUS_SUCCESS);
+        TEST_CHECK(NtClose(Semaphore) == STATUS_SUCCESS);
+        TEST_CHECK(NtClose(Event) == STATUS_SUCCESS);
+        return true;
+}
+
+/* A named event and semaphore are found again by name, in the process and
+ * from a child, and the name is gone once every handle is closed */
+static NTSTATUS TestCreateNamed(PHANDLE Handle, const char *Name, ULONG Attributes, bool Semaphore)
+{
+        ANSI_STRING String;
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        RtlInitAnsiString(&String, Name);
+        InitializeObjectAttributes(&ObjectAttributes, &String, Attributes, NULL, NULL);
+        if (Semaphore) {
+                return NtCreateSemaphore(Handle, SEMAPHORE_ALL_ACCESS, &ObjectAttributes, 0, 10);
+        }
+        return NtCreateEvent(Handle, EVENT_ALL_ACCESS, &ObjectAttributes, NotificationEvent, FALSE);
+}
+
+static NTSTATUS TestOpenNamed(PHANDLE Handle, const char *Name, bool Semaphore)
+{
+        ANSI_STRING String;
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        RtlInitAnsiString(&String, Name);
+        InitializeObjectAttributes(&ObjectAttributes, &String, 0, NULL, NULL);
+        if (Semaphore) {
+                return NtOpenSemaphore(Handle, SEMAPHORE_ALL_ACCESS, &ObjectAttributes);
+        }
+        return NtOpenEvent(Handle, EVENT_ALL_ACCESS, &ObjectAttributes);
+}
+
+static int TestNamedChild(const char *EventName, const char *SemaphoreName)
+{
+        HANDLE Event;
+        HANDLE Semaphore;
+        if (TestOpenNamed(&Event, EventName, false) != STATUS_SUCCESS || TestOpenNamed(&Semaphore, SemaphoreName, true) != STATUS_SUCCESS) {
+                return 1;
+        }
+
+        LARGE_INTEGER TimeOut = {.QuadPart = -50000000};
+        if (NtReleaseSemaphore(Semaphore, 1, NULL) != STATUS_SUCCESS || NtWaitForSingleObject(Event, FALSE, &TimeOut) != STATUS_WAIT_0) {
+                return 2;
+        }
+        return NtClose(Event) == STATUS_SUCCESS && NtClose(Semaphore) == STATUS_SUCCESS ? 0 : 3;
+}
+
+static bool TestNamedObjects(void)
+{
+        /* Named objects always need NTSYNC */
+        if (ntsync == -1) {
+                return true;
+        }
+
+        char EventName[64];
+        char SemaphoreName[64];
+        char LocalName[72];
+        snprintf(EventName, sizeof(EventName), "libntsync-test-%d-event", (int)getpid());
+        snprintf(SemaphoreName, sizeof(SemaphoreName), "libntsync-test-%d-semaphore", (int)getpid());
+        snprintf(LocalName, sizeof(LocalName), "Local\\%s", EventName);
+
+        HANDLE Event;
+        HANDLE Semaphore;
+        HANDLE Other;
+        TEST_CHECK(TestCreateNamed(&Event, EventName, OBJ_OPENIF, false) == STATUS_SUCCESS);
+        TEST_CHECK(TestCreateNamed(&Other, LocalName, OBJ_OPENIF, false) == STATUS_OBJECT_NAME_EXISTS);
+        TEST_CHECK(NtSetEvent(Other, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForSingleObject(Event, FALSE, &TestZeroTimeOut) == STATUS_WAIT_0);
+        TEST_CHECK(NtResetEvent(Event, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtClose(Other) == STATUS_SUCCESS);
+        TEST_CHECK(TestCreateNamed(&Other, EventName, 0, false) == STATUS_OBJECT_NAME_COLLISION);
+        TEST_CHECK(TestCreateNamed(&Other, EventName, OBJ_OPENIF, true) == STATUS_OBJECT_TYPE_MISMATCH);
+        TEST_CHECK(TestOpenNamed(&Other, SemaphoreName, true) == STATUS_OBJECT_NAME_NOT_FOUND);
+        TEST_CHECK(TestCreateNamed(&Semaphore, SemaphoreName, 0, true) == STATUS_SUCCESS);
+
+        pid_t Child = fork();
+        if (Child == 0) {
+                _exit(TestNamedChild(LocalName, SemaphoreName));
+        }
+        TEST_CHECK(Child != -1);
+        LARGE_INTEGER TimeOut = {.QuadPart = -50000000};
+        TEST_CHECK(NtWaitForSingleObject(Semaphore, FALSE, &TimeOut) == STATUS_WAIT_0);
+        TEST_CHECK(NtSetEvent(Event, NULL) == STATUS_SUCCESS);
+        int Status;
+        TEST_CHECK(waitpid(Child, &Status, 0) == Child && WIFEXITED(Status) && WEXITSTATUS(Status) == 0);
+
+        TEST_CHECK(NtClose(Event) == STATUS_SUCCESS);
+        TEST_CHECK(NtClose(Semaphore) == STATUS_SUCCESS);
+        TEST_CHECK(TestOpenNamed(&Other, EventName, false) == STATUS_OBJECT_NAME_NOT_FOUND);
+        TEST_CHECK(TestOpenNamed(&Other, SemaphoreName, true) == STATUS_OBJECT_NAME_NOT_FOUND);
+        return true;
+}
+
+/* A large acquire collects its units while small waiters keep taking and
+ * giving back single ones, it has to get all of them in the end */
+static HANDLE TestAcquireSemaphore;
+static _Atomic bool TestAcquireDone;
+
+static NTSTATUS TestAcquireSmall(PVOID Parameter)
+{
+        (void)Parameter;
+        LARGE_INTEGER TimeOut = {.QuadPart = -10000};
+        while (!atomic_load(&TestAcquireDone)) {
+                NTSTATUS Status = NtWaitForSingleObject(TestAcquireSemaphore, FALSE, &TimeOut);
+                if (Status == STATUS_WAIT_0 && NtReleaseSemaphore(TestAcquireSemaphore, 1, NULL) != STATUS_SUCCESS) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+        }
+        return STATUS_SUCCESS;
+}
+
+static NTSTATUS TestAcquireLarge(PVOID Parameter)
+{
+        (void)Parameter;
+        LARGE_INTEGER TimeOut = {.QuadPart = -50000000};
+        NTSTATUS Status = NtAcquireSemaphoreEx(TestAcquireSemaphore, 4, FALSE, &TimeOut);
+        atomic_store(&TestAcquireDone, true);
+        return Status;
+}
+
+static bool TestAcquireSemaphoreEx(void)
+{
+        TEST_CHECK(NtCreateSemaphore(&TestAcquireSemaphore, SEMAPHORE_ALL_ACCESS, NULL, 1, 4) == STATUS_SUCCESS);
+
+        /* Nothing is kept when the time runs out */
+        LARGE_INTEGER TimeOut = {.QuadPart = -200000};
+        TEST_CHECK(NtAcquireSemaphoreEx(TestAcquireSemaphore, 2, FALSE, &TimeOut) == STATUS_TIMEOUT);
+        SEMAPHORE_BASIC_INFORMATION Information;
+        TEST_CHECK(NtQuerySemaphore(TestAcquireSemaphore, SemaphoreBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.CurrentCount == 1);
+        TEST_CHECK(NtAcquireSemaphoreEx(TestAcquireSemaphore, 5, FALSE, &TimeOut) == STATUS_INVALID_PARAMETER_2);
+
+        atomic_store(&TestAcquireDone, false);
+        HANDLE Threads[3];
+        for (int i = 0; i < 3; i++) {
+                TEST_CHECK(RtlCreateUserThread(&Threads[i], THREAD_ALL_ACCESS, FALSE, 0, i == 0 ? TestAcquireLarge : TestAcquireSmall, NULL, NULL) == STATUS_SUCCESS);
+        }
+        for (int i = 0; i < 3; i++) {
+                usleep(2000);
+                TEST_CHECK(NtReleaseSemaphore(TestAcquireSemaphore, 1, NULL) == STATUS_SUCCESS);
+        }
+        TEST_CHECK(NtWaitForMultipleObjects(3, Threads, WaitAll, FALSE, NULL) == STATUS_WAIT_0);
+
+        for (int i = 0; i < 3; i++) {
+                THREAD_BASIC_INFORMATION Thread;
+                TEST_CHECK(NtQueryInformationThread(Threads[i], ThreadBasicInformation, &Thread, sizeof(Thread), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Thread.ExitStatus == (i == 0 ? STATUS_WAIT_0 : STATUS_SUCCESS));
+                NtClose(Threads[i]);
+        }
+        TEST_CHECK(NtQuerySemaphore(TestAcquireSemaphore, SemaphoreBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.CurrentCount == 0);
+        NtClose(TestAcquireSemaphore);
+        return true;
+}
+
+/* A trace of two threads handing a semaphore and an event back and forth
+ * replays with the same results, flat out and timed. Calls on an object
+ * the trace didn't see created, here an older event and the thread
+ * handle, are skipped. */
+static HANDLE TestTraceSemaphore;
+static HANDLE TestTraceEvent;
+
+static NTSTATUS TestTraceWorker(PVOID Parameter)
+{
+        (void)Parameter;
+        for (int i = 0; i < 3; i++) {
+                NTSTATUS Status = NtReleaseSemaphore(TestTraceSemaphore, 1, NULL);
+                if (Status != STATUS_SUCCESS) {
+                        return Status;
+                }
+        }
+        return NtWaitForSingleObject(TestTraceEvent, FALSE, NULL);
+}
+
+static bool TestTraceReplay(void)
+{
+        HANDLE Untraced;
+        TEST_CHECK(NtCreateEvent(&Untraced, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE) == STATUS_SUCCESS);
+
+        char FileName[] = "/tmp/libntsync-trace-XXXXXX";
+        int Object = mkstemp(FileName);
+        TEST_CHECK(Object != -1);
+        close(Object);
+        TEST_CHECK(RtlStartSyncTrace(FileName, 0) == STATUS_SUCCESS);
+        TEST_CHECK(RtlStartSyncTrace(FileName, 0) != STATUS_SUCCESS);
+        TEST_CHECK(NtCreateSemaphore(&TestTraceSemaphore, SEMAPHORE_ALL_ACCESS, NULL, 0, 3) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateEvent(&TestTraceEvent, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE) == STATUS_SUCCESS);
+        TEST_CHECK(NtSetEvent(Untraced, NULL) == STATUS_SUCCESS);
+
+        HANDLE Thread;
+        TEST_CHECK(RtlCreateUserThread(&Thread, THREAD_ALL_ACCESS, FALSE, 0, TestTraceWorker, NULL, NULL) == STATUS_SUCCESS);
+        for (int i = 0; i < 3; i++) {
+                TEST_CHECK(NtWaitForSingleObject(TestTraceSemaphore, FALSE, NULL) == STATUS_WAIT_0);
+        }
+        TEST_CHECK(NtWaitForSingleObject(TestTraceSemaphore, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtSetEvent(TestTraceEvent, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForSingleObject(Thread, FALSE, NULL) == STATUS_WAIT_0);
+        TEST_CHECK(NtClose(TestTraceSemaphore) == STATUS_SUCCESS);
+        TEST_CHECK(NtClose(TestTraceEvent) == STATUS_SUCCESS);
+        TEST_CHECK(RtlStopSyncTrace() == STATUS_SUCCESS);
+        NtClose(Thread);
+        NtClose(Untraced);
+
+        for (ULONG Flags = 0; Flags <= RTL_SYNC_TRACE_REPLAY_TIMED; Flags += RTL_SYNC_TRACE_REPLAY_TIMED) {
+                RTL_SYNC_TRACE_REPLAY_INFORMATION Replay;
+                NTSTATUS Status = RtlReplaySyncTrace(FileName, Flags, &Replay);
+                TEST_CHECK(Status == STATUS_SUCCESS);
+                TEST_CHECK(Replay.Threads == 2 && Replay.Objects == 2 && Replay.Calls == 15);
+                TEST_CHECK(Replay.Skipped == 2 && Replay.Mismatches == 0);
+        }
+        unlink(FileName);
+        return true;
+}
+
+/* Two threads each holding the lock the other one waits for are reported
+ * as deadlocked, a thread waiting on an event nobody holds is not. Once
+ * the cycle is broken nobody waits anymore. */
+static HANDLE TestRegistryLocks[2];
+static HANDLE TestRegistryEvent;
+static _Atomic LONG TestRegistryHolding;
+
+static NTSTATUS TestRegistryWorker(PVOID Parameter)
+{
+        uintptr_t Index = (uintptr_t)Parameter;
+        if (NtWaitForSingleObject(TestRegistryLocks[Index], FALSE, NULL) != STATUS_WAIT_0) {
+                return STATUS_UNSUCCESSFUL;
+        }
+        atomic_fetch_add(&TestRegistryHolding, 1);
+        while (atomic_load(&TestRegistryHolding) != 2) {
+                usleep(1000);
+        }
+        NTSTATUS Status = NtWaitForSingleObject(TestRegistryLocks[!Index], FALSE, NULL);
+        if (Status != STATUS_WAIT_0) {
+                return Status;
+        }
+
+        /* The second one keeps the unit the test released for it */
+        Status = NtReleaseSemaphore(TestRegistryLocks[Index], 1, NULL);
+        if (Status == STATUS_SUCCESS && Index == 0) {
+                Status = NtReleaseSemaphore(TestRegistryLocks[!Index], 1, NULL);
+        }
+        return Status;
+}
+
+static NTSTATUS TestRegistryIdle(PVOID Parameter)
+{
+        (void)Parameter;
+        return NtWaitForSingleObject(TestRegistryEvent, FALSE, NULL);
+}
+
+static bool TestRegistryQuery(ULONG WaiterCount, ULONG DeadlockedCount)
+{
+        RTL_REGISTRY_OBJECT Objects[64];
+        RTL_REGISTRY_WAITER Waiters[4];
+        RTL_REGISTRY_SNAPSHOT Snapshot = {.Objects = Objects, .ObjectCapacity = 64, .Waiters = Waiters, .WaiterCapacity = 4};
+        TEST_CHECK(RtlQueryObjectRegistry(&Snapshot) == STATUS_SUCCESS);
+        TEST_CHECK(Snapshot.WaiterCount == WaiterCount && Snapshot.DeadlockedCount == DeadlockedCount);
+        for (ULONG i = 0; i < Snapshot.WaiterCount; i++) {
+                TEST_CHECK(Waiters[i].Count == 1);
+                if (Waiters[i].Deadlocked) {
+                        TEST_CHECK(Waiters[i].Types[0] == RtlObjectStateSemaphore);
+                        TEST_CHECK(Waiters[i].Holders[0] != 0 && Waiters[i].Holders[0] != Waiters[i].ThreadId);
+                }
+        }
+
+        RTL_REGISTRY_SNAPSHOT Small = {.Objects = Objects, .ObjectCapacity = 0, .Waiters = Waiters, .WaiterCapacity = 0};
+        TEST_CHECK(RtlQueryObjectRegistry(&Small) == STATUS_BUFFER_OVERFLOW);
+        TEST_CHECK(Small.ObjectCount == Snapshot.ObjectCount && Small.ObjectCount >= 3);
+        return true;
+}
+
+static bool TestObjectRegistry(void)
+{
+        TEST_CHECK(RtlStartObjectRegistry(0, 0) == STATUS_SUCCESS);
+        TEST_CHECK(RtlStartObjectRegistry(0, 0) == STATUS_UNSUCCESSFUL);
+
+        OBJECT_ATTRIBUTES Attributes;
+        InitializeObjectAttributes(&Attributes, NULL, OBJ_REGISTRY_LOCK, NULL, NULL);
+        for (int i = 0; i < 2; i++) {
+                TEST_CHECK(NtCreateSemaphore(&TestRegistryLocks[i], SEMAPHORE_ALL_ACCESS, &Attributes, 1, 1) == STATUS_SUCCESS);
+        }
+        TEST_CHECK(NtCreateEvent(&TestRegistryEvent, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE) == STATUS_SUCCESS);
+        atomic_store(&TestRegistryHolding, 0);
+
+        HANDLE Threads[3];
+        TEST_CHECK(RtlCreateUserThread(&Threads[2], THREAD_ALL_ACCESS, FALSE, 0, TestRegistryIdle, NULL, NULL) == STATUS_SUCCESS);
+        for (uintptr_t i = 0; i < 2; i++) {
+                TEST_CHECK(RtlCreateUserThread(&Threads[i], THREAD_ALL_ACCESS, FALSE, 0, TestRegistryWorker, (PVOID)i, NULL) == STATUS_SUCCESS);
+        }
+        while (atomic_load(&TestRegistryHolding) != 2) {
+                usleep(1000);
+        }
+        usleep(20000);
+        TEST_CHECK(TestRegistryQuery(3, 2));
+
+        TEST_CHECK(NtSetEvent(TestRegistryEvent, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtReleaseSemaphore(TestRegistryLocks[0], 1, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForMultipleObjects(3, Threads, WaitAll, FALSE, NULL) == STATUS_WAIT_0);
+        for (int i = 0; i < 3; i++) {
+                THREAD_BASIC_INFORMATION Information;
+                TEST_CHECK(NtQueryInformationThread(Threads[i], ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Information.ExitStatus == (i == 2 ? STATUS_WAIT_0 : STATUS_SUCCESS));
+                NtClose(Threads[i]);
+        }
+        TEST_CHECK(TestRegistryQuery(0, 0));
+
+        for (int i = 0; i < 2; i++) {
+                SEMAPHORE_BASIC_INFORMATION Semaphore;
+                TEST_CHECK(NtQuerySemaphore(TestRegistryLocks[i], SemaphoreBasicInformation, &Semaphore, sizeof(Semaphore), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Semaphore.CurrentCount == 1);
+                NtClose(TestRegistryLocks[i]);
+        }
+        NtClose(TestRegistryEvent);
+        TEST_CHECK(RtlStopObjectRegistry() == STATUS_SUCCESS);
+        return true;
+}
+
+/* A broadcast releases the waiter that was there and nobody who comes
+ * later. Traced broadcasts replay with the same results. */
+static HANDLE TestBroadcast;
+
+static NTSTATUS TestBroadcastWaiter(PVOID Parameter)
+{
+        (void)Parameter;
+        LARGE_INTEGER TimeOut = {.QuadPart = -20000000};
+        return NtWaitForSingleObject(TestBroadcast, FALSE, &TimeOut);
+}
+
+static bool TestBroadcastEvent(void)
+{
+        TEST_CHECK(NtCreateBroadcastEvent(&TestBroadcast, EVENT_ALL_ACCESS, NULL) == STATUS_SUCCESS);
+        HANDLE Thread;
+        TEST_CHECK(RtlCreateUserThread(&Thread, THREAD_ALL_ACCESS, FALSE, 0, TestBroadcastWaiter, NULL, NULL) == STATUS_SUCCESS);
+        usleep(20000);
+
+        ULONG Generation;
+        TEST_CHECK(NtBroadcastEvent(TestBroadcast, &Generation) == STATUS_SUCCESS && Generation == 0);
+        TEST_CHECK(NtWaitForSingleObject(Thread, FALSE, NULL) == STATUS_WAIT_0);
+        THREAD_BASIC_INFORMATION Information;
+        TEST_CHECK(NtQueryInformationThread(Thread, ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+        TEST_CHECK(Information.ExitStatus == STATUS_WAIT_0);
+        TEST_CHECK(NtWaitForSingleObject(TestBroadcast, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        NtClose(Thread);
+        NtClose(TestBroadcast);
+
+        char FileName[] = "/tmp/libntsync-trace-XXXXXX";
+        int Object = mkstemp(FileName);
+        TEST_CHECK(Object != -1);
+        close(Object);
+        TEST_CHECK(RtlStartSyncTrace(FileName, 0) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateBroadcastEvent(&TestBroadcast, EVENT_ALL_ACCESS, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtBroadcastEvent(TestBroadcast, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtWaitForSingleObject(TestBroadcast, FALSE, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(NtClose(TestBroadcast) == STATUS_SUCCESS);
+        TEST_CHECK(RtlStopSyncTrace() == STATUS_SUCCESS);
+
+        RTL_SYNC_TRACE_REPLAY_INFORMATION Replay;
+        NTSTATUS Status = RtlReplaySyncTrace(FileName, 0, &Replay);
+        unlink(FileName);
+        TEST_CHECK(Status == STATUS_SUCCESS);
+        TEST_CHECK(Replay.Objects == 1 && Replay.Calls == 4 && Replay.Skipped == 0 && Replay.Mismatches == 0);
+        return true;
+}
+
+/* Two producers feed a channel each, a select sees every message once and
+ * in the order its channel got it */
+#define TEST_CHANNEL_COUNT 2000
+
+static RTL_CHANNEL TestChannels[2];
+
+static NTSTATUS TestChannelProducer(PVOID Parameter)
+{
+        uintptr_t Index = (uintptr_t)Parameter;
+        for (uintptr_t i = 0; i < TEST_CHANNEL_COUNT; i++) {
+                PVOID Message = (PVOID)(i << 1 | Index);
+                if (RtlSendChannel(&TestChannels[Index], &Message, 1, NULL, NULL) != STATUS_SUCCESS) {
+                        return STATUS_UNSUCCESSFUL;
+                }
+        }
+        return STATUS_SUCCESS;
+}
+
+static bool TestChannelSelect(void)
+{
+        PRTL_CHANNEL Channels[2] = {&TestChannels[0], &TestChannels[1]};
+        HANDLE Threads[2];
+        for (uintptr_t i = 0; i < 2; i++) {
+                TEST_CHECK(RtlInitChannel(&TestChannels[i], 16) == STATUS_SUCCESS);
+        }
+        for (uintptr_t i = 0; i < 2; i++) {
+                TEST_CHECK(RtlCreateUserThread(&Threads[i], THREAD_ALL_ACCESS, FALSE, 0, TestChannelProducer, (PVOID)i, NULL) == STATUS_SUCCESS);
+        }
+
+        uintptr_t Next[2] = {0, 0};
+        LARGE_INTEGER TimeOut = {.QuadPart = -20000000};
+        for (int i = 0; i < 2 * TEST_CHANNEL_COUNT; i++) {
+                PVOID Message;
+                NTSTATUS Status = RtlSelectChannels(2, Channels, &Message, &TimeOut);
+                TEST_CHECK(Status == STATUS_WAIT_0 || Status == STATUS_WAIT_1);
+                uintptr_t Index = Status - STATUS_WAIT_0;
+                TEST_CHECK(((uintptr_t)Message & 1) == Index);
+                TEST_CHECK((uintptr_t)Message >> 1 == Next[Index]);
+                Next[Index]++;
+        }
+        TEST_CHECK(NtWaitForMultipleObjects(2, Threads, WaitAll, FALSE, NULL) == STATUS_WAIT_0);
+
+        PVOID Message;
+        TEST_CHECK(RtlSelectChannels(2, Channels, &Message, &TestZeroTimeOut) == STATUS_TIMEOUT);
+        for (int i = 0; i < 2; i++) {
+                THREAD_BASIC_INFORMATION Information;
+                TEST_CHECK(NtQueryInformationThread(Threads[i], ThreadBasicInformation, &Information, sizeof(Information), NULL) == STATUS_SUCCESS);
+                TEST_CHECK(Information.ExitStatus == STATUS_SUCCESS);
+                NtClose(Threads[i]);
+                TEST_CHECK(RtlDeleteChannel(&TestChannels[i]) == STATUS_SUCCESS);
+        }
+        return true;
+}
+
+/* A send landing while a select times out is either selected or left in
+ * the channel, never lost and never taken twice */
+static NTSTATUS TestChannelLateSender(PVOID Parameter)
+{
+        usleep((uintptr_t)Parameter % 4 * 500);
+        PVOID Message = Parameter;
+        return RtlSendChannel(&TestChannels[0], &Message, 1, NULL, NULL);
+}
+
+static bool TestChannelSelectTimeOut(void)
+{
+        PRTL_CHANNEL Channel = &TestChannels[0];
+        LARGE_INTEGER TimeOut = {.QuadPart = -10000};
+        for (uintptr_t i = 0; i < 40; i++) {
+                TEST_CHECK(RtlInitChannel(Channel, 4) == STATUS_SUCCESS);
+                HANDLE Thread;
+                TEST_CHECK(RtlCreateUserThread(&Thread, THREAD_ALL_ACCESS, FALSE, 0, TestChannelLateSender, (PVOID)i, NULL) == STATUS_SUCCESS);
+
+                PVOID Message = NULL;
+                NTSTATUS Status = RtlSelectChannels(1, &Channel, &Message, &TimeOut);
+                TEST_CHECK(NtWaitForSingleObject(Thread, FALSE, NULL) == STATUS_WAIT_0);
+                if (Status == STATUS_TIMEOUT) {
+                        TEST_CHECK(RtlSelectChannels(1, &Channel, &Message, &TestZeroTimeOut) == STATUS_WAIT_0);
+                } else {
+                        TEST_CHECK(Status == STATUS_WAIT_0);
+                }
+                TEST_CHECK(Message == (PVOID)i);
+                TEST_CHECK(RtlSelectChannels(1, &Channel, &Message, &TestZeroTimeOut) == STATUS_TIMEOUT);
+                NtClose(Thread);
+                TEST_CHECK(RtlDeleteChannel(Channel) == STATUS_SUCCESS);
+        }
+        return true;
+}
+
+/* A batch that doesn't fit before the time runs out tells how much of it
+ * went in, the rest is not sent */
+static bool TestChannelPartialSend(void)
+{
+        PRTL_CHANNEL Channel = &TestChannels[0];
+        TEST_CHECK(RtlInitChannel(Channel, 4) == STATUS_SUCCESS);
+
+        PVOID Messages[8] = {(PVOID)1, (PVOID)2, (PVOID)3, (PVOID)4, (PVOID)5, (PVOID)6};
+        ULONG Sent;
+        LARGE_INTEGER TimeOut = {.QuadPart = -100000};
+        TEST_CHECK(RtlSendChannel(Channel, Messages, 6, &Sent, &TimeOut) == STATUS_TIMEOUT);
+        TEST_CHECK(Sent == 4);
+
+        PVOID Received[8];
+        ULONG Count;
+        TEST_CHECK(RtlReceiveChannel(Channel, Received, 8, &Count, &TestZeroTimeOut) == STATUS_SUCCESS);
+        TEST_CHECK(Count == 4);
+        TEST_CHECK(memcmp(Received, Messages, 4 * sizeof(PVOID)) == 0);
+        TEST_CHECK(RtlReceiveChannel(Channel, Received, 8, &Count, &TestZeroTimeOut) == STATUS_TIMEOUT && Count == 0);
+        TEST_CHECK(RtlDeleteChannel(Channel) == STATUS_SUCCESS);
+        return true;
+}
+
+/* A handle seen through win32.h is the access mask in the low half and
+ * the fd in the high half. The copy shares the object but has no record. */
+static HANDLE TestCopyHandle(HANDLE Handle)
+{
+        int Object = dup((int)((uintptr_t)Handle >> 32));
+        return (HANDLE)(((uintptr_t)(uint32_t)Object << 32) | ((uintptr_t)Handle & UINT32_MAX));
+}
+
+static void TestCloseCopy(HANDLE Handle)
+{
+        close((int)((uintptr_t)Handle >> 32));
+}
+
+/* Every kind of handle gets a state, a copy of an NTSYNC fd that has no
+ * record is read from NTSYNC itself */
+static bool TestObjectStates(void)
+{
+        HANDLE Handles[5];
+        TEST_CHECK(NtCreateEvent(&Handles[0], EVENT_ALL_ACCESS, NULL, SynchronizationEvent, TRUE) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateSemaphore(&Handles[1], SEMAPHORE_ALL_ACCESS, NULL, 3, 5) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateBroadcastEvent(&Handles[2], EVENT_ALL_ACCESS, NULL) == STATUS_SUCCESS);
+        TEST_CHECK(NtCreateKeyedEvent(&Handles[3], KEYEDEVENT_ALL_ACCESS, NULL, 0) == STATUS_SUCCESS);
+        Handles[4] = TestCopyHandle(Handles[1]);
+        TEST_CHECK((int)((uintptr_t)Handles[4] >> 32) != -1);
+
+        UCHAR Type[5];
+        LONG State[5];
+        LONG MaximumCount[5];
+        NTSTATUS Status[5];
+        RTL_OBJECT_STATES States = {Type, State, MaximumCount, Status};
+        TEST_CHECK(RtlQueryObjectStates(5, Handles, &States) == STATUS_SUCCESS);
+        TEST_CHECK(Status[0] == STATUS_SUCCESS && Type[0] == RtlObjectStateSynchronizationEvent && State[0] == 1);
+        TEST_CHECK(Status[1] == STATUS_SUCCESS && Type[1] == RtlObjectStateSemaphore && State[1] == 3 && MaximumCount[1] == 5);
+        TEST_CHECK(Status[2] == STATUS_SUCCESS && Type[2] == RtlObjectStateNotificationEvent && State[2] == 0);
+        TEST_CHECK(Status[3] == STATUS_SUCCESS && Type[3] == RtlObjectStateKeyedEvent);
+        if (ntsync_backend == NTSYNC_BACKEND_KERNEL) {
+                /* Only the maximum, the process may hold part of the count */
+                TEST_CHECK(Status[4] == STATUS_SUCCESS && Type[4] == RtlObjectStateSemaphore && MaximumCount[4] == 5);
+        } else {
+                TEST_CHECK(Status[4] == STATUS_OBJECT_TYPE_MISMATCH && Type[4] == RtlObjectStateInvalid);
+        }
+
+        TestCloseCopy(Handles[4]);
+        for (int i = 0; i < 4; i++) {
+                TEST_CHECK(NtClose(Handles[i]) == STATUS_SUCCESS);
+        }
+        return true;
+}
+
+static const struct
+{
+        const char *Name;
+        TEST_ROUTINE Routine;
+} TestRoutines[] = {
+        {"auto-reset event", TestAutoResetEvent},
+        {"manual-reset event", TestManualResetEvent},
+        {"semaphore", TestSemaphore},
+        {"wait any and all", TestWaitAnyAll},
+        {"timeout", TestTimeOut},
+        {"thread handle", TestThreadHandle},
+        {"semaphore stress", TestSemaphoreStress},
+        {"semaphore limit", TestSemaphoreLimit},
+        {"object states", TestObjectStates},
+        {"mutant ownership", TestMutantOwnership},
+        {"keyed events", TestKeyedEvents},
+        {"critical sections", TestCriticalSections},
+        {"barrier phases", TestBarrierPhases},
+        {"run once", TestRunOnceInitialization},
+        {"duplicate object", TestDuplicateObject},
+        {"named objects", TestNamedObjects},
+        {"trace replay", TestTraceReplay},
+        {"object registry", TestObjectRegistry},
+        {"acquire many units", TestAcquireSemaphoreEx},
+        {"broadcast event", TestBroadcastEvent},
+        {"channel select", TestChannelSelect},
+        {"channel select timeout", TestChannelSelectTimeOut},
+        {"channel partial send", TestChannelPartialSend},
+};
+
+static void BenchReport(const char *Name, ULONGLONG Start, ULONG Count)
+{
+        printf("    %-28s %8.1f ns\n", Name, (double)(TestGetTime() - Start) / Count);
+}
+
+static HANDLE BenchPing;
+static HANDLE BenchPong;
+
+static NTSTATUS BenchPongRoutine(PVOID Parameter)
+{
+        (void)Parameter;
+        for (int i = 0; i < BENCH_PING_PONG_COUNT; i++) {
+                NtWaitForSingleObject(BenchPing, FALSE, NULL);
+                NtSetEvent(BenchPong, NULL);
+        }
+        return STATUS_SUCCESS;
+}
+
+static void BenchRun(void)
+{
+        HANDLE Event, Semaphore, Handles[4];
+        NtCreateEvent(&Event, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE);
+        NtCreateSemaphore(&Semaphore, SEMAPHORE_ALL_ACCESS, NULL, 0, 1);
+        for (int i = 0; i < 4; i++) {
+                NtCreateSemaphore(&Handles[i], SEMAPHORE_ALL_ACCESS, NULL, 0, 1);
+        }
+
+        ULONGLONG Start = TestGetTime();
+        for (int i = 0; i < BENCH_COUNT; i++) {
+                NtSetEvent(Event, NULL);
+                NtWaitForSingleObject(Event, FALSE, NULL);
+        }
+        BenchReport("event set and wait", Start, BENCH_COUNT);
+
+        Start = TestGetTime();
+        for (int i = 0; i < BENCH_COUNT; i++) {
+                NtReleaseSemaphore(Semaphore, 1, NULL);
+                NtWaitForSingleObject(Semaphore, FALSE, NULL);
+        }
+        BenchReport("semaphore release and wait", Start, BENCH_COUNT);
+
+        Start = TestGetTime();
+        for (int i = 0; i < BENCH_COUNT; i++) {
+                for (int j = 0; j < 4; j++) {
+                        NtReleaseSemaphore(Handles[j], 1, NULL);
+                }
+                NtWaitForMultipleObjects(4, Handles, WaitAll, FALSE, NULL);
+        }
+        BenchReport("wait all on 4 semaphores", Start, BENCH_COUNT);
+
+        NtCreateEvent(&BenchPing, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE);
+        NtCreateEvent(&BenchPong, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE);
+        HANDLE Thread;
+        RtlCreateUserThread(&Thread, THREAD_ALL_ACCESS, FALSE, 0, BenchPongRoutine, NULL, NULL);
+        Start = TestGetTime();
+        for (int i = 0; i < BENCH_PING_PONG_COUNT; i++) {
+                NtSetEvent(BenchPing, NULL);
+                NtWaitForSingleObject(BenchPong, FALSE, NULL);
+        }
+        BenchReport("ping-pong round trip", Start, BENCH_PING_PONG_COUNT);
+        NtWaitForSingleObject(Thread, FALSE, NULL);
+
+        NtClose(Thread);
+        NtClose(BenchPing);
+        NtClose(BenchPong);
+        for (int i = 0; i < 4; i++) {
+                NtClose(Handles[i]);
+        }
+        NtClose(Semaphore);
+        NtClose(Event);
+}
+
+/* Exit status of the process running one backend, 2 if it was skipped */
+static int TestRunBackend(int Backend, bool Bench)
+{
+        if (!ntsync_init_ex(Backend == NTSYNC_BACKEND_USERSPACE ? Backend | NTSYNC_BACKEND_NO_MIXED_WAITS : Backend)) {
+                return 2;
+        }
+
+        int Failed = 0;
+        for (size_t i = 0; i < sizeof(TestRoutines) / sizeof(TestRoutines[0]); i++) {
+                bool Passed = TestRoutines[i].Routine();
+                printf("  %-28s %s\n", TestRoutines[i].Name, Passed ? "ok" : "FAILED");
+                Failed += !Passed;
+        }
+
+        if (Bench && Failed == 0) {
+                printf("  benchmark, per operation\n");
+                BenchRun();
+        }
+
+        ntsync_exit();
+        return Failed != 0;
+}
+
+int main(int argc, char **argv)
+{
+        bool Bench = !(argc > 1 && strcmp(argv[1], "--no-bench") == 0);
+        static const struct
+        {
+                const char *Name;
+                int Backend;
+        } Backends[] = {
+                {"ntsync", NTSYNC_BACKEND_KERNEL},
+                {"userspace", NTSYNC_BACKEND_USERSPACE},
+        };
+
+        int Result = 0;
+        for (size_t i = 0; i < sizeof(Backends) / sizeof(Backends[0]); i++) {
+                printf("%s backend\n", Backends[i].Name);
+                fflush(stdout);
+
+                pid_t Child = fork();
+                if (Child == 0) {
+                        int Status = TestRunBackend(Backends[i].Backend, Bench);
+                        fflush(stdout);
+                        _exit(Status);
+                }
+
+                int Status = 1;
+                if (Child == -1 || waitpid(Child, &Status, 0) == -1 || !WIFEXITED(Status)) {
+                        printf("  crashed\n");
+                        Result = 1;
+                } else if (WEXITSTATUS(Status) == 2) {
+                        printf("  skipped, /dev/ntsync is not available\n");
+                } else if (WEXITSTATUS(Status) != 0) {
+                        Result = 1;
+                }
+        }
+
+        return Result;
+}